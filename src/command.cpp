@@ -0,0 +1,68 @@
+#include <strings.h>
+
+#include "command.h"
+
+namespace cheapis {
+    struct CommandEntry {
+        std::string_view name;
+        int arity; /* Negative means at least -arity */
+        bool write; /* Propagated to the AOF and replicas, refused by a replica */
+    };
+
+    static constexpr CommandEntry kCommandTable[kCommandCount] = {
+            {"get",         2,  false},
+            {"set",         3,  true},
+            {"del",         2,  true},
+            {"info",        -1, false},
+            {"latency",     -2, false},
+            {"slowlog",     -2, false},
+            {"config",      -3, false},
+            {"scan",        -2, false},
+            {"keys",        2,  false},
+            {"range",       -3, false},
+            {"prefix",      -2, false},
+            {"incr",        2,  true},
+            {"incrby",      3,  true},
+            {"decr",        2,  true},
+            {"decrby",      3,  true},
+            {"incrbyfloat", 3,  true},
+            {"hset",        -4, true},
+            {"hget",        3,  false},
+            {"hmget",       -3, false},
+            {"hgetall",     2,  false},
+            {"hdel",        -3, true},
+            {"bgsave",      1,  false},
+            {"lastsave",    1,  false},
+            {"bgrewriteaof", 1,  false},
+            {"checkpoint",  2,  false},
+            {"ping",        -1, false},
+            {"replicaof",   3,  false},
+            {"psync",       3,  false},
+            {"replconf",    -2, false},
+            {"unsupported", 0,  false},
+    };
+
+    Command LookupCommand(const rocksdb::autovector<std::string_view> & argv) {
+        const std::string_view & name = argv[0];
+        auto argc = static_cast<int>(argv.size());
+        for (int i = 0; i < kUnsupported; ++i) {
+            const CommandEntry & entry = kCommandTable[i];
+            if (entry.name.size() == name.size() &&
+                strncasecmp(name.data(), entry.name.data(), name.size()) == 0) {
+                if (entry.arity >= 0 ? argc != entry.arity : argc < -entry.arity) {
+                    break;
+                }
+                return static_cast<Command>(i);
+            }
+        }
+        return kUnsupported;
+    }
+
+    bool IsWriteCommand(Command cmd) {
+        return kCommandTable[cmd].write;
+    }
+
+    const char * GetCommandName(Command cmd) {
+        return kCommandTable[cmd].name.data();
+    }
+}
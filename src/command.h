@@ -0,0 +1,53 @@
+#pragma once
+#ifndef CHEAPIS_COMMAND_H
+#define CHEAPIS_COMMAND_H
+
+#include <string_view>
+
+#include "autovector.h"
+
+namespace cheapis {
+    enum Command {
+        kGet,
+        kSet,
+        kDel,
+        kInfo,
+        kLatency,
+        kSlowlog,
+        kConfig,
+        kScan,
+        kKeys,
+        kRange,
+        kPrefix,
+        kIncr,
+        kIncrBy,
+        kDecr,
+        kDecrBy,
+        kIncrByFloat,
+        kHSet,
+        kHGet,
+        kHMGet,
+        kHGetAll,
+        kHDel,
+        kBgsave,
+        kLastsave,
+        kBgrewriteaof,
+        kCheckpoint,
+        kPing,
+        kReplicaof,
+        kPsync,
+        kReplconf,
+        kUnsupported,
+        kCommandCount,
+    };
+
+    // Case-insensitive. Unknown names and wrong arities are kUnsupported.
+    Command LookupCommand(const rocksdb::autovector<std::string_view> & argv);
+
+    // Whether cmd changes the keyspace.
+    bool IsWriteCommand(Command cmd);
+
+    const char * GetCommandName(Command cmd);
+}
+
+#endif //CHEAPIS_COMMAND_H
@@ -0,0 +1,285 @@
+#include <strings.h>
+
+#include "config.h"
+#include "log.h"
+#include "resp_machine.h"
+#include "util.h"
+
+namespace cheapis {
+    struct ConfigEntry {
+        const char * name;
+        std::string (* get)();
+        bool (* set)(const std::string & value); /* False if the value is invalid */
+        bool immutable; /* Only settable at startup */
+    };
+
+    static bool ParseBool(const std::string & value, std::atomic<bool> * b) {
+        if (strcasecmp(value.c_str(), "yes") == 0) {
+            *b = true;
+        } else if (strcasecmp(value.c_str(), "no") == 0) {
+            *b = false;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    static std::string FormatBool(const std::atomic<bool> & b) {
+        return b.load() ? "yes" : "no";
+    }
+
+    static bool ParseBytes(const std::string & value, uint64_t * bytes) {
+        long long ll;
+        if (!string2ll(value.data(), value.size(), &ll) || ll <= 0) {
+            return false;
+        }
+        *bytes = static_cast<uint64_t>(ll);
+        return true;
+    }
+
+    static const ConfigEntry kConfigTable[] = {
+            {"loglevel",
+                    []() -> std::string { return GetLogLevelName(GetLogLevel()); },
+                    [](const std::string & value) {
+                        LogLevel level;
+                        if (!ParseLogLevel(value, &level)) {
+                            return false;
+                        }
+                        SetLogLevel(level);
+                        return true;
+                    }, false},
+            {"index-grow-step",
+                    []() { return std::to_string(GetConfig()->index_grow_step.load()); },
+                    [](const std::string & value) {
+                        uint64_t bytes;
+                        if (!ParseBytes(value, &bytes)) {
+                            return false;
+                        }
+                        GetConfig()->index_grow_step = bytes;
+                        return true;
+                    }, false},
+            {"index-hugepage",
+                    []() { return FormatBool(GetConfig()->index_hugepage); },
+                    [](const std::string & value) { return ParseBool(value, &GetConfig()->index_hugepage); },
+                    true},
+            {"index-populate",
+                    []() { return FormatBool(GetConfig()->index_populate); },
+                    [](const std::string & value) { return ParseBool(value, &GetConfig()->index_populate); },
+                    true},
+            {"index-mlock",
+                    []() { return FormatBool(GetConfig()->index_mlock); },
+                    [](const std::string & value) { return ParseBool(value, &GetConfig()->index_mlock); },
+                    true},
+            {"bloom-bits-per-key",
+                    []() { return std::to_string(GetConfig()->bloom_bits_per_key.load()); },
+                    [](const std::string & value) {
+                        long long ll;
+                        if (!string2ll(value.data(), value.size(), &ll) || ll < 0 || ll > 64) {
+                            return false;
+                        }
+                        GetConfig()->bloom_bits_per_key = static_cast<uint64_t>(ll);
+                        return true;
+                    }, true},
+            {"io-depth",
+                    []() { return std::to_string(GetConfig()->io_depth.load()); },
+                    [](const std::string & value) {
+                        uint64_t depth;
+                        if (!ParseBytes(value, &depth) || depth > 1024) {
+                            return false;
+                        }
+                        GetConfig()->io_depth = depth;
+                        return true;
+                    }, true},
+            {"write-buffer-size",
+                    []() { return std::to_string(GetConfig()->write_buffer_size.load()); },
+                    [](const std::string & value) {
+                        long long ll;
+                        if (!string2ll(value.data(), value.size(), &ll) || ll < 0) {
+                            return false;
+                        }
+                        GetConfig()->write_buffer_size = static_cast<uint64_t>(ll);
+                        return true;
+                    }, false},
+            {"write-buffer-usec",
+                    []() { return std::to_string(GetConfig()->write_buffer_usec.load()); },
+                    [](const std::string & value) {
+                        uint64_t usec;
+                        if (!ParseBytes(value, &usec) || usec > 1000000) {
+                            return false;
+                        }
+                        GetConfig()->write_buffer_usec = usec;
+                        return true;
+                    }, false},
+            {"write-durability",
+                    []() -> std::string { return GetConfig()->write_relaxed ? "relaxed" : "strict"; },
+                    [](const std::string & value) {
+                        if (strcasecmp(value.c_str(), "strict") == 0) {
+                            GetConfig()->write_relaxed = false;
+                        } else if (strcasecmp(value.c_str(), "relaxed") == 0) {
+                            GetConfig()->write_relaxed = true;
+                        } else {
+                            return false;
+                        }
+                        return true;
+                    }, false},
+            {"shard-threads",
+                    []() { return FormatBool(GetConfig()->shard_threads); },
+                    [](const std::string & value) { return ParseBool(value, &GetConfig()->shard_threads); },
+                    true},
+            {"snapshot-file",
+                    []() { return GetConfig()->snapshot_file; },
+                    [](const std::string & value) {
+                        if (value.empty()) {
+                            return false;
+                        }
+                        GetConfig()->snapshot_file = value;
+                        return true;
+                    }, true},
+            {"appendonly",
+                    []() { return FormatBool(GetConfig()->appendonly); },
+                    [](const std::string & value) { return ParseBool(value, &GetConfig()->appendonly); },
+                    true},
+            {"appendfilename",
+                    []() { return GetConfig()->aof_file; },
+                    [](const std::string & value) {
+                        if (value.empty()) {
+                            return false;
+                        }
+                        GetConfig()->aof_file = value;
+                        return true;
+                    }, true},
+            {"appendfsync",
+                    []() -> std::string { return GetConfig()->aof_fsync ? "everysec" : "no"; },
+                    [](const std::string & value) {
+                        if (strcasecmp(value.c_str(), "everysec") == 0) {
+                            GetConfig()->aof_fsync = true;
+                        } else if (strcasecmp(value.c_str(), "no") == 0) {
+                            GetConfig()->aof_fsync = false;
+                        } else {
+                            return false;
+                        }
+                        return true;
+                    }, false},
+            {"output-buffer-hard-limit",
+                    []() { return std::to_string(GetConfig()->output_buffer_hard_limit.load()); },
+                    [](const std::string & value) {
+                        uint64_t bytes;
+                        if (!ParseBytes(value, &bytes)) {
+                            return false;
+                        }
+                        GetConfig()->output_buffer_hard_limit = bytes;
+                        return true;
+                    }, false},
+            {"output-buffer-soft-limit",
+                    []() { return std::to_string(GetConfig()->output_buffer_soft_limit.load()); },
+                    [](const std::string & value) {
+                        uint64_t bytes;
+                        if (!ParseBytes(value, &bytes)) {
+                            return false;
+                        }
+                        GetConfig()->output_buffer_soft_limit = bytes;
+                        return true;
+                    }, false},
+            {"output-buffer-soft-seconds",
+                    []() { return std::to_string(GetConfig()->output_buffer_soft_seconds.load()); },
+                    [](const std::string & value) {
+                        uint64_t seconds;
+                        if (!ParseBytes(value, &seconds)) {
+                            return false;
+                        }
+                        GetConfig()->output_buffer_soft_seconds = seconds;
+                        return true;
+                    }, false},
+            {"maxclients",
+                    []() { return std::to_string(GetConfig()->max_clients.load()); },
+                    [](const std::string & value) {
+                        uint64_t clients;
+                        if (!ParseBytes(value, &clients) || clients > 10000000) {
+                            return false;
+                        }
+                        GetConfig()->max_clients = clients;
+                        return true;
+                    }, true},
+            {"edge-triggered",
+                    []() { return FormatBool(GetConfig()->edge_triggered); },
+                    [](const std::string & value) { return ParseBool(value, &GetConfig()->edge_triggered); },
+                    true},
+            {"port",
+                    []() { return std::to_string(GetConfig()->port.load()); },
+                    [](const std::string & value) {
+                        uint64_t port;
+                        if (!ParseBytes(value, &port) || port > 65535) {
+                            return false;
+                        }
+                        GetConfig()->port = port;
+                        return true;
+                    }, true},
+            {"repl-backlog-size",
+                    []() { return std::to_string(GetConfig()->repl_backlog_size.load()); },
+                    [](const std::string & value) {
+                        uint64_t bytes;
+                        if (!ParseBytes(value, &bytes)) {
+                            return false;
+                        }
+                        GetConfig()->repl_backlog_size = bytes;
+                        return true;
+                    }, true},
+    };
+
+    static const ConfigEntry * LookupConfig(const std::string & name) {
+        for (const auto & entry:kConfigTable) {
+            if (strcasecmp(name.c_str(), entry.name) == 0) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    Config * GetConfig() {
+        static Config config;
+        return &config;
+    }
+
+    bool LoadConfig(const std::string & name, const std::string & value, std::string * err) {
+        const ConfigEntry * entry = LookupConfig(name);
+        if (entry == nullptr) {
+            *err = "unknown parameter '" + name + "'";
+            return false;
+        }
+        if (!entry->set(value)) {
+            *err = "invalid value '" + value + "' for '" + name + "'";
+            return false;
+        }
+        return true;
+    }
+
+    void ExecuteConfig(const rocksdb::autovector<std::string> & argv, size_t first,
+                       std::string * out) {
+        const std::string & sub = argv[first];
+        if (strcasecmp(sub.c_str(), "get") == 0 && argv.size() == first + 2) {
+            const ConfigEntry * entry = LookupConfig(argv[first + 1]);
+            if (entry != nullptr) {
+                RespMachine::AppendArrayLength(out, 2);
+                RespMachine::AppendBulkString(out, entry->name);
+                RespMachine::AppendBulkString(out, entry->get());
+            } else {
+                RespMachine::AppendArrayLength(out, 0);
+            }
+        } else if (strcasecmp(sub.c_str(), "set") == 0 && argv.size() == first + 3) {
+            const ConfigEntry * entry = LookupConfig(argv[first + 1]);
+            if (entry == nullptr) {
+                RespMachine::AppendError(out, "ERR Unsupported CONFIG parameter");
+            } else if (entry->immutable) {
+                RespMachine::AppendError(out, std::string("ERR CONFIG SET failed, '") + entry->name +
+                                              "' can only be set at startup");
+            } else if (!entry->set(argv[first + 2])) {
+                RespMachine::AppendError(out, std::string("ERR Invalid argument for CONFIG SET '") +
+                                              entry->name + "'");
+            } else {
+                RespMachine::AppendSimpleString(out, "OK");
+            }
+        } else {
+            RespMachine::AppendError(out, "ERR unknown CONFIG subcommand or wrong number of arguments");
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#ifndef CHEAPIS_CONFIG_H
+#define CHEAPIS_CONFIG_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "autovector.h"
+
+namespace cheapis {
+    // Tunables read on the hot path. The log level lives in log.h.
+    struct Config {
+        /* Bytes the index grows by once it is larger, it doubles below that */
+        std::atomic<uint64_t> index_grow_step{1ULL << 30};
+
+        /* Startup only, applied when the index is mapped and as it grows */
+        std::atomic<bool> index_hugepage{false};
+        std::atomic<bool> index_populate{false};
+        std::atomic<bool> index_mlock{false};
+
+        /* Startup only, the size of a disk node's Bloom filter over its keys, 0 for none */
+        std::atomic<uint64_t> bloom_bits_per_key{10};
+
+        /* Startup only, data file reads a batch keeps in flight */
+        std::atomic<uint64_t> io_depth{32};
+
+        /* Data file writes wait in a buffer until it holds this many bytes or
+         * its oldest is this old, 0 writes each batch at once. Replies to
+         * writes wait for the flush unless durability is relaxed. */
+        std::atomic<uint64_t> write_buffer_size{0};
+        std::atomic<uint64_t> write_buffer_usec{1000};
+        std::atomic<bool> write_relaxed{false};
+
+        /* Startup only, a thread per shard of a disk node with several directories */
+        std::atomic<bool> shard_threads{false};
+
+        /* Startup only, where the in-memory executor saves and loads */
+        std::string snapshot_file{"dump.cheapis"};
+        std::atomic<bool> appendonly{false};
+        std::string aof_file{"appendonly.cheapis"};
+
+        /* The AOF is synced once a second, or left to the OS */
+        std::atomic<bool> aof_fsync{true};
+
+        /* A client is dropped once its pending replies pass the hard limit, or
+         * stay past the soft one for longer than the soft seconds */
+        std::atomic<uint64_t> output_buffer_hard_limit{256 << 20};
+        std::atomic<uint64_t> output_buffer_soft_limit{64 << 20};
+        std::atomic<uint64_t> output_buffer_soft_seconds{60};
+
+        /* Startup only, sizes the event loop's client table */
+        std::atomic<uint64_t> max_clients{100000};
+
+        /* Startup only, edge-triggered client reads, drained to EAGAIN */
+        std::atomic<bool> edge_triggered{false};
+
+        /* Startup only */
+        std::atomic<uint64_t> port{6379};
+        std::atomic<uint64_t> repl_backlog_size{1 << 20};
+    };
+
+    Config * GetConfig();
+
+    // Sets a parameter from the command line (--name value), where startup
+    // only parameters are still accepted. Returns false with a message in err.
+    bool LoadConfig(const std::string & name, const std::string & value, std::string * err);
+
+    // CONFIG GET parameter | CONFIG SET parameter value, argv[first] being the
+    // subcommand.
+    void ExecuteConfig(const rocksdb::autovector<std::string> & argv, size_t first,
+                       std::string * out);
+}
+
+#endif //CHEAPIS_CONFIG_H
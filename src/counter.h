@@ -0,0 +1,34 @@
+#pragma once
+#ifndef CHEAPIS_COUNTER_H
+#define CHEAPIS_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace cheapis {
+    // Written by its owning thread only, so a relaxed load plus store is
+    // enough: a plain add on the hot path that other threads can still read.
+    class Counter {
+    public:
+        void Add(int64_t n) {
+            v_.store(v_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        Counter & operator++() {
+            Add(1);
+            return *this;
+        }
+
+        Counter & operator--() {
+            Add(-1);
+            return *this;
+        }
+
+        int64_t Get() const { return v_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<int64_t> v_{0};
+    };
+}
+
+#endif //CHEAPIS_COUNTER_H
@@ -0,0 +1,50 @@
+#include <cstring>
+
+#include "crc32c.h"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace cheapis {
+#if defined(__SSE4_2__)
+    uint32_t Crc32c(uint32_t crc, const void * data, size_t n) {
+        auto p = static_cast<const uint8_t *>(data);
+        uint64_t c = ~crc;
+        for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            c = _mm_crc32_u64(c, word);
+        }
+        auto c32 = static_cast<uint32_t>(c);
+        for (; n > 0; --n, ++p) {
+            c32 = _mm_crc32_u8(c32, *p);
+        }
+        return ~c32;
+    }
+#else
+    struct Crc32cTable {
+        uint32_t entries[256];
+
+        Crc32cTable() : entries() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+                }
+                entries[i] = c;
+            }
+        }
+    };
+
+    uint32_t Crc32c(uint32_t crc, const void * data, size_t n) {
+        static const Crc32cTable table;
+        auto p = static_cast<const uint8_t *>(data);
+        uint32_t c = ~crc;
+        for (; n > 0; --n, ++p) {
+            c = table.entries[(c ^ *p) & 0xff] ^ (c >> 8);
+        }
+        return ~c;
+    }
+#endif
+}
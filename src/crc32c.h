@@ -0,0 +1,14 @@
+#pragma once
+#ifndef CHEAPIS_CRC32C_H
+#define CHEAPIS_CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cheapis {
+    // CRC-32C (Castagnoli) of data, continuing from crc. The SSE4.2
+    // instruction where the build has it, a table otherwise.
+    uint32_t Crc32c(uint32_t crc, const void * data, size_t n);
+}
+
+#endif //CHEAPIS_CRC32C_H
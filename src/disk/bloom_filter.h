@@ -0,0 +1,137 @@
+#pragma once
+#ifndef CHEAPIS_BLOOM_FILTER_H
+#define CHEAPIS_BLOOM_FILTER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+namespace cheapis {
+    // A split block Bloom filter: a key picks one 256-bit block and sets a
+    // bit in each of its eight 32-bit words, so a probe touches one cache
+    // line and the eight bits are made and tested side by side, with AVX2
+    // or SSE4.1 where the build has them. Keys can't be removed.
+    class BloomFilter {
+    public:
+        // Room for keys at bits_per_key, at least one block.
+        BloomFilter(size_t keys, size_t bits_per_key)
+                : blocks_(std::max<size_t>(1, (keys * bits_per_key + kBlockBits - 1) / kBlockBits)),
+                  capacity_(keys) {}
+
+        // 64 bits on every platform, both halves are used. Eight bytes at a
+        // time through murmur3's finalizer, the length folded in first.
+        static uint64_t Hash(const std::string_view & k) {
+            uint64_t h = Mix(k.size() ^ 0x9e3779b97f4a7c15ULL);
+            size_t i = 0;
+            for (; i + 8 <= k.size(); i += 8) {
+                uint64_t w;
+                memcpy(&w, k.data() + i, 8);
+                h = Mix(h ^ w);
+            }
+            uint64_t w = 0;
+            memcpy(&w, k.data() + i, k.size() - i);
+            return Mix(h ^ w);
+        }
+
+        void Add(uint64_t h) {
+            Block & block = blocks_[BlockIndex(h)];
+            auto x = static_cast<uint32_t>(h);
+#if defined(__AVX2__)
+            auto p = reinterpret_cast<__m256i *>(block.words);
+            _mm256_store_si256(p, _mm256_or_si256(_mm256_load_si256(p), MakeMask(x)));
+#elif defined(__SSE4_1__)
+            auto p = reinterpret_cast<__m128i *>(block.words);
+            _mm_store_si128(p, _mm_or_si128(_mm_load_si128(p), MakeMask(x, 0)));
+            _mm_store_si128(p + 1, _mm_or_si128(_mm_load_si128(p + 1), MakeMask(x, 4)));
+#else
+            for (int i = 0; i < kWords; ++i) {
+                block.words[i] |= 1U << ((x * kSalts[i]) >> 27);
+            }
+#endif
+        }
+
+        bool MayContain(uint64_t h) const {
+            const Block & block = blocks_[BlockIndex(h)];
+            auto x = static_cast<uint32_t>(h);
+#if defined(__AVX2__)
+            return _mm256_testc_si256(_mm256_load_si256(reinterpret_cast<const __m256i *>(block.words)),
+                                      MakeMask(x)) != 0;
+#elif defined(__SSE4_1__)
+            auto p = reinterpret_cast<const __m128i *>(block.words);
+            return _mm_testc_si128(_mm_load_si128(p), MakeMask(x, 0)) &&
+                   _mm_testc_si128(_mm_load_si128(p + 1), MakeMask(x, 4));
+#else
+            for (int i = 0; i < kWords; ++i) {
+                if ((block.words[i] & (1U << ((x * kSalts[i]) >> 27))) == 0) {
+                    return false;
+                }
+            }
+            return true;
+#endif
+        }
+
+        // Keys it was sized for, false positives rise past that.
+        size_t GetCapacity() const {
+            return capacity_;
+        }
+
+        size_t GetSize() const {
+            return blocks_.size() * sizeof(Block);
+        }
+
+    private:
+        static constexpr int kWords = 8;
+        static constexpr size_t kBlockBits = kWords * 32;
+        static constexpr uint32_t kSalts[kWords] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                                    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+        struct alignas(32) Block {
+            uint32_t words[kWords];
+        };
+
+        static uint64_t Mix(uint64_t x) {
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdULL;
+            x ^= x >> 33;
+            x *= 0xc4ceb9fe1a85ec53ULL;
+            x ^= x >> 33;
+            return x;
+        }
+
+        // The high half of the hash picks the block, the low half the bits.
+        size_t BlockIndex(uint64_t h) const {
+            return static_cast<size_t>(((h >> 32) * static_cast<uint64_t>(blocks_.size())) >> 32);
+        }
+
+#if defined(__AVX2__)
+        static __m256i MakeMask(uint32_t x) {
+            const __m256i salts = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(kSalts));
+            __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(x), salts), 27);
+            return _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+        }
+#elif defined(__SSE4_1__)
+        // Words first to first + 4. SSE has no per-lane shift, 1 << bits is
+        // 2^bits as a float truncated back (2^31 overflows to 0x80000000,
+        // which is the same bit).
+        static __m128i MakeMask(uint32_t x, int first) {
+            const __m128i salts = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kSalts + first));
+            __m128i bits = _mm_srli_epi32(_mm_mullo_epi32(_mm_set1_epi32(static_cast<int>(x)), salts), 27);
+            __m128i exponent = _mm_slli_epi32(_mm_add_epi32(bits, _mm_set1_epi32(127)), 23);
+            return _mm_cvttps_epi32(_mm_castsi128_ps(exponent));
+        }
+#endif
+
+        std::vector<Block> blocks_;
+        size_t capacity_;
+    };
+}
+
+#endif //CHEAPIS_BLOOM_FILTER_H
@@ -1,12 +1,33 @@
+#include <algorithm>
 #include <cerrno>
-#include <deque>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
 #include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <unordered_map>
 
+#include "../config.h"
+#include "../crc32c.h"
 #include "../env.h"
 #include "../executor.h"
+#include "../fair_queue.h"
+#include "../hash.h"
+#include "../incr.h"
+#include "../io_engine.h"
 #include "../log.h"
+#include "../scan.h"
+#include "../stats.h"
+#include "../util.h"
+#include "bloom_filter.h"
 #include "filename.h"
+#include "kv_rep.h"
 
 #include "likely.h"
 #include "sig_tree.h"
@@ -15,46 +36,42 @@
 #include "sig_tree_rebuild_impl.h"
 #include "sig_tree_visit_impl.h"
 
-#define UINT5_MAX  ((1 << 5) - 1)
-#define UINT11_MAX ((1 << 11) - 1)
-
 namespace cheapis {
     using namespace sgt;
 
     constexpr unsigned int kMaxDataFileSize = 2147483648;
+    constexpr uint64_t kIndexReserveSize = 1ULL << 40; /* Virtual only, shared by the shards of a node */
+    constexpr uint64_t kIndexReserveAlign = 1ULL << 30;
+    constexpr uint64_t kCoalesceGap = 4096;     /* Read over gaps up to this between records */
+    constexpr uint64_t kCoalesceMax = 1 << 20;  /* Bytes per pread */
+    constexpr size_t kKeysBatch = 4096;         /* Keys visited per step of KEYS and RANGE */
+    constexpr size_t kRangeFirstBatch = 64;
+    constexpr size_t kMaxCachedCounters = 65536;
+    constexpr uint64_t kNoPrevRecord = UINT64_MAX;
+    constexpr size_t kHashRecordHeaderSize = 9; /* Rep of the previous record, deltas since the fold */
+    constexpr uint8_t kMaxHashDeltas = 8;
+    constexpr size_t kMaxShards = 256;          /* A SCAN cursor keeps the shard in a byte */
+    constexpr size_t kMaxIoThreads = 1024;      /* Per node, io-depth is cut to fit between shards */
+    constexpr size_t kMinFilterKeys = 1 << 16;
+    constexpr size_t kFilterBuildStep = 1024;   /* Keys visited per step of a Bloom filter rebuild */
+
+    // Thrown by AllocatorImpl::Grow() out of the index operation in progress.
+    class IndexGrowException : public std::exception {
+    public:
+        const char * what() const noexcept override { return "failed growing the index"; }
+    };
 
     class ExecutorDiskImpl;
 
-    static inline uint16_t
-    PackKVLength(size_t k_len, size_t v_len) {
-        return static_cast<uint16_t>((std::min<size_t>(k_len, UINT5_MAX) << 11) |
-                                     (std::min<size_t>(v_len, UINT11_MAX)));
-    }
-
-    static inline std::pair<uint16_t, uint16_t>
-    UnpackLength(uint16_t len) {
-        return {len >> 11, len & UINT11_MAX};
-    }
-
-    static inline uint64_t
-    PackIDLengthAndOffset(uint16_t id, uint16_t len, uint32_t off) {
-        return (static_cast<uint64_t>(id) << (16 + 32)) |
-               (static_cast<uint64_t>(len) << 32) |
-               (static_cast<uint64_t>(off));
-    }
-
-    static inline std::tuple<uint16_t, uint16_t, uint32_t>
-    UnpackKVRep(uint64_t rep) {
-        return {(rep >> (16 + 32)),
-                (rep >> 32) & UINT16_MAX,
-                (rep & UINT32_MAX)};
-    }
+    class ExecutorShardImpl;
 
     class KVTrans {
     private:
         ExecutorDiskImpl * executor_;
         uint64_t rep_;
         Slice k_;
+        uint16_t v_len_ = 0;
+        bool hash_ = false;
 
     public:
         KVTrans(ExecutorDiskImpl * executor, uint64_t rep)
@@ -66,6 +83,15 @@ namespace cheapis {
 
         bool Get(const Slice & k, std::string * v) const;
 
+        uint64_t Rep() const { return rep_; }
+
+        // Known once the header has been read.
+        bool IsHash() const { return hash_; }
+
+        // Record size on disk. Exact once the header has been read, otherwise
+        // from the lengths packed in the rep, which saturate.
+        size_t Size() const;
+
     private:
         void LoadKey(uint16_t id, uint16_t k_len, uint32_t offset);
     };
@@ -78,7 +104,7 @@ namespace cheapis {
 
         uint64_t Add(const Slice & k, const Slice & v) override { return {}; }
 
-        void Del(KVTrans & trans) override {}
+        void Del(KVTrans & trans) override;
 
         uint64_t Pack(size_t offset) const override {
             return offset | (1ULL << 63);
@@ -105,7 +131,8 @@ namespace cheapis {
         explicit AllocatorImpl(std::unique_ptr<MmapRWFile> && file)
                 : file_(std::move(file)),
                   allocate_(0),
-                  recycle_(-1) {}
+                  recycle_(-1),
+                  free_pages_(0) {}
 
         ~AllocatorImpl() override = default;
 
@@ -118,6 +145,7 @@ namespace cheapis {
             if (recycle_ >= 0) {
                 offset = static_cast<size_t>(recycle_);
                 recycle_ = *reinterpret_cast<int64_t *>(reinterpret_cast<uintptr_t>(Base()) + offset);
+                --free_pages_;
             } else {
                 offset = allocate_;
                 size_t occupy = offset + kPageSize;
@@ -133,34 +161,67 @@ namespace cheapis {
         void FreePage(size_t offset) override {
             *reinterpret_cast<int64_t *>(reinterpret_cast<uintptr_t>(Base()) + offset) = recycle_;
             recycle_ = static_cast<int64_t>(offset);
+            ++free_pages_;
         }
 
+        // Doubles up to the grow step, then adds a step at a time, so a large
+        // index never allocates another index worth of disk at once.
         void Grow() override {
-            int r = file_->Resize(file_->GetFileSize() * 2);
-            if (r != 0) {
-                LIN_LOG_ERROR("Failed growing");
-                exit(1);
+            uint64_t size = file_->GetFileSize();
+            uint64_t step = GetConfig()->index_grow_step.load(std::memory_order_relaxed);
+            step = (std::min(size, step) + kPageSize - 1) / kPageSize * kPageSize;
+            uint64_t n = std::min(size + step, file_->GetReserveSize());
+            if (n <= size || file_->Resize(n) != 0) {
+                LIN_LOG_ERROR("Failed growing the index of %lu bytes", static_cast<unsigned long>(size));
+                throw IndexGrowException();
             }
         }
 
+        uint64_t GetFileSize() const { return file_->GetFileSize(); }
+
+        const MmapRWFile * GetFile() const { return file_.get(); }
+
+        size_t GetAllocatedSize() const { return allocate_; }
+
+        size_t GetFreePageCount() const { return free_pages_; }
+
+        int64_t GetRecycledPage() const { return recycle_; }
+
     private:
         std::unique_ptr<MmapRWFile> file_;
         size_t allocate_;
         int64_t recycle_;
-    };
-
-    struct Header {
-        uint16_t k_len;
-        uint16_t v_len;
+        size_t free_pages_;
     };
 
     class ExecutorDiskImpl final : public Executor {
     private:
-        enum Command {
-            kGet,
-            kSet,
-            kDel,
-            kUnsupported,
+        struct DataFileStats {
+            uint64_t live = 0;
+            uint64_t garbage = 0;
+        };
+
+        // A counter's value after INCR and friends, written back to the data
+        // file by the cron rather than on every increment.
+        struct CachedCounter {
+            long long value;
+            bool dirty;
+        };
+
+        enum ValueType {
+            kMissingValue,
+            kStringValue,
+            kHashValue,
+        };
+
+        // A hash merged from its chain of records, newest first. A record is
+        // either a delta, the fields set or deleted since the previous one,
+        // or one of a fold, the whole hash written at once.
+        struct HashState {
+            std::map<std::string, std::string, std::less<>> fields;
+            std::set<std::string, std::less<>> deleted;
+            std::vector<std::pair<uint64_t, size_t>> chain; /* Rep and size on disk */
+            uint8_t deltas = 0;
         };
 
         struct Task {
@@ -168,17 +229,75 @@ namespace cheapis {
             Client * c;
             int fd;
             Command cmd;
+            bool blocked; /* Replies of earlier tasks still unsent */
+            bool hold;    /* Its reply starts the client's held bytes */
+            uint32_t offset; /* Of a SET's record, appended ahead of the batch */
+            uint64_t submitted;
+            uint64_t begun;
+            uint64_t io;
+            uint64_t executed;
+        };
+
+        // A GET's record read, resumable: it advances on whatever is in the
+        // page cache and is handed to the I/O engine for the rest, as often
+        // as needed (the header may say the record is longer than the rep).
+        struct RecordRead {
+            IoRequest request;
+            std::string buf;
+            Header header;
+            int fd;
+            uint32_t offset;
+            size_t have; /* Bytes read */
+            size_t need; /* Exact once the header is in */
+            bool found; /* In the index, else not read */
+            bool parsed;
+            uint64_t io;
+            uint64_t issued;
+        };
+
+        // A file of a checkpoint finished off the loop: copied from fd to name
+        // up to n, the bytes before n never change, or synced in place if
+        // name is empty.
+        struct CheckpointFile {
+            int fd;
+            std::string name;
+            uint64_t n;
+        };
+
+        // Records of a scan that are read with one pread, [first, last) of
+        // scan_order_.
+        struct Extent {
+            uint16_t id;
+            uint32_t begin;
+            uint64_t end;
+            size_t first;
+            size_t last;
         };
 
     public:
         ExecutorDiskImpl(std::string dir,
-                         std::unique_ptr<MmapRWFile> && file)
-                : dir_(std::move(dir)),
+                         std::unique_ptr<MmapRWFile> && file,
+                         size_t io_threads)
+                : io_threads_(io_threads),
+                  dir_(std::move(dir)),
                   helper_(this),
                   allocator_(std::move(file)),
-                  tree_(&helper_, &allocator_) {}
+                  tree_(&helper_, &allocator_) {
+            size_t bits_per_key = GetConfig()->bloom_bits_per_key;
+            if (bits_per_key != 0) {
+                filter_ = std::make_unique<BloomFilter>(kMinFilterKeys, bits_per_key);
+            }
+        }
 
         ~ExecutorDiskImpl() override {
+            if (dirty_counters_ != 0) {
+                CreateFileIfNeed();
+                FlushCounters();
+            }
+            FlushWrites();
+            if (checkpoint_.joinable()) {
+                checkpoint_.join();
+            }
             for (auto & p:fd_map_) {
                 close(p.second);
             }
@@ -186,84 +305,98 @@ namespace cheapis {
 
         void Submit(const rocksdb::autovector<std::string_view> & argv,
                     Client * c, int fd) override {
-            Task & task = tasks_.emplace_back();
+            Task & task = tasks_.EmplaceBack(c);
             task.c = c;
             task.fd = fd;
-
-            if (argv[0] == "GET" && argv.size() == 2) {
-                const auto & k = argv[1];
-                task.cmd = kGet;
-                task.argv.emplace_back(k);
-                PrefetchKeyValue(k, tree_.GetRep(k));
-            } else if (argv[0] == "SET" && argv.size() == 3) {
-                const auto & k = argv[1];
-                const auto & v = argv[2];
-                task.cmd = kSet;
-                task.argv.emplace_back(k);
-                task.argv.emplace_back(v);
-                PrefetchKey(k, tree_.GetRep(k));
-            } else if (argv[0] == "DEL" && argv.size() == 2) {
-                const auto & k = argv[1];
-                task.cmd = kDel;
-                task.argv.emplace_back(k);
-                PrefetchKey(k, tree_.GetRep(k));
-            } else {
-                task.cmd = kUnsupported;
+            task.cmd = LookupCommand(argv);
+            task.submitted = GetCycles();
+            for (size_t i = 1; i < argv.size(); ++i) {
+                task.argv.emplace_back(argv[i]);
             }
+            Prefetch(task);
         }
 
         void Execute(size_t n, long curr_time, EventLoop<Client> * el) override {
-            if (n == 0) {
-                return;
+            if (n != 0) {
+                RunTasks(n);
+                FinishTasks(&running_, &held_, curr_time, el);
+            }
+            if (FlushDue()) {
+                FlushWrites();
             }
+            if (wbuf_.empty() && !held_.empty()) {
+                ReleaseHeld(&held_, curr_time, el);
+            }
+            BuildFilter();
+        }
+
+        // Executes up to n tasks, their replies appended to the clients'
+        // output buffers. Touches no client but the tasks' own and not the
+        // event loop, so the shards of a node can run it in parallel.
+        void RunTasks(size_t n) {
             CreateFileIfNeed();
             buf_.clear();
-            batch_.clear();
-
-            auto it = tasks_.cbegin();
-            for (size_t i = 0; i < n; ++i) {
-                const Task & task = *it++;
-                if (task.cmd == kSet && !task.c->close) {
-                    const auto & k = task.argv[0];
-                    const auto & v = task.argv[1];
-                    Header header = {static_cast<uint16_t>(k.size()),
-                                     static_cast<uint16_t>(v.size())};
-
-                    buf_.append(reinterpret_cast<char *>(&header), sizeof(header));
-                    buf_.append(k);
-                    buf_.append(v);
-
-                    batch_.emplace_back(offset_);
-                    offset_ += sizeof(header) + k.size() + v.size();
+            running_.clear();
+            tasks_.PopFront(n, &running_);
+            Stats * stats = GetStats();
+            bool strict = !GetConfig()->write_relaxed;
+
+            for (Task & task:running_) {
+                if (task.cmd == kSet && !task.c->close &&
+                    task.argv[0].size() <= kMaxKeySize && task.argv[1].size() <= kMaxValueSize) {
+                    task.offset = AppendRecord(task.argv[0], task.argv[1]);
                 }
             }
 
-            ssize_t nwrite = write(curr_fd_, buf_.data(), buf_.size());
-            if (nwrite != static_cast<ssize_t>(buf_.size())) {
-                LIN_LOG_ERROR("Failed writing. Error message: '%s'", strerror(errno));
-                exit(1);
+            uint64_t append_begun = GetCycles();
+            bool appended = !buf_.empty();
+            WriteRecords();
+            if (appended) {
+                stats->stages[kStageAppend].Record(GetCycles() - append_begun);
             }
 
-            for (size_t i = 0, j = 0; i < n; tasks_.pop_front(), ++i) {
-                Task & task = tasks_.front();
+            size_t run_begin = 0;
+            size_t run_end = 0;
+            for (size_t i = 0; i < running_.size(); ++i) {
+                Task & task = running_[i];
                 Client * c = task.c;
-                int fd = task.fd;
-
-                --c->ref_count;
                 if (c->close) {
-                    if (c->ref_count == 0) {
-                        el->Release(fd);
-                    }
                     continue;
                 }
 
-                bool blocked = !c->output.empty();
+                task.blocked = !c->output.empty();
+                size_t replied = c->output.size();
                 auto & argv = task.argv;
+                task.begun = GetCycles();
+                io_cycles_ = 0;
+                ++stats->calls[task.cmd];
                 switch (task.cmd) {
                     case kGet: {
-                        bool found = tree_.Get(argv[0], &v_);
-                        if (found) {
-                            RespMachine::AppendBulkString(&c->output, v_);
+                        if (i >= run_end) {
+                            run_begin = i;
+                            run_end = i + 1;
+                            while (run_end < running_.size() && running_[run_end].cmd == kGet) {
+                                ++run_end;
+                            }
+                            ReadBatch(run_begin, run_end);
+                        }
+                        if (!counters_.empty()) {
+                            auto it = counters_.find(argv[0]);
+                            if (it != counters_.cend()) {
+                                RespMachine::AppendBulkString(&c->output, number_,
+                                                              ll2string(number_, sizeof(number_), it->second.value));
+                                break;
+                            }
+                        }
+                        const RecordRead & read = reads_[i - run_begin];
+                        const char * k = read.buf.data() + sizeof(Header);
+                        io_cycles_ = read.io;
+                        if (read.found && std::string_view(k, read.header.KeySize()) == argv[0]) {
+                            if (read.header.IsHash()) {
+                                RespMachine::AppendError(&c->output, kWrongTypeError);
+                                break;
+                            }
+                            RespMachine::AppendBulkString(&c->output, k + read.header.KeySize(), read.header.v_len);
                         } else {
                             RespMachine::AppendNullArray(&c->output);
                         }
@@ -271,48 +404,1262 @@ namespace cheapis {
                     }
 
                     case kSet: {
-                        uint64_t rep = PackIDLengthAndOffset(static_cast<uint16_t>(curr_id_),
-                                                             PackKVLength(argv[0].size(),
-                                                                          argv[1].size()),
-                                                             batch_[j++]);
-                        tree_.Add(argv[0], rep, [rep](KVTrans & trans, uint64_t & ref) -> bool {
-                            ref = rep;
-                            return true;
-                        });
+                        if (!CheckRecordSize(argv[0], argv[1].size(), &c->output)) {
+                            break;
+                        }
+                        EraseCounter(argv[0]);
+                        if (!AddRecord(argv[0], argv[1].size(), task.offset)) {
+                            RespMachine::AppendError(&c->output, "ERR Index full, failed growing it");
+                            break;
+                        }
                         RespMachine::AppendSimpleString(&c->output, "OK");
                         break;
                     }
 
-                    case kDel: {
-                        tree_.Del(argv[0]);
-                        RespMachine::AppendSimpleString(&c->output, "OK");
-                        break;
+                    case kDel: {
+                        EraseCounter(argv[0]);
+                        if (!MayExist(argv[0])) {
+                            ++filter_negatives_;
+                        } else if (!DelKey(argv[0])) {
+                            RespMachine::AppendError(&c->output, "ERR Index full, failed growing it");
+                            break;
+                        }
+                        RespMachine::AppendSimpleString(&c->output, "OK");
+                        break;
+                    }
+
+                    case kInfo: {
+                        if (dirty_counters_ != 0) { /* The keyspace counts what is in the index */
+                            FlushCounters();
+                        }
+                        std::string info;
+                        GenerateInfo(!argv.empty() ? argv[0] : "", *this, &info);
+                        RespMachine::AppendBulkString(&c->output, info);
+                        break;
+                    }
+
+                    case kLatency: {
+                        ExecuteLatency(argv, 0, &c->output);
+                        break;
+                    }
+
+                    case kSlowlog: {
+                        ExecuteSlowlog(argv, 0, &c->output);
+                        break;
+                    }
+
+                    case kConfig: {
+                        ExecuteConfig(argv, 0, &c->output);
+                        break;
+                    }
+
+                    case kScan: {
+                        ScanArgs args;
+                        if (!ParseScanArgs(argv, 0, &args, &c->output)) {
+                            break;
+                        }
+                        if (dirty_counters_ != 0) {
+                            FlushCounters();
+                        }
+                        if (!cursors_.Resume(args.cursor, &scan_key_)) {
+                            RespMachine::AppendError(&c->output, "ERR invalid cursor");
+                            break;
+                        }
+                        bool more = ScanKeys(args.count, args.pattern);
+                        AppendScanReply(&c->output, more ? cursors_.Suspend(task.fd, scan_key_) : 0, scan_matches_);
+                        break;
+                    }
+
+                    case kKeys: {
+                        std::string_view pattern = argv[0] != "*" ? argv[0] : std::string_view();
+                        size_t total = 0;
+                        if (dirty_counters_ != 0) {
+                            FlushCounters();
+                        }
+                        buf_.clear();
+                        scan_key_.clear();
+                        bool more;
+                        do {
+                            more = ScanKeys(kKeysBatch, pattern);
+                            total += scan_matches_.size();
+                            for (const auto & key:scan_matches_) {
+                                RespMachine::AppendBulkString(&buf_, key);
+                            }
+                        } while (more);
+                        RespMachine::AppendArrayLength(&c->output, total);
+                        c->output.append(buf_);
+                        break;
+                    }
+
+                    case kRange:
+                    case kPrefix: {
+                        RangeArgs args;
+                        if (!ParseRangeArgs(argv, 0, task.cmd == kPrefix, &args, &c->output)) {
+                            break;
+                        }
+                        if (dirty_counters_ != 0) {
+                            FlushCounters();
+                        }
+                        size_t n = ReadRange(args);
+                        RespMachine::AppendArrayLength(&c->output, n * 2);
+                        c->output.append(buf_);
+                        break;
+                    }
+
+                    case kIncr:
+                    case kIncrBy:
+                    case kDecr:
+                    case kDecrBy: {
+                        long long delta;
+                        if (!ParseIncrement(task.cmd, argv, 0, &delta, &c->output) ||
+                            !CheckRecordSize(argv[0], 0, &c->output)) {
+                            break;
+                        }
+                        CachedCounter * counter = LoadCounter(argv[0], &c->output);
+                        if (counter == nullptr || !AddCounter(counter->value, delta, &counter->value, &c->output)) {
+                            break;
+                        }
+                        if (!counter->dirty) {
+                            counter->dirty = true;
+                            ++dirty_counters_;
+                        }
+                        RespMachine::AppendInteger(&c->output, counter->value);
+                        if (counters_.size() > kMaxCachedCounters) {
+                            FlushCounters();
+                            EvictCounters();
+                        }
+                        break;
+                    }
+
+                    case kIncrByFloat: {
+                        if (!CheckRecordSize(argv[0], 0, &c->output)) {
+                            break;
+                        }
+                        auto it = counters_.find(argv[0]);
+                        std::string_view value;
+                        ValueType type = kStringValue;
+                        uint64_t rep;
+                        if (it != counters_.cend()) {
+                            counter_value_.assign(number_, ll2string(number_, sizeof(number_), it->second.value));
+                            value = counter_value_;
+                        } else {
+                            type = LookupValue(argv[0], &rep, &value);
+                        }
+                        if (type == kHashValue) {
+                            RespMachine::AppendError(&c->output, kWrongTypeError);
+                            break;
+                        }
+                        size_t len = AddFloat(type == kStringValue ? &value : nullptr, argv[1], number_, &c->output);
+                        if (len == 0) {
+                            break;
+                        }
+                        EraseCounter(argv[0]);
+                        if (!Put(argv[0], {number_, len})) {
+                            RespMachine::AppendError(&c->output, "ERR Index full, failed growing it");
+                            break;
+                        }
+                        RespMachine::AppendBulkString(&c->output, number_, len);
+                        break;
+                    }
+
+                    case kHSet:
+                    case kHDel: {
+                        if (task.cmd == kHSet && argv.size() % 2 != 1) {
+                            RespMachine::AppendError(&c->output, "ERR wrong number of arguments for 'hset' command");
+                            break;
+                        }
+                        size_t entry_size = 0;
+                        for (size_t f = 1; f < argv.size(); f += (task.cmd == kHSet ? 2 : 1)) {
+                            std::string_view value = task.cmd == kHSet ? argv[f + 1] : std::string_view();
+                            entry_size = std::max(entry_size, GetHashEntrySize(argv[f], &value));
+                        }
+                        if (!CheckRecordSize(argv[0], kHashRecordHeaderSize + entry_size, &c->output)) {
+                            break;
+                        }
+                        uint64_t rep;
+                        ValueType type = LookupValue(argv[0], &rep);
+                        if (type == kStringValue) {
+                            RespMachine::AppendError(&c->output, kWrongTypeError);
+                            break;
+                        }
+                        if (type == kHashValue) {
+                            LoadHash(rep);
+                        } else {
+                            hash_.fields.clear();
+                            hash_.chain.clear();
+                            hash_.deltas = 0;
+                        }
+
+                        long long changed = 0;
+                        hash_touched_.clear();
+                        if (task.cmd == kHSet) {
+                            for (size_t f = 1; f < argv.size(); f += 2) {
+                                changed += hash_.fields.insert_or_assign(argv[f], argv[f + 1]).second;
+                                hash_touched_.emplace(argv[f]);
+                            }
+                        } else {
+                            for (size_t f = 1; f < argv.size(); ++f) {
+                                auto it = hash_.fields.find(argv[f]);
+                                if (it != hash_.fields.end()) {
+                                    hash_.fields.erase(it);
+                                    hash_touched_.emplace(argv[f]);
+                                    ++changed;
+                                }
+                            }
+                        }
+                        if (hash_touched_.empty()) {
+                            RespMachine::AppendInteger(&c->output, changed);
+                            break;
+                        }
+                        if (hash_.fields.empty()) {
+                            if (!DelKey(argv[0])) {
+                                RespMachine::AppendError(&c->output, "ERR Index full, failed growing it");
+                                break;
+                            }
+                            RespMachine::AppendInteger(&c->output, changed);
+                            break;
+                        }
+
+                        /* One entry per field, a field set twice by the command taking its last value */
+                        hash_entries_.clear();
+                        for (const auto & field:hash_touched_) {
+                            auto it = hash_.fields.find(field);
+                            std::string_view value;
+                            if (it != hash_.fields.end()) {
+                                value = it->second;
+                            }
+                            AppendHashEntry(&hash_entries_, field, it != hash_.fields.end() ? &value : nullptr);
+                        }
+                        if (!WriteHash(argv[0])) {
+                            RespMachine::AppendError(&c->output, "ERR Index full, failed growing it");
+                            break;
+                        }
+                        RespMachine::AppendInteger(&c->output, changed);
+                        break;
+                    }
+
+                    case kHGet:
+                    case kHMGet: {
+                        uint64_t rep;
+                        ValueType type = LookupValue(argv[0], &rep);
+                        if (type == kStringValue) {
+                            RespMachine::AppendError(&c->output, kWrongTypeError);
+                            break;
+                        }
+                        /* Newest first, stopping once every field is settled */
+                        size_t n = argv.size() - 1;
+                        size_t settled = 0;
+                        hash_values_.resize(n);
+                        hash_found_.assign(n, 0);
+                        if (type == kHashValue) {
+                            WalkHash(rep, [&](uint64_t, size_t, uint8_t, const std::string_view & entries) {
+                                size_t pos = 0;
+                                std::string_view field;
+                                std::string_view value;
+                                bool deleted;
+                                while (NextHashEntry(entries, &pos, &field, &value, &deleted)) {
+                                    for (size_t f = 0; f < n; ++f) {
+                                        if (hash_found_[f] == 0 && argv[f + 1] == field) {
+                                            hash_found_[f] = deleted ? 2 : 1;
+                                            hash_values_[f].assign(value);
+                                            ++settled;
+                                        }
+                                    }
+                                }
+                                return settled < n;
+                            });
+                        }
+                        if (task.cmd == kHMGet) {
+                            RespMachine::AppendArrayLength(&c->output, n);
+                        }
+                        for (size_t f = 0; f < n; ++f) {
+                            if (hash_found_[f] == 1) {
+                                RespMachine::AppendBulkString(&c->output, hash_values_[f]);
+                            } else {
+                                RespMachine::AppendNullArray(&c->output);
+                            }
+                        }
+                        break;
+                    }
+
+                    case kHGetAll: {
+                        uint64_t rep;
+                        ValueType type = LookupValue(argv[0], &rep);
+                        if (type == kStringValue) {
+                            RespMachine::AppendError(&c->output, kWrongTypeError);
+                            break;
+                        }
+                        if (type == kMissingValue) {
+                            RespMachine::AppendArrayLength(&c->output, 0);
+                            break;
+                        }
+                        LoadHash(rep);
+                        RespMachine::AppendArrayLength(&c->output, hash_.fields.size() * 2);
+                        for (const auto & p:hash_.fields) {
+                            RespMachine::AppendBulkString(&c->output, p.first);
+                            RespMachine::AppendBulkString(&c->output, p.second);
+                        }
+                        break;
+                    }
+
+                    case kCheckpoint: {
+                        ReapCheckpoint();
+                        if (checkpoint_.joinable()) {
+                            RespMachine::AppendError(&c->output, "ERR Checkpoint already in progress");
+                            break;
+                        }
+                        if (dirty_counters_ != 0) {
+                            FlushCounters();
+                        }
+                        std::string err;
+                        if (!StartCheckpoint(argv[0], &err)) {
+                            RespMachine::AppendError(&c->output, err);
+                            break;
+                        }
+                        RespMachine::AppendSimpleString(&c->output, "Background checkpoint started");
+                        break;
+                    }
+
+                    case kPing: {
+                        if (argv.size() > 1) {
+                            RespMachine::AppendError(&c->output, "ERR wrong number of arguments for 'ping' command");
+                        } else if (argv.size() == 1) {
+                            RespMachine::AppendBulkString(&c->output, argv[0]);
+                        } else {
+                            RespMachine::AppendSimpleString(&c->output, "PONG");
+                        }
+                        break;
+                    }
+
+                    case kReplicaof:
+                    case kPsync:
+                    case kReplconf: {
+                        RespMachine::AppendError(&c->output, "ERR replication is for the in-memory executor, "
+                                                             "disk nodes can't be replicated");
+                        break;
+                    }
+
+                    case kBgsave:
+                    case kBgrewriteaof: {
+                        RespMachine::AppendError(&c->output, "ERR BGSAVE and BGREWRITEAOF are for the in-memory "
+                                                             "executor, every write here is in a data file already");
+                        break;
+                    }
+
+                    default: {
+                        RespMachine::AppendError(&c->output, "Unsupported Command");
+                        break;
+                    }
+                }
+                task.io = io_cycles_;
+                task.executed = GetCycles();
+                Hold(&task, replied, strict && IsWriteCommand(task.cmd));
+            }
+        }
+
+        // Holds back the reply just appended until the write buffer is
+        // flushed, if the task wrote into it or its client already waits.
+        void Hold(Task * task, size_t replied, bool wrote) const {
+            Client * c = task->c;
+            task->hold = false;
+            if (c->output.size() > replied && (c->held != 0 || (wrote && !wbuf_.empty()))) {
+                task->hold = c->held == 0;
+                c->held += c->output.size() - replied;
+            }
+        }
+
+        // Writes the replies of tasks run, in task order, and releases the
+        // clients closed meanwhile. Clients with a reply held are added to
+        // held, their references kept. On the loop thread.
+        static void FinishTasks(std::vector<Task> * tasks, std::vector<std::pair<Client *, int>> * held,
+                                long curr_time, EventLoop<Client> * el) {
+            Stats * stats = GetStats();
+            for (const Task & task:*tasks) {
+                Client * c = task.c;
+                int fd = task.fd;
+
+                --c->ref_count;
+                if (c->close) {
+                    if (c->ref_count == 0) {
+                        el->Release(fd);
+                    }
+                    continue;
+                }
+
+                if (task.hold) {
+                    ++c->ref_count;
+                    held->emplace_back(c, fd);
+                }
+                if (!task.blocked && c->output.size() > c->held) {
+                    WriteOutput(fd, c, el);
+                }
+                RecordTask(stats, task.cmd, task.argv, 0,
+                           task.submitted, task.begun, task.io, task.executed, GetCycles());
+                CheckOutputBuffer(fd, c, curr_time, el);
+            }
+        }
+
+        // Sends the replies held until the write buffer flush just done.
+        static void ReleaseHeld(std::vector<std::pair<Client *, int>> * held,
+                                long curr_time, EventLoop<Client> * el) {
+            for (const auto & p:*held) {
+                Client * c = p.first;
+                int fd = p.second;
+
+                c->held = 0;
+                --c->ref_count;
+                if (c->close) {
+                    if (c->ref_count == 0) {
+                        el->Release(fd);
+                    }
+                    continue;
+                }
+                WriteOutput(fd, c, el);
+                CheckOutputBuffer(fd, c, curr_time, el);
+            }
+            held->clear();
+        }
+
+        // Writes what of the output isn't held, the rest waits for writable.
+        static void WriteOutput(int fd, Client * c, EventLoop<Client> * el) {
+            ssize_t nwrite = write(fd, c->output.data(), c->output.size() - c->held);
+            if (nwrite > 0) {
+                c->output.assign(c->output.data() + nwrite,
+                                 c->output.size() - nwrite);
+                GetStats()->net_output_bytes.Add(nwrite);
+            }
+            if (c->output.size() > c->held) {
+                el->AddEvent(fd, kWritable);
+            }
+        }
+
+        size_t GetTaskCount() const override {
+            return tasks_.Size();
+        }
+
+        long GetTimeout() const override {
+            if (next_filter_ != nullptr) {
+                return 0;
+            }
+            if (wbuf_.empty()) {
+                return held_.empty() ? -1 : 0;
+            }
+            uint64_t usec = GetConfig()->write_buffer_usec;
+            uint64_t age = GetCurrentTimeInMicroseconds() - wbuf_since_;
+            return age >= usec ? 0 : static_cast<long>(usec - age);
+        }
+
+        void Cron(long curr_time) override {
+            if (dirty_counters_ != 0) {
+                CreateFileIfNeed();
+                FlushCounters();
+            }
+            ReapCheckpoint();
+        }
+
+        void GetInfo(const char * section, std::string * buf) const override {
+            if (strcmp(section, "server") == 0) {
+                AppendInfoField(buf, "executor", "disk");
+                AppendInfoField(buf, "dir", dir_);
+            } else if (strcmp(section, "memory") == 0) {
+                AppendInfoField(buf, "index_file_size", static_cast<long long>(allocator_.GetFileSize()));
+                AppendInfoField(buf, "index_allocated_bytes", static_cast<long long>(allocator_.GetAllocatedSize()));
+                AppendInfoField(buf, "index_free_pages", static_cast<long long>(allocator_.GetFreePageCount()));
+                AppendInfoField(buf, "cached_counters", static_cast<long long>(counters_.size()));
+                AppendInfoField(buf, "dirty_counters", static_cast<long long>(dirty_counters_));
+                if (filter_ != nullptr) {
+                    AppendInfoField(buf, "bloom_filter_bytes", static_cast<long long>(
+                            filter_->GetSize() + (next_filter_ != nullptr ? next_filter_->GetSize() : 0)));
+                    AppendInfoField(buf, "bloom_filter_keys", static_cast<long long>(filter_keys_));
+                    AppendInfoField(buf, "bloom_filter_rebuilding", next_filter_ != nullptr);
+                }
+            } else if (strcmp(section, "stats") == 0) {
+                AppendInfoField(buf, "bloom_filter_negatives", static_cast<long long>(filter_negatives_));
+            } else if (strcmp(section, "persistence") == 0) {
+                AppendInfoField(buf, "data_files", static_cast<long long>(fd_map_.size()));
+                AppendInfoField(buf, "data_file_current", curr_id_);
+                AppendInfoField(buf, "data_file_offset", curr_fd_ != -1 ? offset_ : 0);
+                AppendInfoField(buf, "write_buffer_bytes", static_cast<long long>(wbuf_.size()));
+                AppendInfoField(buf, "checkpoint_in_progress", checkpoint_.joinable());
+                AppendInfoField(buf, "last_checkpoint_status", last_checkpoint_ok_ ? "ok" : "err");
+                for (const auto & p:file_stats_) {
+                    std::string name = "data_file_" + std::to_string(p.first);
+                    AppendInfoField(buf, name.c_str(), "live=" + std::to_string(p.second.live) +
+                                                       ",garbage=" + std::to_string(p.second.garbage));
+                }
+            } else if (strcmp(section, "replication") == 0) {
+                AppendInfoField(buf, "role", "master");
+                AppendInfoField(buf, "connected_slaves", 0);
+            } else if (strcmp(section, "keyspace") == 0 && keys_ != 0) {
+                AppendInfoField(buf, "db0", "keys=" + std::to_string(keys_));
+            }
+        }
+
+    private:
+        // Appends a record to buf_, returning the offset it will be written at.
+        uint32_t AppendRecord(const std::string_view & k, const std::string_view & v, uint16_t flags = 0) {
+            Header header = {static_cast<uint16_t>(k.size() | flags),
+                             static_cast<uint16_t>(v.size())};
+
+            buf_.append(reinterpret_cast<char *>(&header), sizeof(header));
+            buf_.append(k);
+            buf_.append(v);
+
+            uint32_t offset = offset_;
+            offset_ += sizeof(header) + k.size() + v.size();
+            return offset;
+        }
+
+        // Writes the records of buf_, or moves them to the write buffer if
+        // one is configured. Leaves buf_ empty.
+        void WriteRecords() {
+            if (buf_.empty()) {
+                return;
+            }
+            file_stats_[curr_id_].live += buf_.size();
+            if (!wbuf_.empty()) {
+                wbuf_.append(buf_);
+                buf_.clear();
+                return;
+            }
+            wbuf_offset_ = static_cast<uint32_t>(offset_ - buf_.size());
+            wbuf_.swap(buf_);
+            buf_.clear();
+            if (GetConfig()->write_buffer_size == 0) {
+                FlushWrites();
+            } else {
+                wbuf_since_ = GetCurrentTimeInMicroseconds();
+            }
+        }
+
+        bool FlushDue() const {
+            if (wbuf_.empty()) {
+                return false;
+            }
+            const Config * config = GetConfig();
+            return wbuf_.size() >= config->write_buffer_size ||
+                   GetCurrentTimeInMicroseconds() - wbuf_since_ >= config->write_buffer_usec;
+        }
+
+        // One write for all the records buffered, at the offset they were
+        // given.
+        void FlushWrites() {
+            if (wbuf_.empty()) {
+                return;
+            }
+            ssize_t nwrite = pwrite(curr_fd_, wbuf_.data(), wbuf_.size(), wbuf_offset_);
+            if (nwrite != static_cast<ssize_t>(wbuf_.size())) {
+                LIN_LOG_ERROR("Failed writing. Error message: '%s'", strerror(errno));
+                exit(1);
+            }
+            GetStats()->data_bytes_written.Add(nwrite);
+            wbuf_.clear();
+        }
+
+        uint64_t MakeRep(size_t k_len, size_t v_len, uint32_t offset) const {
+            return PackIDLengthAndOffset(static_cast<uint16_t>(curr_id_), PackKVLength(k_len, v_len), offset);
+        }
+
+        // Points the index at a record just written. Returns false if the
+        // index is full, the record is garbage then. A hash delta keeps the
+        // record it replaces, which is still part of the chain.
+        bool AddRecord(const std::string_view & k, size_t v_len, uint32_t offset, bool retire = true) {
+            uint64_t rep = MakeRep(k.size(), v_len, offset);
+            bool dup = false;
+            try {
+                tree_.Add(k, rep, [this, rep, retire, &dup](KVTrans & trans, uint64_t & ref) -> bool {
+                    if (retire) {
+                        Retire(trans);
+                    }
+                    ref = rep;
+                    dup = true;
+                    return true;
+                });
+            } catch (const IndexGrowException & e) {
+                /* The record is in the data file but unreachable */
+                RetireRecord(rep, sizeof(Header) + k.size() + v_len);
+                return false;
+            }
+            if (!dup) {
+                ++keys_;
+                AddToFilter(k);
+            }
+            return true;
+        }
+
+        // Removes k from the index, which may need it to grow. False if it
+        // couldn't, k is still there then.
+        bool DelKey(const std::string & k) {
+            try {
+                tree_.Del(k);
+            } catch (const IndexGrowException & e) {
+                return false;
+            }
+            return true;
+        }
+
+        // False if k was never added to the index since the Bloom filter was
+        // built, so it can't be there.
+        bool MayExist(const std::string_view & k) const {
+            return filter_ == nullptr || filter_->MayContain(BloomFilter::Hash(k));
+        }
+
+        void AddToFilter(const std::string_view & k) {
+            if (filter_ != nullptr) {
+                uint64_t h = BloomFilter::Hash(k);
+                filter_->Add(h);
+                ++filter_keys_;
+                if (next_filter_ != nullptr) {
+                    next_filter_->Add(h);
+                }
+            }
+        }
+
+        // Rebuilds the Bloom filter from the index once more keys went in
+        // than it was sized for, deleted ones included, which also drops
+        // those. A step of kFilterBuildStep keys per call: keys added
+        // meanwhile go to both filters, the old one answering until done.
+        void BuildFilter() {
+            if (next_filter_ == nullptr) {
+                if (filter_ == nullptr || filter_keys_ <= filter_->GetCapacity()) {
+                    return;
+                }
+                next_filter_ = std::make_unique<BloomFilter>(std::max(kMinFilterKeys, keys_ * 2),
+                                                             GetConfig()->bloom_bits_per_key);
+                filter_key_.clear();
+            }
+            scan_key_ = filter_key_;
+            bool more = VisitReps(kFilterBuildStep);
+            LoadRecords(false);
+            size_t n = more ? kFilterBuildStep : scan_keys_.size();
+            for (size_t i = 0; i < n; ++i) {
+                next_filter_->Add(BloomFilter::Hash(scan_keys_[i]));
+            }
+            if (more) {
+                filter_key_ = scan_keys_[kFilterBuildStep];
+                return;
+            }
+            filter_ = std::move(next_filter_);
+            filter_keys_ = keys_; /* A key added during the rebuild may have been visited too */
+            LIN_LOG_INFO("Rebuilt the Bloom filter, %lu keys in %lu bytes",
+                         static_cast<unsigned long>(filter_keys_), static_cast<unsigned long>(filter_->GetSize()));
+        }
+
+        // One record outside of the batch's write.
+        bool Put(const std::string_view & k, const std::string_view & v) {
+            buf_.clear();
+            uint32_t offset = AppendRecord(k, v);
+            WriteRecords();
+            return AddRecord(k, v.size(), offset);
+        }
+
+        // The cached counter of k, loaded on a miss. Null with the error reply
+        // appended if the value isn't an integer.
+        CachedCounter * LoadCounter(const std::string & k, std::string * out) {
+            auto it = counters_.find(k);
+            if (it != counters_.end()) {
+                return &it->second;
+            }
+            long long ll = 0;
+            uint64_t rep;
+            std::string_view value;
+            ValueType type = LookupValue(k, &rep, &value);
+            if (type == kHashValue) {
+                RespMachine::AppendError(out, kWrongTypeError);
+                return nullptr;
+            }
+            if (type == kStringValue && !ParseCounter(value, &ll, out)) {
+                return nullptr;
+            }
+            return &counters_.emplace(k, CachedCounter{ll, false}).first->second;
+        }
+
+        void EraseCounter(const std::string & k) {
+            if (!counters_.empty()) {
+                auto it = counters_.find(k);
+                if (it != counters_.end()) {
+                    dirty_counters_ -= it->second.dirty;
+                    counters_.erase(it);
+                }
+            }
+        }
+
+        // Writes the dirty counters back with one write. Those the index has
+        // no room for stay dirty. Never switches data files, the caller does.
+        void FlushCounters() {
+            buf_.clear();
+            counter_records_.clear();
+            for (const auto & p:counters_) {
+                if (p.second.dirty) {
+                    int len = ll2string(number_, sizeof(number_), p.second.value);
+                    counter_records_.emplace_back(AppendRecord(p.first, {number_, static_cast<size_t>(len)}), len);
+                }
+            }
+            WriteRecords();
+
+            size_t i = 0;
+            for (auto & p:counters_) {
+                if (p.second.dirty) {
+                    const auto & record = counter_records_[i++];
+                    if (AddRecord(p.first, record.second, record.first)) {
+                        p.second.dirty = false;
+                        --dirty_counters_;
+                    }
+                }
+            }
+        }
+
+        void EvictCounters() {
+            for (auto it = counters_.begin(); it != counters_.end();) {
+                it = it->second.dirty ? std::next(it) : counters_.erase(it);
+            }
+        }
+
+        // Replies an error if a record can't hold k and a value of v_len.
+        static bool CheckRecordSize(const std::string_view & k, size_t v_len, std::string * out) {
+            if (k.size() > kMaxKeySize || v_len > kMaxValueSize) {
+                RespMachine::AppendError(out, "ERR key or value too large");
+                return false;
+            }
+            return true;
+        }
+
+        // Reads the record of rep whole into record_, returning its header.
+        Header ReadRecord(uint64_t rep) {
+            uint16_t id;
+            uint16_t length;
+            uint32_t offset;
+            std::tie(id, length, offset) = UnpackKVRep(rep);
+            auto[k_len, v_len] = UnpackLength(length);
+
+            int fd = fd_map_[id];
+            size_t have = sizeof(Header) + k_len + v_len;
+            record_.resize(have);
+            ssize_t nread = ReadAt(fd, record_.data(), have, offset);
+            if (nread != static_cast<ssize_t>(have)) {
+                LIN_LOG_ERROR("Failed preading. Error message: '%s'", strerror(errno));
+                exit(1);
+            }
+
+            Header header;
+            memcpy(&header, record_.data(), sizeof(header));
+            size_t need = sizeof(Header) + header.KeySize() + header.v_len;
+            if (need > have) { /* Longer than the rep says */
+                record_.resize(need);
+                nread = ReadAt(fd, &record_[have], need - have, offset + have);
+                if (nread != static_cast<ssize_t>(need - have)) {
+                    LIN_LOG_ERROR("Failed preading. Error message: '%s'", strerror(errno));
+                    exit(1);
+                }
+            }
+            return header;
+        }
+
+        // The type of k's record, its rep in *rep and value in *v (into
+        // record_) if there is one. Cached counters are strings too, with
+        // neither filled in.
+        ValueType LookupValue(const std::string & k, uint64_t * rep, std::string_view * v = nullptr) {
+            if (!counters_.empty() && counters_.count(k) != 0) {
+                return kStringValue;
+            }
+            if (!MayExist(k)) {
+                ++filter_negatives_;
+                return kMissingValue;
+            }
+            const uint64_t * candidate = tree_.GetRep(k);
+            if (candidate == nullptr) {
+                return kMissingValue;
+            }
+            Header header = ReadRecord(*candidate);
+            if (std::string_view(record_.data() + sizeof(Header), header.KeySize()) != k) {
+                return kMissingValue;
+            }
+            *rep = *candidate;
+            if (v != nullptr) {
+                *v = {record_.data() + sizeof(Header) + header.KeySize(), header.v_len};
+            }
+            return header.IsHash() ? kHashValue : kStringValue;
+        }
+
+        // Calls f with the rep, size, deltas and entries of each record of
+        // the hash from rep on, newest first, until it returns false.
+        template<typename F>
+        void WalkHash(uint64_t rep, F && f) {
+            while (true) {
+                Header header = ReadRecord(rep);
+                std::string_view value(record_.data() + sizeof(Header) + header.KeySize(), header.v_len);
+                if (!header.IsHash() || value.size() < kHashRecordHeaderSize) {
+                    LIN_LOG_ERROR("Corrupted hash record at %lu", static_cast<unsigned long>(rep));
+                    return;
+                }
+                uint64_t prev;
+                memcpy(&prev, value.data(), sizeof(prev));
+                auto deltas = static_cast<uint8_t>(value[sizeof(prev)]);
+                if (!f(rep, sizeof(Header) + header.KeySize() + header.v_len, deltas,
+                       value.substr(kHashRecordHeaderSize)) || prev == kNoPrevRecord) {
+                    return;
+                }
+                rep = prev;
+            }
+        }
+
+        // Merges the chain of the hash at rep into hash_. A field takes its
+        // newest entry, and a deleted one stays deleted.
+        void LoadHash(uint64_t rep) {
+            hash_.fields.clear();
+            hash_.deleted.clear();
+            hash_.chain.clear();
+            hash_.deltas = 0;
+            WalkHash(rep, [this](uint64_t rep, size_t size, uint8_t deltas, const std::string_view & entries) {
+                if (hash_.chain.empty()) {
+                    hash_.deltas = deltas;
+                }
+                hash_.chain.emplace_back(rep, size);
+                size_t pos = 0;
+                std::string_view field;
+                std::string_view value;
+                bool deleted;
+                while (NextHashEntry(entries, &pos, &field, &value, &deleted)) {
+                    if (hash_.fields.find(field) != hash_.fields.end() ||
+                        hash_.deleted.find(field) != hash_.deleted.end()) {
+                        continue;
+                    }
+                    if (deleted) {
+                        hash_.deleted.emplace(field);
+                    } else {
+                        hash_.fields.emplace(field, value);
+                    }
+                }
+                return true;
+            });
+        }
+
+        // Appends a hash record whose previous one is prev.
+        uint32_t AppendHashRecord(const std::string_view & k, uint64_t prev, uint8_t deltas,
+                                  const std::string_view & entries) {
+            hash_record_.clear();
+            hash_record_.append(reinterpret_cast<const char *>(&prev), sizeof(prev));
+            hash_record_.push_back(static_cast<char>(deltas));
+            hash_record_.append(entries);
+            return AppendRecord(k, hash_record_, kHashRecordFlag);
+        }
+
+        // Writes hash_entries_, the changes to hash_, as a delta on top of the
+        // chain, or folds the chain once it has kMaxHashDeltas deltas. There
+        // is no compaction, so reads stay bounded by folding on write.
+        bool WriteHash(const std::string_view & k) {
+            size_t v_len = kHashRecordHeaderSize + hash_entries_.size();
+            if (hash_.chain.empty() || hash_.deltas + 1 >= kMaxHashDeltas || v_len > kMaxValueSize) {
+                return FoldHash(k);
+            }
+            buf_.clear();
+            uint32_t offset = AppendHashRecord(k, hash_.chain.front().first,
+                                               static_cast<uint8_t>(hash_.deltas + 1), hash_entries_);
+            WriteRecords();
+            return AddRecord(k, v_len, offset, false);
+        }
+
+        // Writes the fields of hash_ as a new chain with one write, as many
+        // records as they need, and retires the old chain.
+        bool FoldHash(const std::string_view & k) {
+            buf_.clear();
+            hash_entries_.clear();
+            uint64_t prev = kNoPrevRecord;
+            for (const auto & p:hash_.fields) {
+                std::string_view value = p.second;
+                if (!hash_entries_.empty() &&
+                    kHashRecordHeaderSize + hash_entries_.size() + GetHashEntrySize(p.first, &value) > kMaxValueSize) {
+                    uint32_t offset = AppendHashRecord(k, prev, 0, hash_entries_);
+                    prev = MakeRep(k.size(), kHashRecordHeaderSize + hash_entries_.size(), offset);
+                    hash_entries_.clear();
+                }
+                AppendHashEntry(&hash_entries_, p.first, &value);
+            }
+            size_t v_len = kHashRecordHeaderSize + hash_entries_.size();
+            uint32_t offset = AppendHashRecord(k, prev, 0, hash_entries_);
+            WriteRecords();
+            if (!AddRecord(k, v_len, offset, false)) {
+                return false;
+            }
+            for (const auto & p:hash_.chain) {
+                RetireRecord(p.first, p.second);
+            }
+            return true;
+        }
+
+        // Every data file read goes through here, timing it for the read stage.
+        ssize_t ReadAt(int fd, void * buf, size_t count, off_t offset) {
+            uint64_t begun = GetCycles();
+            ssize_t nread = IsBuffered(fd, count, offset) ? ReadBuffered(buf, count, offset)
+                                                          : pread(fd, buf, count, offset);
+            io_cycles_ += GetCycles() - begun;
+            return nread;
+        }
+
+        bool IsBuffered(int fd, size_t count, uint64_t offset) const {
+            return fd == curr_fd_ && !wbuf_.empty() && offset + count > wbuf_offset_;
+        }
+
+        // Reads the part of the active data file still in the write buffer
+        // from there, what comes before it from the file.
+        ssize_t ReadBuffered(void * buf, size_t count, uint64_t offset) const {
+            size_t n = 0;
+            if (offset < wbuf_offset_) {
+                ssize_t nread = pread(curr_fd_, buf, wbuf_offset_ - offset, offset);
+                if (nread != static_cast<ssize_t>(wbuf_offset_ - offset)) {
+                    return nread;
+                }
+                n = static_cast<size_t>(nread);
+            }
+            size_t from = offset + n - wbuf_offset_;
+            if (from < wbuf_.size()) {
+                size_t m = std::min(count - n, wbuf_.size() - from);
+                memcpy(static_cast<char *>(buf) + n, wbuf_.data() + from, m);
+                n += m;
+            }
+            return static_cast<ssize_t>(n);
+        }
+
+        // Reads the records of a run of GETs with up to io-depth of them in
+        // flight. Each read goes as far as the page cache allows right away,
+        // only the ones that would wait on the device go to the I/O engine,
+        // and they resume as the engine completes them. Replies are written
+        // afterwards in task order, so a client sees them in order. A key the
+        // Bloom filter rules out, or the index doesn't have, isn't read.
+        void ReadBatch(size_t begin, size_t end) {
+            if (reads_.size() < end - begin) {
+                reads_.resize(end - begin);
+            }
+            waiting_.clear();
+            for (size_t i = begin; i < end; ++i) {
+                RecordRead & read = reads_[i - begin];
+                read.found = false;
+                const std::string & k = running_[i].argv[0];
+                if (running_[i].c->close) {
+                    continue;
+                }
+                if (!MayExist(k)) {
+                    ++filter_negatives_;
+                    continue;
+                }
+                const uint64_t * rep = tree_.GetRep(k);
+                if (rep == nullptr) {
+                    continue;
+                }
+                uint16_t id;
+                uint16_t length;
+                uint32_t offset;
+                std::tie(id, length, offset) = UnpackKVRep(*rep);
+
+                uint16_t k_len;
+                uint16_t v_len;
+                std::tie(k_len, v_len) = UnpackLength(length);
+
+                read.found = true;
+                read.fd = fd_map_[id];
+                read.offset = offset;
+                read.have = 0;
+                read.need = sizeof(Header) + k_len + v_len;
+                read.parsed = false;
+                read.io = 0;
+                read.buf.resize(read.need);
+                if (!ResumeRead(&read)) {
+                    waiting_.emplace_back(&read.request);
+                }
+            }
+            if (waiting_.empty()) {
+                return;
+            }
+
+            if (io_engine_ == nullptr) {
+                io_engine_ = std::make_unique<IoEngine>(io_threads_);
+            }
+            for (IoRequest * request:waiting_) {
+                io_engine_->Submit(request);
+            }
+            while (io_engine_->GetInFlightCount() != 0) {
+                waiting_.clear();
+                io_engine_->Wait(&waiting_);
+                uint64_t now = GetCycles();
+                for (IoRequest * request:waiting_) {
+                    auto * read = static_cast<RecordRead *>(request->data);
+                    read->io += now - read->issued;
+                    if (request->result <= 0) {
+                        LIN_LOG_ERROR("Failed preading. Error message: '%s'", strerror(request->error));
+                        exit(1);
+                    }
+                    AdvanceRead(read, static_cast<size_t>(request->result));
+                    if (!ResumeRead(read)) {
+                        io_engine_->Submit(request);
+                    }
+                }
+            }
+        }
+
+        // Reads on from the page cache. Returns false with the request for
+        // the rest filled in if the device is needed.
+        bool ResumeRead(RecordRead * read) {
+            while (read->have < read->need) {
+                uint64_t begun = GetCycles();
+                size_t count = read->need - read->have;
+                uint64_t offset = static_cast<uint64_t>(read->offset) + read->have;
+                ssize_t nread = IsBuffered(read->fd, count, offset)
+                                ? ReadBuffered(&read->buf[read->have], count, offset)
+                                : FileReadNoWait(read->fd, &read->buf[read->have], count, offset);
+                read->io += GetCycles() - begun;
+                if (nread > 0) {
+                    AdvanceRead(read, static_cast<size_t>(nread));
+                } else if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    IoRequest & request = read->request;
+                    request.fd = read->fd;
+                    request.buf = &read->buf[read->have];
+                    request.count = read->need - read->have;
+                    request.offset = read->offset + read->have;
+                    request.data = read;
+                    read->issued = GetCycles();
+                    return false;
+                } else {
+                    LIN_LOG_ERROR("Failed preading. Error message: '%s'", nread == 0 ? "EOF" : strerror(errno));
+                    exit(1);
+                }
+            }
+            return true;
+        }
+
+        void AdvanceRead(RecordRead * read, size_t n) {
+            read->have += n;
+            if (!read->parsed && read->have >= sizeof(Header)) {
+                memcpy(&read->header, read->buf.data(), sizeof(Header));
+                read->need = sizeof(Header) + read->header.KeySize() + read->header.v_len;
+                read->buf.resize(read->need);
+                read->parsed = true;
+            }
+        }
+
+        // Visits up to count keys in order from scan_key_, the ones matching
+        // pattern go to scan_matches_. Returns whether any are left, scan_key_ then
+        // being the next one.
+        bool ScanKeys(size_t count, const std::string_view & pattern) {
+            bool more = VisitReps(count);
+            LoadRecords(false);
+
+            scan_matches_.clear();
+            for (size_t i = 0; i < std::min(count, scan_reps_.size()); ++i) {
+                if (MatchKey(pattern, scan_keys_[i])) {
+                    scan_matches_.emplace_back(scan_keys_[i]);
+                }
+            }
+            if (more) {
+                scan_key_ = scan_keys_[count];
+            }
+            return more;
+        }
+
+        // Collects the reps of up to count + 1 keys from scan_key_ on, the
+        // extra one being where to resume. Returns whether it was found.
+        bool VisitReps(size_t count) {
+            scan_reps_.clear();
+            tree_.Visit(scan_key_, [this, count](const uint64_t & rep) {
+                scan_reps_.emplace_back(rep);
+                return scan_reps_.size() <= count;
+            });
+            return scan_reps_.size() > count;
+        }
+
+        // Reads the keys of scan_reps_ into scan_keys_, and the values into
+        // scan_values_ if asked. Records are taken in file and offset order
+        // and neighbours come in with one pread rather than one each. Value
+        // reads stream: every extent is read ahead before the first pread,
+        // the files hinted sequential meanwhile.
+        void LoadRecords(bool values) {
+            size_t n = scan_reps_.size();
+            scan_keys_.resize(n);
+            scan_hashes_.resize(n);
+            if (values) {
+                scan_values_.resize(n);
+            }
+            scan_order_.resize(n);
+            std::iota(scan_order_.begin(), scan_order_.end(), 0);
+            std::sort(scan_order_.begin(), scan_order_.end(), [this](size_t a, size_t b) {
+                return (scan_reps_[a] & ~(static_cast<uint64_t>(UINT16_MAX) << 32)) <
+                       (scan_reps_[b] & ~(static_cast<uint64_t>(UINT16_MAX) << 32));
+            });
+
+            auto record_end = [values](uint64_t rep) -> uint64_t {
+                uint16_t length;
+                uint32_t offset;
+                std::tie(std::ignore, length, offset) = UnpackKVRep(rep);
+                auto[k_len, v_len] = UnpackLength(length);
+                return offset + sizeof(Header) + k_len + (values ? v_len : 0);
+            };
+
+            scan_extents_.clear();
+            for (size_t i = 0; i < n;) {
+                Extent extent;
+                std::tie(extent.id, std::ignore, extent.begin) = UnpackKVRep(scan_reps_[scan_order_[i]]);
+                extent.end = record_end(scan_reps_[scan_order_[i]]);
+                extent.first = i;
+                for (++i; i < n; ++i) {
+                    uint64_t rep = scan_reps_[scan_order_[i]];
+                    uint16_t id;
+                    uint32_t offset;
+                    std::tie(id, std::ignore, offset) = UnpackKVRep(rep);
+                    if (id != extent.id || offset > extent.end + kCoalesceGap ||
+                        record_end(rep) - extent.begin > kCoalesceMax) {
+                        break;
+                    }
+                    extent.end = std::max(extent.end, record_end(rep));
+                }
+                extent.last = i;
+                scan_extents_.emplace_back(extent);
+            }
+
+            if (values) {
+                for (size_t i = 0; i < scan_extents_.size(); ++i) {
+                    const Extent & extent = scan_extents_[i];
+                    int fd = fd_map_[extent.id];
+                    if (i == 0 || scan_extents_[i - 1].id != extent.id) {
+                        FileHint(fd, kSequential);
+                    }
+                    FilePrefetch(fd, extent.begin, extent.end - extent.begin);
+                }
+            }
+
+            for (const Extent & extent:scan_extents_) {
+                int fd = fd_map_[extent.id];
+                scan_buf_.resize(extent.end - extent.begin);
+                ssize_t nread = ReadAt(fd, scan_buf_.data(), scan_buf_.size(), extent.begin);
+                if (nread != static_cast<ssize_t>(scan_buf_.size())) {
+                    LIN_LOG_ERROR("Failed preading. Error message: '%s'", strerror(errno));
+                    exit(1);
+                }
+                for (size_t i = extent.first; i < extent.last; ++i) {
+                    size_t index = scan_order_[i];
+                    uint32_t offset;
+                    std::tie(std::ignore, std::ignore, offset) = UnpackKVRep(scan_reps_[index]);
+                    Header header;
+                    memcpy(&header, &scan_buf_[offset - extent.begin], sizeof(header));
+
+                    const char * data;
+                    uint64_t data_offset = offset + sizeof(header);
+                    size_t size = header.KeySize() + (values ? header.v_len : 0);
+                    if (data_offset + size <= extent.end) {
+                        data = &scan_buf_[data_offset - extent.begin];
+                    } else { /* Longer than the rep says */
+                        scan_spill_.resize(size);
+                        nread = ReadAt(fd, scan_spill_.data(), size, data_offset);
+                        if (nread != static_cast<ssize_t>(size)) {
+                            LIN_LOG_ERROR("Failed preading. Error message: '%s'", strerror(errno));
+                            exit(1);
+                        }
+                        data = scan_spill_.data();
+                    }
+                    scan_keys_[index].assign(data, header.KeySize());
+                    scan_hashes_[index] = header.IsHash();
+                    if (values) {
+                        scan_values_[index].assign(data + header.KeySize(), header.v_len);
                     }
+                }
+            }
 
-                    case kUnsupported: {
-                        RespMachine::AppendError(&c->output, "Unsupported Command");
-                        break;
+            if (values) {
+                for (size_t i = 0; i < scan_extents_.size(); ++i) {
+                    if (i == 0 || scan_extents_[i - 1].id != scan_extents_[i].id) {
+                        FileHint(fd_map_[scan_extents_[i].id], kRandom);
                     }
                 }
+            }
+        }
 
-                if (!blocked) {
-                    nwrite = write(fd, c->output.data(), c->output.size());
-                    if (nwrite > 0) {
-                        c->output.assign(c->output.data() + nwrite,
-                                         c->output.size() - nwrite);
+        // Appends the pairs of the range to buf_, visiting a batch at a time
+        // that doubles up to kKeysBatch. Returns the number of pairs, hashes
+        // being skipped.
+        size_t ReadRange(const RangeArgs & args) {
+            buf_.clear();
+            scan_key_ = args.start;
+            size_t n = 0;
+            size_t step = kRangeFirstBatch;
+            while (n < args.limit) {
+                size_t count = std::min(step, args.limit - n);
+                bool more = VisitReps(count);
+                LoadRecords(true);
+                for (size_t i = 0; i < std::min(count, scan_reps_.size()); ++i) {
+                    if (!InRange(args, scan_keys_[i])) {
+                        return n;
                     }
-                    if (!c->output.empty()) {
-                        el->AddEvent(fd, kWritable);
+                    if (scan_hashes_[i]) {
+                        continue;
                     }
+                    RespMachine::AppendBulkString(&buf_, scan_keys_[i]);
+                    RespMachine::AppendBulkString(&buf_, scan_values_[i]);
+                    ++n;
+                }
+                if (!more) {
+                    break;
                 }
+                scan_key_ = scan_keys_[count];
+                step = std::min(step * 2, kKeysBatch);
             }
+            return n;
         }
 
-        size_t GetTaskCount() const override {
-            return tasks_.size();
+        // Moves a replaced or deleted record from live to garbage bytes, the
+        // whole chain of a hash. trans points into buf_, the chain is read
+        // elsewhere.
+        void Retire(const KVTrans & trans) {
+            if (trans.IsHash()) {
+                WalkHash(trans.Rep(), [this](uint64_t rep, size_t size, uint8_t, const std::string_view &) {
+                    RetireRecord(rep, size);
+                    return true;
+                });
+                return;
+            }
+            RetireRecord(trans.Rep(), trans.Size());
+        }
+
+        void RetireRecord(uint64_t rep, size_t size) {
+            DataFileStats & file_stats = file_stats_[std::get<0>(UnpackKVRep(rep))];
+            file_stats.live -= std::min<uint64_t>(file_stats.live, size);
+            file_stats.garbage += size;
+        }
+
+        // A task the sharded executor routed here, prefetched already.
+        void Enqueue(Task && task) {
+            Client * c = task.c;
+            tasks_.EmplaceBack(c) = std::move(task);
+        }
+
+        // Starts reading what a task will need from the data files.
+        void Prefetch(const Task & task) {
+            switch (task.cmd) {
+                case kGet: {
+                    const auto & k = task.argv[0];
+                    if (MayExist(k)) {
+                        PrefetchKeyValue(k, tree_.GetRep(k));
+                    }
+                    break;
+                }
+
+                case kSet: {
+                    const auto & k = task.argv[0];
+                    PrefetchKey(k, tree_.GetRep(k));
+                    break;
+                }
+
+                case kDel: {
+                    const auto & k = task.argv[0];
+                    if (MayExist(k)) {
+                        PrefetchKey(k, tree_.GetRep(k));
+                    }
+                    break;
+                }
+
+                default: {
+                    break;
+                }
+            }
         }
 
-    private:
         void PrefetchKey(const Slice & k, const uint64_t * rep) {
             if (SGT_LIKELY(rep != nullptr)) {
                 uint16_t id;
@@ -342,8 +1689,163 @@ namespace cheapis {
             }
         }
 
+        // Freezes the node for as long as it takes to hard link the rolled
+        // over data files and reflink the index, then leaves the writing to a
+        // thread: the records before offset_ never change. Without reflinks it
+        // fails, a copy of the index would stall the loop and double memory. The checkpoint is built in
+        // <dir>.tmp and renamed to dir once synced. Cheapis can't start from
+        // one, a disk node always begins with a fresh index.
+        bool StartCheckpoint(std::string dir, std::string * err) {
+            while (dir.size() > 1 && dir.back() == '/') {
+                dir.pop_back();
+            }
+            struct stat st;
+            if (stat(dir.c_str(), &st) == 0) {
+                *err = "ERR " + dir + " exists";
+                return false;
+            }
+            std::string tmp = dir + ".tmp";
+            if (mkdir(tmp.c_str(), 0755) != 0) {
+                *err = "ERR Failed creating " + tmp + ": " + strerror(errno);
+                return false;
+            }
+
+            FlushWrites(); /* The copy reads the file up to offset_ */
+            uint64_t begin = GetCurrentTimeInMilliseconds();
+            std::vector<CheckpointFile> files;
+            std::string name;
+            auto fail = [&]() {
+                *err = "ERR Failed checkpointing " + name + ": " + strerror(errno);
+                for (const auto & f:files) {
+                    if (f.fd >= 0) {
+                        close(f.fd);
+                    }
+                }
+                RemoveCheckpoint(tmp);
+                return false;
+            };
+            size_t linked = 0;
+            uint64_t copying = 0;
+            for (const auto & p:fd_map_) {
+                DataFilename(dir_, p.first, &buf_);
+                DataFilename(tmp, p.first, &name);
+                int fd = dup(p.second);
+                if (fd < 0) {
+                    return fail();
+                }
+                if (p.first != curr_id_ && link(buf_.c_str(), name.c_str()) == 0) {
+                    files.push_back({fd, "", 0});
+                    ++linked;
+                    continue;
+                }
+                uint64_t n = offset_;
+                if (p.first != curr_id_) { /* Another filesystem */
+                    if (fstat(fd, &st) != 0) {
+                        close(fd);
+                        return fail();
+                    }
+                    n = static_cast<uint64_t>(st.st_size);
+                }
+                files.push_back({fd, name, n});
+                copying += n;
+            }
+
+            IndexFilename(tmp, &name);
+            int fd = OpenFile(name, O_CREAT | O_WRONLY | O_TRUNC);
+            if (fd < 0) {
+                return fail();
+            }
+            if (FileClone(allocator_.GetFile()->GetFd(), fd) != 0) {
+                std::string reason = strerror(errno);
+                close(fd);
+                fail();
+                *err = "ERR Failed reflinking the index, CHECKPOINT needs a filesystem with reflinks (XFS, Btrfs): " +
+                       reason;
+                return false;
+            }
+            files.push_back({fd, "", 0});
+
+            CheckpointFilename(tmp, &name);
+            fd = OpenFile(name, O_CREAT | O_WRONLY | O_TRUNC);
+            if (fd < 0) {
+                return fail();
+            }
+            files.push_back({fd, "", 0});
+            buf_.clear();
+            AppendInfoField(&buf_, "data_file_current", curr_id_);
+            AppendInfoField(&buf_, "data_file_offset", offset_);
+            AppendInfoField(&buf_, "index_allocated_bytes", static_cast<long long>(allocator_.GetAllocatedSize()));
+            AppendInfoField(&buf_, "index_recycled_page", static_cast<long long>(allocator_.GetRecycledPage()));
+            AppendInfoField(&buf_, "index_free_pages", static_cast<long long>(allocator_.GetFreePageCount()));
+            AppendInfoField(&buf_, "keys", static_cast<long long>(keys_));
+            if (FileWrite(fd, buf_.data(), buf_.size()) != 0) {
+                return fail();
+            }
+            LIN_LOG_INFO("Checkpoint froze the node for %ld ms, %zu data files linked, %lu bytes to copy",
+                         static_cast<long>(GetCurrentTimeInMilliseconds() - begin), linked,
+                         static_cast<unsigned long>(copying));
+
+            checkpoint_begun_ = begin;
+            checkpoint_done_ = false;
+            checkpoint_ = std::thread([this, files = std::move(files), tmp, dir]() {
+                bool ok = true;
+                for (const auto & f:files) {
+                    if (ok && !f.name.empty()) {
+                        int out = OpenFile(f.name, O_CREAT | O_WRONLY | O_TRUNC);
+                        ok = out >= 0 &&
+                             FileCopy(f.fd, out, f.n) == 0 &&
+                             fsync(out) == 0;
+                        if (out >= 0) {
+                            close(out);
+                        }
+                    } else if (ok) {
+                        ok = fsync(f.fd) == 0;
+                    }
+                    if (f.fd >= 0) {
+                        close(f.fd);
+                    }
+                }
+                size_t slash = dir.find_last_of('/');
+                std::string parent = slash == std::string::npos ? "." : dir.substr(0, std::max<size_t>(slash, 1));
+                ok = ok && DirSync(tmp) == 0 && rename(tmp.c_str(), dir.c_str()) == 0 && DirSync(parent) == 0;
+                if (!ok) {
+                    LIN_LOG_ERROR("Failed checkpointing to %s. Error message: '%s'", dir.c_str(), strerror(errno));
+                }
+                checkpoint_ok_ = ok;
+                checkpoint_finished_ = GetCurrentTimeInMilliseconds();
+                checkpoint_done_.store(true, std::memory_order_release);
+            });
+            return true;
+        }
+
+        // Removes what a checkpoint of this node wrote to dir, and dir.
+        void RemoveCheckpoint(const std::string & dir) {
+            std::string name;
+            IndexFilename(dir, &name);
+            unlink(name.c_str());
+            CheckpointFilename(dir, &name);
+            unlink(name.c_str());
+            for (const auto & p:fd_map_) {
+                DataFilename(dir, p.first, &name);
+                unlink(name.c_str());
+            }
+            rmdir(dir.c_str());
+        }
+
+        void ReapCheckpoint() {
+            if (checkpoint_.joinable() && checkpoint_done_.load(std::memory_order_acquire)) {
+                checkpoint_.join();
+                last_checkpoint_ok_ = checkpoint_ok_;
+                if (last_checkpoint_ok_) {
+                    LIN_LOG_INFO("Checkpoint took %ld ms",
+                                 static_cast<long>(checkpoint_finished_ - checkpoint_begun_));
+                }
+            }
+        }
+
         void CreateFileIfNeed() {
             if (offset_ >= kMaxDataFileSize) {
+                FlushWrites(); /* Buffered records belong to the file being left */
 #if defined(__linux__)
                 if (SGT_LIKELY(curr_fd_ != -1)) {
                     auto a = GetCurrentTimeInMilliseconds();
@@ -369,25 +1871,81 @@ namespace cheapis {
         }
 
     private:
+        const size_t io_threads_; /* Of io_engine_, started on the first read */
         std::string dir_;
         std::string buf_;
-        std::string v_;
-        std::vector<uint32_t> batch_;
 
         Helper helper_;
         AllocatorImpl allocator_;
         SignatureTreeTpl<KVTrans> tree_;
 
-        std::deque<Task> tasks_;
+        FairQueue<Client *, Task> tasks_;
+        std::vector<Task> running_;
+        std::vector<std::pair<Client *, int>> held_;
+        std::vector<RecordRead> reads_;
+        std::vector<IoRequest *> waiting_;
+        std::unique_ptr<IoEngine> io_engine_;
+
+        ScanCursors cursors_;
+        std::string scan_key_;
+        std::string scan_buf_;
+        std::string scan_spill_;
+        std::vector<uint64_t> scan_reps_;
+        std::vector<size_t> scan_order_;
+        std::vector<std::string> scan_keys_;
+        std::vector<std::string> scan_values_;
+        std::vector<char> scan_hashes_;
+        std::vector<Extent> scan_extents_;
+        std::vector<std::string_view> scan_matches_;
+
+        std::unordered_map<std::string, CachedCounter> counters_;
+        size_t dirty_counters_ = 0;
+        std::vector<std::pair<uint32_t, int>> counter_records_;
+        std::string counter_value_;
+        HashState hash_;
+        std::string hash_entries_;
+        std::string hash_record_;
+        std::set<std::string_view> hash_touched_;
+        std::vector<std::string> hash_values_;
+        std::vector<char> hash_found_;
+        std::string record_;
+        char number_[kNumberBufferSize];
         std::unordered_map<uint16_t, int> fd_map_;
+        std::map<uint16_t, DataFileStats> file_stats_;
+        size_t keys_ = 0;
+        uint64_t io_cycles_ = 0;
+
+        std::unique_ptr<BloomFilter> filter_; /* Null with bloom-bits-per-key 0 */
+        std::unique_ptr<BloomFilter> next_filter_;
+        std::string filter_key_;              /* Where the rebuild of next_filter_ resumes */
+        size_t filter_keys_ = 0;
+        size_t filter_negatives_ = 0;
+
+        std::thread checkpoint_;
+        std::atomic<bool> checkpoint_done_{false};
+        bool checkpoint_ok_ = false;
+        bool last_checkpoint_ok_ = true;
+        uint64_t checkpoint_begun_ = 0;
+        uint64_t checkpoint_finished_ = 0;
 
         int curr_fd_ = -1;
         int32_t curr_id_ = -1;
         uint32_t offset_ = UINT32_MAX;
 
+        std::string wbuf_; /* Records not yet written, from wbuf_offset_ of the active file */
+        uint32_t wbuf_offset_ = 0;
+        uint64_t wbuf_since_ = 0;
+
+        friend class Helper;
         friend class KVTrans;
+        friend class ExecutorShardImpl;
     };
 
+    void Helper::Del(KVTrans & trans) {
+        executor_->Retire(trans);
+        --executor_->keys_;
+    }
+
     bool KVTrans::operator==(const Slice & k) const {
         if (k_.size() != 0) {
             return k_ == k;
@@ -427,6 +1985,20 @@ namespace cheapis {
         return k_;
     }
 
+    size_t KVTrans::Size() const {
+        if (k_.size() != 0) {
+            return sizeof(Header) + k_.size() + v_len_;
+        }
+
+        uint16_t length;
+        std::tie(std::ignore, length, std::ignore) = UnpackKVRep(rep_);
+
+        uint16_t k_len;
+        uint16_t v_len;
+        std::tie(k_len, v_len) = UnpackLength(length);
+        return sizeof(Header) + k_len + v_len;
+    }
+
     bool KVTrans::Get(const Slice & k, std::string * v) const {
         assert(k_.size() == 0);
         uint16_t id;
@@ -443,7 +2015,7 @@ namespace cheapis {
         buf.resize(sizeof(header) + k_len + v_len);
 
         int fd = executor_->fd_map_[id];
-        ssize_t nread = pread(fd, buf.data(), buf.size(), offset);
+        ssize_t nread = executor_->ReadAt(fd, buf.data(), buf.size(), offset);
         if (nread != static_cast<ssize_t>(buf.size())) {
             LIN_LOG_ERROR("Failed preading. Error message: '%s'", strerror(errno));
             exit(1);
@@ -451,19 +2023,21 @@ namespace cheapis {
 
         memcpy(&header, buf.data(), sizeof(header));
         size_t have = buf.size();
-        size_t need = sizeof(header) + header.k_len + header.v_len;
+        size_t need = sizeof(header) + header.KeySize() + header.v_len;
         assert(need >= have);
         size_t less = need - have;
         if (less > 0) {
             buf.resize(need);
 
-            nread = pread(fd, &buf[have], less, offset + have);
+            nread = executor_->ReadAt(fd, &buf[have], less, offset + have);
             if (nread != static_cast<ssize_t>(less)) {
                 LIN_LOG_ERROR("Failed preading. Error message: '%s'", strerror(errno));
                 exit(1);
             }
         }
-        const_cast<KVTrans *>(this)->k_ = {buf.data() + sizeof(header), header.k_len};
+        const_cast<KVTrans *>(this)->k_ = {buf.data() + sizeof(header), header.KeySize()};
+        const_cast<KVTrans *>(this)->v_len_ = header.v_len;
+        const_cast<KVTrans *>(this)->hash_ = header.IsHash();
 
         if (k_ == k) {
             if (v != nullptr) {
@@ -480,13 +2054,17 @@ namespace cheapis {
         buf.resize(sizeof(Header) + k_len);
 
         int fd = executor_->fd_map_[id];
-        ssize_t nread = pread(fd, buf.data(), buf.size(), offset);
+        ssize_t nread = executor_->ReadAt(fd, buf.data(), buf.size(), offset);
         if (nread != static_cast<ssize_t>(buf.size())) {
             LIN_LOG_ERROR("Failed preading. Error message: '%s'", strerror(errno));
             exit(1);
         }
 
-        memcpy(&k_len, buf.data(), sizeof(k_len));
+        Header header;
+        memcpy(&header, buf.data(), sizeof(header));
+        k_len = header.KeySize();
+        v_len_ = header.v_len;
+        hash_ = header.IsHash();
         size_t have = buf.size();
         size_t need = sizeof(Header) + k_len;
         assert(need >= have);
@@ -494,7 +2072,7 @@ namespace cheapis {
         if (less > 0) {
             buf.resize(need);
 
-            nread = pread(fd, &buf[have], less, offset + have);
+            nread = executor_->ReadAt(fd, &buf[have], less, offset + have);
             if (nread != static_cast<ssize_t>(less)) {
                 LIN_LOG_ERROR("Failed preading. Error message: '%s'", strerror(errno));
                 exit(1);
@@ -503,15 +2081,578 @@ namespace cheapis {
         k_ = {buf.data() + sizeof(Header), k_len};
     }
 
-    std::unique_ptr<Executor>
-    OpenExecutorDisk(const std::string & name) {
+    // Keys partitioned by hash across disk executors, one per directory, each
+    // with its own index and data files. A batch runs in waves in which a
+    // client has tasks in one shard at most, so its replies keep their order
+    // however the shards interleave. INFO, SCAN, KEYS, RANGE, PREFIX and
+    // CHECKPOINT span the shards, the other keyless commands go to the first.
+    class ExecutorShardImpl final : public Executor {
+    private:
+        using Task = ExecutorDiskImpl::Task;
+
+        static constexpr size_t kSpanRoute = SIZE_MAX - 2;
+        static constexpr size_t kGlobalRoute = SIZE_MAX - 1;
+
+        struct Routed {
+            Task task;
+            size_t route; /* A shard, kSpanRoute or kGlobalRoute */
+        };
+
+        // A client's route in the batch so far and the wave it runs in.
+        struct Owner {
+            size_t route;
+            size_t wave;
+        };
+
+        // A shard's place in a merged RANGE, its batch in its scan_keys_.
+        struct RangeHead {
+            ExecutorDiskImpl * shard;
+            size_t i;
+            size_t count;
+            size_t step;
+            bool more;
+        };
+
+    public:
+        ExecutorShardImpl(std::vector<std::unique_ptr<ExecutorDiskImpl>> && shards, bool threads)
+                : shards_(std::move(shards)) {
+            counts_.resize(shards_.size());
+            run_.resize(shards_.size());
+            if (threads) {
+                for (size_t s = 0; s < shards_.size(); ++s) {
+                    workers_.emplace_back([this, s]() { Work(s); });
+                }
+            }
+        }
+
+        ~ExecutorShardImpl() override {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            work_cv_.notify_all();
+            for (auto & worker:workers_) {
+                worker.join();
+            }
+        }
+
+        void Submit(const rocksdb::autovector<std::string_view> & argv,
+                    Client * c, int fd) override {
+            Routed & routed = tasks_.EmplaceBack(c);
+            Task & task = routed.task;
+            task.c = c;
+            task.fd = fd;
+            task.cmd = LookupCommand(argv);
+            task.submitted = GetCycles();
+            for (size_t i = 1; i < argv.size(); ++i) {
+                task.argv.emplace_back(argv[i]);
+            }
+            routed.route = Route(task);
+            if (routed.route < shards_.size()) {
+                shards_[routed.route]->Prefetch(task);
+            }
+        }
+
+        void Execute(size_t n, long curr_time, EventLoop<Client> * el) override {
+            batch_.clear();
+            tasks_.PopFront(n, &batch_);
+            /* A client's tasks run in waves, one run of them on a single route
+             * per wave, so its replies stay in order across the shards */
+            owners_.clear();
+            size_t waves = 0;
+            for (Routed & routed:batch_) {
+                auto[it, fresh] = owners_.emplace(routed.task.c, Owner{routed.route, 0});
+                Owner & owner = it->second;
+                if (!fresh && owner.route != routed.route) {
+                    owner.route = routed.route;
+                    ++owner.wave;
+                }
+                if (owner.wave == waves_.size()) {
+                    waves_.emplace_back();
+                }
+                waves_[owner.wave].emplace_back(std::move(routed));
+                waves = std::max(waves, owner.wave + 1);
+            }
+            for (size_t w = 0; w < waves; ++w) {
+                global_.clear();
+                span_.clear();
+                std::fill(counts_.begin(), counts_.end(), 0);
+                for (Routed & routed:waves_[w]) {
+                    if (routed.route == kSpanRoute) {
+                        span_.emplace_back(std::move(routed.task));
+                    } else if (routed.route == kGlobalRoute) {
+                        global_.emplace_back(std::move(routed.task));
+                    } else {
+                        shards_[routed.route]->Enqueue(std::move(routed.task));
+                        ++counts_[routed.route];
+                    }
+                }
+
+                RunShards();
+                for (size_t s = 0; s < shards_.size(); ++s) {
+                    if (counts_[s] != 0) {
+                        ExecutorDiskImpl::FinishTasks(&shards_[s]->running_, &held_, curr_time, el);
+                    }
+                }
+                if (!global_.empty()) {
+                    for (Task & task:global_) {
+                        shards_[0]->Enqueue(std::move(task));
+                    }
+                    shards_[0]->RunTasks(global_.size());
+                    ExecutorDiskImpl::FinishTasks(&shards_[0]->running_, &held_, curr_time, el);
+                }
+                if (!span_.empty()) {
+                    for (Task & task:span_) {
+                        RunSpanning(&task);
+                    }
+                    ExecutorDiskImpl::FinishTasks(&span_, &held_, curr_time, el);
+                }
+                waves_[w].clear();
+            }
+
+            // The shards flush together once one is due, a reply held may
+            // wait on writes to any of them.
+            bool due = false;
+            for (const auto & shard:shards_) {
+                due = due || shard->FlushDue();
+            }
+            if (due) {
+                for (auto & shard:shards_) {
+                    shard->FlushWrites();
+                }
+            }
+            if (!held_.empty() && std::all_of(shards_.cbegin(), shards_.cend(), [](const auto & shard) {
+                return shard->wbuf_.empty();
+            })) {
+                ExecutorDiskImpl::ReleaseHeld(&held_, curr_time, el);
+            }
+            for (auto & shard:shards_) {
+                shard->BuildFilter();
+            }
+        }
+
+        size_t GetTaskCount() const override {
+            return tasks_.Size();
+        }
+
+        long GetTimeout() const override {
+            long timeout = -1;
+            for (const auto & shard:shards_) {
+                long t = shard->GetTimeout();
+                if (t >= 0 && (timeout < 0 || t < timeout)) {
+                    timeout = t;
+                }
+            }
+            return timeout < 0 && !held_.empty() ? 0 : timeout;
+        }
+
+        void Cron(long curr_time) override {
+            for (auto & shard:shards_) {
+                shard->Cron(curr_time);
+            }
+        }
+
+        void GetInfo(const char * section, std::string * buf) const override {
+            if (strcmp(section, "server") == 0) {
+                AppendInfoField(buf, "executor", "disk");
+                AppendInfoField(buf, "shards", static_cast<long long>(shards_.size()));
+                AppendInfoField(buf, "shard_threads", !workers_.empty());
+                for (size_t s = 0; s < shards_.size(); ++s) {
+                    std::string name = "shard" + std::to_string(s) + "_dir";
+                    AppendInfoField(buf, name.c_str(), shards_[s]->dir_);
+                }
+            } else if (strcmp(section, "replication") == 0) {
+                shards_[0]->GetInfo(section, buf);
+            } else if (strcmp(section, "keyspace") == 0) {
+                size_t keys = 0;
+                for (const auto & shard:shards_) {
+                    keys += shard->keys_;
+                }
+                if (keys != 0) {
+                    AppendInfoField(buf, "db0", "keys=" + std::to_string(keys));
+                }
+            } else { /* Each shard's own fields, prefixed with shard<n>_ */
+                std::string fields;
+                for (size_t s = 0; s < shards_.size(); ++s) {
+                    fields.clear();
+                    shards_[s]->GetInfo(section, &fields);
+                    std::string prefix = "shard" + std::to_string(s) + "_";
+                    size_t pos = 0;
+                    size_t eol;
+                    while ((eol = fields.find("\r\n", pos)) != std::string::npos) {
+                        buf->append(prefix);
+                        buf->append(fields, pos, eol + 2 - pos);
+                        pos = eol + 2;
+                    }
+                }
+            }
+        }
+
+    private:
+        size_t Route(const Task & task) const {
+            switch (task.cmd) {
+                case kGet:
+                case kSet:
+                case kDel:
+                case kIncr:
+                case kIncrBy:
+                case kDecr:
+                case kDecrBy:
+                case kIncrByFloat:
+                case kHSet:
+                case kHGet:
+                case kHMGet:
+                case kHGetAll:
+                case kHDel: {
+                    const auto & k = task.argv[0];
+                    return Crc32c(0, k.data(), k.size()) % shards_.size();
+                }
+
+                case kInfo:
+                case kScan:
+                case kKeys:
+                case kRange:
+                case kPrefix:
+                case kCheckpoint: {
+                    return kSpanRoute;
+                }
+
+                default: {
+                    return kGlobalRoute;
+                }
+            }
+        }
+
+        // Runs the tasks of the wave on every shard that has some, in
+        // parallel with threads. The loop thread takes the first shard.
+        void RunShards() {
+            size_t first = shards_.size();
+            size_t busy = 0;
+            for (size_t s = 0; s < shards_.size(); ++s) {
+                if (counts_[s] != 0) {
+                    first = std::min(first, s);
+                    busy += s != first;
+                }
+            }
+            if (workers_.empty() || busy == 0) {
+                for (size_t s = 0; s < shards_.size(); ++s) {
+                    if (counts_[s] != 0) {
+                        shards_[s]->RunTasks(counts_[s]);
+                    }
+                }
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (size_t s = 0; s < shards_.size(); ++s) {
+                    run_[s] = s != first ? counts_[s] : 0;
+                }
+                busy_ = busy;
+                ++generation_;
+            }
+            work_cv_.notify_all();
+            shards_[first]->RunTasks(counts_[first]);
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_cv_.wait(lock, [this]() { return busy_ == 0; });
+        }
+
+        void Work(size_t s) {
+            uint64_t seen = 0;
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true) {
+                work_cv_.wait(lock, [this, &seen]() { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+                size_t n = run_[s];
+                if (n == 0) {
+                    continue;
+                }
+                lock.unlock();
+                shards_[s]->RunTasks(n);
+                lock.lock();
+                if (--busy_ == 0) {
+                    done_cv_.notify_one();
+                }
+            }
+        }
+
+        // Runs a command spanning the shards, like RunTasks does one of a
+        // shard's own.
+        void RunSpanning(Task * task) {
+            Client * c = task->c;
+            if (c->close) {
+                return;
+            }
+            task->blocked = !c->output.empty();
+            size_t replied = c->output.size();
+            task->begun = GetCycles();
+            for (auto & shard:shards_) {
+                shard->io_cycles_ = 0;
+            }
+            ++GetStats()->calls[task->cmd];
+            auto & argv = task->argv;
+            switch (task->cmd) {
+                case kInfo: {
+                    for (auto & shard:shards_) {
+                        Settle(shard.get());
+                    }
+                    std::string info;
+                    GenerateInfo(!argv.empty() ? argv[0] : "", *this, &info);
+                    RespMachine::AppendBulkString(&c->output, info);
+                    break;
+                }
+
+                case kScan: {
+                    ScanArgs args;
+                    if (!ParseScanArgs(argv, 0, &args, &c->output)) {
+                        break;
+                    }
+                    if (!cursors_.Resume(args.cursor, &scan_key_)) {
+                        RespMachine::AppendError(&c->output, "ERR invalid cursor");
+                        break;
+                    }
+                    /* The shard in the first byte, then the key it resumes from */
+                    size_t s = scan_key_.empty() ? 0 : static_cast<unsigned char>(scan_key_[0]);
+                    ExecutorDiskImpl * shard = shards_[s].get();
+                    Settle(shard);
+                    shard->scan_key_.assign(scan_key_, std::min<size_t>(scan_key_.size(), 1));
+                    uint64_t cursor = 0;
+                    if (shard->ScanKeys(args.count, args.pattern)) {
+                        scan_key_.assign(1, static_cast<char>(s));
+                        scan_key_.append(shard->scan_key_);
+                        cursor = cursors_.Suspend(task->fd, scan_key_);
+                    } else if (s + 1 < shards_.size()) {
+                        scan_key_.assign(1, static_cast<char>(s + 1));
+                        cursor = cursors_.Suspend(task->fd, scan_key_);
+                    }
+                    AppendScanReply(&c->output, cursor, shard->scan_matches_);
+                    break;
+                }
+
+                case kKeys: {
+                    std::string_view pattern = argv[0] != "*" ? argv[0] : std::string_view();
+                    size_t total = 0;
+                    buf_.clear();
+                    for (auto & shard:shards_) {
+                        Settle(shard.get());
+                        shard->scan_key_.clear();
+                        bool more;
+                        do {
+                            more = shard->ScanKeys(kKeysBatch, pattern);
+                            total += shard->scan_matches_.size();
+                            for (const auto & key:shard->scan_matches_) {
+                                RespMachine::AppendBulkString(&buf_, key);
+                            }
+                        } while (more);
+                    }
+                    RespMachine::AppendArrayLength(&c->output, total);
+                    c->output.append(buf_);
+                    break;
+                }
+
+                case kRange:
+                case kPrefix: {
+                    RangeArgs args;
+                    if (!ParseRangeArgs(argv, 0, task->cmd == kPrefix, &args, &c->output)) {
+                        break;
+                    }
+                    size_t n = ReadRange(args);
+                    RespMachine::AppendArrayLength(&c->output, n * 2);
+                    c->output.append(buf_);
+                    break;
+                }
+
+                case kCheckpoint: {
+                    bool busy = false;
+                    for (auto & shard:shards_) {
+                        shard->ReapCheckpoint();
+                        busy = busy || shard->checkpoint_.joinable();
+                    }
+                    if (busy) {
+                        RespMachine::AppendError(&c->output, "ERR Checkpoint already in progress");
+                        break;
+                    }
+                    /* One checkpoint per shard, dir/<shard> */
+                    std::string dir = argv[0];
+                    while (dir.size() > 1 && dir.back() == '/') {
+                        dir.pop_back();
+                    }
+                    if (mkdir(dir.c_str(), 0755) != 0) {
+                        RespMachine::AppendError(&c->output, errno == EEXIST ? "ERR " + dir + " exists"
+                                                                             : "ERR Failed creating " + dir + ": " +
+                                                                               strerror(errno));
+                        break;
+                    }
+                    std::string err;
+                    size_t s = 0;
+                    for (; s < shards_.size(); ++s) {
+                        Settle(shards_[s].get());
+                        if (!shards_[s]->StartCheckpoint(dir + "/" + std::to_string(s), &err)) {
+                            break;
+                        }
+                    }
+                    if (s != shards_.size()) {
+                        /* No partial checkpoint left behind, a retry would find dir */
+                        for (size_t t = 0; t < s; ++t) {
+                            ExecutorDiskImpl * shard = shards_[t].get();
+                            shard->checkpoint_.join();
+                            shard->last_checkpoint_ok_ = false;
+                            shard->RemoveCheckpoint(dir + "/" + std::to_string(t));
+                            shard->RemoveCheckpoint(dir + "/" + std::to_string(t) + ".tmp");
+                        }
+                        shards_[s]->last_checkpoint_ok_ = false;
+                        rmdir(dir.c_str());
+                        RespMachine::AppendError(&c->output, err + " (shard " + std::to_string(s) + ", " +
+                                                             std::to_string(s) + " started shards undone)");
+                        break;
+                    }
+                    RespMachine::AppendSimpleString(&c->output, "Background checkpoint started");
+                    break;
+                }
+
+                default: {
+                    break;
+                }
+            }
+            task->io = 0;
+            for (auto & shard:shards_) {
+                task->io += shard->io_cycles_;
+            }
+            task->executed = GetCycles();
+            shards_[0]->Hold(task, replied, false);
+        }
+
+        // Writes back a shard's cached counters before its index is walked.
+        static void Settle(ExecutorDiskImpl * shard) {
+            if (shard->dirty_counters_ != 0) {
+                shard->CreateFileIfNeed();
+                shard->FlushCounters();
+            }
+        }
+
+        // The pairs of the range merged from every shard in key order into
+        // buf_, each shard visiting a batch at a time as ReadRange does.
+        // Returns the number of pairs.
+        size_t ReadRange(const RangeArgs & args) {
+            buf_.clear();
+            heads_.clear();
+            for (auto & shard:shards_) {
+                Settle(shard.get());
+                shard->scan_key_ = args.start;
+                heads_.push_back({shard.get(), 0, 0, kRangeFirstBatch, false});
+                FillRangeHead(&heads_.back(), args.limit);
+            }
+            size_t n = 0;
+            while (n < args.limit) {
+                RangeHead * min = nullptr;
+                for (auto & head:heads_) {
+                    if (head.i < head.count &&
+                        (min == nullptr || head.shard->scan_keys_[head.i] < min->shard->scan_keys_[min->i])) {
+                        min = &head;
+                    }
+                }
+                if (min == nullptr || !InRange(args, min->shard->scan_keys_[min->i])) {
+                    break;
+                }
+                ExecutorDiskImpl * shard = min->shard;
+                if (!shard->scan_hashes_[min->i]) {
+                    RespMachine::AppendBulkString(&buf_, shard->scan_keys_[min->i]);
+                    RespMachine::AppendBulkString(&buf_, shard->scan_values_[min->i]);
+                    ++n;
+                }
+                if (++min->i == min->count && min->more) {
+                    shard->scan_key_ = shard->scan_keys_[min->count];
+                    min->step = std::min(min->step * 2, kKeysBatch);
+                    FillRangeHead(min, args.limit - n);
+                }
+            }
+            return n;
+        }
+
+        static void FillRangeHead(RangeHead * head, size_t limit) {
+            size_t count = std::min(head->step, limit);
+            head->more = head->shard->VisitReps(count);
+            head->shard->LoadRecords(true);
+            head->count = std::min(count, head->shard->scan_reps_.size());
+            head->i = 0;
+        }
+
+    private:
+        std::vector<std::unique_ptr<ExecutorDiskImpl>> shards_;
+        FairQueue<Client *, Routed> tasks_;
+        std::vector<Routed> batch_;
+        std::vector<std::vector<Routed>> waves_;
+        std::unordered_map<Client *, Owner> owners_;
+        std::vector<Task> global_;
+        std::vector<Task> span_;
+        std::vector<size_t> counts_;
+        std::vector<std::pair<Client *, int>> held_;
+
+        ScanCursors cursors_;
+        std::string scan_key_;
+        std::string buf_;
+        std::vector<RangeHead> heads_;
+
+        std::vector<std::thread> workers_;
+        std::mutex mutex_;
+        std::condition_variable work_cv_;
+        std::condition_variable done_cv_;
+        std::vector<size_t> run_;
+        size_t busy_ = 0;
+        uint64_t generation_ = 0;
+        bool stop_ = false;
+    };
+
+    static std::unique_ptr<ExecutorDiskImpl>
+    OpenExecutorDiskImpl(const std::string & name, uint64_t reserve = kIndexReserveSize,
+                         size_t io_threads = GetConfig()->io_depth) {
         std::string index_filename;
         IndexFilename(name, &index_filename);
-        auto index_file = OpenMmapRWFile(index_filename, kPageSize);
+        const Config * config = GetConfig();
+        int flags = (config->index_hugepage ? kMmapHugePage : 0) |
+                    (config->index_populate ? kMmapPopulate : 0) |
+                    (config->index_mlock ? kMmapLock : 0);
+        auto index_file = OpenMmapRWFile(index_filename, kPageSize, reserve, flags);
         if (index_file == nullptr) {
             return nullptr;
         }
         index_file->Hint(kRandom);
-        return std::make_unique<ExecutorDiskImpl>(name, std::move(index_file));
+        return std::make_unique<ExecutorDiskImpl>(name, std::move(index_file), io_threads);
+    }
+
+    std::unique_ptr<Executor>
+    OpenExecutorDisk(const std::string & name) {
+        return OpenExecutorDiskImpl(name);
+    }
+
+    std::unique_ptr<Executor>
+    OpenExecutorDisk(const std::vector<std::string> & names) {
+        if (names.size() == 1) {
+            return OpenExecutorDisk(names[0]);
+        }
+        if (names.size() > kMaxShards) {
+            LIN_LOG_ERROR("Expected at most %zu directories", kMaxShards);
+            return nullptr;
+        }
+        std::vector<std::unique_ptr<ExecutorDiskImpl>> shards;
+        for (const auto & name:names) {
+            if (std::count(names.cbegin(), names.cend(), name) > 1) {
+                LIN_LOG_ERROR("Directory %s given twice", name.c_str());
+                return nullptr;
+            }
+            /* Each shard's index and reads are capped so they fit the address space and thread count together */
+            auto shard = OpenExecutorDiskImpl(name, kIndexReserveSize / names.size() / kIndexReserveAlign *
+                                                    kIndexReserveAlign,
+                                              std::max<size_t>(1, std::min<size_t>(GetConfig()->io_depth,
+                                                                                   kMaxIoThreads / names.size())));
+            if (shard == nullptr) {
+                return nullptr;
+            }
+            shards.emplace_back(std::move(shard));
+        }
+        return std::make_unique<ExecutorShardImpl>(std::move(shards), GetConfig()->shard_threads);
     }
-}
\ No newline at end of file
+}
@@ -16,6 +16,13 @@ namespace cheapis {
         name->assign(dir);
         name->append("/cheapis-dakv.index");
     }
+
+    // What a checkpoint needs besides its files: the active data file, where
+    // it ends and the allocator of the index.
+    inline void CheckpointFilename(const std::string & dir, std::string * name) {
+        name->assign(dir);
+        name->append("/cheapis-dakv.checkpoint");
+    }
 }
 
 #endif //CHEAPIS_FILENAME_H
\ No newline at end of file
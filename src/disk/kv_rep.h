@@ -0,0 +1,58 @@
+#pragma once
+#ifndef CHEAPIS_KV_REP_H
+#define CHEAPIS_KV_REP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+
+#define UINT5_MAX  ((1 << 5) - 1)
+#define UINT11_MAX ((1 << 11) - 1)
+
+namespace cheapis {
+    // A rep is what the index stores per key: data file id (16 bits), key
+    // and value lengths saturated to 5 and 11 bits, and the record's offset
+    // (32 bits). The header of the record has the exact lengths.
+    static inline uint16_t
+    PackKVLength(size_t k_len, size_t v_len) {
+        return static_cast<uint16_t>((std::min<size_t>(k_len, UINT5_MAX) << 11) |
+                                     (std::min<size_t>(v_len, UINT11_MAX)));
+    }
+
+    static inline std::pair<uint16_t, uint16_t>
+    UnpackLength(uint16_t len) {
+        return {len >> 11, len & UINT11_MAX};
+    }
+
+    static inline uint64_t
+    PackIDLengthAndOffset(uint16_t id, uint16_t len, uint32_t off) {
+        return (static_cast<uint64_t>(id) << (16 + 32)) |
+               (static_cast<uint64_t>(len) << 32) |
+               (static_cast<uint64_t>(off));
+    }
+
+    static inline std::tuple<uint16_t, uint16_t, uint32_t>
+    UnpackKVRep(uint64_t rep) {
+        return {(rep >> (16 + 32)),
+                (rep >> 32) & UINT16_MAX,
+                (rep & UINT32_MAX)};
+    }
+
+    // The top bit of k_len marks a hash record, so keys are shorter than
+    // 32 KB.
+    constexpr uint16_t kHashRecordFlag = 1 << 15;
+    constexpr size_t kMaxKeySize = kHashRecordFlag - 1;
+    constexpr size_t kMaxValueSize = UINT16_MAX;
+
+    struct Header {
+        uint16_t k_len;
+        uint16_t v_len;
+
+        uint16_t KeySize() const { return k_len & ~kHashRecordFlag; }
+
+        bool IsHash() const { return (k_len & kHashRecordFlag) != 0; }
+    };
+}
+
+#endif //CHEAPIS_KV_REP_H
@@ -1,9 +1,19 @@
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
 #include "env.h"
 #include "log.h"
 
@@ -15,9 +25,20 @@
 #define posix_fadvise(fd, offset, len, advice) 0
 #endif
 
+#if !defined(MAP_NORESERVE)
+#define MAP_NORESERVE 0
+#endif
+#if !defined(MAP_POPULATE)
+#define MAP_POPULATE 0
+#endif
+
 #define PERM_rw_r__r__ 0644
 
 namespace cheapis {
+    constexpr uint64_t kHugePageSize = 2097152;
+    constexpr uint64_t kPageInChunk = 67108864;
+    constexpr uint64_t kCopyChunk = 1048576;
+
     int OpenFile(const std::string & name, int flags) {
         return open(name.c_str(), flags, PERM_rw_r__r__);
     }
@@ -64,6 +85,36 @@ namespace cheapis {
         return r;
     }
 
+    ssize_t FileReadNoWait(int fd, void * buf, size_t n, uint64_t offset) {
+#if defined(__linux__) && defined(RWF_NOWAIT)
+        struct iovec iov = {buf, n};
+        ssize_t r = preadv2(fd, &iov, 1, static_cast<off_t>(offset), RWF_NOWAIT);
+        if (r < 0 && errno == EOPNOTSUPP) {
+            errno = EAGAIN;
+        }
+        return r;
+#else
+        errno = EAGAIN;
+        return -1;
+#endif
+    }
+
+    int FileWrite(int fd, const void * buf, size_t n) {
+        auto p = static_cast<const char *>(buf);
+        while (n > 0) {
+            ssize_t nwrite = write(fd, p, n);
+            if (nwrite < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            p += nwrite;
+            n -= nwrite;
+        }
+        return 0;
+    }
+
     int FileRangeSync(int fd, uint64_t offset, uint64_t n) {
         int r = 0;
 #if defined(__linux__)
@@ -73,38 +124,237 @@ namespace cheapis {
         return r;
     }
 
+    int FileCopy(int in_fd, int out_fd, uint64_t n) {
+        uint64_t done = 0;
+#if defined(__linux__)
+        while (done < n) {
+            auto in_offset = static_cast<loff_t>(done);
+            auto out_offset = static_cast<loff_t>(done);
+            ssize_t ncopy = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, n - done, 0);
+            if (ncopy < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ncopy <= 0) { /* Across filesystems on older kernels, fall back to reading */
+                break;
+            }
+            done += ncopy;
+        }
+#endif
+        std::string buf(std::min<uint64_t>(n - done, kCopyChunk), '\0');
+        while (done < n) {
+            ssize_t nread = pread(in_fd, &buf[0], std::min<uint64_t>(n - done, buf.size()),
+                                  static_cast<off_t>(done));
+            if (nread < 0 && errno == EINTR) {
+                continue;
+            }
+            if (nread <= 0) {
+                if (nread == 0) {
+                    errno = EIO;
+                }
+                return -1;
+            }
+            for (ssize_t written = 0; written < nread;) {
+                ssize_t nwrite = pwrite(out_fd, buf.data() + written, nread - written,
+                                        static_cast<off_t>(done + written));
+                if (nwrite < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return -1;
+                }
+                written += nwrite;
+            }
+            done += nread;
+        }
+        return 0;
+    }
+
+    int FileClone(int in_fd, int out_fd) {
+#if defined(FICLONE)
+        return ioctl(out_fd, FICLONE, in_fd);
+#else
+        (void) in_fd;
+        (void) out_fd;
+        errno = EOPNOTSUPP;
+        return -1;
+#endif
+    }
+
+    int DirSync(const std::string & name) {
+        int fd = open(name.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) {
+            return -1;
+        }
+        int r = fsync(fd);
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return r;
+    }
+
+    int FileEvict(int fd) {
+        int r = fsync(fd);
+#if defined(__linux__)
+        if (r == 0) {
+            r = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+#endif
+        return r;
+    }
+
+    double GetCyclesPerMicrosecond() {
+        static const double cycles_per_us = [] {
+#if defined(__x86_64__) || defined(__i386__)
+            auto a = std::chrono::steady_clock::now();
+            uint64_t begin = GetCycles();
+            usleep(20000);
+            uint64_t end = GetCycles();
+            auto b = std::chrono::steady_clock::now();
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(b - a).count();
+            return static_cast<double>(end - begin) / std::max<long long>(us, 1);
+#else
+            return 1000.0;
+#endif
+        }();
+        return cycles_per_us;
+    }
+
+    uint64_t GetRSS() {
+#if defined(__linux__)
+        FILE * fp = fopen("/proc/self/statm", "r");
+        if (fp == nullptr) {
+            return 0;
+        }
+        unsigned long long size, resident;
+        int n = fscanf(fp, "%llu %llu", &size, &resident);
+        fclose(fp);
+        return n == 2 ? resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+#else
+        struct rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_maxrss); /* Peak, in bytes on macOS */
+#endif
+    }
+
     MmapRWFile::~MmapRWFile() {
-        munmap(base_, len_);
+        if (pager_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_paging_ = true;
+            }
+            cv_.notify_one();
+            pager_.join();
+        }
+        munmap(base_, reserve_);
         close(fd_);
     }
 
     int MmapRWFile::Resize(uint64_t n) {
-        int r = FileAllocate(fd_, n);
-        if (r != 0) {
-            LIN_LOG_ERROR("Failed resizing the MmapRWFile. Error message: '%s'",
-                          strerror(errno));
+        if (n <= len_) {
+            return 0;
+        }
+        if (n > reserve_) {
+            LIN_LOG_ERROR("Failed resizing the MmapRWFile. %lu bytes exceed the %lu reserved",
+                          static_cast<unsigned long>(n), static_cast<unsigned long>(reserve_));
             return -1;
         }
+
+        int r;
 #if !defined(__linux__)
-        if (munmap(base_, len_) != 0) {
+        r = ftruncate(fd_, static_cast<off_t>(n));
+#else
+        r = posix_fallocate(fd_, static_cast<off_t>(len_), static_cast<off_t>(n - len_));
+#endif
+        if (r != 0) {
             LIN_LOG_ERROR("Failed resizing the MmapRWFile. Error message: '%s'",
-                          strerror(errno));
+                          strerror(r > 0 ? r : errno));
             return -1;
         }
-        base_ = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
-#else
-        base_ = mremap(base_, len_, n, MREMAP_MAYMOVE);
-#endif
-        if (base_ == MAP_FAILED) {
+        void * extent = reinterpret_cast<char *>(base_) + len_;
+        if (mmap(extent, n - len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                 fd_, static_cast<off_t>(len_)) == MAP_FAILED) {
             LIN_LOG_ERROR("Failed resizing the MmapRWFile. Error message: '%s'",
                           strerror(errno));
             return -1;
         }
+#if defined(MADV_HUGEPAGE)
+        if ((flags_ & kMmapHugePage) && madvise(extent, n - len_, MADV_HUGEPAGE) != 0) {
+            LIN_LOG_WARN("Failed advising huge pages. Error message: '%s'", strerror(errno));
+        }
+#endif
+        if (flags_ & (kMmapPopulate | kMmapLock)) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                extents_.emplace_back(len_, n - len_);
+                if (!pager_.joinable()) {
+                    pager_ = std::thread(&MmapRWFile::RunPager, this);
+                }
+            }
+            cv_.notify_one();
+        }
         len_ = n;
-        return 0;
+        return Hint(pattern_); // new extents are separate mappings
+    }
+
+    // Faults an extent in a chunk at a time, locking it with kMmapLock,
+    // stopping early when the file closes.
+    void MmapRWFile::PageIn(uint64_t offset, uint64_t n) {
+        for (uint64_t end = offset + n; offset < end; offset += kPageInChunk) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stop_paging_) {
+                    return;
+                }
+            }
+            uint64_t len = std::min(kPageInChunk, end - offset);
+            void * chunk = reinterpret_cast<char *>(base_) + offset;
+            if (flags_ & kMmapLock) {
+                if (mlock(chunk, len) != 0) { /* Faults the pages in too */
+                    LIN_LOG_WARN("Failed locking %lu bytes, check RLIMIT_MEMLOCK. Error message: '%s'",
+                                 static_cast<unsigned long>(len), strerror(errno));
+                }
+                continue;
+            }
+#if defined(MADV_POPULATE_WRITE)
+            if (madvise(chunk, len, MADV_POPULATE_WRITE) == 0) {
+                continue;
+            }
+#endif
+            FilePrefetch(fd_, offset, len);
+            posix_madvise(chunk, len, POSIX_MADV_WILLNEED);
+        }
+    }
+
+    void MmapRWFile::RunPager() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]() { return stop_paging_ || !extents_.empty(); });
+            if (stop_paging_) {
+                return;
+            }
+            auto [offset, n] = extents_.front();
+            extents_.pop_front();
+            lock.unlock();
+            PageIn(offset, n);
+            lock.lock();
+        }
+    }
+
+    void MmapRWFile::ApplyFlags(uint64_t offset, uint64_t n) {
+        void * extent = reinterpret_cast<char *>(base_) + offset;
+#if defined(MADV_HUGEPAGE)
+        if ((flags_ & kMmapHugePage) && madvise(extent, n, MADV_HUGEPAGE) != 0) {
+            LIN_LOG_WARN("Failed advising huge pages. Error message: '%s'", strerror(errno));
+        }
+#endif
+        if ((flags_ & kMmapLock) && mlock(extent, n) != 0) {
+            LIN_LOG_WARN("Failed locking %lu bytes, check RLIMIT_MEMLOCK. Error message: '%s'",
+                         static_cast<unsigned long>(n), strerror(errno));
+        }
     }
 
     int MmapRWFile::Hint(AccessPattern pattern) {
+        pattern_ = pattern;
         int r = 0;
         switch (pattern) {
             case kNormal:
@@ -121,7 +371,7 @@ namespace cheapis {
     }
 
     std::unique_ptr<MmapRWFile>
-    OpenMmapRWFile(const std::string & name, uint64_t n) {
+    OpenMmapRWFile(const std::string & name, uint64_t n, uint64_t reserve, int flags) {
         int fd = OpenFile(name, O_CREAT | O_RDWR);
         if (fd < 0) {
             LIN_LOG_ERROR("Failed opening the MmapRWFile. Error message: '%s'",
@@ -134,12 +384,34 @@ namespace cheapis {
                           strerror(errno));
             return nullptr;
         }
-        void * base = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-        if (base == MAP_FAILED) {
+        /* Huge page aligned, so extents can be backed by huge pages */
+        reserve = std::max(reserve, n);
+        void * area = mmap(nullptr, reserve + kHugePageSize, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+        if (area == MAP_FAILED) {
+            close(fd);
+            LIN_LOG_ERROR("Failed reserving %lu bytes for the MmapRWFile. Error message: '%s'",
+                          static_cast<unsigned long>(reserve), strerror(errno));
+            return nullptr;
+        }
+        auto begin = reinterpret_cast<uintptr_t>(area);
+        uintptr_t aligned = (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        if (aligned != begin) {
+            munmap(area, aligned - begin);
+        }
+        munmap(reinterpret_cast<void *>(aligned + reserve), begin + kHugePageSize - aligned);
+        void * base = reinterpret_cast<void *>(aligned);
+
+        int populate = (flags & kMmapPopulate) ? MAP_POPULATE : 0;
+        if (mmap(base, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | populate, fd, 0) == MAP_FAILED) {
+            munmap(base, reserve);
+            close(fd);
             LIN_LOG_ERROR("Failed opening the MmapRWFile. Error message: '%s'",
                           strerror(errno));
             return nullptr;
         }
-        return std::make_unique<MmapRWFile>(base, n, fd);
+        auto file = std::make_unique<MmapRWFile>(base, n, reserve, fd, flags);
+        file->ApplyFlags(0, n);
+        return file;
     }
 }
\ No newline at end of file
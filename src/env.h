@@ -2,9 +2,21 @@
 #ifndef CHEAPIS_ENV_H
 #define CHEAPIS_ENV_H
 
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <sys/time.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 namespace cheapis {
     inline time_t GetCurrentTimeInSeconds() {
@@ -19,6 +31,27 @@ namespace cheapis {
         return tv.tv_sec * 1000 + tv.tv_usec / 1000;
     }
 
+    inline uint64_t GetCurrentTimeInMicroseconds() {
+        struct timeval tv;
+        gettimeofday(&tv, nullptr);
+        return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+    }
+
+    // Cheap clock for latency measurement: the TSC on x86, nanoseconds
+    // elsewhere. Only differences are meaningful.
+    inline uint64_t GetCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+    }
+
+    // Calibrated once, the first call takes a few milliseconds.
+    double GetCyclesPerMicrosecond();
+
     enum AccessPattern {
         kNormal,
         kSequential,
@@ -33,32 +66,96 @@ namespace cheapis {
 
     int FileHint(int fd, AccessPattern pattern);
 
+    // pread that only copies what is already in the page cache: -1 with errno
+    // EAGAIN instead of waiting on the device, and always so where the OS
+    // can't tell. May read less than asked.
+    ssize_t FileReadNoWait(int fd, void * buf, size_t n, uint64_t offset);
+
+    // Writes all of buf, retrying short and interrupted writes. 0, or -1
+    // with errno set.
+    int FileWrite(int fd, const void * buf, size_t n);
+
     int FileRangeSync(int fd, uint64_t offset, uint64_t n);
 
+    // Copies the first n bytes of in_fd to the start of out_fd, in the kernel
+    // where it can (a reflink on filesystems that share extents). Neither
+    // file offset moves. 0, or -1 with errno set.
+    int FileCopy(int in_fd, int out_fd, uint64_t n);
+
+    // Makes out_fd share all of in_fd's extents, a metadata only copy on
+    // filesystems with reflinks. 0, or -1 with errno set where it can't.
+    int FileClone(int in_fd, int out_fd);
+
+    // fsync of a directory, so the entries created in it are durable.
+    int DirSync(const std::string & name);
+
+    // Writes the file back and drops it from the page cache where the OS
+    // allows, so following reads go to the device.
+    int FileEvict(int fd);
+
+    // Resident set size in bytes, 0 if unknown.
+    uint64_t GetRSS();
+
+    enum MmapFlags {
+        kMmapHugePage = 1 << 0, /* MADV_HUGEPAGE, effective on tmpfs or with file THP */
+        kMmapPopulate = 1 << 1, /* Prefault extents as they are mapped */
+        kMmapLock = 1 << 2,     /* mlock extents as they are mapped */
+    };
+
+    // The file is mapped at the start of a reserved (PROT_NONE) virtual
+    // range and grows into it extent by extent, so Base() never moves.
     class MmapRWFile {
     public:
-        MmapRWFile(void * base, uint64_t len, int fd)
-                : base_(base), len_(len), fd_(fd) {}
+        MmapRWFile(void * base, uint64_t len, uint64_t reserve, int fd, int flags = 0)
+                : base_(base), len_(len), reserve_(reserve), fd_(fd), flags_(flags) {}
 
         ~MmapRWFile();
 
     public:
+        // Only grows, up to the reserved size. With kMmapPopulate or kMmapLock
+        // the new extent is faulted in and locked by a pager thread, so a
+        // large extent doesn't stall the caller.
         int Resize(uint64_t n);
 
         int Hint(AccessPattern pattern);
 
         void * Base() { return base_; }
 
+        const void * Base() const { return base_; }
+
         uint64_t GetFileSize() const { return len_; }
 
+        uint64_t GetReserveSize() const { return reserve_; }
+
+        int GetFd() const { return fd_; }
+
     private:
         void * base_;
         uint64_t len_;
+        uint64_t reserve_;
         int fd_;
+        int flags_;
+        AccessPattern pattern_ = kNormal;
+
+        std::thread pager_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<std::pair<uint64_t, uint64_t>> extents_; /* Offset and length, waiting for the pager */
+        bool stop_paging_ = false;
+
+        friend std::unique_ptr<MmapRWFile>
+        OpenMmapRWFile(const std::string & name, uint64_t n, uint64_t reserve, int flags);
+
+    private:
+        void ApplyFlags(uint64_t offset, uint64_t n);
+
+        void PageIn(uint64_t offset, uint64_t n);
+
+        void RunPager();
     };
 
     std::unique_ptr<MmapRWFile>
-    OpenMmapRWFile(const std::string & name, uint64_t n);
+    OpenMmapRWFile(const std::string & name, uint64_t n, uint64_t reserve = 0, int flags = 0);
 }
 
 #endif //CHEAPIS_ENV_H
\ No newline at end of file
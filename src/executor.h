@@ -5,6 +5,7 @@
 #include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "autovector.h"
 #include "server.h"
@@ -23,13 +24,34 @@ namespace cheapis {
         virtual void Execute(size_t n, long curr_time, EventLoop<Client> * el) = 0;
 
         virtual size_t GetTaskCount() const = 0;
+
+        // Microseconds until there is work due without a task, such as
+        // buffered writes to flush, -1 if none.
+        virtual long GetTimeout() const { return -1; }
+
+        // Background work, called by the server cron about once a second.
+        virtual void Cron(long curr_time) = 0;
+
+        // Appends the executor's own fields of an INFO section.
+        virtual void GetInfo(const char * section, std::string * buf) const = 0;
+
+        // Takes what a master sends ahead of its write stream on a syncing
+        // link, until it clears c->syncing. Returns the bytes of input used.
+        virtual size_t Sync(Client * c, const std::string & input, long curr_time) { return input.size(); }
     };
 
+    // Loads the AOF if given, otherwise the snapshot file if there is one.
+    // Null if it is unreadable.
     std::unique_ptr<Executor>
-    OpenExecutorMem();
+    OpenExecutorMem(const std::string & snapshot = "", const std::string & aof = "");
 
     std::unique_ptr<Executor>
     OpenExecutorDisk(const std::string & name);
+
+    // One shard per directory, keys partitioned by hash, a plain disk
+    // executor for one directory. Null if any of them fails to open.
+    std::unique_ptr<Executor>
+    OpenExecutorDisk(const std::vector<std::string> & names);
 }
 
 #endif //CHEAPIS_EXECUTOR_H
\ No newline at end of file
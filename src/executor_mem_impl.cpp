@@ -1,36 +1,184 @@
-#include <deque>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
 #include <map>
+#include <memory>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
 
+#include "anet.h"
+#include "config.h"
+#include "env.h"
 #include "executor.h"
+#include "fair_queue.h"
+#include "hash.h"
+#include "incr.h"
+#include "log.h"
+#include "replication.h"
+#include "scan.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "util.h"
 
 namespace cheapis {
+    constexpr size_t kAofReadSize = 8 << 20;
+    constexpr size_t kAofWriteSize = 1 << 20;
+    constexpr size_t kAofRewriteItems = 64;             /* Fields per HSET */
+    constexpr uint64_t kAofRewriteMinSize = 64 << 20;   /* Rewritten past this once doubled since the last rewrite */
+    constexpr long kReplTimeout = 60;                   /* Seconds a link may stay silent */
+    constexpr long kReplPingInterval = 10;
+    constexpr const char * kChildNames[] = {"", "saving", "AOF rewrite", "full sync"};
+    constexpr const char * kReplicaStateNames[] = {"wait_bgsave", "send_bulk", "send_bulk", "online"};
+
     class ExecutorMemImpl final : public Executor {
     private:
         struct Task {
             rocksdb::autovector<std::string> argv;
             Client * c;
             int fd;
+            Command cmd;
+            uint64_t submitted;
+        };
+
+        enum ChildType {
+            kNoChild,
+            kSnapshotChild,
+            kRewriteChild,
+            kSyncChild,
+        };
+
+        enum ReplicaState {
+            kReplicaWaitSync, /* For the next full sync child */
+            kReplicaSyncing,  /* A child is sending it the snapshot */
+            kReplicaReady,    /* Sent, the stream since waits in pending */
+            kReplicaOnline,
+        };
+
+        // A replica of this node, its client held by a reference.
+        struct Replica {
+            Client * c;
+            int fd;
+            ReplicaState state;
+            std::string pending;
+            uint64_t ack_offset;
+            long ack_time;
+            bool drop;
+        };
+
+        // The link of this node to its master.
+        enum LinkState {
+            kLinkNone,      /* A master */
+            kLinkConnect,   /* Connecting once the retry is due */
+            kLinkHandshake, /* PSYNC sent */
+            kLinkTransfer,  /* Receiving the snapshot */
+            kLinkConnected, /* Applying the write stream */
+        };
+
+        enum ValueType {
+            kStringValue,
+            kIntegerValue,
+            kHashValue,
+        };
+
+        // Counters are kept as integers once INCR and friends touch them, so
+        // an increment neither parses nor formats. A small hash is a listpack
+        // in s, a larger one a map of its own.
+        struct Value {
+            std::string s;
+            long long ll = 0;
+            ValueType type = kStringValue;
+            std::unique_ptr<std::unordered_map<std::string, std::string>> dict;
+
+            std::string_view View(char * buf) const {
+                return type == kIntegerValue ? std::string_view(buf, ll2string(buf, kNumberBufferSize, ll)) : s;
+            }
+        };
+
+        // Parses the blocks of a snapshot chunk into a slot each, inserted in
+        // order once the chunk is done. Snapshots are in key order, so every
+        // insert goes at the end of the map.
+        class Loader final : public SnapshotLoader {
+        public:
+            explicit Loader(std::map<std::string, Value> * map) : map_(map) {}
+
+            ~Loader() override = default;
+
+            void BeginChunk(size_t blocks) override {
+                slots_.resize(blocks);
+            }
+
+            void Parse(size_t block, SnapshotType type,
+                       const std::string_view & k, const std::string_view & v) override {
+                Value & value = slots_[block].emplace_back(k, Value()).second;
+                value.s.assign(v);
+                if (type == kSnapshotInteger && string2ll(v.data(), v.size(), &value.ll)) {
+                    value.type = kIntegerValue;
+                    value.s.clear();
+                } else if (type == kSnapshotHash) {
+                    value.type = kHashValue;
+                    if (!FitsListpack(&value.s)) {
+                        ConvertToDict(&value);
+                    }
+                }
+            }
+
+            void CommitChunk() override {
+                for (auto & slot:slots_) {
+                    for (auto & p:slot) {
+                        map_->emplace_hint(map_->end(), std::move(p.first), std::move(p.second));
+                    }
+                    slot.clear();
+                }
+            }
+
+        private:
+            std::map<std::string, Value> * map_;
+            std::vector<std::vector<std::pair<std::string, Value>>> slots_;
         };
 
     public:
-        ~ExecutorMemImpl() override = default;
+        ExecutorMemImpl(std::string snapshot_file, std::string aof_file)
+                : snapshot_file_(std::move(snapshot_file)),
+                  last_save_time_(GetCurrentTimeInSeconds()),
+                  aof_file_(std::move(aof_file)),
+                  replid_(GenerateReplicationId()) {}
+
+        ~ExecutorMemImpl() override {
+            if (aof_fd_ != -1 && !propagate_buf_.empty()) {
+                FlushAof();
+            }
+            if (aof_fd_ != -1) {
+                fsync(aof_fd_);
+                close(aof_fd_);
+            }
+        }
 
         void Submit(const rocksdb::autovector<std::string_view> & argv,
                     Client * c, int fd) override {
-            Task & task = tasks_.emplace_back();
+            Task & task = tasks_.EmplaceBack(c);
             for (const auto & arg : argv) { task.argv.emplace_back(arg); }
             task.c = c;
             task.fd = fd;
+            task.cmd = LookupCommand(argv);
+            task.submitted = GetCycles();
         }
 
         void Execute(size_t n, long curr_time, EventLoop<Client> * el) override {
-            for (size_t i = 0; i < n; tasks_.pop_front(), ++i) {
-                Task & task = tasks_.front();
+            running_.clear();
+            tasks_.PopFront(n, &running_);
+            Stats * stats = GetStats();
+
+            for (Task & task:running_) {
                 Client * c = task.c;
                 int fd = task.fd;
 
                 --c->ref_count;
-                if (c->close) {
+                if (c->close && !c->master) { /* What a master sent is applied even once the link is gone */
                     if (c->ref_count == 0) {
                         el->Release(fd);
                     }
@@ -39,47 +187,1384 @@ namespace cheapis {
 
                 bool blocked = !c->output.empty();
                 auto & argv = task.argv;
-                if (argv[0] == "GET" && argv.size() == 2) {
-                    auto it = map_.find(argv[1]);
-                    if (it != map_.cend()) {
-                        RespMachine::AppendBulkString(&c->output, it->second);
-                    } else {
-                        RespMachine::AppendNullArray(&c->output);
-                    }
-                } else if (argv[0] == "SET" && argv.size() == 3) {
-                    map_.emplace(std::move(argv[1]), std::move(argv[2]));
-                    RespMachine::AppendSimpleString(&c->output, "OK");
-                } else if (argv[0] == "DEL" && argv.size() == 2) {
-                    map_.erase(argv[1]);
-                    RespMachine::AppendSimpleString(&c->output, "OK");
+                uint64_t begun = GetCycles();
+                ++stats->calls[task.cmd];
+                if (c->master) {
+                    ExecuteCommand(task.cmd, argv, curr_time, fd, &discard_);
+                    discard_.clear();
+                    master_offset_ += GetStreamSize(argv);
+                    uint64_t executed = GetCycles();
+                    RecordTask(stats, task.cmd, argv, 1,
+                               task.submitted, begun, 0, executed, executed);
+                    continue;
+                }
+                if (link_state_ != kLinkNone && IsWriteCommand(task.cmd)) {
+                    RespMachine::AppendError(&c->output, "READONLY You can't write against a read only replica.");
+                } else if (task.cmd == kPsync) {
+                    ExecutePsync(c, fd, argv, curr_time);
+                } else if (task.cmd == kReplconf) {
+                    ExecuteReplconf(c, argv, curr_time);
                 } else {
-                    RespMachine::AppendError(&c->output, "Unsupported Command");
+                    ExecuteCommand(task.cmd, argv, curr_time, fd, &c->output);
                 }
+                uint64_t executed = GetCycles();
 
                 if (!blocked) {
                     ssize_t nwrite = write(fd, c->output.data(), c->output.size());
                     if (nwrite > 0) {
                         c->output.assign(c->output.data() + nwrite,
                                          c->output.size() - nwrite);
+                        stats->net_output_bytes.Add(nwrite);
                     }
                     if (!c->output.empty()) {
                         el->AddEvent(fd, kWritable);
                     }
                 }
+                RecordTask(stats, task.cmd, argv, 1,
+                           task.submitted, begun, 0, executed, GetCycles());
+                CheckOutputBuffer(fd, c, curr_time, el);
+            }
+            if (!propagate_buf_.empty()) {
+                FlushPropagated(curr_time, el);
+            }
+            if (!replicas_.empty()) {
+                ServeReplicas(curr_time, el);
+            }
+            if (link_state_ != kLinkNone || master_ != nullptr) {
+                ServeLink(curr_time, el);
             }
         }
 
         size_t GetTaskCount() const override {
-            return tasks_.size();
+            return tasks_.Size();
+        }
+
+        void Cron(long curr_time) override {
+            if (child_type_ != kNoChild) {
+                ReapChild(curr_time);
+            }
+            if (aof_fd_ == -1) {
+                return;
+            }
+            if (aof_unsynced_ && GetConfig()->aof_fsync.load(std::memory_order_relaxed)) {
+                if (fsync(aof_fd_) != 0) {
+                    LIN_LOG_WARN("Failed syncing the AOF. Error message: '%s'", strerror(errno));
+                }
+                aof_unsynced_ = false;
+            }
+            if (child_type_ == kNoChild && aof_size_ >= kAofRewriteMinSize && aof_size_ >= aof_base_size_ * 2) {
+                LIN_LOG_INFO("Rewriting the AOF of %lu bytes, %lu after the last rewrite",
+                             static_cast<unsigned long>(aof_size_), static_cast<unsigned long>(aof_base_size_));
+                StartChild(kRewriteChild, curr_time);
+            }
+        }
+
+        // Replays the AOF, parsed a large read at a time as if it came from a
+        // client. A command cut short at the end, as a crash mid-write leaves
+        // it, is dropped and the file truncated before it. Then opens the AOF
+        // for appending, writing it from the snapshot first if it is new.
+        bool LoadAof() {
+            int fd = OpenFile(aof_file_, O_RDWR);
+            if (fd < 0 && errno != ENOENT) {
+                LIN_LOG_ERROR("Failed opening %s. Error message: '%s'", aof_file_.c_str(), strerror(errno));
+                return false;
+            }
+            if (fd < 0) {
+                if (!LoadSnapshotFile()) {
+                    return false;
+                }
+                if (!map_.empty() && (!RewriteAof() || rename((aof_file_ + ".rewrite").c_str(), aof_file_.c_str()) != 0)) {
+                    LIN_LOG_ERROR("Failed writing %s from the snapshot", aof_file_.c_str());
+                    return false;
+                }
+                return OpenAof();
+            }
+
+            long begun = GetCurrentTimeInMilliseconds();
+            long curr_time = GetCurrentTimeInSeconds();
+            FileHint(fd, kSequential);
+            RespMachine resp;
+            rocksdb::autovector<std::string> argv;
+            std::string buf;
+            std::string out;
+            uint64_t offset = 0; /* Of buf in the file */
+            uint64_t commands = 0;
+            size_t consumed = 0;
+            while (true) {
+                size_t have = buf.size();
+                buf.resize(have + kAofReadSize);
+                ssize_t nread = read(fd, &buf[have], kAofReadSize);
+                if (nread < 0) {
+                    LIN_LOG_ERROR("Failed reading %s. Error message: '%s'", aof_file_.c_str(), strerror(errno));
+                    close(fd);
+                    return false;
+                }
+                buf.resize(have + nread);
+                if (nread == 0) {
+                    break;
+                }
+
+                size_t start = 0;
+                while (start + consumed < buf.size()) {
+                    consumed += resp.Input(buf.data() + start + consumed, buf.size() - start - consumed);
+                    auto state = resp.GetState();
+                    if (state == RespMachine::kSuccess) {
+                        const auto & views = resp.GetArgv();
+                        argv.clear();
+                        for (const auto & view:views) {
+                            argv.emplace_back(view);
+                        }
+                        if (!argv.empty()) {
+                            ExecuteCommand(LookupCommand(views), argv, curr_time, -1, &out);
+                            out.clear();
+                            ++commands;
+                        }
+                        resp.Reset();
+                        start += consumed;
+                        consumed = 0;
+                    } else if (state == RespMachine::kProcess) {
+                        break;
+                    } else {
+                        LIN_LOG_ERROR("Failed parsing %s at offset %lu", aof_file_.c_str(),
+                                      static_cast<unsigned long>(offset + start));
+                        close(fd);
+                        return false;
+                    }
+                }
+                buf.erase(0, start);
+                offset += start;
+            }
+            if (!buf.empty()) {
+                LIN_LOG_WARN("Dropping %lu bytes of a command cut short at the end of %s",
+                             static_cast<unsigned long>(buf.size()), aof_file_.c_str());
+                if (ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+                    LIN_LOG_ERROR("Failed truncating %s. Error message: '%s'", aof_file_.c_str(), strerror(errno));
+                    close(fd);
+                    return false;
+                }
+            }
+            close(fd);
+            LIN_LOG_INFO("Replayed %lu commands from %s in %ld ms", static_cast<unsigned long>(commands),
+                         aof_file_.c_str(), static_cast<long>(GetCurrentTimeInMilliseconds() - begun));
+            return OpenAof();
+        }
+
+        // A missing snapshot file is an empty snapshot.
+        bool LoadSnapshotFile() {
+            int fd = OpenFile(snapshot_file_, O_RDONLY);
+            if (fd < 0) {
+                if (errno == ENOENT) {
+                    return true;
+                }
+                LIN_LOG_ERROR("Failed opening %s. Error message: '%s'", snapshot_file_.c_str(), strerror(errno));
+                return false;
+            }
+            long begun = GetCurrentTimeInMilliseconds();
+            Loader loader(&map_);
+            uint64_t entries = 0;
+            std::string err;
+            bool ok = LoadSnapshot(fd, std::thread::hardware_concurrency(), &loader, &entries, &err);
+            close(fd);
+            if (!ok) {
+                LIN_LOG_ERROR("Failed loading %s: %s", snapshot_file_.c_str(), err.c_str());
+                return false;
+            }
+            LIN_LOG_INFO("Loaded %lu keys from %s in %ld ms", static_cast<unsigned long>(entries),
+                         snapshot_file_.c_str(), static_cast<long>(GetCurrentTimeInMilliseconds() - begun));
+            return true;
+        }
+
+        void GetInfo(const char * section, std::string * buf) const override {
+            if (strcmp(section, "server") == 0) {
+                AppendInfoField(buf, "executor", "memory");
+            } else if (strcmp(section, "persistence") == 0) {
+                AppendInfoField(buf, "rdb_bgsave_in_progress", child_type_ == kSnapshotChild);
+                AppendInfoField(buf, "rdb_last_save_time", last_save_time_);
+                AppendInfoField(buf, "rdb_last_bgsave_status", last_bgsave_ok_ ? "ok" : "err");
+                AppendInfoField(buf, "rdb_last_bgsave_time_sec", last_bgsave_time_);
+                AppendInfoField(buf, "latest_fork_usec", last_fork_usec_);
+                AppendInfoField(buf, "aof_enabled", aof_fd_ != -1);
+                AppendInfoField(buf, "aof_rewrite_in_progress", child_type_ == kRewriteChild);
+                AppendInfoField(buf, "aof_last_bgrewrite_status", last_rewrite_ok_ ? "ok" : "err");
+                if (aof_fd_ != -1) {
+                    AppendInfoField(buf, "aof_current_size", static_cast<long long>(aof_size_));
+                    AppendInfoField(buf, "aof_base_size", static_cast<long long>(aof_base_size_));
+                    AppendInfoField(buf, "aof_rewrite_buffer_length", static_cast<long long>(aof_rewrite_buf_.size()));
+                }
+            } else if (strcmp(section, "replication") == 0) {
+                if (link_state_ == kLinkNone) {
+                    AppendInfoField(buf, "role", "master");
+                    AppendInfoField(buf, "connected_slaves", static_cast<long long>(replicas_.size()));
+                    for (size_t i = 0; i < replicas_.size(); ++i) {
+                        const Replica & replica = replicas_[i];
+                        std::string name = "slave" + std::to_string(i);
+                        AppendInfoField(buf, name.c_str(), "fd=" + std::to_string(replica.fd) +
+                                                           ",state=" + kReplicaStateNames[replica.state] +
+                                                           ",offset=" + std::to_string(replica.ack_offset) +
+                                                           ",lag=" + std::to_string(GetCurrentTimeInSeconds() -
+                                                                                    replica.ack_time));
+                    }
+                    AppendInfoField(buf, "master_replid", replid_);
+                    AppendInfoField(buf, "master_repl_offset",
+                                    static_cast<long long>(backlog_ != nullptr ? backlog_->GetOffset() : 0));
+                    AppendInfoField(buf, "repl_backlog_active", backlog_ != nullptr);
+                    if (backlog_ != nullptr) {
+                        AppendInfoField(buf, "repl_backlog_size", static_cast<long long>(backlog_->GetSize()));
+                        AppendInfoField(buf, "repl_backlog_first_byte_offset",
+                                        static_cast<long long>(backlog_->GetFirstOffset()));
+                        AppendInfoField(buf, "repl_backlog_histlen",
+                                        static_cast<long long>(backlog_->GetHistoryLength()));
+                    }
+                } else {
+                    AppendInfoField(buf, "role", "slave");
+                    AppendInfoField(buf, "master_host", master_host_);
+                    AppendInfoField(buf, "master_port", master_port_);
+                    AppendInfoField(buf, "master_link_status", link_state_ == kLinkConnected ? "up" : "down");
+                    AppendInfoField(buf, "master_sync_in_progress", link_state_ == kLinkTransfer);
+                    if (link_state_ == kLinkTransfer) {
+                        AppendInfoField(buf, "master_sync_read_bytes", static_cast<long long>(sync_bytes_));
+                    }
+                    AppendInfoField(buf, "master_replid", master_replid_.empty() ? "?" : master_replid_);
+                    AppendInfoField(buf, "slave_repl_offset", static_cast<long long>(master_offset_));
+                }
+            } else if (strcmp(section, "keyspace") == 0 && !map_.empty()) {
+                AppendInfoField(buf, "db0", "keys=" + std::to_string(map_.size()));
+            }
+        }
+
+        // Before the write stream, a master replies to PSYNC with a line:
+        // +CONTINUE, or +FULLRESYNC and then the snapshot between two EOF
+        // marks, which is written to a file as it comes and loaded whole.
+        size_t Sync(Client * c, const std::string & input, long curr_time) override {
+            size_t pos = 0;
+            if (link_drop_) {
+                return input.size();
+            }
+            if (link_state_ == kLinkHandshake) {
+                size_t eol = input.find("\r\n");
+                if (eol == std::string::npos) {
+                    return 0;
+                }
+                std::string line = input.substr(0, eol);
+                pos = eol + 2;
+                long long offset;
+                if (line.compare(0, 10, "+CONTINUE ") == 0) {
+                    LIN_LOG_INFO("Continuing the stream of master %s:%d at offset %lu", master_host_.c_str(),
+                                 master_port_, static_cast<unsigned long>(master_offset_));
+                    link_state_ = kLinkConnected;
+                    c->syncing = false;
+                    return pos;
+                }
+                if (line.compare(0, 12, "+FULLRESYNC ") != 0 || line.size() < 13 + kReplicationIdSize || line[12 + kReplicationIdSize] != ' ' ||
+                    !string2ll(line.data() + 13 + kReplicationIdSize, line.size() - 13 - kReplicationIdSize,
+                               &offset) || offset < 0) {
+                    LIN_LOG_WARN("Unexpected reply from master %s:%d to PSYNC: '%s'", master_host_.c_str(),
+                                 master_port_, line.c_str());
+                    link_drop_ = true;
+                    return input.size();
+                }
+                sync_replid_ = line.substr(12, kReplicationIdSize);
+                sync_offset_ = static_cast<uint64_t>(offset);
+                sync_mark_.clear();
+                sync_bytes_ = 0;
+                sync_fd_ = OpenFile(snapshot_file_ + ".sync", O_CREAT | O_WRONLY | O_TRUNC);
+                if (sync_fd_ < 0) {
+                    LIN_LOG_ERROR("Failed opening %s.sync. Error message: '%s'", snapshot_file_.c_str(),
+                                  strerror(errno));
+                    link_drop_ = true;
+                    return input.size();
+                }
+                link_state_ = kLinkTransfer;
+                LIN_LOG_INFO("Full sync from master %s:%d", master_host_.c_str(), master_port_);
+            }
+
+            if (sync_mark_.empty()) {
+                size_t eol = input.find("\r\n", pos);
+                if (eol == std::string::npos) {
+                    return pos;
+                }
+                if (eol - pos != 5 + kReplicationIdSize || input.compare(pos, 5, "$EOF:") != 0) {
+                    LIN_LOG_WARN("Unexpected snapshot header from master %s:%d", master_host_.c_str(), master_port_);
+                    link_drop_ = true;
+                    return input.size();
+                }
+                sync_mark_ = input.substr(pos + 5, kReplicationIdSize);
+                pos = eol + 2;
+            }
+            /* Held back: the start of a mark cut by the end of the input */
+            size_t found = input.find(sync_mark_, pos);
+            size_t end = found;
+            if (found == std::string::npos) {
+                end = std::max(pos, input.size() - std::min(input.size(), sync_mark_.size() - 1));
+            }
+            if (FileWrite(sync_fd_, input.data() + pos, end - pos) != 0) {
+                LIN_LOG_ERROR("Failed writing %s.sync. Error message: '%s'", snapshot_file_.c_str(), strerror(errno));
+                link_drop_ = true;
+                return input.size();
+            }
+            sync_bytes_ += end - pos;
+            if (found == std::string::npos) {
+                return end;
+            }
+            if (!LoadSync(curr_time)) {
+                link_drop_ = true;
+                return input.size();
+            }
+            link_state_ = kLinkConnected;
+            c->syncing = false;
+            return found + sync_mark_.size();
         }
 
     private:
-        std::deque<Task> tasks_;
-        std::map<std::string, std::string> map_;
+        // Runs one command for the client on fd, the reply appended to out.
+        // Also how the AOF is replayed, fd then -1 and out discarded.
+        void ExecuteCommand(Command cmd, const rocksdb::autovector<std::string> & argv, long curr_time,
+                            int fd, std::string * out) {
+            switch (cmd) {
+                case kGet: {
+                    auto it = map_.find(argv[1]);
+                    if (it != map_.cend() && it->second.type == kHashValue) {
+                        RespMachine::AppendError(out, kWrongTypeError);
+                    } else if (it != map_.cend()) {
+                        RespMachine::AppendBulkString(out, it->second.View(number_));
+                    } else {
+                        RespMachine::AppendNullArray(out);
+                    }
+                    break;
+                }
+
+                case kSet: {
+                    // Copied, the slowlog may still need argv
+                    Value & value = map_.try_emplace(argv[1]).first->second;
+                    value.s.assign(argv[2]);
+                    value.type = kStringValue;
+                    value.dict.reset();
+                    Propagate(argv);
+                    RespMachine::AppendSimpleString(out, "OK");
+                    break;
+                }
+
+                case kDel: {
+                    if (map_.erase(argv[1]) != 0) {
+                        Propagate(argv);
+                    }
+                    RespMachine::AppendSimpleString(out, "OK");
+                    break;
+                }
+
+                case kInfo: {
+                    info_.clear();
+                    GenerateInfo(argv.size() > 1 ? argv[1] : "", *this, &info_);
+                    RespMachine::AppendBulkString(out, info_);
+                    break;
+                }
+
+                case kLatency: {
+                    ExecuteLatency(argv, 1, out);
+                    break;
+                }
+
+                case kSlowlog: {
+                    ExecuteSlowlog(argv, 1, out);
+                    break;
+                }
+
+                case kConfig: {
+                    ExecuteConfig(argv, 1, out);
+                    break;
+                }
+
+                case kScan: {
+                    ScanArgs args;
+                    if (!ParseScanArgs(argv, 1, &args, out)) {
+                        break;
+                    }
+                    if (!cursors_.Resume(args.cursor, &scan_key_)) {
+                        RespMachine::AppendError(out, "ERR invalid cursor");
+                        break;
+                    }
+                    scan_matches_.clear();
+                    auto it = map_.lower_bound(scan_key_);
+                    for (size_t i = 0; i < args.count && it != map_.cend(); ++i, ++it) {
+                        if (MatchKey(args.pattern, it->first)) {
+                            scan_matches_.emplace_back(it->first);
+                        }
+                    }
+                    AppendScanReply(out, it != map_.cend() ? cursors_.Suspend(fd, it->first) : 0, scan_matches_);
+                    break;
+                }
+
+                case kKeys: {
+                    scan_matches_.clear();
+                    std::string_view pattern = argv[1] != "*" ? argv[1] : std::string_view();
+                    for (const auto & p:map_) {
+                        if (MatchKey(pattern, p.first)) {
+                            scan_matches_.emplace_back(p.first);
+                        }
+                    }
+                    RespMachine::AppendArrayLength(out, scan_matches_.size());
+                    for (const auto & key:scan_matches_) {
+                        RespMachine::AppendBulkString(out, key);
+                    }
+                    break;
+                }
+
+                case kRange:
+                case kPrefix: {
+                    RangeArgs args;
+                    if (!ParseRangeArgs(argv, 1, cmd == kPrefix, &args, out)) {
+                        break;
+                    }
+                    range_.clear();
+                    size_t n = 0;
+                    for (auto it = map_.lower_bound(args.start);
+                         n < args.limit && it != map_.cend() && InRange(args, it->first); ++it) {
+                        if (it->second.type != kHashValue) {
+                            RespMachine::AppendBulkString(&range_, it->first);
+                            RespMachine::AppendBulkString(&range_, it->second.View(number_));
+                            ++n;
+                        }
+                    }
+                    RespMachine::AppendArrayLength(out, n * 2);
+                    out->append(range_);
+                    break;
+                }
+
+                case kIncr:
+                case kIncrBy:
+                case kDecr:
+                case kDecrBy: {
+                    long long delta;
+                    if (!ParseIncrement(cmd, argv, 1, &delta, out)) {
+                        break;
+                    }
+                    auto it = map_.find(argv[1]);
+                    long long ll = 0;
+                    if (it != map_.cend()) {
+                        if (it->second.type == kHashValue) {
+                            RespMachine::AppendError(out, kWrongTypeError);
+                            break;
+                        }
+                        ll = it->second.ll;
+                        if (it->second.type != kIntegerValue && !ParseCounter(it->second.s, &ll, out)) {
+                            break;
+                        }
+                    }
+                    if (!AddCounter(ll, delta, &ll, out)) {
+                        break;
+                    }
+                    if (it == map_.cend()) {
+                        it = map_.try_emplace(argv[1]).first;
+                    }
+                    it->second.ll = ll;
+                    it->second.type = kIntegerValue;
+                    it->second.s.clear();
+                    Propagate(argv);
+                    RespMachine::AppendInteger(out, ll);
+                    break;
+                }
+
+                case kIncrByFloat: {
+                    auto it = map_.find(argv[1]);
+                    if (it != map_.cend() && it->second.type == kHashValue) {
+                        RespMachine::AppendError(out, kWrongTypeError);
+                        break;
+                    }
+                    std::string_view value;
+                    if (it != map_.cend()) {
+                        value = it->second.View(number_);
+                    }
+                    size_t len = AddFloat(it != map_.cend() ? &value : nullptr, argv[2], number_, out);
+                    if (len == 0) {
+                        break;
+                    }
+                    if (it == map_.cend()) {
+                        it = map_.try_emplace(argv[1]).first;
+                    }
+                    it->second.s.assign(number_, len);
+                    it->second.type = kStringValue;
+                    /* Replayed as the result, not an increment to redo in floating point */
+                    Propagate({"SET", argv[1], it->second.s});
+                    RespMachine::AppendBulkString(out, it->second.s);
+                    break;
+                }
+
+                case kHSet: {
+                    if (argv.size() % 2 != 0) {
+                        RespMachine::AppendError(out, "ERR wrong number of arguments for 'hset' command");
+                        break;
+                    }
+                    Value * value;
+                    if (!LookupHash(argv[1], &value, out)) {
+                        break;
+                    }
+                    if (value == nullptr) {
+                        value = &map_.try_emplace(argv[1]).first->second;
+                        value->type = kHashValue;
+                    }
+                    long long added = 0;
+                    for (size_t i = 2; i < argv.size(); i += 2) {
+                        added += HashSet(value, argv[i], argv[i + 1]);
+                    }
+                    Propagate(argv);
+                    RespMachine::AppendInteger(out, added);
+                    break;
+                }
+
+                case kHGet:
+                case kHMGet: {
+                    Value * value;
+                    if (!LookupHash(argv[1], &value, out)) {
+                        break;
+                    }
+                    if (cmd == kHMGet) {
+                        RespMachine::AppendArrayLength(out, argv.size() - 2);
+                    }
+                    for (size_t i = 2; i < argv.size(); ++i) {
+                        std::string_view field_value;
+                        if (value != nullptr && HashGet(value, argv[i], &field_value)) {
+                            RespMachine::AppendBulkString(out, field_value);
+                        } else {
+                            RespMachine::AppendNullArray(out);
+                        }
+                    }
+                    break;
+                }
+
+                case kHGetAll: {
+                    Value * value;
+                    if (!LookupHash(argv[1], &value, out)) {
+                        break;
+                    }
+                    if (value == nullptr) {
+                        RespMachine::AppendArrayLength(out, 0);
+                        break;
+                    }
+                    auto append = [out](const std::string_view & field, const std::string_view & field_value) {
+                        RespMachine::AppendBulkString(out, field);
+                        RespMachine::AppendBulkString(out, field_value);
+                    };
+                    if (value->dict != nullptr) {
+                        RespMachine::AppendArrayLength(out, value->dict->size() * 2);
+                        for (const auto & p:*value->dict) {
+                            append(p.first, p.second);
+                        }
+                    } else {
+                        Listpack listpack(&value->s);
+                        RespMachine::AppendArrayLength(out, listpack.Size() * 2);
+                        listpack.ForEach(append);
+                    }
+                    break;
+                }
+
+                case kHDel: {
+                    Value * value;
+                    if (!LookupHash(argv[1], &value, out)) {
+                        break;
+                    }
+                    long long deleted = 0;
+                    for (size_t i = 2; value != nullptr && i < argv.size(); ++i) {
+                        deleted += value->dict != nullptr ? value->dict->erase(argv[i])
+                                                          : Listpack(&value->s).Erase(argv[i]);
+                    }
+                    if (value != nullptr && (value->dict != nullptr ? value->dict->empty() : value->s.empty())) {
+                        map_.erase(argv[1]);
+                    }
+                    if (deleted != 0) {
+                        Propagate(argv);
+                    }
+                    RespMachine::AppendInteger(out, deleted);
+                    break;
+                }
+
+                case kBgsave: {
+                    if (snapshot_file_.empty()) {
+                        RespMachine::AppendError(out, "ERR no snapshot file");
+                    } else if (child_type_ == kSnapshotChild) {
+                        RespMachine::AppendError(out, "ERR Background save already in progress");
+                    } else if (child_type_ == kRewriteChild) {
+                        RespMachine::AppendError(out, "ERR Background append only file rewriting in progress");
+                    } else if (child_type_ == kSyncChild) {
+                        RespMachine::AppendError(out, "ERR Full sync of a replica in progress");
+                    } else if (!StartChild(kSnapshotChild, curr_time)) {
+                        RespMachine::AppendError(out, "ERR Failed forking");
+                    } else {
+                        RespMachine::AppendSimpleString(out, "Background saving started");
+                    }
+                    break;
+                }
+
+                case kBgrewriteaof: {
+                    if (aof_fd_ == -1) {
+                        RespMachine::AppendError(out, "ERR appendonly is off");
+                    } else if (child_type_ == kRewriteChild) {
+                        RespMachine::AppendError(out, "ERR Background append only file rewriting already in progress");
+                    } else if (child_type_ == kSnapshotChild) {
+                        RespMachine::AppendError(out, "ERR Background save in progress");
+                    } else if (child_type_ == kSyncChild) {
+                        RespMachine::AppendError(out, "ERR Full sync of a replica in progress");
+                    } else if (!StartChild(kRewriteChild, curr_time)) {
+                        RespMachine::AppendError(out, "ERR Failed forking");
+                    } else {
+                        RespMachine::AppendSimpleString(out, "Background append only file rewriting started");
+                    }
+                    break;
+                }
+
+                case kLastsave: {
+                    RespMachine::AppendInteger(out, last_save_time_);
+                    break;
+                }
+
+                case kCheckpoint: {
+                    RespMachine::AppendError(out, "ERR CHECKPOINT is for the disk executor, use BGSAVE");
+                    break;
+                }
+
+                case kPing: {
+                    if (argv.size() > 2) {
+                        RespMachine::AppendError(out, "ERR wrong number of arguments for 'ping' command");
+                    } else if (argv.size() == 2) {
+                        RespMachine::AppendBulkString(out, argv[1]);
+                    } else {
+                        RespMachine::AppendSimpleString(out, "PONG");
+                    }
+                    break;
+                }
+
+                case kReplicaof: {
+                    if (strcasecmp(argv[1].c_str(), "no") == 0 && strcasecmp(argv[2].c_str(), "one") == 0) {
+                        if (link_state_ != kLinkNone) {
+                            LIN_LOG_INFO("Promoted from a replica of %s:%d to a master", master_host_.c_str(),
+                                         master_port_);
+                            link_state_ = kLinkNone;
+                            replid_ = GenerateReplicationId();
+                        }
+                        RespMachine::AppendSimpleString(out, "OK");
+                        break;
+                    }
+                    long long port;
+                    if (!string2ll(argv[2].data(), argv[2].size(), &port) || port <= 0 || port > 65535) {
+                        RespMachine::AppendError(out, "ERR Invalid master port");
+                        break;
+                    }
+                    if (snapshot_file_.empty()) {
+                        RespMachine::AppendError(out, "ERR no snapshot file to sync into");
+                        break;
+                    }
+                    if (link_state_ != kLinkNone && master_host_ == argv[1] && master_port_ == port) {
+                        RespMachine::AppendSimpleString(out, "OK Already connected to specified master");
+                        break;
+                    }
+                    /* The replicas of a replica would have nothing to continue from */
+                    for (auto & replica:replicas_) {
+                        replica.drop = true;
+                    }
+                    backlog_.reset();
+                    link_drop_ = master_ != nullptr;
+                    master_host_ = argv[1];
+                    master_port_ = static_cast<int>(port);
+                    master_replid_.clear();
+                    link_state_ = kLinkConnect;
+                    link_retry_time_ = 0;
+                    LIN_LOG_INFO("Replicating %s:%d", master_host_.c_str(), master_port_);
+                    RespMachine::AppendSimpleString(out, "OK");
+                    break;
+                }
+
+                default: {
+                    RespMachine::AppendError(out, "Unsupported Command");
+                    break;
+                }
+            }
+        }
+
+        // Forks a child that writes the map as of now, shared copy-on-write,
+        // to a temporary file: a snapshot, or an AOF rewrite. The child has
+        // none of the parent's threads, so it doesn't log.
+        bool StartChild(ChildType type, long curr_time) {
+            uint64_t begun = GetCycles();
+            pid_t pid = fork();
+            if (pid == 0) {
+                bool ok = type == kSnapshotChild ? SaveSnapshot() :
+                          type == kRewriteChild ? RewriteAof() : SendSnapshots();
+                _exit(ok ? 0 : 1);
+            }
+            if (pid < 0) {
+                LIN_LOG_WARN("Failed forking. Error message: '%s'", strerror(errno));
+                return false;
+            }
+            last_fork_usec_ = static_cast<long long>((GetCycles() - begun) / GetCyclesPerMicrosecond());
+            child_pid_ = pid;
+            child_type_ = type;
+            child_begun_ = curr_time;
+            if (type == kRewriteChild) {
+                aof_rewrite_buf_.clear();
+            }
+            LIN_LOG_INFO("Background %s started by pid %d", kChildNames[type], static_cast<int>(pid));
+            return true;
+        }
+
+        void ReapChild(long curr_time) {
+            int status;
+            pid_t pid = waitpid(child_pid_, &status, WNOHANG);
+            if (pid == 0) {
+                return;
+            }
+            bool ok = pid == child_pid_ && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            ChildType type = child_type_;
+            child_pid_ = -1;
+            child_type_ = kNoChild;
+            if (type == kSnapshotChild) {
+                last_bgsave_ok_ = ok;
+                last_bgsave_time_ = curr_time - child_begun_;
+                if (ok) {
+                    last_save_time_ = curr_time;
+                    LIN_LOG_INFO("Background saving took %ld s", last_bgsave_time_);
+                } else {
+                    unlink((snapshot_file_ + ".tmp").c_str());
+                    LIN_LOG_WARN("Background saving failed");
+                }
+            } else if (type == kSyncChild) {
+                for (auto & replica:replicas_) {
+                    if (replica.state == kReplicaSyncing) {
+                        replica.state = kReplicaReady;
+                        replica.drop = !ok;
+                    }
+                }
+                if (ok) {
+                    LIN_LOG_INFO("Full sync took %ld s", curr_time - child_begun_);
+                } else {
+                    LIN_LOG_WARN("Full sync failed");
+                }
+            } else {
+                last_rewrite_ok_ = ok && FinishAofRewrite();
+                if (last_rewrite_ok_) {
+                    LIN_LOG_INFO("Background AOF rewrite took %ld s, %lu bytes", curr_time - child_begun_,
+                                 static_cast<unsigned long>(aof_size_));
+                } else {
+                    unlink((aof_file_ + ".rewrite").c_str());
+                    LIN_LOG_WARN("Background AOF rewrite failed");
+                }
+                aof_rewrite_buf_.clear();
+                aof_rewrite_buf_.shrink_to_fit();
+            }
+        }
+
+        // Queues a write for the AOF and the replicas, and keeps it for the
+        // rewrite in progress too, which only has the map as of its fork.
+        template<typename Args>
+        void Propagate(const Args & argv) {
+            if (aof_fd_ == -1 && backlog_ == nullptr) {
+                return;
+            }
+            size_t begin = propagate_buf_.size();
+            RespMachine::AppendArrayLength(&propagate_buf_, argv.size());
+            for (const auto & arg:argv) {
+                RespMachine::AppendBulkString(&propagate_buf_, arg);
+            }
+            if (child_type_ == kRewriteChild) {
+                aof_rewrite_buf_.append(propagate_buf_, begin, std::string::npos);
+            }
+        }
+
+        void Propagate(std::initializer_list<std::string_view> argv) {
+            Propagate<std::initializer_list<std::string_view>>(argv);
+        }
+
+        void FlushPropagated(long curr_time, EventLoop<Client> * el) {
+            if (aof_fd_ != -1) {
+                FlushAof();
+            }
+            if (backlog_ != nullptr) {
+                FeedReplicas(propagate_buf_, curr_time, el);
+            }
+            propagate_buf_.clear();
+        }
+
+        // The writes of a whole Execute() go out with one write, synced by
+        // the cron. A crash can lose what was replied to since the last sync.
+        void FlushAof() {
+            if (FileWrite(aof_fd_, propagate_buf_.data(), propagate_buf_.size()) != 0) {
+                LIN_LOG_ERROR("Failed writing the AOF. Error message: '%s'", strerror(errno));
+                exit(1);
+            }
+            aof_size_ += propagate_buf_.size();
+            aof_unsynced_ = true;
+        }
+
+        bool OpenAof() {
+            aof_fd_ = OpenFile(aof_file_, O_CREAT | O_WRONLY | O_APPEND);
+            if (aof_fd_ < 0) {
+                LIN_LOG_ERROR("Failed opening %s. Error message: '%s'", aof_file_.c_str(), strerror(errno));
+                return false;
+            }
+            struct stat st = {};
+            fstat(aof_fd_, &st);
+            aof_size_ = aof_base_size_ = static_cast<uint64_t>(st.st_size);
+            return true;
+        }
+
+        // Writes the commands that rebuild the map to the rewrite file, a
+        // large write at a time.
+        bool RewriteAof() {
+            int fd = OpenFile(aof_file_ + ".rewrite", O_CREAT | O_WRONLY | O_TRUNC);
+            if (fd < 0) {
+                return false;
+            }
+            std::string buf;
+            bool ok = true;
+            for (auto it = map_.begin(); ok && it != map_.end(); ++it) {
+                Value & value = it->second;
+                if (value.type != kHashValue) {
+                    RespMachine::AppendArrayLength(&buf, 3);
+                    RespMachine::AppendBulkString(&buf, "SET");
+                    RespMachine::AppendBulkString(&buf, it->first);
+                    RespMachine::AppendBulkString(&buf, value.View(number_));
+                } else {
+                    rewrite_fields_.clear();
+                    if (value.dict != nullptr) {
+                        for (const auto & p:*value.dict) {
+                            rewrite_fields_.emplace_back(p.first, p.second);
+                        }
+                    } else {
+                        Listpack(&value.s).ForEach(
+                                [this](const std::string_view & f, const std::string_view & v) {
+                                    rewrite_fields_.emplace_back(f, v);
+                                });
+                    }
+                    for (size_t i = 0; i < rewrite_fields_.size(); i += kAofRewriteItems) {
+                        size_t n = std::min(kAofRewriteItems, rewrite_fields_.size() - i);
+                        RespMachine::AppendArrayLength(&buf, 2 + n * 2);
+                        RespMachine::AppendBulkString(&buf, "HSET");
+                        RespMachine::AppendBulkString(&buf, it->first);
+                        for (size_t j = i; j < i + n; ++j) {
+                            RespMachine::AppendBulkString(&buf, rewrite_fields_[j].first);
+                            RespMachine::AppendBulkString(&buf, rewrite_fields_[j].second);
+                        }
+                    }
+                }
+                if (buf.size() >= kAofWriteSize) {
+                    ok = FileWrite(fd, buf.data(), buf.size()) == 0;
+                    buf.clear();
+                }
+            }
+            ok = ok && FileWrite(fd, buf.data(), buf.size()) == 0 && fsync(fd) == 0;
+            close(fd);
+            return ok;
+        }
+
+        // Appends the writes made during the rewrite to it and puts it in
+        // place of the AOF.
+        bool FinishAofRewrite() {
+            std::string tmp = aof_file_ + ".rewrite";
+            int fd = OpenFile(tmp, O_WRONLY | O_APPEND);
+            if (fd < 0) {
+                return false;
+            }
+            if (FileWrite(fd, aof_rewrite_buf_.data(), aof_rewrite_buf_.size()) != 0 || fsync(fd) != 0 ||
+                rename(tmp.c_str(), aof_file_.c_str()) != 0) {
+                close(fd);
+                return false;
+            }
+            close(aof_fd_);
+            aof_fd_ = fd;
+            struct stat st = {};
+            fstat(aof_fd_, &st);
+            aof_size_ = aof_base_size_ = static_cast<uint64_t>(st.st_size);
+            aof_unsynced_ = false;
+            return true;
+        }
+
+        bool SaveSnapshot() {
+            std::string tmp = snapshot_file_ + ".tmp";
+            int fd = OpenFile(tmp, O_CREAT | O_WRONLY | O_TRUNC);
+            if (fd < 0) {
+                return false;
+            }
+            bool ok = WriteSnapshot(fd, true);
+            close(fd);
+            return ok && rename(tmp.c_str(), snapshot_file_.c_str()) == 0;
+        }
+
+        bool WriteSnapshot(int fd, bool sync) {
+            SnapshotWriter writer(fd);
+            std::string hash;
+            bool ok = true;
+            for (auto it = map_.cbegin(); ok && it != map_.cend(); ++it) {
+                const Value & value = it->second;
+                if (value.type != kHashValue) {
+                    ok = writer.Add(value.type == kIntegerValue ? kSnapshotInteger : kSnapshotString,
+                                    it->first, value.View(number_));
+                } else if (value.dict == nullptr) {
+                    ok = writer.Add(kSnapshotHash, it->first, value.s);
+                } else {
+                    hash.clear();
+                    for (const auto & p:*value.dict) {
+                        std::string_view field_value = p.second;
+                        AppendHashEntry(&hash, p.first, &field_value);
+                    }
+                    ok = writer.Add(kSnapshotHash, it->first, hash);
+                }
+            }
+            return ok && writer.Finish(sync);
+        }
+
+        // Bytes of argv as a RESP array, which is how the stream carries it.
+        static size_t GetStreamSize(const rocksdb::autovector<std::string> & argv) {
+            char buf[kNumberBufferSize];
+            size_t n = 3 + ll2string(buf, sizeof(buf), static_cast<long long>(argv.size()));
+            for (const auto & arg:argv) {
+                n += 5 + ll2string(buf, sizeof(buf), static_cast<long long>(arg.size())) + arg.size();
+            }
+            return n;
+        }
+
+        // Writes what it can of the output of a client the executor holds,
+        // leaving the rest to the event loop.
+        static void SendOutput(int fd, Client * c, long curr_time, EventLoop<Client> * el) {
+            ssize_t nwrite = write(fd, c->output.data(), c->output.size());
+            if (nwrite > 0) {
+                c->output.erase(0, static_cast<size_t>(nwrite));
+                GetStats()->net_output_bytes.Add(nwrite);
+            }
+            if (!c->output.empty()) {
+                el->AddEvent(fd, kWritable);
+            }
+            CheckOutputBuffer(fd, c, curr_time, el);
+        }
+
+        // PSYNC replid offset, offset being where the stream of the replica
+        // ends: the rest of it from the backlog if it is still there,
+        // otherwise a full sync by the next child. The client of a replica is
+        // held until it is dropped.
+        void ExecutePsync(Client * c, int fd, const rocksdb::autovector<std::string> & argv, long curr_time) {
+            if (link_state_ != kLinkNone) {
+                RespMachine::AppendError(&c->output, "ERR this node is a replica, sync from its master");
+                return;
+            }
+            for (const auto & replica:replicas_) {
+                if (replica.c == c) {
+                    RespMachine::AppendError(&c->output, "ERR already a replica");
+                    return;
+                }
+            }
+            if (backlog_ == nullptr) {
+                backlog_ = std::make_unique<ReplicationBacklog>(GetConfig()->repl_backlog_size.load(), 0);
+            }
+            long long offset = 0;
+            ReplicaState state = kReplicaWaitSync;
+            if (argv[1] == replid_ && string2ll(argv[2].data(), argv[2].size(), &offset) && offset >= 0) {
+                size_t begin = c->output.size();
+                RespMachine::AppendSimpleString(&c->output, "CONTINUE " + replid_);
+                if (backlog_->Read(static_cast<uint64_t>(offset), &c->output)) {
+                    state = kReplicaOnline;
+                } else {
+                    c->output.resize(begin);
+                }
+            }
+            ++c->ref_count;
+            replicas_.push_back({c, fd, state, "", static_cast<uint64_t>(std::max(offset, 0LL)), curr_time, false});
+            LIN_LOG_INFO("Replica fd %d %s", fd, state == kReplicaOnline ? "continues its stream" : "needs a full sync");
+        }
+
+        // REPLCONF ACK offset, sent by a replica once a second and never
+        // answered. Whatever else it configures is accepted and ignored.
+        void ExecuteReplconf(Client * c, const rocksdb::autovector<std::string> & argv, long curr_time) {
+            if (strcasecmp(argv[1].c_str(), "ack") != 0) {
+                RespMachine::AppendSimpleString(&c->output, "OK");
+                return;
+            }
+            long long offset;
+            if (argv.size() != 3 || !string2ll(argv[2].data(), argv[2].size(), &offset) || offset < 0) {
+                return;
+            }
+            for (auto & replica:replicas_) {
+                if (replica.c == c) {
+                    replica.ack_offset = static_cast<uint64_t>(offset);
+                    replica.ack_time = curr_time;
+                }
+            }
+        }
+
+        // Adds to the backlog and sends to the replicas online. A replica
+        // syncing has it sent once the snapshot is.
+        void FeedReplicas(const std::string & s, long curr_time, EventLoop<Client> * el) {
+            backlog_->Append(s.data(), s.size());
+            for (auto & replica:replicas_) {
+                if (replica.state == kReplicaOnline) {
+                    bool blocked = !replica.c->output.empty();
+                    replica.c->output.append(s);
+                    if (!blocked && !replica.c->close) {
+                        SendOutput(replica.fd, replica.c, curr_time, el);
+                    }
+                } else if (replica.state != kReplicaWaitSync) {
+                    replica.pending.append(s);
+                }
+            }
+        }
+
+        // Drops the replicas that are gone, silent for too long or failed by
+        // their sync, puts those synced online, forks the next full sync and
+        // keeps the links alive with PINGs.
+        void ServeReplicas(long curr_time, EventLoop<Client> * el) {
+            bool waiting = false;
+            for (size_t i = 0; i < replicas_.size();) {
+                Replica & replica = replicas_[i];
+                Client * c = replica.c;
+                if (replica.state == kReplicaOnline && curr_time - replica.ack_time > kReplTimeout) {
+                    LIN_LOG_WARN("Replica fd %d timed out", replica.fd);
+                    replica.drop = true;
+                }
+                if (c->close || replica.drop) {
+                    if (!c->close) {
+                        ReleaseOrMarkClient(replica.fd, c, el);
+                    }
+                    if (--c->ref_count == 0) {
+                        el->Release(replica.fd);
+                    }
+                    LIN_LOG_INFO("Replica fd %d dropped", replica.fd);
+                    replicas_.erase(replicas_.begin() + i);
+                    continue;
+                }
+                if (replica.state == kReplicaReady) {
+                    anetNonBlock(nullptr, replica.fd);
+                    anetSendTimeout(nullptr, replica.fd, 0);
+                    replica.state = kReplicaOnline;
+                    replica.ack_time = curr_time;
+                    bool blocked = !c->output.empty();
+                    c->output.append(replica.pending);
+                    replica.pending.clear();
+                    replica.pending.shrink_to_fit();
+                    if (!blocked && !c->output.empty()) {
+                        SendOutput(replica.fd, c, curr_time, el);
+                    }
+                    LIN_LOG_INFO("Replica fd %d online", replica.fd);
+                }
+                waiting = waiting || replica.state == kReplicaWaitSync;
+                ++i;
+            }
+
+            if (waiting && child_type_ == kNoChild) {
+                full_sync_offset_ = backlog_->GetOffset();
+                for (auto & replica:replicas_) {
+                    if (replica.state == kReplicaWaitSync) {
+                        replica.state = kReplicaSyncing;
+                    }
+                }
+                if (!StartChild(kSyncChild, curr_time)) {
+                    for (auto & replica:replicas_) {
+                        replica.drop = replica.drop || replica.state == kReplicaSyncing;
+                    }
+                }
+            }
+            if (!replicas_.empty() && curr_time - last_ping_time_ >= kReplPingInterval) {
+                last_ping_time_ = curr_time;
+                ping_.clear();
+                RespMachine::AppendArrayLength(&ping_, 1);
+                RespMachine::AppendBulkString(&ping_, "PING");
+                FeedReplicas(ping_, curr_time, el);
+            }
+        }
+
+        // In the child: the FULLRESYNC reply, then the snapshot between two
+        // EOF marks, to each replica about to sync. The parent leaves their
+        // sockets alone until it reaps, so the writes here block, up to the
+        // timeout.
+        bool SendSnapshots() {
+            bool ok = true;
+            for (const auto & replica:replicas_) {
+                if (replica.state != kReplicaSyncing) {
+                    continue;
+                }
+                anetBlock(nullptr, replica.fd);
+                anetSendTimeout(nullptr, replica.fd, kReplTimeout * 1000);
+                std::string mark = GenerateReplicationId();
+                std::string header = "+FULLRESYNC " + replid_ + " " + std::to_string(full_sync_offset_) +
+                                     "\r\n$EOF:" + mark + "\r\n";
+                ok = FileWrite(replica.fd, header.data(), header.size()) == 0 &&
+                     WriteSnapshot(replica.fd, false) &&
+                     FileWrite(replica.fd, mark.data(), mark.size()) == 0 && ok;
+            }
+            return ok;
+        }
+
+        // Keeps the link to the master: reconnects a second after losing it,
+        // once what came over the old link is applied, and acknowledges the
+        // stream applied so far once a second.
+        void ServeLink(long curr_time, EventLoop<Client> * el) {
+            if (master_ == nullptr) {
+                if (link_state_ == kLinkConnect && curr_time >= link_retry_time_) {
+                    ConnectMaster(curr_time, el);
+                }
+                return;
+            }
+            bool timeout = curr_time - master_->last_mod_time > kReplTimeout;
+            if (master_->close || link_drop_ || link_state_ == kLinkNone || timeout) {
+                if (!master_->close) {
+                    if (timeout) {
+                        LIN_LOG_WARN("Master %s:%d timed out", master_host_.c_str(), master_port_);
+                    }
+                    ReleaseOrMarkClient(master_fd_, master_, el);
+                }
+                if (master_->ref_count > 1) { /* Its stream is still queued */
+                    return;
+                }
+                --master_->ref_count;
+                el->Release(master_fd_);
+                master_ = nullptr;
+                master_fd_ = -1;
+                link_drop_ = false;
+                if (sync_fd_ != -1) {
+                    close(sync_fd_);
+                    sync_fd_ = -1;
+                    unlink((snapshot_file_ + ".sync").c_str());
+                }
+                if (link_state_ != kLinkNone) {
+                    LIN_LOG_WARN("Lost the link to master %s:%d", master_host_.c_str(), master_port_);
+                    link_state_ = kLinkConnect;
+                    link_retry_time_ = curr_time + 1;
+                }
+                return;
+            }
+            if (link_state_ == kLinkConnected && curr_time != last_ack_time_) {
+                last_ack_time_ = curr_time;
+                bool blocked = !master_->output.empty();
+                std::string offset = std::to_string(master_offset_);
+                RespMachine::AppendArrayLength(&master_->output, 3);
+                RespMachine::AppendBulkString(&master_->output, "REPLCONF");
+                RespMachine::AppendBulkString(&master_->output, "ACK");
+                RespMachine::AppendBulkString(&master_->output, offset);
+                if (!blocked) {
+                    SendOutput(master_fd_, master_, curr_time, el);
+                }
+            }
+        }
+
+        // The link is a client of the event loop like any other, held by the
+        // executor, whose first output is the PSYNC.
+        void ConnectMaster(long curr_time, EventLoop<Client> * el) {
+            link_retry_time_ = curr_time + 1;
+            char err[ANET_ERR_LEN];
+            int fd = anetTcpNonBlockConnect(err, &master_host_[0], master_port_);
+            if (fd < 0) {
+                LIN_LOG_WARN("Failed connecting to master %s:%d. Error message: '%s'", master_host_.c_str(),
+                             master_port_, err);
+                return;
+            }
+            auto client = std::make_unique<Client>(fd, curr_time);
+            Client * c = client.get();
+            if (el->Acquire(fd, std::move(client)) != 0) {
+                close(fd);
+                LIN_LOG_WARN("Failed acquiring the fd of the master link");
+                return;
+            }
+            if (el->AddEvent(fd, kReadable | kWritable) != 0) {
+                el->Release(fd);
+                LIN_LOG_WARN("Failed adding the events of the master link. Error message: '%s'", strerror(errno));
+                return;
+            }
+            anetEnableTcpNoDelay(nullptr, fd);
+            c->master = true;
+            c->syncing = true;
+            ++c->ref_count;
+            bool known = !master_replid_.empty();
+            RespMachine::AppendArrayLength(&c->output, 3);
+            RespMachine::AppendBulkString(&c->output, "PSYNC");
+            RespMachine::AppendBulkString(&c->output, known ? master_replid_ : "?");
+            RespMachine::AppendBulkString(&c->output, known ? std::to_string(master_offset_) : "-1");
+            master_ = c;
+            master_fd_ = fd;
+            link_state_ = kLinkHandshake;
+        }
+
+        // Replaces the map with the snapshot the master sent, which becomes
+        // the snapshot file, and rewrites the AOF from it.
+        bool LoadSync(long curr_time) {
+            long begun = GetCurrentTimeInMilliseconds();
+            std::string name = snapshot_file_ + ".sync";
+            std::string err = "failed syncing";
+            bool ok = fsync(sync_fd_) == 0;
+            close(sync_fd_);
+            sync_fd_ = -1;
+            if (child_type_ != kNoChild) {
+                DiscardChild();
+            }
+            map_.clear();
+            int fd = OpenFile(name, O_RDONLY);
+            Loader loader(&map_);
+            uint64_t entries = 0;
+            if (fd < 0) {
+                err = strerror(errno);
+            }
+            ok = ok && fd >= 0 && LoadSnapshot(fd, std::thread::hardware_concurrency(), &loader, &entries, &err);
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (!ok || rename(name.c_str(), snapshot_file_.c_str()) != 0) {
+                LIN_LOG_ERROR("Failed loading the snapshot of master %s:%d: %s", master_host_.c_str(), master_port_,
+                              err.c_str());
+                map_.clear();
+                return false;
+            }
+            last_save_time_ = curr_time;
+            if (aof_fd_ != -1) {
+                close(aof_fd_);
+                aof_fd_ = -1;
+                if (!RewriteAof() || rename((aof_file_ + ".rewrite").c_str(), aof_file_.c_str()) != 0 || !OpenAof()) {
+                    LIN_LOG_ERROR("Failed rewriting %s after a full sync", aof_file_.c_str());
+                    exit(1);
+                }
+            }
+            master_replid_ = sync_replid_;
+            master_offset_ = sync_offset_;
+            LIN_LOG_INFO("Loaded %lu keys from master %s:%d in %ld ms", static_cast<unsigned long>(entries),
+                         master_host_.c_str(), master_port_, static_cast<long>(GetCurrentTimeInMilliseconds() - begun));
+            return true;
+        }
+
+        // Kills the child in progress, whose work is stale.
+        void DiscardChild() {
+            kill(child_pid_, SIGKILL);
+            waitpid(child_pid_, nullptr, 0);
+            LIN_LOG_WARN("Killed the background %s of pid %d", kChildNames[child_type_], static_cast<int>(child_pid_));
+            if (child_type_ == kSnapshotChild) {
+                unlink((snapshot_file_ + ".tmp").c_str());
+            } else if (child_type_ == kRewriteChild) {
+                unlink((aof_file_ + ".rewrite").c_str());
+                aof_rewrite_buf_.clear();
+            } else {
+                for (auto & replica:replicas_) {
+                    replica.drop = replica.drop || replica.state == kReplicaSyncing;
+                }
+            }
+            child_pid_ = -1;
+            child_type_ = kNoChild;
+        }
+
+        // Null if k is absent. Returns false with the error reply appended if
+        // it holds something else than a hash.
+        bool LookupHash(const std::string & k, Value ** value, std::string * out) {
+            auto it = map_.find(k);
+            if (it == map_.end()) {
+                *value = nullptr;
+                return true;
+            }
+            if (it->second.type != kHashValue) {
+                RespMachine::AppendError(out, kWrongTypeError);
+                return false;
+            }
+            *value = &it->second;
+            return true;
+        }
+
+        static bool HashGet(Value * value, const std::string_view & field, std::string_view * field_value) {
+            if (value->dict != nullptr) {
+                auto it = value->dict->find(std::string(field));
+                if (it == value->dict->cend()) {
+                    return false;
+                }
+                *field_value = it->second;
+                return true;
+            }
+            return Listpack(&value->s).Find(field, field_value);
+        }
+
+        // Returns true if the field is new. The listpack becomes a map once
+        // it would hold too many entries or a long field or value.
+        static bool HashSet(Value * value, const std::string_view & field, const std::string_view & field_value) {
+            if (value->dict == nullptr) {
+                Listpack listpack(&value->s);
+                std::string_view old;
+                if (field.size() <= kHashMaxListpackValue && field_value.size() <= kHashMaxListpackValue &&
+                    (listpack.Find(field, &old) || listpack.Size() < kHashMaxListpackEntries)) {
+                    return listpack.Set(field, field_value);
+                }
+                ConvertToDict(value);
+            }
+            return value->dict->insert_or_assign(std::string(field), field_value).second;
+        }
+
+        static bool FitsListpack(std::string * s) {
+            size_t n = 0;
+            bool fits = true;
+            Listpack(s).ForEach([&](const std::string_view & f, const std::string_view & v) {
+                fits = fits && ++n <= kHashMaxListpackEntries &&
+                       f.size() <= kHashMaxListpackValue && v.size() <= kHashMaxListpackValue;
+            });
+            return fits;
+        }
+
+        static void ConvertToDict(Value * value) {
+            value->dict = std::make_unique<std::unordered_map<std::string, std::string>>();
+            Listpack(&value->s).ForEach([value](const std::string_view & f, const std::string_view & v) {
+                value->dict->emplace(f, v);
+            });
+            value->s.clear();
+            value->s.shrink_to_fit();
+        }
+
+    private:
+        FairQueue<Client *, Task> tasks_;
+        std::vector<Task> running_;
+        std::map<std::string, Value> map_;
+        std::string info_;
+        ScanCursors cursors_;
+        std::string scan_key_;
+        std::vector<std::string_view> scan_matches_;
+        std::string range_;
+        char number_[kNumberBufferSize];
+
+        std::string snapshot_file_;
+        pid_t child_pid_ = -1;
+        ChildType child_type_ = kNoChild;
+        long child_begun_ = 0;
+        long last_save_time_;
+        long last_bgsave_time_ = -1;
+        long long last_fork_usec_ = 0;
+        bool last_bgsave_ok_ = true;
+
+        std::string aof_file_;
+        int aof_fd_ = -1;
+        std::string propagate_buf_;
+        std::string aof_rewrite_buf_;
+        std::vector<std::pair<std::string_view, std::string_view>> rewrite_fields_;
+        uint64_t aof_size_ = 0;
+        uint64_t aof_base_size_ = 0; /* After the last rewrite */
+        bool aof_unsynced_ = false;
+        bool last_rewrite_ok_ = true;
+
+        std::string replid_;
+        std::unique_ptr<ReplicationBacklog> backlog_;
+        std::vector<Replica> replicas_;
+        uint64_t full_sync_offset_ = 0; /* Of the snapshot the sync child sends */
+        long last_ping_time_ = 0;
+        std::string ping_;
+
+        std::string master_host_;
+        int master_port_ = 0;
+        LinkState link_state_ = kLinkNone;
+        Client * master_ = nullptr;
+        int master_fd_ = -1;
+        bool link_drop_ = false;
+        long link_retry_time_ = 0;
+        long last_ack_time_ = 0;
+        std::string master_replid_;     /* Empty until the first full sync */
+        uint64_t master_offset_ = 0;    /* Of the stream applied */
+        std::string sync_replid_;
+        uint64_t sync_offset_ = 0;
+        std::string sync_mark_;
+        int sync_fd_ = -1;
+        uint64_t sync_bytes_ = 0;
+        std::string discard_;
     };
 
     std::unique_ptr<Executor>
-    OpenExecutorMem() {
-        return std::make_unique<ExecutorMemImpl>();
+    OpenExecutorMem(const std::string & snapshot, const std::string & aof) {
+        auto executor = std::make_unique<ExecutorMemImpl>(snapshot, aof);
+        if (!aof.empty() ? !executor->LoadAof() : !snapshot.empty() && !executor->LoadSnapshotFile()) {
+            return nullptr;
+        }
+        return executor;
     }
 }
\ No newline at end of file
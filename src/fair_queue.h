@@ -0,0 +1,54 @@
+#pragma once
+#ifndef CHEAPIS_FAIR_QUEUE_H
+#define CHEAPIS_FAIR_QUEUE_H
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+namespace cheapis {
+    // One FIFO per owner, served round-robin. A client pipelining thousands of
+    // commands gets one slot per round like everyone else, while the order of
+    // its own commands is kept.
+    template<typename K, typename T>
+    class FairQueue {
+    public:
+        T & EmplaceBack(K owner) {
+            auto & q = queues_[owner];
+            if (q.empty()) {
+                ring_.emplace_back(owner);
+            }
+            ++size_;
+            return q.emplace_back();
+        }
+
+        void PopFront(size_t n, std::vector<T> * out) {
+            while (n != 0 && !ring_.empty()) {
+                K owner = ring_.front();
+                ring_.pop_front();
+
+                auto it = queues_.find(owner);
+                auto & q = it->second;
+                out->emplace_back(std::move(q.front()));
+                q.pop_front();
+                --size_;
+                --n;
+
+                if (q.empty()) {
+                    queues_.erase(it);
+                } else {
+                    ring_.emplace_back(owner);
+                }
+            }
+        }
+
+        size_t Size() const { return size_; }
+
+    private:
+        std::unordered_map<K, std::deque<T>> queues_;
+        std::deque<K> ring_;
+        size_t size_ = 0;
+    };
+}
+
+#endif //CHEAPIS_FAIR_QUEUE_H
@@ -31,9 +31,11 @@ namespace gujia {
 #include <memory>
 #include <type_traits>
 #include <unistd.h>
+#include <vector>
 
 namespace gujia {
     constexpr size_t kDefaultSize = 10000;
+    constexpr size_t kChunkSize = 4096;
 
     enum {
         kNone = 0,
@@ -41,10 +43,21 @@ namespace gujia {
         kWritable = 1 << 1,
     };
 
-    template<typename T, size_t SIZE = kDefaultSize>
+    // Resources live in fixed-size chunks allocated on demand, so the table
+    // grows with the highest fd in use while references stay valid. The set
+    // size caps the fds accepted and sizes the event array.
+    //
+    // In edge-triggered mode an fd is registered for both directions once.
+    // Later mask changes are bookkeeping only, so callers must drain fds until
+    // EAGAIN, ignore events outside their mask and call RearmEvent() when they
+    // stop early with data left.
+    template<typename T>
     class EventLoop {
     public:
-        explicit EventLoop(int el_fd) : el_fd_(el_fd) {}
+        explicit EventLoop(int el_fd, size_t set_size = kDefaultSize,
+                           bool edge_triggered = false)
+                : el_fd_(el_fd), set_size_(set_size), edge_triggered_(edge_triggered),
+                  events_(set_size) {}
 
         ~EventLoop();
 
@@ -52,9 +65,13 @@ namespace gujia {
 
         int DelEvent(int fd, int mask);
 
+        int RearmEvent(int fd);
+
+        bool IsEdgeTriggered() const { return edge_triggered_; }
+
         int Poll(const struct timeval * tvp);
 
-        const std::array<Event, SIZE> &
+        const std::vector<Event> &
         GetEvents() const { return events_; }
 
         static int GetEventFD(const Event & e);
@@ -72,21 +89,31 @@ namespace gujia {
 
         int GetMaxFD() const { return max_fd_; }
 
+        size_t GetSetSize() const { return set_size_; }
+
         std::unique_ptr<T> &
-        GetResource(int fd) { return resources_[fd]; }
+        GetResource(int fd) { return GetSlot(fd).resource; }
+
+    private:
+        struct Slot {
+            std::unique_ptr<T> resource;
+            int mask = kNone;
+        };
+
+        typedef std::array<Slot, kChunkSize> Chunk;
 
-        std::array<std::unique_ptr<T>, SIZE> &
-        GetResources() { return resources_; }
+        Slot & GetSlot(int fd) {
+            assert(fd >= 0 && static_cast<size_t>(fd) / kChunkSize < chunks_.size());
+            return (*chunks_[fd / kChunkSize])[fd % kChunkSize];
+        }
 
     private:
         int el_fd_;
         int max_fd_ = -1;
-        std::array<Event, SIZE> events_;
-        std::array<std::unique_ptr<T>, SIZE> resources_;
-
-#if defined(GUJIA_HAS_EPOLL)
-        std::array<int, SIZE> masks_{};
-#endif
+        size_t set_size_;
+        bool edge_triggered_;
+        std::vector<Event> events_;
+        std::vector<std::unique_ptr<Chunk>> chunks_;
     };
 }
 
@@ -6,39 +6,56 @@
 
 #if defined(GUJIA_HAS_EPOLL)
 namespace gujia {
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
     AddEvent(int fd, int mask) {
-        mask |= masks_[fd]; /* Merge old events */
-        if (mask == masks_[fd]) {
+        int & old_mask = GetSlot(fd).mask;
+        mask |= old_mask; /* Merge old events */
+        if (mask == old_mask) {
+            return 0;
+        }
+
+        /* Edge triggered fds stay registered for both directions. Only a newly
+         * wanted read needs a MOD, which also reports data that arrived while
+         * reading was off. */
+        if (edge_triggered_ && old_mask != kNone) {
+            if ((mask & ~old_mask & kReadable) && RearmEvent(fd) == -1) return -1;
+            old_mask = mask;
             return 0;
         }
 
         /* If the fd was already monitored for some event, we need a MOD
          * operation. Otherwise we need an ADD operation. */
-        int op = masks_[fd] == kNone ?
+        int op = old_mask == kNone ?
                  EPOLL_CTL_ADD : EPOLL_CTL_MOD;
 
         struct epoll_event ee = {0};
-        if (mask & kReadable) ee.events |= EPOLLIN;
-        if (mask & kWritable) ee.events |= EPOLLOUT;
+        if (edge_triggered_) {
+            ee.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        } else {
+            if (mask & kReadable) ee.events |= EPOLLIN;
+            if (mask & kWritable) ee.events |= EPOLLOUT;
+        }
         ee.data.fd = fd;
         if (epoll_ctl(el_fd_, op, fd, &ee) == -1) return -1;
-        masks_[fd] = mask;
+        old_mask = mask;
         return 0;
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
     DelEvent(int fd, int del_mask) {
-        int mask = masks_[fd] & (~del_mask);
-        if (mask == masks_[fd]) {
+        int & old_mask = GetSlot(fd).mask;
+        int mask = old_mask & (~del_mask);
+        if (mask == old_mask) {
             return 0;
         }
 
         struct epoll_event ee = {0};
         ee.data.fd = fd;
-        if (mask != kNone) {
+        if (mask != kNone && edge_triggered_) {
+            /* Still registered for both directions */
+        } else if (mask != kNone) {
             if (mask & kReadable) ee.events |= EPOLLIN;
             if (mask & kWritable) ee.events |= EPOLLOUT;
             epoll_ctl(el_fd_, EPOLL_CTL_MOD, fd, &ee);
@@ -47,38 +64,51 @@ namespace gujia {
              * EPOLL_CTL_DEL. */
             epoll_ctl(el_fd_, EPOLL_CTL_DEL, fd, &ee);
         }
-        masks_[fd] = mask;
+        old_mask = mask;
         return 0;
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
+    RearmEvent(int fd) {
+        if (!edge_triggered_ || GetSlot(fd).mask == kNone) {
+            return 0;
+        }
+
+        struct epoll_event ee = {0};
+        ee.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ee.data.fd = fd;
+        return epoll_ctl(el_fd_, EPOLL_CTL_MOD, fd, &ee);
+    }
+
+    template<typename T>
+    int EventLoop<T>::
     Poll(const struct timeval * tvp) {
         return epoll_wait(el_fd_,
                           events_.data(), static_cast<int>(events_.size()),
                           tvp ? (tvp->tv_sec * 1000 + tvp->tv_usec / 1000) : -1);
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
     GetEventFD(const Event & e) {
         return e.data.fd;
     }
 
-    template<typename T, size_t SIZE>
-    bool EventLoop<T, SIZE>::
+    template<typename T>
+    bool EventLoop<T>::
     IsEventReadable(const Event & e) {
         return e.events & EPOLLIN;
     }
 
-    template<typename T, size_t SIZE>
-    bool EventLoop<T, SIZE>::
+    template<typename T>
+    bool EventLoop<T>::
     IsEventWritable(const Event & e) {
         return e.events & (EPOLLOUT | EPOLLERR | EPOLLHUP);
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
     Open() {
         return epoll_create(1024); /* 1024 is just a hint for the kernel */
     }
@@ -12,45 +12,46 @@
 #endif
 
 namespace gujia {
-    template<typename T, size_t SIZE>
-    EventLoop<T, SIZE>::
+    template<typename T>
+    EventLoop<T>::
     ~EventLoop() {
         close(el_fd_);
         for (int fd = 0; fd <= max_fd_; ++fd) {
-            if (resources_[fd] != nullptr) {
+            if (GetSlot(fd).resource != nullptr) {
                 close(fd);
             }
         }
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
     Acquire(int fd, std::unique_ptr<T> && resource) {
         assert(fd >= 0 && resource != nullptr);
-        if (fd >= resources_.size()) {
+        if (static_cast<size_t>(fd) >= set_size_) {
             return -1;
         }
+        while (fd / kChunkSize >= chunks_.size()) {
+            chunks_.emplace_back(std::make_unique<Chunk>());
+        }
 
-        resources_[fd].swap(resource);
+        GetSlot(fd).resource.swap(resource);
         assert(resource == nullptr);
         max_fd_ = std::max(max_fd_, fd);
         return 0;
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
     Release(int fd) {
         assert(fd >= 0 && fd <= max_fd_);
-        resources_[fd].reset();
+        Slot & slot = GetSlot(fd);
+        slot.resource.reset();
+        slot.mask = kNone;
         if (fd == max_fd_) {
             do {
                 --max_fd_;
-            } while (max_fd_ != -1 && resources_[max_fd_] == nullptr);
+            } while (max_fd_ != -1 && GetSlot(max_fd_).resource == nullptr);
         }
-
-#if defined(GUJIA_HAS_EPOLL)
-        masks_[fd] = 0;
-#endif
         return close(fd);
     }
 }
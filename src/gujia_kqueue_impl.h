@@ -6,9 +6,37 @@
 
 #if defined(GUJIA_HAS_KQUEUE)
 namespace gujia {
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    /* Adds the read (and optionally write) filter with EV_CLEAR, the kqueue
+     * flavour of EPOLLET. Re-adding an existing filter re-arms it. */
+    inline int KqueueAddClear(int el_fd, int fd, bool writable) {
+        struct kevent ke[2];
+        int n = 0;
+        EV_SET(&ke[n++], fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, nullptr);
+        if (writable) {
+            EV_SET(&ke[n++], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, nullptr);
+        }
+        return kevent(el_fd, ke, n, nullptr, 0, nullptr) == -1 ? -1 : 0;
+    }
+
+    template<typename T>
+    int EventLoop<T>::
     AddEvent(int fd, int mask) {
+        if (edge_triggered_) {
+            int & old_mask = GetSlot(fd).mask;
+            mask |= old_mask;
+            if (mask == old_mask) {
+                return 0;
+            }
+            /* Same as epoll: register both filters once, re-add the read filter
+             * only when reading is wanted again. */
+            if ((old_mask == kNone || (mask & ~old_mask & kReadable)) &&
+                KqueueAddClear(el_fd_, fd, old_mask == kNone) == -1) {
+                return -1;
+            }
+            old_mask = mask;
+            return 0;
+        }
+
         struct kevent ke;
         if (mask & kReadable) {
             EV_SET(&ke, fd, EVFILT_READ, EV_ADD, 0, 0, nullptr);
@@ -21,9 +49,19 @@ namespace gujia {
         return 0;
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
     DelEvent(int fd, int mask) {
+        if (edge_triggered_) {
+            int & old_mask = GetSlot(fd).mask;
+            if (old_mask == kNone || (old_mask & ~mask) != kNone) {
+                old_mask &= ~mask;
+                return 0;
+            }
+            old_mask = kNone;
+            mask = kReadable | kWritable;
+        }
+
         struct kevent ke;
         if (mask & kReadable) {
             EV_SET(&ke, fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
@@ -36,8 +74,17 @@ namespace gujia {
         return 0;
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
+    RearmEvent(int fd) {
+        if (!edge_triggered_ || GetSlot(fd).mask == kNone) {
+            return 0;
+        }
+        return KqueueAddClear(el_fd_, fd, false);
+    }
+
+    template<typename T>
+    int EventLoop<T>::
     Poll(const struct timeval * tvp) {
         if (tvp != nullptr) {
             struct timespec timeout;
@@ -53,26 +100,26 @@ namespace gujia {
         }
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
     GetEventFD(const Event & e) {
         return static_cast<int>(e.ident);
     }
 
-    template<typename T, size_t SIZE>
-    bool EventLoop<T, SIZE>::
+    template<typename T>
+    bool EventLoop<T>::
     IsEventReadable(const Event & e) {
         return e.filter == EVFILT_READ;
     }
 
-    template<typename T, size_t SIZE>
-    bool EventLoop<T, SIZE>::
+    template<typename T>
+    bool EventLoop<T>::
     IsEventWritable(const Event & e) {
         return e.filter == EVFILT_WRITE;
     }
 
-    template<typename T, size_t SIZE>
-    int EventLoop<T, SIZE>::
+    template<typename T>
+    int EventLoop<T>::
     Open() {
         return kqueue();
     }
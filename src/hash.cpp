@@ -0,0 +1,137 @@
+#include "hash.h"
+
+namespace cheapis {
+    static void AppendVarint(std::string * buf, uint32_t v) {
+        while (v >= 0x80) {
+            buf->push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        buf->push_back(static_cast<char>(v));
+    }
+
+    static size_t GetVarintSize(uint32_t v) {
+        size_t n = 1;
+        while (v >= 0x80) {
+            v >>= 7;
+            ++n;
+        }
+        return n;
+    }
+
+    static bool ReadVarint(const std::string_view & buf, size_t * pos, uint32_t * v) {
+        uint32_t result = 0;
+        for (uint32_t shift = 0; shift <= 28 && *pos < buf.size(); shift += 7) {
+            auto byte = static_cast<uint8_t>(buf[(*pos)++]);
+            result |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                *v = result;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void AppendHashEntry(std::string * buf, const std::string_view & field, const std::string_view * value) {
+        AppendVarint(buf, static_cast<uint32_t>(field.size()));
+        buf->append(field);
+        if (value != nullptr) {
+            AppendVarint(buf, static_cast<uint32_t>(value->size() + 1));
+            buf->append(*value);
+        } else {
+            AppendVarint(buf, 0);
+        }
+    }
+
+    size_t GetHashEntrySize(const std::string_view & field, const std::string_view * value) {
+        size_t n = GetVarintSize(static_cast<uint32_t>(field.size())) + field.size();
+        if (value != nullptr) {
+            n += GetVarintSize(static_cast<uint32_t>(value->size() + 1)) + value->size();
+        } else {
+            n += 1;
+        }
+        return n;
+    }
+
+    bool NextHashEntry(const std::string_view & buf, size_t * pos,
+                       std::string_view * field, std::string_view * value, bool * deleted) {
+        uint32_t len;
+        if (*pos >= buf.size() || !ReadVarint(buf, pos, &len) || buf.size() - *pos < len) {
+            return false;
+        }
+        *field = buf.substr(*pos, len);
+        *pos += len;
+        if (!ReadVarint(buf, pos, &len)) {
+            return false;
+        }
+        *deleted = len == 0;
+        if (len != 0) {
+            if (buf.size() - *pos < len - 1) {
+                return false;
+            }
+            *value = buf.substr(*pos, len - 1);
+            *pos += len - 1;
+        }
+        return true;
+    }
+
+    bool Listpack::Locate(const std::string_view & field, size_t * begin, size_t * end) const {
+        size_t pos = 0;
+        std::string_view f;
+        std::string_view v;
+        bool deleted;
+        while (true) {
+            size_t entry = pos;
+            if (!NextHashEntry(*buf_, &pos, &f, &v, &deleted)) {
+                return false;
+            }
+            if (f == field) {
+                *begin = entry;
+                *end = pos;
+                return true;
+            }
+        }
+    }
+
+    bool Listpack::Find(const std::string_view & field, std::string_view * value) const {
+        size_t pos = 0;
+        std::string_view f;
+        std::string_view v;
+        bool deleted;
+        while (NextHashEntry(*buf_, &pos, &f, &v, &deleted)) {
+            if (f == field) {
+                *value = v;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Listpack::Set(const std::string_view & field, const std::string_view & value) {
+        size_t begin;
+        size_t end;
+        if (Locate(field, &begin, &end)) {
+            std::string entry;
+            AppendHashEntry(&entry, field, &value);
+            buf_->replace(begin, end - begin, entry);
+            return false;
+        }
+        AppendHashEntry(buf_, field, &value);
+        return true;
+    }
+
+    bool Listpack::Erase(const std::string_view & field) {
+        size_t begin;
+        size_t end;
+        if (Locate(field, &begin, &end)) {
+            buf_->erase(begin, end - begin);
+            return true;
+        }
+        return false;
+    }
+
+    size_t Listpack::Size() const {
+        size_t n = 0;
+        ForEach([&n](const std::string_view &, const std::string_view &) { ++n; });
+        return n;
+    }
+}
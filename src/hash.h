@@ -0,0 +1,63 @@
+#pragma once
+#ifndef CHEAPIS_HASH_H
+#define CHEAPIS_HASH_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cheapis {
+    constexpr size_t kHashMaxListpackEntries = 128;
+    constexpr size_t kHashMaxListpackValue = 64;
+
+    constexpr const char * kWrongTypeError = "WRONGTYPE Operation against a key holding the wrong kind of value";
+
+    // A hash entry is the varint length of the field, the field, the varint
+    // length of the value plus one and the value. A length of 0 instead marks
+    // the field deleted, which only delta records on disk have.
+    void AppendHashEntry(std::string * buf, const std::string_view & field, const std::string_view * value);
+
+    size_t GetHashEntrySize(const std::string_view & field, const std::string_view * value);
+
+    // Reads the entry at *pos and moves past it, value null if deleted.
+    // Returns false at the end or if the entry is cut short.
+    bool NextHashEntry(const std::string_view & buf, size_t * pos,
+                       std::string_view * field, std::string_view * value, bool * deleted);
+
+    // Field-value pairs of a small hash packed into one string and looked up
+    // by a linear scan, which for a few dozen short entries is faster and far
+    // smaller than a node per entry.
+    class Listpack {
+    public:
+        explicit Listpack(std::string * buf) : buf_(buf) {}
+
+        bool Find(const std::string_view & field, std::string_view * value) const;
+
+        // Returns true if the field is new.
+        bool Set(const std::string_view & field, const std::string_view & value);
+
+        bool Erase(const std::string_view & field);
+
+        size_t Size() const;
+
+        template<typename F>
+        void ForEach(F && f) const {
+            size_t pos = 0;
+            std::string_view field;
+            std::string_view value;
+            bool deleted;
+            while (NextHashEntry(*buf_, &pos, &field, &value, &deleted)) {
+                f(field, value);
+            }
+        }
+
+    private:
+        // Where the entry of field starts and ends, false if absent.
+        bool Locate(const std::string_view & field, size_t * begin, size_t * end) const;
+
+    private:
+        std::string * buf_;
+    };
+}
+
+#endif //CHEAPIS_HASH_H
@@ -0,0 +1,64 @@
+#pragma once
+#ifndef CHEAPIS_HISTOGRAM_H
+#define CHEAPIS_HISTOGRAM_H
+
+#include <cstdint>
+
+#include "counter.h"
+
+namespace cheapis {
+    // Log-linear (HDR style) histogram. Values below kSubCount get a bucket
+    // each; above that every power of two is split into kSubCount buckets, so
+    // a bucket is never wider than 1/kSubCount of its lower bound.
+    class Histogram {
+    public:
+        static constexpr int kSubBits = 4;
+        static constexpr int kSubCount = 1 << kSubBits;
+        static constexpr int kBucketCount = (64 - kSubBits + 1) * kSubCount;
+
+        void Record(uint64_t v) { ++buckets_[GetBucket(v)]; }
+
+        void AddTo(uint64_t * sum) const {
+            for (int i = 0; i < kBucketCount; ++i) {
+                sum[i] += static_cast<uint64_t>(buckets_[i].Get());
+            }
+        }
+
+        static int GetBucket(uint64_t v) {
+            if (v < kSubCount) {
+                return static_cast<int>(v);
+            }
+            int e = 63 - __builtin_clzll(v);
+            return (e - kSubBits + 1) * kSubCount +
+                   static_cast<int>((v >> (e - kSubBits)) & (kSubCount - 1));
+        }
+
+        static uint64_t GetBucketUpperBound(int bucket) {
+            if (bucket < kSubCount) {
+                return static_cast<uint64_t>(bucket);
+            }
+            int e = bucket / kSubCount + kSubBits - 1;
+            uint64_t sub = static_cast<uint64_t>(bucket % kSubCount);
+            uint64_t lower = (1ULL << e) | (sub << (e - kSubBits));
+            return lower + ((1ULL << (e - kSubBits)) - 1);
+        }
+
+        // Upper bound of the bucket holding the p-th percentile (0 < p <= 100).
+        static uint64_t GetPercentile(const uint64_t * buckets, uint64_t count, double p) {
+            auto rank = static_cast<uint64_t>(count * p / 100.0 + 0.5);
+            uint64_t seen = 0;
+            for (int i = 0; i < kBucketCount; ++i) {
+                seen += buckets[i];
+                if (seen >= rank && seen != 0) {
+                    return GetBucketUpperBound(i);
+                }
+            }
+            return 0;
+        }
+
+    private:
+        Counter buckets_[kBucketCount];
+    };
+}
+
+#endif //CHEAPIS_HISTOGRAM_H
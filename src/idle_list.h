@@ -0,0 +1,69 @@
+#pragma once
+#ifndef CHEAPIS_IDLE_LIST_H
+#define CHEAPIS_IDLE_LIST_H
+
+namespace cheapis {
+    class IdleList;
+
+    // Intrusive node of an IdleList. Unlinks itself on destruction, so owners
+    // can be freed anywhere without telling the list.
+    class IdleNode {
+    public:
+        IdleNode() = default;
+
+        IdleNode(const IdleNode &) = delete;
+
+        IdleNode & operator=(const IdleNode &) = delete;
+
+        ~IdleNode() { Unlink(); }
+
+        void Unlink() {
+            if (prev_ != nullptr) {
+                prev_->next_ = next_;
+                next_->prev_ = prev_;
+                prev_ = next_ = nullptr;
+            }
+        }
+
+    private:
+        IdleNode * prev_ = nullptr;
+        IdleNode * next_ = nullptr;
+
+        friend class IdleList;
+    };
+
+    // Nodes ordered by last activity, the longest idle one at the front.
+    // Every timeout shares the same length, so touching a node (move to back)
+    // keeps the order and expiring costs only the number of expired nodes.
+    class IdleList {
+    public:
+        IdleList() { head_.prev_ = head_.next_ = &head_; }
+
+        ~IdleList() {
+            while (head_.next_ != &head_) {
+                head_.next_->Unlink();
+            }
+            head_.prev_ = head_.next_ = nullptr;
+        }
+
+        IdleNode * Front() {
+            return head_.next_ != &head_ ? head_.next_ : nullptr;
+        }
+
+        void Touch(IdleNode * node) {
+            if (node->next_ == &head_) {
+                return;
+            }
+            node->Unlink();
+            node->prev_ = head_.prev_;
+            node->next_ = &head_;
+            head_.prev_->next_ = node;
+            head_.prev_ = node;
+        }
+
+    private:
+        IdleNode head_;
+    };
+}
+
+#endif //CHEAPIS_IDLE_LIST_H
@@ -0,0 +1,103 @@
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "incr.h"
+#include "resp_machine.h"
+#include "util.h"
+
+namespace cheapis {
+    static bool ParseLongDouble(const std::string_view & s, long double * ld) {
+        char buf[kNumberBufferSize];
+        if (s.empty() || s.size() >= sizeof(buf) || isspace(static_cast<unsigned char>(s[0]))) {
+            return false;
+        }
+        memcpy(buf, s.data(), s.size());
+        buf[s.size()] = '\0';
+        char * end;
+        errno = 0;
+        *ld = strtold(buf, &end);
+        return end == buf + s.size() && errno != ERANGE && !std::isnan(*ld);
+    }
+
+    bool ParseIncrement(Command cmd, const rocksdb::autovector<std::string> & argv, size_t first,
+                        long long * delta, std::string * out) {
+        if (cmd == kIncr || cmd == kDecr) {
+            *delta = cmd == kIncr ? 1 : -1;
+            return true;
+        }
+        const std::string & s = argv[first + 1];
+        long long ll;
+        if (!string2ll(s.data(), s.size(), &ll)) {
+            RespMachine::AppendError(out, "ERR value is not an integer or out of range");
+            return false;
+        }
+        if (cmd == kDecrBy) {
+            if (ll == LLONG_MIN) {
+                RespMachine::AppendError(out, "ERR decrement would overflow");
+                return false;
+            }
+            ll = -ll;
+        }
+        *delta = ll;
+        return true;
+    }
+
+    bool ParseCounter(const std::string_view & value, long long * ll, std::string * out) {
+        if (!string2ll(value.data(), value.size(), ll)) {
+            RespMachine::AppendError(out, "ERR value is not an integer or out of range");
+            return false;
+        }
+        return true;
+    }
+
+    bool AddCounter(long long value, long long delta, long long * result, std::string * out) {
+        if ((delta < 0 && value < 0 && delta < LLONG_MIN - value) ||
+            (delta > 0 && value > 0 && delta > LLONG_MAX - value)) {
+            RespMachine::AppendError(out, "ERR increment or decrement would overflow");
+            return false;
+        }
+        *result = value + delta;
+        return true;
+    }
+
+    size_t AddFloat(const std::string_view * value, const std::string_view & increment,
+                    char * buf, std::string * out) {
+        long double ld = 0;
+        long double incr;
+        if ((value != nullptr && !ParseLongDouble(*value, &ld)) || !ParseLongDouble(increment, &incr)) {
+            RespMachine::AppendError(out, "ERR value is not a valid float");
+            return 0;
+        }
+        ld += incr;
+        if (std::isnan(ld) || std::isinf(ld)) {
+            RespMachine::AppendError(out, "ERR increment would produce NaN or Infinity");
+            return 0;
+        }
+
+        /* As Redis: 17 digits of precision, trailing zeroes dropped */
+        int len = snprintf(buf, kNumberBufferSize, "%.17Lf", ld);
+        if (len <= 0 || static_cast<size_t>(len) >= kNumberBufferSize) {
+            RespMachine::AppendError(out, "ERR increment would produce NaN or Infinity");
+            return 0;
+        }
+        if (strchr(buf, '.') != nullptr) {
+            while (buf[len - 1] == '0') {
+                --len;
+            }
+            if (buf[len - 1] == '.') {
+                --len;
+            }
+        }
+        if (len == 2 && buf[0] == '-' && buf[1] == '0') {
+            buf[0] = '0';
+            len = 1;
+        }
+        buf[len] = '\0';
+        return static_cast<size_t>(len);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#ifndef CHEAPIS_INCR_H
+#define CHEAPIS_INCR_H
+
+#include <string>
+#include <string_view>
+
+#include "autovector.h"
+#include "command.h"
+
+namespace cheapis {
+    // Enough for any long long and any INCRBYFLOAT result.
+    constexpr size_t kNumberBufferSize = 5 * 1024;
+
+    // The delta of INCR, DECR, INCRBY or DECRBY, argv[first] being the key.
+    // Appends the error reply and returns false if it isn't an integer.
+    bool ParseIncrement(Command cmd, const rocksdb::autovector<std::string> & argv, size_t first,
+                        long long * delta, std::string * out);
+
+    // A stored value as a counter, absent values counting as 0.
+    bool ParseCounter(const std::string_view & value, long long * ll, std::string * out);
+
+    bool AddCounter(long long value, long long delta, long long * result, std::string * out);
+
+    // INCRBYFLOAT, value being null if absent. The result is formatted into
+    // buf (kNumberBufferSize), returns its length, or 0 with the error reply
+    // appended.
+    size_t AddFloat(const std::string_view * value, const std::string_view & increment,
+                    char * buf, std::string * out);
+}
+
+#endif //CHEAPIS_INCR_H
@@ -0,0 +1,64 @@
+#include <cerrno>
+#include <unistd.h>
+
+#include "io_engine.h"
+
+namespace cheapis {
+    IoEngine::IoEngine(size_t threads) {
+        for (size_t i = 0; i < threads; ++i) {
+            threads_.emplace_back(&IoEngine::Work, this);
+        }
+    }
+
+    IoEngine::~IoEngine() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        submitted_.notify_all();
+        for (auto & thread:threads_) {
+            thread.join();
+        }
+    }
+
+    void IoEngine::Submit(IoRequest * request) {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            queue_.emplace_back(request);
+        }
+        ++in_flight_;
+        submitted_.notify_one();
+    }
+
+    void IoEngine::Wait(std::vector<IoRequest *> * done) {
+        if (in_flight_ == 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        completed_.wait(lock, [this]() { return !done_.empty(); });
+        in_flight_ -= done_.size();
+        done->insert(done->end(), done_.begin(), done_.end());
+        done_.clear();
+    }
+
+    void IoEngine::Work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            submitted_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            IoRequest * request = queue_.front();
+            queue_.pop_front();
+            lock.unlock();
+
+            request->result = pread(request->fd, request->buf, request->count,
+                                    static_cast<off_t>(request->offset));
+            request->error = request->result < 0 ? errno : 0;
+
+            lock.lock();
+            done_.emplace_back(request);
+            completed_.notify_one();
+        }
+    }
+}
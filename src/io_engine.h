@@ -0,0 +1,56 @@
+#pragma once
+#ifndef CHEAPIS_IO_ENGINE_H
+#define CHEAPIS_IO_ENGINE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+namespace cheapis {
+    struct IoRequest {
+        int fd;
+        void * buf;
+        size_t count;
+        uint64_t offset;
+        ssize_t result; /* Bytes read, or -1 with error set */
+        int error;
+        void * data;    /* The caller's */
+    };
+
+    // Runs blocking preads on a pool of threads, so one caller keeps up to a
+    // thread's worth of reads in flight each and picks them up as they
+    // complete. Submit() and Wait() are for a single thread.
+    class IoEngine {
+    public:
+        explicit IoEngine(size_t threads);
+
+        ~IoEngine();
+
+        void Submit(IoRequest * request);
+
+        // Blocks until at least one submitted request is done, then appends
+        // every done one. Returns at once if nothing is in flight.
+        void Wait(std::vector<IoRequest *> * done);
+
+        size_t GetInFlightCount() const { return in_flight_; }
+
+    private:
+        void Work();
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable submitted_;
+        std::condition_variable completed_;
+        std::deque<IoRequest *> queue_;
+        std::vector<IoRequest *> done_;
+        std::vector<std::thread> threads_;
+        size_t in_flight_ = 0;
+        bool stop_ = false;
+    };
+}
+
+#endif //CHEAPIS_IO_ENGINE_H
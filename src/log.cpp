@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <strings.h>
+#include <sys/time.h>
+#include <thread>
+
+#include "log.h"
+
+namespace cheapis {
+    constexpr size_t kLogRingSize = 4096; /* Power of two */
+    constexpr size_t kLogLineLength = 512;
+    constexpr unsigned int kLogBurst = 10; /* Lines per second of one call site */
+    constexpr unsigned int kLogFlushInterval = 10; /* Milliseconds */
+
+    constexpr const char * kLogLevelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+#if defined(LIN_DEBUG)
+    std::atomic<int> log_level(kLogDebug);
+#else
+    std::atomic<int> log_level(kLogInfo);
+#endif
+
+    // Bounded MPSC ring after Vyukov's queue: producers claim a slot by
+    // bumping tail_, format in place and publish it through the slot's
+    // sequence number. The event loop never blocks on stdout.
+    class Logger {
+    private:
+        struct Slot {
+            std::atomic<size_t> seq;
+            size_t len;
+            char line[kLogLineLength];
+        };
+
+    public:
+        Logger() : slots_(new Slot[kLogRingSize]) {
+            for (size_t i = 0; i < kLogRingSize; ++i) {
+                slots_[i].seq.store(i, std::memory_order_relaxed);
+            }
+            flusher_ = std::thread([this]() {
+                while (!stop_.load(std::memory_order_acquire)) {
+                    if (Drain() == 0) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(kLogFlushInterval));
+                    }
+                }
+                Drain();
+            });
+        }
+
+        // Runs at exit, so lines logged right before exit(1) still make it.
+        ~Logger() {
+            stop_.store(true, std::memory_order_release);
+            flusher_.join();
+        }
+
+        // Returns nullptr if the ring is full.
+        Slot * Claim(size_t * pos) {
+            size_t p = tail_.load(std::memory_order_relaxed);
+            while (true) {
+                Slot & slot = slots_[p & (kLogRingSize - 1)];
+                size_t seq = slot.seq.load(std::memory_order_acquire);
+                auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(p);
+                if (diff == 0) {
+                    if (tail_.compare_exchange_weak(p, p + 1, std::memory_order_relaxed)) {
+                        *pos = p;
+                        return &slot;
+                    }
+                } else if (diff < 0) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                } else {
+                    p = tail_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        static void Publish(Slot * slot, size_t pos) {
+            slot->seq.store(pos + 1, std::memory_order_release);
+        }
+
+    private:
+        size_t Drain() {
+            size_t n = 0;
+            while (true) {
+                Slot & slot = slots_[head_ & (kLogRingSize - 1)];
+                if (slot.seq.load(std::memory_order_acquire) != head_ + 1) {
+                    break;
+                }
+                fwrite(slot.line, 1, slot.len, stdout);
+                slot.seq.store(head_ + kLogRingSize, std::memory_order_release);
+                ++head_;
+                ++n;
+            }
+
+            unsigned int dropped = dropped_.exchange(0, std::memory_order_relaxed);
+            if (dropped != 0) {
+                fprintf(stdout, "%u log lines dropped, the log ring was full\n", dropped);
+            }
+            if (n != 0 || dropped != 0) {
+                fflush(stdout);
+            }
+            return n;
+        }
+
+    private:
+        std::unique_ptr<Slot[]> slots_;
+        alignas(64) std::atomic<size_t> tail_{0};
+        alignas(64) size_t head_ = 0;
+        std::atomic<unsigned int> dropped_{0};
+        std::atomic<bool> stop_{false};
+        std::thread flusher_;
+    };
+
+    static Logger & GetLogger() {
+        static Logger logger;
+        return logger;
+    }
+
+    // "[YYYY-mm-dd HH:MM:SS", localtime_r only once a second per thread.
+    static size_t FormatSecond(long sec, char * buf) {
+        thread_local long cached_sec = -1;
+        thread_local char cached[32];
+        thread_local size_t cached_len = 0;
+        if (sec != cached_sec) {
+            time_t t = sec;
+            struct tm curr_tm = {0};
+            localtime_r(&t, &curr_tm);
+            cached_len = strftime(cached, sizeof(cached), "[%Y-%m-%d %H:%M:%S", &curr_tm);
+            cached_sec = sec;
+        }
+        memcpy(buf, cached, cached_len);
+        return cached_len;
+    }
+
+    void SetLogLevel(LogLevel level) {
+        log_level.store(level, std::memory_order_relaxed);
+    }
+
+    LogLevel GetLogLevel() {
+        return static_cast<LogLevel>(log_level.load(std::memory_order_relaxed));
+    }
+
+    const char * GetLogLevelName(LogLevel level) {
+        return kLogLevelNames[level];
+    }
+
+    bool ParseLogLevel(const std::string_view & name, LogLevel * level) {
+        static constexpr struct {
+            std::string_view name;
+            LogLevel level;
+        } kNames[] = {
+                {"debug",   kLogDebug},
+                {"verbose", kLogDebug},
+                {"info",    kLogInfo},
+                {"notice",  kLogInfo},
+                {"warn",    kLogWarn},
+                {"warning", kLogWarn},
+                {"error",   kLogError},
+        };
+        for (const auto & entry:kNames) {
+            if (entry.name.size() == name.size() &&
+                strncasecmp(name.data(), entry.name.data(), name.size()) == 0) {
+                *level = entry.level;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void LogWrite(LogSite * site, LogLevel level, const char * file, int line,
+                  const char * function, const char * fmt, ...) {
+        struct timeval tv = {0};
+        gettimeofday(&tv, nullptr);
+
+        long sec = site->second.load(std::memory_order_relaxed);
+        if (sec != tv.tv_sec &&
+            site->second.compare_exchange_strong(sec, tv.tv_sec, std::memory_order_relaxed)) {
+            site->count.store(0, std::memory_order_relaxed);
+        }
+        if (site->count.fetch_add(1, std::memory_order_relaxed) >= kLogBurst) {
+            site->suppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        unsigned int suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+
+        Logger & logger = GetLogger();
+        size_t pos;
+        auto * slot = logger.Claim(&pos);
+        char fallback[kLogLineLength];
+        char * buf = slot != nullptr ? slot->line : fallback;
+        if (slot == nullptr && level < kLogError) {
+            return;
+        }
+
+        size_t len = FormatSecond(tv.tv_sec, buf);
+        len += snprintf(buf + len, kLogLineLength - len, ".%06ld] %-5s %s:%d:%s ",
+                        static_cast<long>(tv.tv_usec), kLogLevelNames[level], file, line, function);
+        if (len < kLogLineLength) {
+            va_list ap;
+            va_start(ap, fmt);
+            len += vsnprintf(buf + len, kLogLineLength - len, fmt, ap);
+            va_end(ap);
+        }
+        if (suppressed != 0 && len < kLogLineLength) {
+            len += snprintf(buf + len, kLogLineLength - len,
+                            " (%u similar lines suppressed)", suppressed);
+        }
+        len = std::min(len, kLogLineLength - 1);
+        buf[len++] = '\n';
+
+        if (slot != nullptr) {
+            slot->len = len;
+            Logger::Publish(slot, pos);
+        } else { // errors are written even when the ring is full
+            fwrite(buf, 1, len, stdout);
+            fflush(stdout);
+        }
+    }
+}
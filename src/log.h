@@ -2,23 +2,54 @@
 #ifndef CHEAPIS_LOG_H
 #define CHEAPIS_LOG_H
 
-#include <cstdio>
-#include <ctime>
-#include <sys/time.h>
-
-#define LIN_LOG_IMPL(level, file, line, function, fmt, args...)              \
-    do {                                                                     \
-        struct timeval tv = {0};                                             \
-        gettimeofday(&tv, nullptr);                                          \
-        time_t t = tv.tv_sec;                                                \
-        struct tm curr_tm = {0};                                             \
-        localtime_r(&t, &curr_tm);                                           \
-        long usec = tv.tv_usec;                                              \
-        printf(                                                              \
-            "[%04d-%02d-%02d %02d:%02d:%02d.%06ld] %-5s %s:%d:%s " fmt "\n", \
-            curr_tm.tm_year + 1900, curr_tm.tm_mon + 1, curr_tm.tm_mday,     \
-            curr_tm.tm_hour, curr_tm.tm_min, curr_tm.tm_sec, usec,           \
-            level, file, line, function, ##args);                            \
+#include <atomic>
+#include <string_view>
+
+namespace cheapis {
+    enum LogLevel {
+        kLogDebug,
+        kLogInfo,
+        kLogWarn,
+        kLogError,
+    };
+
+    // Rate limiting state of one LIN_LOG_* call site.
+    struct LogSite {
+        std::atomic<long> second{-1};
+        std::atomic<unsigned int> count{0};
+        std::atomic<unsigned int> suppressed{0};
+    };
+
+    extern std::atomic<int> log_level;
+
+    inline bool IsLogEnabled(LogLevel level) {
+        return level >= log_level.load(std::memory_order_relaxed);
+    }
+
+    void SetLogLevel(LogLevel level);
+
+    LogLevel GetLogLevel();
+
+    const char * GetLogLevelName(LogLevel level);
+
+    // Case-insensitive, also takes the Redis names (verbose, notice, warning).
+    bool ParseLogLevel(const std::string_view & name, LogLevel * level);
+
+    // Formats the line into a lock-free ring and returns, a background thread
+    // writes it to stdout. Lines beyond a burst per second of one call site
+    // are dropped and counted on the next line that gets through.
+    void LogWrite(LogSite * site, LogLevel level, const char * file, int line,
+                  const char * function, const char * fmt, ...)
+    __attribute__((format(printf, 6, 7)));
+}
+
+#define LIN_LOG_IMPL(level, file, line, function, fmt, args...)            \
+    do {                                                                   \
+        if (cheapis::IsLogEnabled(level)) {                                \
+            static cheapis::LogSite lin_log_site;                          \
+            cheapis::LogWrite(&lin_log_site, level, file, line, function,  \
+                              fmt, ##args);                                \
+        }                                                                  \
     } while (false)
 
 #if !defined(NDEBUG)
@@ -30,27 +61,27 @@
 #define LIN_ERROR
 
 #if defined(LIN_DEBUG)
-#define LIN_LOG_DEBUG(fmt, args...) LIN_LOG_IMPL("DEBUG", __FILE__, __LINE__, __FUNCTION__, fmt, ##args)
+#define LIN_LOG_DEBUG(fmt, args...) LIN_LOG_IMPL(cheapis::kLogDebug, __FILE__, __LINE__, __FUNCTION__, fmt, ##args)
 #else
 #define LIN_LOG_DEBUG(fmt, args...)
 #endif
 
 #if defined(LIN_INFO)
-#define LIN_LOG_INFO(fmt, args...) LIN_LOG_IMPL("INFO", __FILE__, __LINE__, __FUNCTION__, fmt, ##args)
+#define LIN_LOG_INFO(fmt, args...) LIN_LOG_IMPL(cheapis::kLogInfo, __FILE__, __LINE__, __FUNCTION__, fmt, ##args)
 #else
 #define LIN_LOG_INFO(fmt, args...)
 #endif
 
 #if defined(LIN_WARN)
-#define LIN_LOG_WARN(fmt, args...) LIN_LOG_IMPL("WARN", __FILE__, __LINE__, __FUNCTION__, fmt, ##args)
+#define LIN_LOG_WARN(fmt, args...) LIN_LOG_IMPL(cheapis::kLogWarn, __FILE__, __LINE__, __FUNCTION__, fmt, ##args)
 #else
 #define LIN_LOG_WARN(fmt, args...)
 #endif
 
 #if defined(LIN_ERROR)
-#define LIN_LOG_ERROR(fmt, args...) LIN_LOG_IMPL("ERROR", __FILE__, __LINE__, __FUNCTION__, fmt, ##args)
+#define LIN_LOG_ERROR(fmt, args...) LIN_LOG_IMPL(cheapis::kLogError, __FILE__, __LINE__, __FUNCTION__, fmt, ##args)
 #else
 #define LIN_LOG_ERROR(fmt, args...)
 #endif
 
-#endif //CHEAPIS_LOG_H
\ No newline at end of file
+#endif //CHEAPIS_LOG_H
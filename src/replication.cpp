@@ -0,0 +1,51 @@
+#include <algorithm>
+#include <random>
+
+#include "replication.h"
+
+namespace cheapis {
+    std::string GenerateReplicationId() {
+        static const char kHex[] = "0123456789abcdef";
+        std::random_device rd;
+        std::mt19937_64 rng((static_cast<uint64_t>(rd()) << 32) | rd());
+        std::string id(kReplicationIdSize, '0');
+        for (char & c:id) {
+            c = kHex[rng() & 15];
+        }
+        return id;
+    }
+
+    ReplicationBacklog::ReplicationBacklog(size_t size, uint64_t offset)
+            : buf_(size, '\0'), offset_(offset) {}
+
+    void ReplicationBacklog::Append(const char * s, size_t n) {
+        offset_ += n;
+        if (n >= buf_.size()) { /* Only the last buf_.size() bytes stay */
+            s += n - buf_.size();
+            n = buf_.size();
+        }
+        history_ = std::min(history_ + n, buf_.size());
+        while (n > 0) {
+            size_t len = std::min(n, buf_.size() - pos_);
+            buf_.replace(pos_, len, s, len);
+            pos_ = (pos_ + len) % buf_.size();
+            s += len;
+            n -= len;
+        }
+    }
+
+    bool ReplicationBacklog::Read(uint64_t offset, std::string * out) const {
+        if (offset < GetFirstOffset() || offset > offset_) {
+            return false;
+        }
+        auto n = static_cast<size_t>(offset_ - offset);
+        size_t begin = (pos_ + buf_.size() - n) % buf_.size();
+        while (n > 0) {
+            size_t len = std::min(n, buf_.size() - begin);
+            out->append(buf_, begin, len);
+            begin = 0;
+            n -= len;
+        }
+        return true;
+    }
+}
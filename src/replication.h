@@ -0,0 +1,45 @@
+#pragma once
+#ifndef CHEAPIS_REPLICATION_H
+#define CHEAPIS_REPLICATION_H
+
+#include <cstdint>
+#include <string>
+
+namespace cheapis {
+    constexpr size_t kReplicationIdSize = 40;
+
+    // 40 random hex characters, naming a history of the write stream. The
+    // EOF mark of a full sync is one too.
+    std::string GenerateReplicationId();
+
+    // The tail of the write stream a master feeds its replicas, so one that
+    // reconnects continues from its offset rather than taking a full sync.
+    // Offsets count the bytes of the stream since the backlog was created.
+    class ReplicationBacklog {
+    public:
+        ReplicationBacklog(size_t size, uint64_t offset);
+
+    public:
+        void Append(const char * s, size_t n);
+
+        // Appends the stream from offset on to out. False if that part of
+        // the stream is gone, or never was.
+        bool Read(uint64_t offset, std::string * out) const;
+
+        uint64_t GetOffset() const { return offset_; }
+
+        uint64_t GetFirstOffset() const { return offset_ - history_; }
+
+        size_t GetSize() const { return buf_.size(); }
+
+        size_t GetHistoryLength() const { return history_; }
+
+    private:
+        std::string buf_;
+        size_t pos_ = 0;     /* Where the next byte goes */
+        size_t history_ = 0; /* Bytes of the stream in buf_ */
+        uint64_t offset_;    /* Of the end of the stream */
+    };
+}
+
+#endif //CHEAPIS_REPLICATION_H
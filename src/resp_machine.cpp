@@ -9,9 +9,11 @@ size_t RespMachine::Input(const char * s, size_t n) {
     if (req_type_ == kUnknown) {
         req_type_ = (*s == '*' ? kMultiBulk : kInline);
     }
-    return req_type_ == kMultiBulk ?
-           ProcessMultiBulkInput(s, n) :
-           ProcessInlineInput(s, n);
+    size_t consume_len = req_type_ == kMultiBulk ?
+                         ProcessMultiBulkInput(s, n) :
+                         ProcessInlineInput(s, n);
+    consumed_ += consume_len;
+    return consume_len;
 }
 
 size_t RespMachine::ProcessInlineInput(const char * s, size_t n) {
@@ -108,7 +110,7 @@ size_t RespMachine::ProcessMultiBulkInput(const char * s, size_t n) {
         if (sv.size() < bulk_read_len) {
             break;
         } else {
-            argv_.emplace_back(sv.data(), bulk_len_);
+            bulks_.emplace_back(consumed_ + consume_len, bulk_len_);
             consume_len += bulk_read_len;
             bulk_len_ = -1;
             --multi_bulk_len_;
@@ -116,6 +118,10 @@ size_t RespMachine::ProcessMultiBulkInput(const char * s, size_t n) {
     }
 
     if (multi_bulk_len_ == 0) {
+        const char * base = s - consumed_;
+        for (const auto & bulk:bulks_) {
+            argv_.emplace_back(base + bulk.first, bulk.second);
+        }
         state_ = kSuccess;
     }
     return consume_len;
@@ -125,6 +131,8 @@ void RespMachine::Reset() {
     state_ = kInit;
     req_type_ = kUnknown;
     argv_.clear();
+    bulks_.clear();
+    consumed_ = 0;
     multi_bulk_len_ = 0;
     bulk_len_ = -1;
 }
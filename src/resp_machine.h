@@ -4,6 +4,7 @@
 
 #include <cstddef>
 #include <string_view>
+#include <utility>
 
 #include "autovector.h"
 
@@ -72,6 +73,11 @@ private:
     State state_ = kInit;
     ReqType req_type_ = kUnknown;
     rocksdb::autovector<std::string_view> argv_;
+    /* Bulk arguments as (offset, length) from the start of the request. The
+     * caller may move its buffer between two Input() calls, so views are only
+     * built once the request is complete. */
+    rocksdb::autovector<std::pair<size_t, size_t>> bulks_;
+    size_t consumed_ = 0;
     int multi_bulk_len_ = 0;
     int bulk_len_ = -1;
 };
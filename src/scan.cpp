@@ -0,0 +1,115 @@
+#include <strings.h>
+
+#include "resp_machine.h"
+#include "scan.h"
+#include "util.h"
+
+namespace cheapis {
+    constexpr size_t kMaxScanCursorsPerClient = 16;
+
+    bool ParseScanArgs(const rocksdb::autovector<std::string> & argv, size_t first,
+                       ScanArgs * args, std::string * out) {
+        const std::string & cursor = argv[first];
+        long long ll;
+        if (!string2ll(cursor.data(), cursor.size(), &ll) || ll < 0) {
+            RespMachine::AppendError(out, "ERR invalid cursor");
+            return false;
+        }
+        args->cursor = static_cast<uint64_t>(ll);
+
+        for (size_t i = first + 1; i < argv.size(); i += 2) {
+            if (i + 1 == argv.size()) {
+                RespMachine::AppendError(out, "ERR syntax error");
+                return false;
+            }
+            const std::string & value = argv[i + 1];
+            if (strcasecmp(argv[i].c_str(), "match") == 0) {
+                args->pattern = value;
+                if (args->pattern == "*") {
+                    args->pattern = {};
+                }
+            } else if (strcasecmp(argv[i].c_str(), "count") == 0) {
+                if (!string2ll(value.data(), value.size(), &ll) || ll < 1) {
+                    RespMachine::AppendError(out, "ERR value is out of range, must be positive");
+                    return false;
+                }
+                args->count = static_cast<size_t>(ll);
+            } else {
+                RespMachine::AppendError(out, "ERR syntax error");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool ParseRangeArgs(const rocksdb::autovector<std::string> & argv, size_t first, bool prefix,
+                        RangeArgs * args, std::string * out) {
+        args->start = argv[first];
+        if (prefix) {
+            args->end = args->start;
+            while (!args->end.empty() && static_cast<unsigned char>(args->end.back()) == UCHAR_MAX) {
+                args->end.pop_back();
+            }
+            if (!args->end.empty()) {
+                ++args->end.back();
+            }
+        } else {
+            args->end = argv[++first];
+        }
+
+        for (size_t i = first + 1; i < argv.size(); i += 2) {
+            long long ll;
+            if (i + 1 == argv.size() || strcasecmp(argv[i].c_str(), "limit") != 0) {
+                RespMachine::AppendError(out, "ERR syntax error");
+                return false;
+            }
+            if (!string2ll(argv[i + 1].data(), argv[i + 1].size(), &ll) || ll < 0) {
+                RespMachine::AppendError(out, "ERR value is out of range, must be positive");
+                return false;
+            }
+            args->limit = static_cast<size_t>(ll);
+        }
+        return true;
+    }
+
+    bool MatchKey(const std::string_view & pattern, const std::string_view & key) {
+        return pattern.empty() ||
+               stringmatchlen(pattern.data(), static_cast<int>(pattern.size()),
+                              key.data(), static_cast<int>(key.size()), 0);
+    }
+
+    void AppendScanReply(std::string * out, uint64_t cursor,
+                         const std::vector<std::string_view> & keys) {
+        RespMachine::AppendArrayLength(out, 2);
+        RespMachine::AppendBulkString(out, std::to_string(cursor));
+        RespMachine::AppendArrayLength(out, keys.size());
+        for (const auto & key:keys) {
+            RespMachine::AppendBulkString(out, key);
+        }
+    }
+
+    bool ScanCursors::Resume(uint64_t cursor, std::string * key) const {
+        if (cursor == 0) {
+            key->clear();
+            return true;
+        }
+        auto it = cursors_.find(cursor);
+        if (it == cursors_.cend()) {
+            return false;
+        }
+        *key = it->second;
+        return true;
+    }
+
+    uint64_t ScanCursors::Suspend(int fd, const std::string_view & key) {
+        auto & owned = clients_[fd];
+        if (owned.size() == kMaxScanCursorsPerClient) {
+            cursors_.erase(owned.front());
+            owned.pop_front();
+        }
+        uint64_t cursor = next_++;
+        cursors_.emplace(cursor, key);
+        owned.push_back(cursor);
+        return cursor;
+    }
+}
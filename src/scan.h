@@ -0,0 +1,71 @@
+#pragma once
+#ifndef CHEAPIS_SCAN_H
+#define CHEAPIS_SCAN_H
+
+#include <climits>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "autovector.h"
+
+namespace cheapis {
+    constexpr size_t kScanDefaultCount = 10;
+
+    struct ScanArgs {
+        uint64_t cursor = 0;
+        std::string_view pattern; /* Empty matches everything */
+        size_t count = kScanDefaultCount;
+    };
+
+    struct RangeArgs {
+        std::string start;
+        std::string end; /* Exclusive, none if empty */
+        size_t limit = SIZE_MAX;
+    };
+
+    // RANGE start end [LIMIT count] | PREFIX prefix [LIMIT count], argv[first]
+    // being start or prefix. A prefix is the range up to its successor.
+    // Appends the error reply and returns false if malformed.
+    bool ParseRangeArgs(const rocksdb::autovector<std::string> & argv, size_t first, bool prefix,
+                        RangeArgs * args, std::string * out);
+
+    inline bool InRange(const RangeArgs & args, const std::string_view & key) {
+        return args.end.empty() || key < args.end;
+    }
+
+    // SCAN cursor [MATCH pattern] [COUNT count], argv[first] being the cursor.
+    // Appends the error reply and returns false if malformed.
+    bool ParseScanArgs(const rocksdb::autovector<std::string> & argv, size_t first,
+                       ScanArgs * args, std::string * out);
+
+    bool MatchKey(const std::string_view & pattern, const std::string_view & key);
+
+    // *2 [cursor, [key ...]]
+    void AppendScanReply(std::string * out, uint64_t cursor,
+                         const std::vector<std::string_view> & keys);
+
+    // Both indexes iterate in key order, so a scan resumes from the next key
+    // it would have returned. Cursors are numbers for clients that parse them,
+    // each standing for such a key. Any client may resume any cursor, but
+    // past a limit per client (by fd) its own oldest are forgotten, so other
+    // clients' scans never end a slow one.
+    class ScanCursors {
+    public:
+        // The key to resume from, empty for cursor 0. False if unknown.
+        bool Resume(uint64_t cursor, std::string * key) const;
+
+        uint64_t Suspend(int fd, const std::string_view & key);
+
+    private:
+        std::map<uint64_t, std::string> cursors_;
+        std::unordered_map<int, std::deque<uint64_t>> clients_; /* Cursors of each fd, oldest first */
+        uint64_t next_ = 1;
+    };
+}
+
+#endif //CHEAPIS_SCAN_H
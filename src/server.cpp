@@ -1,7 +1,12 @@
+#include <algorithm>
 #include <cerrno>
+#include <csignal>
 #include <cstring>
+#include <sys/resource.h>
+#include <vector>
 
 #include "anet.h"
+#include "config.h"
 #include "env.h"
 #include "executor.h"
 #include "log.h"
@@ -9,99 +14,195 @@
 
 namespace cheapis {
     constexpr char kBindAddr[] = "0.0.0.0";
-    constexpr unsigned int kPort = 6379;
     constexpr unsigned int kBacklog = 511;
     constexpr unsigned int kCronInterval = 1;
     constexpr unsigned int kMaxAcceptPerCall = 1000;
+    constexpr unsigned int kReservedFDs = 128;
     constexpr unsigned int kNetIPLength = 46;
     constexpr unsigned int kTCPKeepAlive = 300;
     constexpr unsigned int kTimeout = 360;
-    constexpr unsigned int kReadLength = 4096;
+    constexpr unsigned int kReadLength = 16384;
+    constexpr unsigned int kReadBudget = 65536;
     constexpr unsigned int kMaxInputBuffer = 10485760;
 
-    static void ReleaseOrMarkClient(int fd, Client * c, EventLoop<Client> * el) {
+    // Raises RLIMIT_NOFILE towards maxclients (plus the fds the server uses
+    // itself) and returns the number of fds the event loop may hold.
+    static size_t AdjustOpenFilesLimit() {
+        const auto max_clients = static_cast<unsigned long>(GetConfig()->max_clients.load());
+        const rlim_t want = max_clients + kReservedFDs;
+        struct rlimit limit = {0};
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            LIN_LOG_WARN("Failed getting the open files limit. Error message: '%s'",
+                         strerror(errno));
+            return want;
+        }
+
+        if (limit.rlim_cur < want) {
+            rlim_t old_cur = limit.rlim_cur;
+            limit.rlim_cur = std::min(want, limit.rlim_max);
+            if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+                limit.rlim_cur = old_cur;
+            }
+            if (limit.rlim_cur < want) {
+                LIN_LOG_WARN("Open files limit is %lu, less than the %lu needed by %lu clients",
+                             static_cast<unsigned long>(limit.rlim_cur),
+                             static_cast<unsigned long>(want), max_clients);
+            }
+        }
+        return static_cast<size_t>(std::min(limit.rlim_cur, want));
+    }
+
+    void ReleaseOrMarkClient(int fd, Client * c, EventLoop<Client> * el) {
         if (c->ref_count == 0) {
             el->Release(fd);
         } else {
             c->close = true;
+            c->Unlink();
             el->DelEvent(fd, kReadable | kWritable);
         }
     }
 
     static void ReadFromClient(int fd, Client * c, long curr_time, Executor * executor,
-                               EventLoop<Client> * el) {
+                               IdleList * idle, EventLoop<Client> * el) {
+        std::string & in = c->input;
+        size_t old_size = in.size();
         char buf[kReadLength];
-        ssize_t nread = read(fd, buf, kReadLength);
-        if (nread == -1) {
-            if (errno != EAGAIN) {
+        while (true) {
+            ssize_t nread = read(fd, buf, kReadLength);
+            if (nread == -1) {
+                if (errno != EAGAIN) {
+                    ReleaseOrMarkClient(fd, c, el);
+                    LIN_LOG_WARN("Failed reading. Error message: '%s'", strerror(errno));
+                    return;
+                }
+                break;
+            } else if (nread == 0) {
+                if (in.size() != old_size) { // run what came before the FIN first, the rearm reports it again
+                    el->RearmEvent(fd);
+                    break;
+                }
                 ReleaseOrMarkClient(fd, c, el);
-                LIN_LOG_WARN("Failed reading. Error message: '%s'", strerror(errno));
+                LIN_LOG_DEBUG("Client closed connection");
+                return;
             }
-            return;
-        } else if (nread == 0) {
-            ReleaseOrMarkClient(fd, c, el);
-            LIN_LOG_DEBUG("Client closed connection");
-            return;
-        }
 
-        std::string & in = c->input;
-        in.append(buf, static_cast<size_t>(nread));
-        if (in.size() > kMaxInputBuffer) {
-            ReleaseOrMarkClient(fd, c, el);
-            LIN_LOG_WARN("Client reached max input buffer length");
+            in.append(buf, static_cast<size_t>(nread));
+            GetStats()->net_input_bytes.Add(nread);
+            if (in.size() > kMaxInputBuffer) {
+                ReleaseOrMarkClient(fd, c, el);
+                LIN_LOG_WARN("Client reached max input buffer length");
+                return;
+            }
+            if (nread < kReadLength && !el->IsEdgeTriggered()) { // drained, a FIN after it wakes us again
+                break;
+            }
+            if (in.size() - old_size >= kReadBudget) { // leave the rest to the next round
+                el->RearmEvent(fd);
+                break;
+            }
+        }
+        if (in.size() == old_size) {
             return;
         }
         c->last_mod_time = curr_time;
+        idle->Touch(c);
+        if (c->syncing) {
+            in.erase(0, executor->Sync(c, in, curr_time));
+            if (c->syncing) {
+                return;
+            }
+        }
 
-        while (c->consume_len < in.size()) {
-            size_t consume_len = c->resp.Input(in.data() + c->consume_len,
-                                               in.size() - c->consume_len);
+        Stats * stats = GetStats();
+        size_t start = 0;
+        while (start + c->consume_len < in.size()) {
+            uint64_t parse_begun = GetCycles();
+            size_t consume_len = c->resp.Input(in.data() + start + c->consume_len,
+                                               in.size() - start - c->consume_len);
             c->consume_len += consume_len;
 
             auto state = c->resp.GetState();
-            switch (state) {
-                case RespMachine::kSuccess: {
-                    assert(consume_len != 0);
+            if (state == RespMachine::kSuccess) {
+                assert(consume_len != 0);
+                stats->stages[kStageParse].Record(GetCycles() - parse_begun);
+                if (!c->resp.GetArgv().empty()) {
                     executor->Submit(c->resp.GetArgv(), c, fd);
                     ++c->ref_count;
-
-                    c->resp.Reset();
-                    in.assign(&in[c->consume_len], &in[in.size()]);
-                    c->consume_len = 0;
-                    break;
-                }
-
-                case RespMachine::kProcess: {
-                    return;
                 }
 
-                case RespMachine::kInit:
-                default: { // error
-                    ReleaseOrMarkClient(fd, c, el);
-                    LIN_LOG_WARN("Failed parsing. Error state: %d", state);
-                    return;
-                }
+                c->resp.Reset();
+                start += c->consume_len;
+                c->consume_len = 0;
+            } else if (state == RespMachine::kProcess) {
+                break;
+            } else { // error
+                ReleaseOrMarkClient(fd, c, el);
+                LIN_LOG_WARN("Failed parsing. Error state: %d", state);
+                return;
             }
         }
+        in.erase(0, start);
     }
 
-    static void WriteToClient(int fd, Client * c, long curr_time, EventLoop<Client> * el) {
+    static void WriteToClient(int fd, Client * c, long curr_time, IdleList * idle,
+                              EventLoop<Client> * el) {
         std::string & out = c->output;
         assert(!out.empty());
-        ssize_t nwrite = write(fd, out.data(), out.size());
-        if (nwrite <= 0) {
-            if (nwrite == -1 && errno != EAGAIN) {
-                ReleaseOrMarkClient(fd, c, el);
-                LIN_LOG_WARN("Failed writing. Error message: '%s'", strerror(errno));
+        size_t ready = out.size() - c->held;
+        size_t written = 0;
+        while (written < ready) {
+            ssize_t nwrite = write(fd, out.data() + written, ready - written);
+            if (nwrite <= 0) {
+                if (nwrite == -1 && errno != EAGAIN) {
+                    ReleaseOrMarkClient(fd, c, el);
+                    LIN_LOG_WARN("Failed writing. Error message: '%s'", strerror(errno));
+                    return;
+                }
+                break;
             }
+            written += nwrite;
+        }
+        if (written == 0) {
             return;
         }
+        GetStats()->net_output_bytes.Add(written);
         c->last_mod_time = curr_time;
+        idle->Touch(c);
 
-        out.assign(out.data() + nwrite,
-                   out.size() - nwrite);
+        out.erase(0, written);
+        if (out.size() < GetConfig()->output_buffer_soft_limit) {
+            c->soft_limit_time = -1;
+        }
         if (out.empty()) {
             el->DelEvent(fd, kWritable);
+            if (c->read_paused) {
+                c->read_paused = false;
+                el->AddEvent(fd, kReadable);
+            }
+        }
+    }
+
+    void CheckOutputBuffer(int fd, Client * c, long curr_time, EventLoop<Client> * el) {
+        const Config * config = GetConfig();
+        size_t size = c->output.size();
+        if (size < config->output_buffer_soft_limit) {
+            c->soft_limit_time = -1;
+            return;
+        }
+
+        if (c->soft_limit_time == -1) {
+            c->soft_limit_time = curr_time;
+        }
+        if (size >= config->output_buffer_hard_limit ||
+            curr_time - c->soft_limit_time > static_cast<long>(config->output_buffer_soft_seconds)) {
+            ReleaseOrMarkClient(fd, c, el);
+            LIN_LOG_WARN("Client reached output buffer limit");
+            return;
+        }
+
+        if (!c->read_paused) {
+            c->read_paused = true;
+            el->DelEvent(fd, kReadable);
         }
     }
 
@@ -110,42 +211,61 @@ namespace cheapis {
         executor->Execute(plan, curr_time, el);
     }
 
-    static void ServerCron(long * last_cron_time, long curr_time, EventLoop<Client> * el) {
+    static void ServerCron(long * last_cron_time, long curr_time, Executor * executor,
+                           IdleList * idle, EventLoop<Client> * el) {
         if (curr_time - *last_cron_time >= kCronInterval) {
             *last_cron_time = curr_time;
+            SampleStats(GetCurrentTimeInMilliseconds());
+            executor->Cron(curr_time);
 
-            auto & clients = el->GetResources();
-            for (int i = 0; i <= el->GetMaxFD(); ++i) {
-                auto & client = clients[i];
-                if (client != nullptr && client->last_mod_time != -1) {
-                    assert(!client->close || client->ref_count);
-                    if (curr_time - client->last_mod_time > kTimeout) {
-                        ReleaseOrMarkClient(i, client.get(), el);
-                        LIN_LOG_DEBUG("Client timed out");
-                    }
+            for (IdleNode * node = idle->Front(); node != nullptr; node = idle->Front()) {
+                auto * c = static_cast<Client *>(node);
+                if (curr_time - c->last_mod_time <= kTimeout) {
+                    break;
                 }
+                ReleaseOrMarkClient(c->fd, c, el);
+                LIN_LOG_DEBUG("Client timed out");
             }
         }
     }
 
     int ServerMain(int argc, char * argv[]) {
+        signal(SIGPIPE, SIG_IGN); /* Writes to a closed socket fail with EPIPE instead */
+        IdleList idle;
+        std::vector<std::string> dirs;
+        for (int i = 1; i < argc; ++i) {
+            if (strncmp(argv[i], "--", 2) != 0) {
+                dirs.emplace_back(argv[i]);
+                continue;
+            }
+            std::string err = "missing value";
+            if (i + 1 == argc || !LoadConfig(argv[i] + 2, argv[i + 1], &err)) {
+                LIN_LOG_ERROR("Bad option %s: %s", argv[i], err.c_str());
+                return 1;
+            }
+            ++i;
+        }
+
+        /* Sized once maxclients is known */
         const int el_fd = EventLoop<Client>::Open();
         if (el_fd < 0) {
             LIN_LOG_ERROR("Failed creating the event loop. Error message: '%s'",
                           strerror(errno));
             return 1;
         }
-        EventLoop<Client> el(el_fd);
+        EventLoop<Client> el(el_fd, AdjustOpenFilesLimit(), GetConfig()->edge_triggered);
 
-        auto executor = argc == 1 ? OpenExecutorMem()
-                                  : OpenExecutorDisk(argv[1]);
+        const Config * config = GetConfig();
+        auto executor = dirs.empty() ? OpenExecutorMem(config->snapshot_file,
+                                                       config->appendonly ? config->aof_file : "")
+                                     : OpenExecutorDisk(dirs);
         if (executor == nullptr) {
             LIN_LOG_ERROR("Failed creating the executor");
             return 1;
         }
 
         char err[ANET_ERR_LEN];
-        const int ac_fd = anetTcpServer(err, kPort, const_cast<char *>(kBindAddr), kBacklog);
+        const int ac_fd = anetTcpServer(err, static_cast<int>(config->port.load()), const_cast<char *>(kBindAddr), kBacklog);
         if (ac_fd < 0) {
             LIN_LOG_ERROR("Failed creating the TCP server. Error message: '%s'", err);
             return 1;
@@ -166,11 +286,21 @@ namespace cheapis {
         }
 
         long last_cron_time = GetCurrentTimeInSeconds();
+        InitStats(last_cron_time, static_cast<unsigned int>(config->port.load()));
         struct timeval tv = {0};
         while (true) {
             tv.tv_sec = executor->GetTaskCount() ? 0 : kCronInterval;
+            tv.tv_usec = 0;
+            long timeout = executor->GetTimeout();
+            if (tv.tv_sec != 0 && timeout >= 0 && timeout < kCronInterval * 1000000L) {
+                timeout = (timeout + 999) / 1000 * 1000; /* Poll counts milliseconds */
+                tv.tv_sec = timeout / 1000000;
+                tv.tv_usec = timeout % 1000000;
+            }
             r = el.Poll(&tv);
-            if (r < 0) {
+            if (r < 0 && errno == EINTR) { /* e.g. resumed by SIGCONT */
+                r = 0;
+            } else if (r < 0) {
                 LIN_LOG_ERROR("Failed polling. Error message: '%s'",
                               strerror(errno));
                 return 1;
@@ -185,6 +315,7 @@ namespace cheapis {
                 if (efd == ac_fd) { // acceptor
                     int cport, cfd, max = kMaxAcceptPerCall;
                     char cip[kNetIPLength];
+                    bool drained = false;
 
                     while (max--) {
                         cfd = anetTcpAccept(err, ac_fd, cip, sizeof(cip), &cport);
@@ -192,17 +323,19 @@ namespace cheapis {
                             if (errno != EAGAIN) {
                                 LIN_LOG_WARN("Failed accepting. Error message: '%s'", err);
                             }
+                            drained = true;
                             break;
                         }
 
-                        r = el.Acquire(cfd, std::make_unique<Client>(curr_time));
-                        if (r != 0) {
+                        /* Not r, which counts the events still to handle */
+                        auto client = std::make_unique<Client>(cfd, curr_time);
+                        idle.Touch(client.get());
+                        if (el.Acquire(cfd, std::move(client)) != 0) {
                             close(cfd);
                             LIN_LOG_WARN("Failed acquiring the client's fd");
                             break;
                         }
-                        r = el.AddEvent(cfd, kReadable);
-                        if (r != 0) {
+                        if (el.AddEvent(cfd, kReadable) != 0) {
                             el.Release(cfd);
                             LIN_LOG_WARN("Failed adding the client's readable event. Error message: '%s'",
                                          strerror(errno));
@@ -211,21 +344,29 @@ namespace cheapis {
                         anetNonBlock(nullptr, cfd);
                         anetEnableTcpNoDelay(nullptr, cfd);
                         anetKeepAlive(nullptr, cfd, kTCPKeepAlive);
+                        ++GetStats()->connections_received;
                         LIN_LOG_DEBUG("Accepted %s:%d", cip, cport);
                     }
+                    if (!drained) {
+                        el.RearmEvent(ac_fd);
+                    }
                 } else { // processor
+                    /* Edge triggered events are not filtered by mask, so check
+                     * what the client actually wants. */
                     auto & client = el.GetResource(efd);
-                    if (EventLoop<Client>::IsEventReadable(event)) {
-                        ReadFromClient(efd, client.get(), curr_time, executor.get(), &el);
+                    if (EventLoop<Client>::IsEventReadable(event) &&
+                        client != nullptr && !client->close && !client->read_paused) {
+                        ReadFromClient(efd, client.get(), curr_time, executor.get(), &idle, &el);
                     }
-                    if (EventLoop<Client>::IsEventWritable(event) && client != nullptr) {
-                        WriteToClient(efd, client.get(), curr_time, &el);
+                    if (EventLoop<Client>::IsEventWritable(event) &&
+                        client != nullptr && !client->output.empty()) {
+                        WriteToClient(efd, client.get(), curr_time, &idle, &el);
                     }
                 }
             }
 
             ExecuteTasks(executor.get(), curr_time, &el);
-            ServerCron(&last_cron_time, curr_time, &el);
+            ServerCron(&last_cron_time, curr_time, executor.get(), &idle, &el);
         }
     }
 }
\ No newline at end of file
@@ -6,25 +6,53 @@
 
 #include "gujia.h"
 #include "gujia_impl.h"
+#include "idle_list.h"
 #include "resp_machine.h"
+#include "stats.h"
 
 namespace cheapis {
     using namespace gujia;
 
     int ServerMain(int argc, char * argv[]);
 
-    struct Client {
+    struct Client : public IdleNode {
         RespMachine resp;
         std::string input;
         std::string output;
+        int fd;
         long last_mod_time;
+        long soft_limit_time = -1;
         unsigned int ref_count = 0;
         unsigned int consume_len = 0;
+        size_t held = 0;      /* Bytes at the end of output waiting on a flush */
         bool close = false;
+        bool read_paused = false;
+        bool master = false;  /* The link of a replica to its master */
+        bool syncing = false; /* Master link still before the write stream */
 
-        explicit Client(long last_mod_time = -1)
-                : last_mod_time(last_mod_time) {}
+        explicit Client(int fd = -1, long last_mod_time = -1)
+                : fd(fd), last_mod_time(last_mod_time) {
+            if (fd != -1) {
+                ++GetStats()->connected_clients;
+            }
+        }
+
+        ~Client() {
+            if (fd != -1) {
+                --GetStats()->connected_clients;
+            }
+        }
     };
+
+    // Releases the client, or marks it closed while tasks (or the executor)
+    // still hold a reference.
+    void ReleaseOrMarkClient(int fd, Client * c, EventLoop<Client> * el);
+
+    // Called by executors after appending replies. Stops reading from a client
+    // whose output buffer passed the soft limit and drops it at the hard limit
+    // (or after staying over the soft limit for too long). The client may be
+    // released, so it must not be touched afterwards.
+    void CheckOutputBuffer(int fd, Client * c, long curr_time, EventLoop<Client> * el);
 }
 
 #endif //CHEAPIS_SERVER_H
\ No newline at end of file
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "crc32c.h"
+#include "env.h"
+#include "hash.h"
+#include "snapshot.h"
+
+namespace cheapis {
+    constexpr size_t kBlockHeaderSize = 8; /* Length and CRC-32C */
+
+    struct Block {
+        std::string_view entries;
+        uint32_t crc;
+    };
+
+    // Appends up to n bytes, fewer only at the end of the file.
+    static bool ReadMore(int fd, std::string * buf, size_t n, bool * eof) {
+        size_t have = buf->size();
+        size_t want = have + n;
+        buf->resize(want);
+        while (have < want) {
+            ssize_t nread = read(fd, &(*buf)[have], want - have);
+            if (nread < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                buf->resize(have);
+                return false;
+            }
+            if (nread == 0) {
+                *eof = true;
+                break;
+            }
+            have += nread;
+        }
+        buf->resize(have);
+        return true;
+    }
+
+    // Splits the whole blocks of data from *pos on. *pos stops at the first
+    // incomplete one, or past the trailer with *end set. Returns false if the
+    // trailer is corrupt.
+    static bool SplitBlocks(const std::string & data, size_t * pos, std::vector<Block> * blocks,
+                            bool * end, uint64_t * count) {
+        while (data.size() - *pos >= kBlockHeaderSize) {
+            uint32_t len;
+            uint32_t crc;
+            memcpy(&len, &data[*pos], sizeof(len));
+            memcpy(&crc, &data[*pos + sizeof(len)], sizeof(crc));
+            if (len == 0) {
+                if (data.size() - *pos < kBlockHeaderSize + sizeof(*count)) {
+                    break;
+                }
+                memcpy(count, &data[*pos + kBlockHeaderSize], sizeof(*count));
+                if (Crc32c(0, count, sizeof(*count)) != crc) {
+                    return false;
+                }
+                *pos += kBlockHeaderSize + sizeof(*count);
+                *end = true;
+                break;
+            }
+            if (data.size() - *pos - kBlockHeaderSize < len) {
+                break;
+            }
+            blocks->push_back({std::string_view(&data[*pos + kBlockHeaderSize], len), crc});
+            *pos += kBlockHeaderSize + len;
+        }
+        return true;
+    }
+
+    static bool ParseBlock(const Block & block, size_t slot, SnapshotLoader * loader, std::atomic<uint64_t> * parsed) {
+        if (Crc32c(0, block.entries.data(), block.entries.size()) != block.crc) {
+            return false;
+        }
+        size_t pos = 0;
+        uint64_t n = 0;
+        while (pos < block.entries.size()) {
+            auto type = static_cast<uint8_t>(block.entries[pos++]);
+            std::string_view k;
+            std::string_view v;
+            bool deleted;
+            if (type > kSnapshotHash || !NextHashEntry(block.entries, &pos, &k, &v, &deleted) || deleted) {
+                return false;
+            }
+            loader->Parse(slot, static_cast<SnapshotType>(type), k, v);
+            ++n;
+        }
+        *parsed += n;
+        return true;
+    }
+
+    SnapshotWriter::SnapshotWriter(int fd) : fd_(fd), block_(kBlockHeaderSize, '\0') {
+        ok_ = FileWrite(fd_, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0;
+    }
+
+    bool SnapshotWriter::Add(SnapshotType type, const std::string_view & k, const std::string_view & v) {
+        block_.push_back(static_cast<char>(type));
+        AppendHashEntry(&block_, k, &v);
+        ++entries_;
+        if (block_.size() >= kBlockHeaderSize + kSnapshotBlockSize) {
+            WriteBlock();
+        }
+        return ok_;
+    }
+
+    bool SnapshotWriter::Finish(bool sync) {
+        if (block_.size() > kBlockHeaderSize) {
+            WriteBlock();
+        }
+        char trailer[kBlockHeaderSize + sizeof(entries_)];
+        uint32_t len = 0;
+        uint32_t crc = Crc32c(0, &entries_, sizeof(entries_));
+        memcpy(trailer, &len, sizeof(len));
+        memcpy(trailer + sizeof(len), &crc, sizeof(crc));
+        memcpy(trailer + kBlockHeaderSize, &entries_, sizeof(entries_));
+        ok_ = ok_ && FileWrite(fd_, trailer, sizeof(trailer)) == 0 && (!sync || fsync(fd_) == 0);
+        return ok_;
+    }
+
+    bool SnapshotWriter::WriteBlock() {
+        auto len = static_cast<uint32_t>(block_.size() - kBlockHeaderSize);
+        uint32_t crc = Crc32c(0, block_.data() + kBlockHeaderSize, len);
+        memcpy(&block_[0], &len, sizeof(len));
+        memcpy(&block_[sizeof(len)], &crc, sizeof(crc));
+        ok_ = ok_ && FileWrite(fd_, block_.data(), block_.size()) == 0;
+        block_.resize(kBlockHeaderSize);
+        return ok_;
+    }
+
+    bool LoadSnapshot(int fd, size_t threads, SnapshotLoader * loader, uint64_t * entries, std::string * err) {
+        FileHint(fd, kSequential);
+        std::string data[2];
+        int cur = 0;
+        bool eof = false;
+        if (!ReadMore(fd, &data[cur], kSnapshotChunkSize, &eof)) {
+            *err = strerror(errno);
+            return false;
+        }
+        if (data[cur].size() < sizeof(kSnapshotMagic) ||
+            memcmp(data[cur].data(), kSnapshotMagic, sizeof(kSnapshotMagic)) != 0) {
+            *err = "not a snapshot";
+            return false;
+        }
+
+        size_t pos = sizeof(kSnapshotMagic);
+        std::vector<Block> blocks;
+        std::atomic<uint64_t> parsed{0};
+        uint64_t count = 0;
+        bool end = false;
+        while (!end) {
+            blocks.clear();
+            if (!SplitBlocks(data[cur], &pos, &blocks, &end, &count)) {
+                *err = "corrupt trailer";
+                return false;
+            }
+            if (blocks.empty() && !end) {
+                if (eof) {
+                    *err = "truncated";
+                    return false;
+                }
+                /* A block larger than a chunk, read on until it is whole */
+                if (!ReadMore(fd, &data[cur], kSnapshotChunkSize, &eof)) {
+                    *err = strerror(errno);
+                    return false;
+                }
+                continue;
+            }
+
+            loader->BeginChunk(blocks.size());
+            std::atomic<size_t> next{0};
+            std::atomic<bool> corrupt{false};
+            std::vector<std::thread> workers;
+            for (size_t i = 0; i < std::min(std::max<size_t>(threads, 1), blocks.size()); ++i) {
+                workers.emplace_back([&]() {
+                    for (size_t j = next++; j < blocks.size(); j = next++) {
+                        if (!ParseBlock(blocks[j], j, loader, &parsed)) {
+                            corrupt = true;
+                        }
+                    }
+                });
+            }
+
+            /* The rest of the file streams in meanwhile */
+            int other = 1 - cur;
+            bool read = true;
+            if (!end) {
+                data[other].assign(data[cur], pos, std::string::npos);
+                read = eof || ReadMore(fd, &data[other], kSnapshotChunkSize, &eof);
+            }
+            int error = errno;
+            for (auto & worker:workers) {
+                worker.join();
+            }
+            if (corrupt) {
+                *err = "corrupt block";
+                return false;
+            }
+            if (!read) {
+                *err = strerror(error);
+                return false;
+            }
+            loader->CommitChunk();
+            cur = other;
+            pos = 0;
+        }
+        if (parsed != count) {
+            *err = "entry count mismatch";
+            return false;
+        }
+        *entries = count;
+        return true;
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#ifndef CHEAPIS_SNAPSHOT_H
+#define CHEAPIS_SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cheapis {
+    // A snapshot is the magic, blocks of entries each led by its length and
+    // CRC-32C, and a zero length block whose CRC covers the entry count that
+    // follows. An entry is its type and then the key and value as a hash
+    // entry, so the value of a hash is itself a listpack of its fields.
+    // Entries never straddle blocks, which are parsed independently.
+    constexpr char kSnapshotMagic[8] = {'C', 'H', 'P', 'S', 'N', 'A', 'P', '1'};
+    constexpr size_t kSnapshotBlockSize = 1 << 20;   /* Blocks are cut past this */
+    constexpr size_t kSnapshotChunkSize = 64 << 20;  /* Bytes per read while loading */
+
+    enum SnapshotType : uint8_t {
+        kSnapshotString,
+        kSnapshotInteger, /* Value in decimal */
+        kSnapshotHash,
+    };
+
+    // Streams a snapshot to fd, a block per write.
+    class SnapshotWriter {
+    public:
+        explicit SnapshotWriter(int fd);
+
+        // Returns false once a write has failed.
+        bool Add(SnapshotType type, const std::string_view & k, const std::string_view & v);
+
+        // Writes the last block and the trailer, then syncs the file if sync
+        // is set, which a socket can't be.
+        bool Finish(bool sync = true);
+
+    private:
+        bool WriteBlock();
+
+    private:
+        int fd_;
+        std::string block_;
+        uint64_t entries_ = 0;
+        bool ok_ = true;
+    };
+
+    // Takes the entries of a snapshot being loaded.
+    class SnapshotLoader {
+    public:
+        SnapshotLoader() = default;
+
+        virtual ~SnapshotLoader() = default;
+
+    public:
+        // Before the blocks of a chunk are parsed.
+        virtual void BeginChunk(size_t blocks) = 0;
+
+        // On one of the loading threads, block being the position within
+        // the chunk.
+        virtual void Parse(size_t block, SnapshotType type,
+                           const std::string_view & k, const std::string_view & v) = 0;
+
+        // On the calling thread once the whole chunk is parsed, chunks in
+        // file order.
+        virtual void CommitChunk() = 0;
+    };
+
+    // Reads the snapshot at fd a chunk at a time with large sequential
+    // reads, reading the next chunk while up to threads threads check and
+    // parse the blocks of the current one. Returns false with a message in
+    // err if the snapshot is corrupt or truncated.
+    bool LoadSnapshot(int fd, size_t threads, SnapshotLoader * loader, uint64_t * entries, std::string * err);
+}
+
+#endif //CHEAPIS_SNAPSHOT_H
@@ -0,0 +1,422 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <strings.h>
+#include <unistd.h>
+#include <vector>
+
+#include "env.h"
+#include "executor.h"
+#include "gujia.h"
+#include "resp_machine.h"
+#include "stats.h"
+#include "util.h"
+
+namespace cheapis {
+    constexpr long long kSlowlogSlowerThan = 10000; /* Microseconds */
+    constexpr size_t kSlowlogMaxLen = 128;
+    constexpr size_t kSlowlogMaxArgc = 32;
+    constexpr size_t kSlowlogMaxArgLength = 128;
+
+    constexpr const char * kStageNames[kStageCount] = {
+            "parse", "queue", "index", "read", "append", "write",
+    };
+
+    struct SlowlogEntry {
+        long long id;
+        long time;
+        long long duration;
+        std::vector<std::string> argv;
+    };
+
+    /* Histograms summed across threads, commands first, then stages */
+    constexpr size_t kHistogramCount = kCommandCount + kStageCount;
+    typedef std::vector<uint64_t> HistogramSums;
+
+    struct StatsTotal {
+        int64_t calls[kCommandCount] = {};
+        int64_t connections_received = 0;
+        int64_t connected_clients = 0;
+        int64_t net_input_bytes = 0;
+        int64_t net_output_bytes = 0;
+        int64_t data_bytes_written = 0;
+    };
+
+    static std::mutex registry_mutex;
+    static std::vector<Stats *> registry; /* Never freed, threads live as long as the server */
+
+    static long start_time = 0;
+    static unsigned int tcp_port = 0;
+
+    static HistogramSums latency_baseline(kHistogramCount * Histogram::kBucketCount);
+
+    static std::mutex slowlog_mutex;
+    static std::deque<SlowlogEntry> slowlog; /* Newest first */
+    static long long slowlog_next_id = 0;
+
+    static long sample_time_ms = 0;
+    static int64_t sample_calls[kCommandCount] = {};
+    static double ops_per_sec[kCommandCount] = {};
+
+    Stats * GetStats() {
+        thread_local Stats * stats = [] {
+            auto * s = new Stats();
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            registry.emplace_back(s);
+            return s;
+        }();
+        return stats;
+    }
+
+    static void SumStats(StatsTotal * total) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const Stats * s:registry) {
+            for (int i = 0; i < kCommandCount; ++i) {
+                total->calls[i] += s->calls[i].Get();
+            }
+            total->connections_received += s->connections_received.Get();
+            total->connected_clients += s->connected_clients.Get();
+            total->net_input_bytes += s->net_input_bytes.Get();
+            total->net_output_bytes += s->net_output_bytes.Get();
+            total->data_bytes_written += s->data_bytes_written.Get();
+        }
+    }
+
+    /* Minus what LATENCY RESET saw, other threads' counters are never written */
+    static void SumHistograms(HistogramSums * sums) {
+        sums->assign(kHistogramCount * Histogram::kBucketCount, 0);
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const Stats * s:registry) {
+            for (int i = 0; i < kCommandCount; ++i) {
+                s->latency[i].AddTo(&(*sums)[i * Histogram::kBucketCount]);
+            }
+            for (int i = 0; i < kStageCount; ++i) {
+                s->stages[i].AddTo(&(*sums)[(kCommandCount + i) * Histogram::kBucketCount]);
+            }
+        }
+        for (size_t i = 0; i < sums->size(); ++i) {
+            (*sums)[i] -= latency_baseline[i];
+        }
+    }
+
+    static void AppendPercentiles(std::string * buf, const char * prefix, const char * name,
+                                  const uint64_t * buckets) {
+        uint64_t count = 0;
+        for (int i = 0; i < Histogram::kBucketCount; ++i) {
+            count += buckets[i];
+        }
+        if (count == 0) {
+            return;
+        }
+
+        double cycles_per_us = GetCyclesPerMicrosecond();
+        char line[256];
+        int n = snprintf(line, sizeof(line), "%s%s:p50=%.3f,p99=%.3f,p99.9=%.3f\r\n", prefix, name,
+                         Histogram::GetPercentile(buckets, count, 50) / cycles_per_us,
+                         Histogram::GetPercentile(buckets, count, 99) / cycles_per_us,
+                         Histogram::GetPercentile(buckets, count, 99.9) / cycles_per_us);
+        buf->append(line, static_cast<size_t>(n));
+    }
+
+    static void SlowlogPush(Command cmd, const rocksdb::autovector<std::string> & argv, size_t first,
+                            long long duration) {
+        SlowlogEntry entry;
+        entry.time = GetCurrentTimeInSeconds();
+        entry.duration = duration;
+        entry.argv.emplace_back(GetCommandName(cmd));
+        for (size_t i = first; i < argv.size(); ++i) {
+            if (entry.argv.size() == kSlowlogMaxArgc - 1 && i != argv.size() - 1) {
+                entry.argv.emplace_back("... (" + std::to_string(argv.size() - i) + " more arguments)");
+                break;
+            }
+            const std::string & arg = argv[i];
+            if (arg.size() > kSlowlogMaxArgLength) {
+                entry.argv.emplace_back(arg, 0, kSlowlogMaxArgLength);
+                entry.argv.back().append("... (" + std::to_string(arg.size() - kSlowlogMaxArgLength) +
+                                         " more bytes)");
+            } else {
+                entry.argv.emplace_back(arg);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(slowlog_mutex);
+        entry.id = slowlog_next_id++;
+        slowlog.emplace_front(std::move(entry));
+        if (slowlog.size() > kSlowlogMaxLen) {
+            slowlog.pop_back();
+        }
+    }
+
+    void RecordTask(Stats * stats, Command cmd,
+                    const rocksdb::autovector<std::string> & argv, size_t first,
+                    uint64_t submitted, uint64_t begun, uint64_t io,
+                    uint64_t executed, uint64_t replied) {
+        static const auto slow_cycles = static_cast<uint64_t>(kSlowlogSlowerThan *
+                                                              GetCyclesPerMicrosecond());
+        stats->stages[kStageQueue].Record(begun - submitted);
+        /* A batched GET's read may have started before the task began */
+        stats->stages[kStageIndex].Record(executed - begun > io ? executed - begun - io : 0);
+        if (io != 0) {
+            stats->stages[kStageRead].Record(io);
+        }
+        stats->stages[kStageWrite].Record(replied - executed);
+        stats->latency[cmd].Record(replied - submitted);
+
+        if (executed - begun > slow_cycles) {
+            SlowlogPush(cmd, argv, first,
+                        static_cast<long long>((executed - begun) / GetCyclesPerMicrosecond()));
+        }
+    }
+
+    static bool EqualsIgnoreCase(const std::string_view & a, const char * b) {
+        return a.size() == strlen(b) && strncasecmp(a.data(), b, a.size()) == 0;
+    }
+
+    void ExecuteLatency(const rocksdb::autovector<std::string> & argv, size_t first,
+                        std::string * out) {
+        if (first < argv.size() && EqualsIgnoreCase(argv[first], "reset")) {
+            HistogramSums sums;
+            SumHistograms(&sums);
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            for (size_t i = 0; i < sums.size(); ++i) {
+                latency_baseline[i] += sums[i];
+            }
+            RespMachine::AppendSimpleString(out, "OK");
+            return;
+        }
+        if (first >= argv.size() || !EqualsIgnoreCase(argv[first], "histogram")) {
+            RespMachine::AppendError(out, "ERR unknown LATENCY subcommand, try HISTOGRAM or RESET");
+            return;
+        }
+
+        HistogramSums sums;
+        SumHistograms(&sums);
+        double cycles_per_us = GetCyclesPerMicrosecond();
+        std::string body;
+        int commands = 0;
+        for (int i = 0; i < kUnsupported; ++i) {
+            const char * name = GetCommandName(static_cast<Command>(i));
+            bool wanted = first + 1 == argv.size();
+            for (size_t j = first + 1; j < argv.size() && !wanted; ++j) {
+                wanted = EqualsIgnoreCase(argv[j], name);
+            }
+            if (!wanted) {
+                continue;
+            }
+
+            /* Fold into the power of two microsecond buckets Redis reports */
+            const uint64_t * buckets = &sums[i * Histogram::kBucketCount];
+            uint64_t pow2[64] = {};
+            uint64_t calls = 0;
+            for (int b = 0; b < Histogram::kBucketCount; ++b) {
+                if (buckets[b] != 0) {
+                    double us = Histogram::GetBucketUpperBound(b) / cycles_per_us;
+                    int p = us <= 1 ? 0 : static_cast<int>(std::ceil(std::log2(us)));
+                    pow2[std::min(p, 63)] += buckets[b];
+                    calls += buckets[b];
+                }
+            }
+            if (calls == 0) {
+                continue;
+            }
+
+            ++commands;
+            RespMachine::AppendBulkString(&body, name);
+            RespMachine::AppendArrayLength(&body, 4);
+            RespMachine::AppendBulkString(&body, "calls");
+            RespMachine::AppendInteger(&body, static_cast<long long>(calls));
+            RespMachine::AppendBulkString(&body, "histogram_usec");
+            int filled = 0;
+            for (uint64_t c:pow2) {
+                filled += c != 0;
+            }
+            RespMachine::AppendArrayLength(&body, filled * 2);
+            uint64_t cumulative = 0;
+            for (int p = 0; p < 64; ++p) {
+                if (pow2[p] != 0) {
+                    cumulative += pow2[p];
+                    RespMachine::AppendInteger(&body, 1LL << p);
+                    RespMachine::AppendInteger(&body, static_cast<long long>(cumulative));
+                }
+            }
+        }
+        RespMachine::AppendArrayLength(out, commands * 2);
+        out->append(body);
+    }
+
+    void ExecuteSlowlog(const rocksdb::autovector<std::string> & argv, size_t first,
+                        std::string * out) {
+        std::lock_guard<std::mutex> lock(slowlog_mutex);
+        if (first < argv.size() && EqualsIgnoreCase(argv[first], "len")) {
+            RespMachine::AppendInteger(out, static_cast<long long>(slowlog.size()));
+        } else if (first < argv.size() && EqualsIgnoreCase(argv[first], "reset")) {
+            slowlog.clear();
+            RespMachine::AppendSimpleString(out, "OK");
+        } else if (first < argv.size() && EqualsIgnoreCase(argv[first], "get")) {
+            long long count = 10;
+            if (first + 1 < argv.size()) {
+                const std::string & arg = argv[first + 1];
+                if (!string2ll(arg.data(), arg.size(), &count) || count < -1) {
+                    RespMachine::AppendError(out, "ERR count should be greater than or equal to -1");
+                    return;
+                }
+                if (count == -1) {
+                    count = static_cast<long long>(slowlog.size());
+                }
+            }
+
+            auto n = std::min(static_cast<size_t>(count), slowlog.size());
+            RespMachine::AppendArrayLength(out, static_cast<long long>(n));
+            for (size_t i = 0; i < n; ++i) {
+                const SlowlogEntry & entry = slowlog[i];
+                RespMachine::AppendArrayLength(out, 6);
+                RespMachine::AppendInteger(out, entry.id);
+                RespMachine::AppendInteger(out, entry.time);
+                RespMachine::AppendInteger(out, entry.duration);
+                RespMachine::AppendArrayLength(out, static_cast<long long>(entry.argv.size()));
+                for (const auto & arg:entry.argv) {
+                    RespMachine::AppendBulkString(out, arg);
+                }
+                RespMachine::AppendBulkString(out, "");
+                RespMachine::AppendBulkString(out, "");
+            }
+        } else {
+            RespMachine::AppendError(out, "ERR unknown SLOWLOG subcommand, try GET, LEN or RESET");
+        }
+    }
+
+    void InitStats(long start, unsigned int port) {
+        start_time = start;
+        tcp_port = port;
+        GetCyclesPerMicrosecond();
+    }
+
+    void SampleStats(long curr_time_ms) {
+        StatsTotal total;
+        SumStats(&total);
+        long elapsed = curr_time_ms - sample_time_ms;
+        for (int i = 0; i < kCommandCount; ++i) {
+            if (sample_time_ms != 0 && elapsed > 0) {
+                ops_per_sec[i] = (total.calls[i] - sample_calls[i]) * 1000.0 / elapsed;
+            }
+            sample_calls[i] = total.calls[i];
+        }
+        sample_time_ms = curr_time_ms;
+    }
+
+    void AppendInfoField(std::string * buf, const char * name, long long value) {
+        buf->append(name);
+        buf->push_back(':');
+        buf->append(std::to_string(value));
+        buf->append("\r\n");
+    }
+
+    void AppendInfoField(std::string * buf, const char * name, const std::string_view & value) {
+        buf->append(name);
+        buf->push_back(':');
+        buf->append(value);
+        buf->append("\r\n");
+    }
+
+    static bool BeginSection(const std::string_view & wanted, const char * title,
+                             std::string * buf) {
+        if (!wanted.empty() &&
+            !(wanted.size() == 3 && strncasecmp(wanted.data(), "all", 3) == 0) &&
+            !(wanted.size() == 7 && strncasecmp(wanted.data(), "default", 7) == 0) &&
+            !(wanted.size() == 10 && strncasecmp(wanted.data(), "everything", 10) == 0) &&
+            !(wanted.size() == strlen(title) && strncasecmp(wanted.data(), title, wanted.size()) == 0)) {
+            return false;
+        }
+        if (!buf->empty()) {
+            buf->append("\r\n");
+        }
+        buf->append("# ");
+        buf->append(title);
+        buf->append("\r\n");
+        return true;
+    }
+
+    void GenerateInfo(const std::string_view & section, const Executor & executor,
+                      std::string * buf) {
+        StatsTotal total;
+        SumStats(&total);
+
+        if (BeginSection(section, "Server", buf)) {
+#if defined(GUJIA_HAS_EPOLL)
+            AppendInfoField(buf, "multiplexing_api", "epoll");
+#else
+            AppendInfoField(buf, "multiplexing_api", "kqueue");
+#endif
+            AppendInfoField(buf, "process_id", getpid());
+            AppendInfoField(buf, "tcp_port", tcp_port);
+            AppendInfoField(buf, "uptime_in_seconds", GetCurrentTimeInSeconds() - start_time);
+            executor.GetInfo("server", buf);
+        }
+
+        if (BeginSection(section, "Clients", buf)) {
+            AppendInfoField(buf, "connected_clients", total.connected_clients);
+            AppendInfoField(buf, "pending_tasks", static_cast<long long>(executor.GetTaskCount()));
+            executor.GetInfo("clients", buf);
+        }
+
+        if (BeginSection(section, "Memory", buf)) {
+            AppendInfoField(buf, "used_memory_rss", static_cast<long long>(GetRSS()));
+            executor.GetInfo("memory", buf);
+        }
+
+        if (BeginSection(section, "Persistence", buf)) {
+            AppendInfoField(buf, "total_data_bytes_written", total.data_bytes_written);
+            executor.GetInfo("persistence", buf);
+        }
+
+        if (BeginSection(section, "Stats", buf)) {
+            int64_t commands = 0;
+            double ops = 0;
+            for (int i = 0; i < kCommandCount; ++i) {
+                commands += total.calls[i];
+                ops += ops_per_sec[i];
+            }
+            AppendInfoField(buf, "total_connections_received", total.connections_received);
+            AppendInfoField(buf, "total_commands_processed", commands);
+            AppendInfoField(buf, "instantaneous_ops_per_sec", static_cast<long long>(ops));
+            AppendInfoField(buf, "total_net_input_bytes", total.net_input_bytes);
+            AppendInfoField(buf, "total_net_output_bytes", total.net_output_bytes);
+            executor.GetInfo("stats", buf);
+        }
+
+        if (BeginSection(section, "Replication", buf)) {
+            executor.GetInfo("replication", buf);
+        }
+
+        if (BeginSection(section, "Commandstats", buf)) {
+            char line[128];
+            for (int i = 0; i < kCommandCount; ++i) {
+                if (total.calls[i] != 0) {
+                    int n = snprintf(line, sizeof(line), "cmdstat_%s:calls=%lld,ops_per_sec=%.2f\r\n",
+                                     GetCommandName(static_cast<Command>(i)),
+                                     static_cast<long long>(total.calls[i]), ops_per_sec[i]);
+                    buf->append(line, static_cast<size_t>(n));
+                }
+            }
+        }
+
+        if (BeginSection(section, "Latencystats", buf)) {
+            HistogramSums sums;
+            SumHistograms(&sums);
+            for (int i = 0; i < kCommandCount; ++i) {
+                AppendPercentiles(buf, "latency_percentiles_usec_", GetCommandName(static_cast<Command>(i)),
+                                  &sums[i * Histogram::kBucketCount]);
+            }
+            for (int i = 0; i < kStageCount; ++i) {
+                AppendPercentiles(buf, "latency_stage_usec_", kStageNames[i],
+                                  &sums[(kCommandCount + i) * Histogram::kBucketCount]);
+            }
+        }
+
+        if (BeginSection(section, "Keyspace", buf)) {
+            executor.GetInfo("keyspace", buf);
+        }
+    }
+}
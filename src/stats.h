@@ -0,0 +1,74 @@
+#pragma once
+#ifndef CHEAPIS_STATS_H
+#define CHEAPIS_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "autovector.h"
+#include "command.h"
+#include "counter.h"
+#include "histogram.h"
+
+namespace cheapis {
+    class Executor;
+
+    // Where the time of a request goes, for INFO latencystats.
+    enum Stage {
+        kStageParse,
+        kStageQueue,
+        kStageIndex,
+        kStageRead,
+        kStageAppend,
+        kStageWrite,
+        kStageCount,
+    };
+
+    struct Stats {
+        Counter calls[kCommandCount];
+        Counter connections_received;
+        Counter connected_clients;
+        Counter net_input_bytes;
+        Counter net_output_bytes;
+        Counter data_bytes_written;
+        Histogram latency[kCommandCount];
+        Histogram stages[kStageCount];
+    };
+
+    // Counters of the calling thread. INFO sums the counters of all threads.
+    Stats * GetStats();
+
+    void InitStats(long start_time, unsigned int port);
+
+    // Samples the counters behind the ops/sec figures, called by ServerCron.
+    void SampleStats(long curr_time_ms);
+
+    // Records one retired task, all arguments are GetCycles() readings except
+    // io, the cycles spent reading data files while executing it. Commands
+    // slower than the slowlog threshold are logged with their arguments
+    // argv[first..].
+    void RecordTask(Stats * stats, Command cmd,
+                    const rocksdb::autovector<std::string> & argv, size_t first,
+                    uint64_t submitted, uint64_t begun, uint64_t io,
+                    uint64_t executed, uint64_t replied);
+
+    // LATENCY HISTOGRAM [command ...] | LATENCY RESET, argv[first] being the
+    // subcommand.
+    void ExecuteLatency(const rocksdb::autovector<std::string> & argv, size_t first,
+                        std::string * out);
+
+    // SLOWLOG GET [count] | SLOWLOG LEN | SLOWLOG RESET
+    void ExecuteSlowlog(const rocksdb::autovector<std::string> & argv, size_t first,
+                        std::string * out);
+
+    void AppendInfoField(std::string * buf, const char * name, long long value);
+
+    void AppendInfoField(std::string * buf, const char * name, const std::string_view & value);
+
+    // Redis style INFO text. Executors fill in their own part of each section.
+    void GenerateInfo(const std::string_view & section, const Executor & executor,
+                      std::string * buf);
+}
+
+#endif //CHEAPIS_STATS_H
@@ -1,7 +1,143 @@
+#include <ctype.h>
 #include <limits.h>
 
 #include "util.h"
 
+/* Glob-style pattern matching. */
+static int stringmatchlen_impl(const char * pattern, int patternLen,
+                               const char * string, int stringLen, int nocase,
+                               int * skipLongerMatches, int nesting) {
+    /* Protection against abusive patterns. */
+    if (nesting > 1000) return 0;
+
+    while (patternLen && stringLen) {
+        switch (pattern[0]) {
+            case '*':
+                while (patternLen > 1 && pattern[1] == '*') {
+                    pattern++;
+                    patternLen--;
+                }
+                if (patternLen == 1)
+                    return 1; /* match */
+                while (stringLen) {
+                    if (stringmatchlen_impl(pattern + 1, patternLen - 1,
+                                            string, stringLen, nocase, skipLongerMatches, nesting + 1))
+                        return 1; /* match */
+                    if (*skipLongerMatches)
+                        return 0; /* no match */
+                    string++;
+                    stringLen--;
+                }
+                /* There was no match for the rest of the pattern starting
+                 * from anywhere in the rest of the string. Earlier '*' can't
+                 * do better by matching longer substrings, since the rest of
+                 * the pattern would then have to match even later. */
+                *skipLongerMatches = 1;
+                return 0; /* no match */
+            case '?':
+                string++;
+                stringLen--;
+                break;
+            case '[': {
+                int not, match;
+
+                pattern++;
+                patternLen--;
+                not = patternLen && pattern[0] == '^';
+                if (not) {
+                    pattern++;
+                    patternLen--;
+                }
+                match = 0;
+                while (1) {
+                    if (patternLen == 0) {
+                        pattern--;
+                        patternLen++;
+                        break;
+                    } else if (pattern[0] == '\\' && patternLen >= 2) {
+                        pattern++;
+                        patternLen--;
+                        if (pattern[0] == string[0])
+                            match = 1;
+                    } else if (pattern[0] == ']') {
+                        break;
+                    } else if (patternLen >= 3 && pattern[1] == '-') {
+                        int start = pattern[0];
+                        int end = pattern[2];
+                        int c = string[0];
+                        if (start > end) {
+                            int t = start;
+                            start = end;
+                            end = t;
+                        }
+                        if (nocase) {
+                            start = tolower(start);
+                            end = tolower(end);
+                            c = tolower(c);
+                        }
+                        pattern += 2;
+                        patternLen -= 2;
+                        if (c >= start && c <= end)
+                            match = 1;
+                    } else {
+                        if (!nocase) {
+                            if (pattern[0] == string[0])
+                                match = 1;
+                        } else {
+                            if (tolower((int) pattern[0]) == tolower((int) string[0]))
+                                match = 1;
+                        }
+                    }
+                    pattern++;
+                    patternLen--;
+                }
+                if (not)
+                    match = !match;
+                if (!match)
+                    return 0; /* no match */
+                string++;
+                stringLen--;
+                break;
+            }
+            case '\\':
+                if (patternLen >= 2) {
+                    pattern++;
+                    patternLen--;
+                }
+                /* fall through */
+            default:
+                if (!nocase) {
+                    if (pattern[0] != string[0])
+                        return 0; /* no match */
+                } else {
+                    if (tolower((int) pattern[0]) != tolower((int) string[0]))
+                        return 0; /* no match */
+                }
+                string++;
+                stringLen--;
+                break;
+        }
+        pattern++;
+        patternLen--;
+        if (stringLen == 0) {
+            while (patternLen && *pattern == '*') {
+                pattern++;
+                patternLen--;
+            }
+            break;
+        }
+    }
+    if (patternLen == 0 && stringLen == 0)
+        return 1;
+    return 0;
+}
+
+int stringmatchlen(const char * pattern, int patternLen,
+                   const char * string, int stringLen, int nocase) {
+    int skipLongerMatches = 0;
+    return stringmatchlen_impl(pattern, patternLen, string, stringLen, nocase, &skipLongerMatches, 0);
+}
+
 /* Convert a string into a long long. Returns 1 if the string could be parsed
  * into a (non-overflowing) long long, 0 otherwise. The value will be set to
  * the parsed value when appropriate.
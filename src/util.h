@@ -37,6 +37,9 @@
 extern "C" {
 #endif
 
+int stringmatchlen(const char * pattern, int patternLen,
+                   const char * string, int stringLen, int nocase);
+
 int string2ll(const char * s, size_t slen, long long * value);
 
 uint32_t digits10(uint64_t v);
@@ -0,0 +1,199 @@
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+
+#include "test.h"
+
+using namespace cheapis;
+
+static std::string ReadFile(const std::string & name) {
+    std::ifstream in(name, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+static off_t GetFileSize(const std::string & name) {
+    struct stat st = {};
+    return stat(name.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+// Every kind of write replays to the same keys, an INCRBYFLOAT as the SET
+// of its result.
+TEST(aof, Replay) {
+    std::string dir = MakeTestDir("aof");
+    std::string aof = dir + "/appendonly.aof";
+    {
+        auto executor = OpenExecutorMem("", aof);
+        CHECK(executor != nullptr);
+        TestSession session(executor.get());
+        session.Submit({"SET", "s", "first"});
+        session.Submit({"SET", "s", "second"});
+        session.Submit({"SET", "gone", "v"});
+        session.Submit({"DEL", "gone"});
+        session.Submit({"INCR", "n"});
+        session.Submit({"INCRBY", "n", "10"});
+        session.Submit({"DECR", "n"});
+        session.Submit({"INCRBYFLOAT", "f", "0.1"});
+        session.Submit({"INCRBYFLOAT", "f", "0.2"});
+        session.Submit({"HSET", "h", "a", "1", "b", "2", "c", "3"});
+        session.Submit({"HDEL", "h", "b"});
+        session.Submit({"HDEL", "h", "missing"});
+        session.Submit({"GET", "s"});
+        session.Drain();
+        session.Read(0, 1);
+    }
+    std::string contents = ReadFile(aof);
+    CHECK(contents.find("INCRBYFLOAT") == std::string::npos);
+    CHECK(contents.find("GET") == std::string::npos);
+    CHECK(contents.find("missing") == std::string::npos);
+
+    auto executor = OpenExecutorMem("", aof);
+    CHECK(executor != nullptr);
+    if (executor != nullptr) {
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"GET", "s"}), Bulk("second"));
+        CHECK_EQ(session.Run({"GET", "gone"}), kNil);
+        CHECK_EQ(session.Run({"GET", "n"}), Bulk("10"));
+        CHECK_EQ(session.Run({"GET", "f"}), Bulk("0.3"));
+        CHECK_EQ(session.Run({"HMGET", "h", "a", "b", "c"}), "*3\r\n" + Bulk("1") + kNil + Bulk("3"));
+        CHECK_EQ(session.Run({"INCR", "n"}), ":11\r\n");
+    }
+    executor.reset();
+    RemoveTree(dir);
+}
+
+// A command cut short at the end, as a crash mid-write leaves it, is dropped
+// and the file truncated before it, so the next writes replay too.
+TEST(aof, CutShort) {
+    std::string dir = MakeTestDir("aof");
+    std::string aof = dir + "/appendonly.aof";
+    {
+        auto executor = OpenExecutorMem("", aof);
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"SET", "a", "1"}), "+OK\r\n");
+    }
+    off_t size = GetFileSize(aof);
+    {
+        std::ofstream out(aof, std::ios::binary | std::ios::app);
+        out << "*3\r\n$3\r\nSET\r\n$1\r\nz\r\n$5\r\nvv";
+    }
+    {
+        auto executor = OpenExecutorMem("", aof);
+        CHECK(executor != nullptr);
+        if (executor == nullptr) {
+            RemoveTree(dir);
+            return;
+        }
+        CHECK(GetFileSize(aof) == size);
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"GET", "z"}), kNil);
+        CHECK_EQ(session.Run({"SET", "b", "2"}), "+OK\r\n");
+    }
+    auto executor = OpenExecutorMem("", aof);
+    CHECK(executor != nullptr);
+    if (executor != nullptr) {
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"GET", "a"}), Bulk("1"));
+        CHECK_EQ(session.Run({"GET", "b"}), Bulk("2"));
+    }
+    executor.reset();
+    RemoveTree(dir);
+}
+
+// The rewrite holds the keys as of its fork plus the writes made while it
+// ran, in far fewer bytes than the history it replaces.
+TEST(aof, Rewrite) {
+    std::string dir = MakeTestDir("aof");
+    std::string aof = dir + "/appendonly.aof";
+    {
+        auto executor = OpenExecutorMem("", aof);
+        TestSession session(executor.get());
+        for (int i = 0; i < 1000; ++i) {
+            session.Submit({"SET", "k", std::to_string(i)});
+            session.Submit({"HSET", "h", "f" + std::to_string(i % 10), std::to_string(i)});
+        }
+        session.Drain();
+        session.Read(0, 1);
+        off_t size = GetFileSize(aof);
+
+        CHECK_EQ(session.Run({"BGREWRITEAOF"}), "+Background append only file rewriting started\r\n");
+        CHECK_EQ(session.Run({"BGREWRITEAOF"}),
+                 "-ERR Background append only file rewriting already in progress\r\n");
+        CHECK_EQ(session.Run({"SET", "during", "v"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "k", "0.5"}), Bulk("999.5"));
+        CHECK(session.CronUntil("persistence", "aof_rewrite_in_progress:0"));
+        CHECK(session.CronUntil("persistence", "aof_last_bgrewrite_status:ok"));
+        CHECK(GetFileSize(aof) < size / 10);
+        CHECK(access((aof + ".rewrite").c_str(), F_OK) != 0);
+        CHECK_EQ(session.Run({"SET", "after", "v"}), "+OK\r\n");
+    }
+    auto executor = OpenExecutorMem("", aof);
+    CHECK(executor != nullptr);
+    if (executor != nullptr) {
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"GET", "k"}), Bulk("999.5"));
+        CHECK_EQ(session.Run({"HGET", "h", "f9"}), Bulk("999"));
+        CHECK_EQ(session.Run({"GET", "during"}), Bulk("v"));
+        CHECK_EQ(session.Run({"GET", "after"}), Bulk("v"));
+    }
+    executor.reset();
+    RemoveTree(dir);
+}
+
+// A node turning the AOF on starts it from its snapshot.
+TEST(aof, FromSnapshot) {
+    std::string dir = MakeTestDir("aof");
+    std::string snapshot = dir + "/dump.snapshot";
+    std::string aof = dir + "/appendonly.aof";
+    {
+        auto executor = OpenExecutorMem(snapshot);
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"SET", "saved", "v"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"BGSAVE"}), "+Background saving started\r\n");
+        CHECK(session.CronUntil("persistence", "rdb_bgsave_in_progress:0"));
+    }
+    {
+        auto executor = OpenExecutorMem(snapshot, aof);
+        CHECK(executor != nullptr);
+        if (executor == nullptr) {
+            RemoveTree(dir);
+            return;
+        }
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"GET", "saved"}), Bulk("v"));
+        CHECK_EQ(session.Run({"SET", "appended", "v"}), "+OK\r\n");
+    }
+    unlink(snapshot.c_str());
+    auto executor = OpenExecutorMem(snapshot, aof);
+    CHECK(executor != nullptr);
+    if (executor != nullptr) {
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"GET", "saved"}), Bulk("v"));
+        CHECK_EQ(session.Run({"GET", "appended"}), Bulk("v"));
+    }
+    executor.reset();
+    RemoveTree(dir);
+}
+
+TEST(aof, Errors) {
+    {
+        auto executor = OpenExecutorMem();
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"BGREWRITEAOF"}), "-ERR appendonly is off\r\n");
+    }
+    std::string dir = MakeTestDir("aof");
+    {
+        auto executor = OpenExecutorMem(dir + "/dump.snapshot", dir + "/appendonly.aof");
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"SET", "k", "v"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"BGREWRITEAOF"}), "+Background append only file rewriting started\r\n");
+        CHECK_EQ(session.Run({"BGSAVE"}), "-ERR Background append only file rewriting in progress\r\n");
+        CHECK(session.CronUntil("persistence", "aof_rewrite_in_progress:0"));
+        CHECK_EQ(session.Run({"BGSAVE"}), "+Background saving started\r\n");
+        CHECK_EQ(session.Run({"BGREWRITEAOF"}), "-ERR Background save in progress\r\n");
+        CHECK(session.CronUntil("persistence", "rdb_bgsave_in_progress:0"));
+    }
+    RemoveTree(dir);
+}
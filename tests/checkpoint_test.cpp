@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+
+#include "../src/disk/filename.h"
+#include "../src/env.h"
+#include "test.h"
+
+using namespace cheapis;
+
+// The value of a name:value line of INFO style text, empty if none.
+static std::string GetField(const std::string & text, const std::string & name) {
+    size_t pos = ("\n" + text).find("\n" + name + ":");
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += name.size() + 1;
+    return text.substr(pos, text.find("\r\n", pos) - pos);
+}
+
+static std::string ReadFile(const std::string & name, size_t n = SIZE_MAX) {
+    std::ifstream in(name, std::ios::binary);
+    std::string s;
+    char buf[65536];
+    while (s.size() < n && in.read(buf, std::min(sizeof(buf), n - s.size())).gcount() > 0) {
+        s.append(buf, static_cast<size_t>(in.gcount()));
+    }
+    return s;
+}
+
+// Checks the checkpoint in dir of the node in node_dir: an index, and the
+// active data file as of the checkpoint, byte for byte. Returns its keys.
+static long long CheckCheckpoint(const std::string & dir, const std::string & node_dir) {
+    std::string name;
+    IndexFilename(dir, &name);
+    CHECK(access(name.c_str(), F_OK) == 0);
+    CheckpointFilename(dir, &name);
+    std::string checkpoint = ReadFile(name);
+    std::string id = GetField(checkpoint, "data_file_current");
+    std::string offset = GetField(checkpoint, "data_file_offset");
+    CHECK(!id.empty() && !offset.empty());
+    if (id.empty() || offset.empty()) {
+        return -1;
+    }
+    DataFilename(dir, std::stoull(id), &name);
+    std::string copy = ReadFile(name);
+    CHECK(copy.size() == std::stoull(offset));
+    DataFilename(node_dir, std::stoull(id), &name);
+    CHECK(copy == ReadFile(name, copy.size()));
+    return std::stoll(GetField(checkpoint, "keys"));
+}
+
+// Whether files in dir can be reflinked, which CHECKPOINT needs.
+static bool HasReflinks(const std::string & dir) {
+    std::string in = dir + "/reflink-in";
+    std::string out = dir + "/reflink-out";
+    int in_fd = open(in.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    int out_fd = open(out.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    bool ok = in_fd >= 0 && out_fd >= 0 && write(in_fd, "x", 1) == 1 && FileClone(in_fd, out_fd) == 0;
+    if (in_fd >= 0) {
+        close(in_fd);
+    }
+    if (out_fd >= 0) {
+        close(out_fd);
+    }
+    unlink(in.c_str());
+    unlink(out.c_str());
+    return ok;
+}
+
+const std::string kNoReflinks = "-ERR Failed reflinking the index, CHECKPOINT needs a filesystem with reflinks";
+
+// Runs cron until the checkpoint of every shard is done.
+static void WaitForCheckpoint(TestSession * session, size_t shards) {
+    for (size_t s = 0; s < shards; ++s) {
+        std::string prefix = shards > 1 ? "shard" + std::to_string(s) + "_" : "";
+        CHECK(session->CronUntil("persistence", prefix + "checkpoint_in_progress:0"));
+        CHECK(session->CronUntil("persistence", prefix + "last_checkpoint_status:ok"));
+    }
+}
+
+// Writes after the checkpoint starts aren't in it, and a second checkpoint
+// has them. Sharded, each shard checkpoints to dir/<shard>. Where the index
+// can't be reflinked it fails and leaves nothing behind.
+TEST(checkpoint, Disk) {
+    for (size_t shards:{1, 3}) {
+        GetTestContext() = shards == 1 ? "disk" : "disk with 3 shards";
+        TestDisk disk(shards);
+        TestSession session(disk.Get());
+        for (int i = 0; i < 100; ++i) {
+            session.Submit({"SET", "k" + std::to_string(i), std::string(i * 100, 'v')});
+        }
+        session.Submit({"INCRBY", "counter", "5"});
+        session.Submit({"HSET", "h", "f", "v"});
+        session.Drain();
+        session.Read(0, 1);
+
+        std::string dir = MakeTestDir("checkpoint");
+        std::string first = dir + "/first";
+        if (!HasReflinks(disk.GetDirs()[0])) {
+            /* Fails whole rather than copy the index in the freeze, and can be retried */
+            for (int i = 0; i < 2; ++i) {
+                std::string reply = session.Run({"CHECKPOINT", first});
+                CHECK(reply.compare(0, kNoReflinks.size(), kNoReflinks) == 0);
+                CHECK(access(first.c_str(), F_OK) != 0);
+                CHECK(access((first + ".tmp").c_str(), F_OK) != 0);
+            }
+            CHECK(session.CronUntil("persistence", std::string(shards > 1 ? "shard0_" : "") +
+                                                   "checkpoint_in_progress:0"));
+            CHECK_EQ(session.Run({"GET", "k99"}), Bulk(std::string(9900, 'v')));
+            CHECK_EQ(session.Run({"SET", "after", "v"}), "+OK\r\n");
+            RemoveTree(dir);
+            continue;
+        }
+        CHECK_EQ(session.Run({"CHECKPOINT", first}), "+Background checkpoint started\r\n");
+        for (int i = 0; i < 10; ++i) {
+            session.Submit({"SET", "after" + std::to_string(i), "v"});
+        }
+        session.Drain();
+        session.Read(0, 1);
+        WaitForCheckpoint(&session, shards);
+
+        std::string second = dir + "/second/";
+        CHECK_EQ(session.Run({"CHECKPOINT", second}), "+Background checkpoint started\r\n");
+        WaitForCheckpoint(&session, shards);
+        long long first_keys = 0;
+        long long second_keys = 0;
+        for (size_t s = 0; s < shards; ++s) {
+            std::string sub = shards > 1 ? "/" + std::to_string(s) : "";
+            first_keys += CheckCheckpoint(first + sub, disk.GetDirs()[s]);
+            second_keys += CheckCheckpoint(dir + "/second" + sub, disk.GetDirs()[s]);
+        }
+        CHECK(first_keys == 102);
+        CHECK(second_keys == 112);
+        CHECK(access((first + ".tmp").c_str(), F_OK) != 0);
+
+        CHECK_EQ(session.Run({"CHECKPOINT", first}), "-ERR " + first + " exists\r\n");
+        CHECK_EQ(session.Run({"GET", "k99"}), Bulk(std::string(9900, 'v')));
+        RemoveTree(dir);
+    }
+    GetTestContext().clear();
+}
+
+// Lowers the open files limit so that only n more fds can be opened, and
+// puts it back on destruction. The hard limit is left alone.
+class FreeFdLimit {
+public:
+    explicit FreeFdLimit(int n) {
+        getrlimit(RLIMIT_NOFILE, &old_);
+        struct rlimit limit = old_;
+        limit.rlim_cur = 0;
+        while (n > 0) {
+            if (fcntl(static_cast<int>(limit.rlim_cur), F_GETFD) == -1) {
+                --n;
+            }
+            ++limit.rlim_cur;
+        }
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    ~FreeFdLimit() {
+        setrlimit(RLIMIT_NOFILE, &old_);
+    }
+
+private:
+    struct rlimit old_;
+};
+
+// Sharded, a shard that fails to start its checkpoint undoes the ones
+// started before it: nothing is left in dir, which a retry can then use.
+TEST(checkpoint, ShardUndo) {
+    TestDisk disk(3);
+    TestSession session(disk.Get());
+    for (int i = 0; i < 30; ++i) {
+        session.Submit({"SET", "k" + std::to_string(i), "v"});
+    }
+    session.Drain();
+    session.Read(0, 1);
+    std::string dir = MakeTestDir("checkpoint");
+    std::string target = dir + "/target";
+
+    std::string reply;
+    size_t failed = 1;
+    if (HasReflinks(disk.GetDirs()[0])) {
+        /* Shard 0 takes the three fds left: its data file, index and checkpoint file */
+        FreeFdLimit limit(3);
+        reply = session.Run({"CHECKPOINT", target});
+    } else {
+        failed = 0;
+        reply = session.Run({"CHECKPOINT", target});
+        CHECK(reply.compare(0, kNoReflinks.size(), kNoReflinks) == 0);
+    }
+    std::string undone = " (shard " + std::to_string(failed) + ", " + std::to_string(failed) +
+                         " started shards undone)\r\n";
+    CHECK(reply.size() > undone.size() && reply.compare(reply.size() - undone.size(), undone.size(), undone) == 0);
+    CHECK(access(target.c_str(), F_OK) != 0);
+    for (size_t s = 0; s <= failed; ++s) {
+        std::string prefix = "shard" + std::to_string(s) + "_";
+        CHECK(session.CronUntil("persistence", prefix + "checkpoint_in_progress:0"));
+        CHECK(session.CronUntil("persistence", prefix + "last_checkpoint_status:err"));
+    }
+    CHECK(session.CronUntil("persistence", "shard2_last_checkpoint_status:ok"));
+
+    if (failed != 0) {
+        CHECK_EQ(session.Run({"CHECKPOINT", target}), "+Background checkpoint started\r\n");
+        WaitForCheckpoint(&session, 3);
+        long long keys = 0;
+        for (size_t s = 0; s < 3; ++s) {
+            keys += CheckCheckpoint(target + "/" + std::to_string(s), disk.GetDirs()[s]);
+        }
+        CHECK(keys == 30);
+    } else {
+        CHECK(session.Run({"CHECKPOINT", target}).compare(0, kNoReflinks.size(), kNoReflinks) == 0);
+    }
+    CHECK_EQ(session.Run({"GET", "k7"}), Bulk("v"));
+    RemoveTree(dir);
+}
+
+TEST(checkpoint, Mem) {
+    auto executor = OpenExecutorMem();
+    TestSession session(executor.get());
+    CHECK_EQ(session.Run({"CHECKPOINT", "/tmp/anywhere"}), "-ERR CHECKPOINT is for the disk executor, use BGSAVE\r\n");
+}
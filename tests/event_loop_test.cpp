@@ -0,0 +1,60 @@
+#include <memory>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "../src/gujia.h"
+#include "../src/gujia_impl.h"
+#include "test.h"
+
+using namespace gujia;
+
+struct Resource {
+    int id;
+
+    explicit Resource(int id) : id(id) {}
+};
+
+// An fd past the default set size and the first chunks is acquired into a
+// chunk allocated for it, polled and released, while resources in earlier
+// chunks stay where they were.
+TEST(event_loop, HighFd) {
+    const int kHighFd = 12345; /* In the fourth chunk */
+    struct rlimit old;
+    getrlimit(RLIMIT_NOFILE, &old);
+    struct rlimit limit = old;
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    EventLoop<Resource> el(EventLoop<Resource>::Open(), 20000);
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    CHECK(el.Acquire(sv[0], std::make_unique<Resource>(1)) == 0);
+    Resource * low = el.GetResource(sv[0]).get();
+    CHECK(dup2(sv[1], kHighFd) == kHighFd);
+    close(sv[1]);
+
+    CHECK(el.Acquire(kHighFd, std::make_unique<Resource>(2)) == 0);
+    CHECK(el.GetMaxFD() == kHighFd);
+    CHECK(el.GetResource(kHighFd)->id == 2);
+    CHECK(el.GetResource(sv[0]).get() == low);
+    CHECK(el.AddEvent(kHighFd, kReadable) == 0);
+    CHECK(write(sv[0], "x", 1) == 1);
+    struct timeval tv = {1, 0};
+    int n = el.Poll(&tv);
+    CHECK(n == 1);
+    if (n == 1) {
+        CHECK(EventLoop<Resource>::GetEventFD(el.GetEvents()[0]) == kHighFd);
+        CHECK(EventLoop<Resource>::IsEventReadable(el.GetEvents()[0]));
+    }
+
+    CHECK(el.Acquire(20000, std::make_unique<Resource>(3)) == -1); /* Past the set size */
+    CHECK(el.DelEvent(kHighFd, kReadable) == 0);
+    CHECK(el.Release(kHighFd) == 0);
+    CHECK(el.GetMaxFD() == sv[0]);
+    CHECK(fcntl(kHighFd, F_GETFD) == -1);
+    CHECK(el.GetResource(sv[0])->id == 1);
+    CHECK(el.Release(sv[0]) == 0);
+    CHECK(el.GetMaxFD() == -1);
+    setrlimit(RLIMIT_NOFILE, &old);
+}
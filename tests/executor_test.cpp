@@ -0,0 +1,224 @@
+#include <fcntl.h>
+#include <map>
+#include <string>
+
+#include "../src/config.h"
+#include "../src/crc32c.h"
+#include "../src/disk/filename.h"
+#include "test.h"
+
+using namespace cheapis;
+
+TEST(executor, SetGetDel) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"GET", "k"}), kNil);
+        CHECK_EQ(session.Run({"SET", "k", "v"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"GET", "k"}), Bulk("v"));
+        CHECK_EQ(session.Run({"SET", "k", ""}), "+OK\r\n");
+        CHECK_EQ(session.Run({"GET", "k"}), Bulk(""));
+        CHECK_EQ(session.Run({"DEL", "k"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"GET", "k"}), kNil);
+    });
+}
+
+TEST(executor, SetOverwrites) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"SET", "k", "first"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"SET", "k", "a longer second value"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"GET", "k"}), Bulk("a longer second value"));
+
+        /* A string replaces a hash, of any size */
+        CHECK_EQ(session.Run({"HSET", "h", "f", "v"}), ":1\r\n");
+        CHECK_EQ(session.Run({"SET", "h", "s"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"GET", "h"}), Bulk("s"));
+        CHECK_EQ(session.Run({"HGET", "h", "f"}),
+                 "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+    });
+}
+
+// Replies come back in the order of a client's commands even when several
+// commands of several clients run in one batch.
+TEST(executor, PipelinedReplies) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        size_t other = session.Connect();
+        std::string expected;
+        std::string other_expected;
+        for (int i = 0; i < 100; ++i) {
+            std::string k = "k" + std::to_string(i);
+            std::string v = "v" + std::to_string(i);
+            session.Submit({"SET", k, v});
+            session.Submit({"GET", k});
+            session.Submit({"GET", "missing"}, other);
+            expected += "+OK\r\n" + Bulk(v);
+            other_expected += kNil;
+        }
+        session.Drain();
+        CHECK_EQ(session.Read(0, expected.size()), expected);
+        CHECK_EQ(session.Read(other, other_expected.size()), other_expected);
+    });
+}
+
+// The n-th key with prefix that a node of three shards keeps in shard.
+static std::string GetShardKey(const std::string & prefix, uint32_t shard, int n) {
+    for (int i = 0;; ++i) {
+        std::string k = prefix + std::to_string(i);
+        if (Crc32c(0, k.data(), k.size()) % 3 == shard && n-- == 0) {
+            return k;
+        }
+    }
+}
+
+// One pipeline whose commands go to a different shard each time, with
+// commands for one shard, for all of them and for the first, still gets
+// its replies in order, whether the batch is cut short or not.
+TEST(executor, AlternatingShards) {
+    ForEachExecutor([](Executor * executor) {
+        for (size_t batch:{size_t(1000), size_t(5)}) {
+            TestSession session(executor);
+            size_t other = session.Connect();
+            std::map<std::string, std::string> values;
+            std::map<std::string, long long> counters;
+            std::string expected;
+            std::string other_expected;
+            for (int i = 0; i < 300; ++i) {
+                std::string k = GetShardKey("b" + std::to_string(batch) + ":", i % 3, i / 3);
+                std::string next = GetShardKey("b" + std::to_string(batch) + ":", (i + 1) % 3, i / 3);
+                std::string v = "v" + std::to_string(i);
+                session.Submit({"SET", k, v});
+                session.Submit({"GET", next});
+                std::string mine = GetShardKey("o" + std::to_string(batch) + ":", (i + 1) % 3, i / 3);
+                session.Submit({"SET", mine, v}, other);
+                session.Submit({"GET", mine}, other);
+                values[k] = v;
+                auto it = values.find(next);
+                expected += "+OK\r\n" + (it != values.end() ? Bulk(it->second) : std::string(kNil));
+                other_expected += "+OK\r\n" + Bulk(v);
+                if (i % 7 == 0) {
+                    std::string counter = GetShardKey("c" + std::to_string(batch) + ":", (i + 2) % 3, 0);
+                    session.Submit({"INCR", counter});
+                    expected += ":" + std::to_string(++counters[counter]) + "\r\n";
+                }
+                if (i % 10 == 0) {
+                    session.Submit({"PING"});
+                    expected += "+PONG\r\n";
+                }
+                if (i % 25 == 0) {
+                    session.Submit({"KEYS", "nothing*"});
+                    expected += "*0\r\n";
+                }
+            }
+            while (executor->GetTaskCount() != 0) {
+                executor->Execute(batch, time(nullptr), session.GetEventLoop());
+            }
+            CHECK_EQ(session.Read(0, expected.size()), expected);
+            CHECK_EQ(session.Read(other, other_expected.size()), other_expected);
+        }
+    });
+}
+
+// Drops the pages of data file 0 in each dir from the page cache, so reads
+// of it go to the device, through the I/O engine.
+static void DropDataFiles(const std::vector<std::string> & dirs) {
+    for (const auto & dir:dirs) {
+        std::string name;
+        DataFilename(dir, 0, &name);
+        int fd = open(name.c_str(), O_RDONLY);
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// A batch with many more GETs than io-depth, hits off the device mixed with
+// misses, other clients and other commands, keeps each client's replies in
+// order.
+TEST(executor, ReadsBeyondIoDepth) {
+    Config * config = GetConfig();
+    uint64_t io_depth = config->io_depth;
+    config->io_depth = 4;
+    for (size_t shards:{1, 3}) {
+        GetTestContext() = shards == 1 ? "disk" : "disk with 3 shards";
+        TestDisk disk(shards);
+        TestSession session(disk.Get());
+        size_t other = session.Connect();
+        const int kKeys = 300;
+        for (int i = 0; i < kKeys; ++i) {
+            session.Submit({"SET", "k" + std::to_string(i), std::string(5000, 'a' + i % 26) + std::to_string(i)});
+        }
+        session.Drain();
+        session.Read(0, kKeys * 5);
+        DropDataFiles(disk.GetDirs());
+
+        std::string expected;
+        std::string other_expected;
+        for (int i = kKeys - 1; i >= 0; --i) {
+            session.Submit({"GET", "k" + std::to_string(i)});
+            expected += Bulk(std::string(5000, 'a' + i % 26) + std::to_string(i));
+            if (i % 7 == 0) {
+                session.Submit({"GET", "missing" + std::to_string(i)});
+                expected += kNil;
+            }
+            if (i % 50 == 0) {
+                session.Submit({"PING"});
+                expected += "+PONG\r\n";
+            }
+            if (i % 3 == 0) {
+                session.Submit({"GET", "k" + std::to_string(i * 7 % kKeys)}, other);
+                other_expected += Bulk(std::string(5000, 'a' + i * 7 % kKeys % 26) + std::to_string(i * 7 % kKeys));
+            }
+        }
+        session.Drain();
+        CHECK_EQ(session.Read(0, expected.size()), expected);
+        CHECK_EQ(session.Read(other, other_expected.size()), other_expected);
+    }
+    GetTestContext().clear();
+    config->io_depth = io_depth;
+}
+
+// A client closed with commands queued gets nothing run, and the writes of
+// the other clients in the same batch land where they should.
+TEST(executor, ClosedClientMidBatch) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        size_t closing = session.Connect();
+        session.Submit({"SET", "a", "1"});
+        session.Submit({"SET", "gone", "x"}, closing);
+        session.Submit({"SET", "b", "2"});
+        session.Submit({"SET", "gone", "y"}, closing);
+        session.Submit({"SET", "c", "3"});
+        session.GetClient(closing)->close = true;
+        session.Drain();
+        CHECK_EQ(session.Read(0, 15), "+OK\r\n+OK\r\n+OK\r\n");
+        CHECK(session.GetClient(closing) == nullptr);
+        CHECK_EQ(session.Run({"GET", "a"}), Bulk("1"));
+        CHECK_EQ(session.Run({"GET", "b"}), Bulk("2"));
+        CHECK_EQ(session.Run({"GET", "c"}), Bulk("3"));
+        CHECK_EQ(session.Run({"GET", "gone"}), kNil);
+    });
+}
+
+// A client that doesn't read its replies is dropped at the hard limit.
+TEST(executor, OutputBufferHardLimit) {
+    Config * config = GetConfig();
+    uint64_t hard_limit = config->output_buffer_hard_limit;
+    uint64_t soft_limit = config->output_buffer_soft_limit;
+    config->output_buffer_hard_limit = 1 << 20;
+    config->output_buffer_soft_limit = 1 << 19;
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        size_t reader = session.Connect();
+        CHECK_EQ(session.Run({"SET", "big", std::string(1 << 15, 'v')}), "+OK\r\n");
+        for (int i = 0; i < 64; ++i) {
+            session.Submit({"GET", "big"});
+        }
+        session.Submit({"PING"}, reader);
+        session.Drain();
+        CHECK(session.GetClient(0) == nullptr);
+        CHECK_EQ(session.Read(reader), "+PONG\r\n");
+    });
+    config->output_buffer_hard_limit = hard_limit;
+    config->output_buffer_soft_limit = soft_limit;
+}
@@ -0,0 +1,83 @@
+#include <string>
+
+#include "test.h"
+
+using namespace cheapis;
+
+// The value of a name:value line of an INFO section, empty if none.
+static std::string GetInfoField(Executor * executor, const char * section, const std::string & name) {
+    std::string info = "\n";
+    executor->GetInfo(section, &info);
+    size_t pos = info.find("\n" + name + ":");
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += name.size() + 2;
+    return info.substr(pos, info.find("\r\n", pos) - pos);
+}
+
+static void SetKeys(TestSession * session, const std::string & prefix, int n) {
+    for (int i = 0; i < n; ++i) {
+        session->Submit({"SET", prefix + std::to_string(i), prefix});
+    }
+    session->Drain();
+    session->Read(0, 1);
+}
+
+// Runs the loop with nothing to do, as the server does while a rebuild
+// asks for no timeout, a few steps or until the rebuild is done.
+static void StepRebuild(Executor * executor, TestSession * session, int steps = 1000000) {
+    for (int i = 0; i < steps && GetInfoField(executor, "memory", "bloom_filter_rebuilding") == "1"; ++i) {
+        executor->Execute(0, time(nullptr), session->GetEventLoop());
+    }
+}
+
+// Past the keys it was sized for the filter is rebuilt a step at a time.
+// Keys added meanwhile, before or after where the rebuild is, are found
+// and counted once, and misses and deletes stay right after it.
+TEST(filter, Rebuild) {
+    TestDisk disk;
+    Executor * executor = disk.Get();
+    TestSession session(executor);
+    const int kKeys = 70000; /* Over the smallest filter's 65536 */
+    SetKeys(&session, "a", 1000);
+    SetKeys(&session, "m", kKeys - 2000);
+    SetKeys(&session, "z", 1000);
+    CHECK_EQ(GetInfoField(executor, "memory", "bloom_filter_rebuilding"), "1");
+
+    StepRebuild(executor, &session, 10);
+    CHECK_EQ(GetInfoField(executor, "memory", "bloom_filter_rebuilding"), "1");
+    SetKeys(&session, "b", 100); /* Behind the rebuild */
+    SetKeys(&session, "y", 100); /* Ahead of it */
+    CHECK_EQ(session.Run({"DEL", "a0"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"DEL", "z0"}), "+OK\r\n");
+    StepRebuild(executor, &session);
+    CHECK_EQ(GetInfoField(executor, "memory", "bloom_filter_rebuilding"), "0");
+
+    CHECK_EQ(GetInfoField(executor, "keyspace", "db0"), "keys=" + std::to_string(kKeys + 198));
+    CHECK_EQ(GetInfoField(executor, "memory", "bloom_filter_keys"), std::to_string(kKeys + 198));
+    for (int i = 0; i < 100; i += 9) {
+        CHECK_EQ(session.Run({"GET", "b" + std::to_string(i)}), Bulk("b"));
+        CHECK_EQ(session.Run({"GET", "y" + std::to_string(i)}), Bulk("y"));
+    }
+    CHECK_EQ(session.Run({"GET", "a1"}), Bulk("a"));
+    CHECK_EQ(session.Run({"GET", "m12345"}), Bulk("m"));
+    CHECK_EQ(session.Run({"GET", "a0"}), kNil);
+    CHECK_EQ(session.Run({"GET", "z0"}), kNil);
+
+    long long negatives = std::stoll(GetInfoField(executor, "stats", "bloom_filter_negatives"));
+    for (int i = 0; i < 100; ++i) {
+        CHECK_EQ(session.Run({"GET", "missing" + std::to_string(i)}), kNil);
+    }
+    CHECK(std::stoll(GetInfoField(executor, "stats", "bloom_filter_negatives")) > negatives + 50);
+
+    CHECK_EQ(session.Run({"DEL", "b1"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"DEL", "y1"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"DEL", "m1"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"GET", "b1"}), kNil);
+    CHECK_EQ(session.Run({"GET", "y1"}), kNil);
+    CHECK_EQ(session.Run({"GET", "m1"}), kNil);
+    CHECK_EQ(session.Run({"SET", "m1", "again"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"GET", "m1"}), Bulk("again"));
+    CHECK_EQ(session.Run({"GET", "m2"}), Bulk("m"));
+}
@@ -0,0 +1,138 @@
+#include <map>
+#include <string>
+
+#include "test.h"
+
+using namespace cheapis;
+
+static std::string Join(const std::map<std::string, std::string> & fields) {
+    std::string s;
+    for (const auto & p:fields) {
+        s += p.first + "=" + p.second + " ";
+    }
+    return s;
+}
+
+// HGETALL as field=value pairs in field order, which the executors don't
+// reply in alike.
+static std::string GetAll(TestSession * session, const std::string & k) {
+    Reply reply = ParseReply(session->Run({"HGETALL", k}));
+    if (reply.type != '*' || reply.elements.size() % 2 != 0) {
+        return "not a field-value array";
+    }
+    std::map<std::string, std::string> fields;
+    for (size_t i = 0; i < reply.elements.size(); i += 2) {
+        if (!fields.emplace(reply.elements[i].str, reply.elements[i + 1].str).second) {
+            return "field " + reply.elements[i].str + " twice";
+        }
+    }
+    return Join(fields);
+}
+
+TEST(hash, SetGetDel) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"HSET", "h", "a", "1", "b", "2"}), ":2\r\n");
+        CHECK_EQ(session.Run({"HSET", "h", "b", "3", "c", "4"}), ":1\r\n");
+        CHECK_EQ(session.Run({"HSET", "h", "d", "5", "d", "6"}), ":1\r\n");
+        CHECK_EQ(session.Run({"HGET", "h", "b"}), Bulk("3"));
+        CHECK_EQ(session.Run({"HGET", "h", "d"}), Bulk("6"));
+        CHECK_EQ(session.Run({"HGET", "h", "x"}), kNil);
+        CHECK_EQ(session.Run({"HGET", "missing", "a"}), kNil);
+        CHECK_EQ(session.Run({"HMGET", "h", "a", "x", "c"}), "*3\r\n" + Bulk("1") + kNil + Bulk("4"));
+        CHECK_EQ(session.Run({"HMGET", "missing", "a", "b"}), std::string("*2\r\n") + kNil + kNil);
+        CHECK_EQ(GetAll(&session, "h"), "a=1 b=3 c=4 d=6 ");
+        CHECK_EQ(session.Run({"HGETALL", "missing"}), "*0\r\n");
+
+        CHECK_EQ(session.Run({"HDEL", "h", "a", "x", "a"}), ":1\r\n");
+        CHECK_EQ(session.Run({"HDEL", "missing", "a"}), ":0\r\n");
+        CHECK_EQ(GetAll(&session, "h"), "b=3 c=4 d=6 ");
+        CHECK_EQ(session.Run({"HSET", "h", "a", "7"}), ":1\r\n");
+        CHECK_EQ(session.Run({"HGET", "h", "a"}), Bulk("7"));
+    });
+}
+
+// Deleting the last field deletes the key.
+TEST(hash, DelToEmpty) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"HSET", "h", "a", "1", "b", "2"}), ":2\r\n");
+        CHECK_EQ(session.Run({"HDEL", "h", "a"}), ":1\r\n");
+        CHECK_EQ(session.Run({"HDEL", "h", "b"}), ":1\r\n");
+        CHECK_EQ(session.Run({"HGETALL", "h"}), "*0\r\n");
+        CHECK_EQ(session.Run({"KEYS", "*"}), "*0\r\n");
+        CHECK_EQ(session.Run({"SET", "h", "s"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"GET", "h"}), Bulk("s"));
+    });
+}
+
+// On disk every write past the first is a delta record until the chain is
+// folded, the fields read back the same across folds.
+TEST(hash, ManyWrites) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        std::map<std::string, std::string> expected;
+        for (int i = 0; i < 40; ++i) {
+            std::string field = "f" + std::to_string(i % 7);
+            std::string value = "v" + std::to_string(i);
+            if (i % 5 == 4) {
+                CHECK_EQ(session.Run({"HDEL", "h", field}), expected.erase(field) != 0 ? ":1\r\n" : ":0\r\n");
+            } else {
+                bool fresh = expected.count(field) == 0;
+                expected[field] = value;
+                CHECK_EQ(session.Run({"HSET", "h", field, value}), fresh ? ":1\r\n" : ":0\r\n");
+            }
+            CHECK_EQ(GetAll(&session, "h"), Join(expected));
+        }
+        for (const auto & p:expected) {
+            CHECK_EQ(session.Run({"HGET", "h", p.first}), Bulk(p.second));
+        }
+    });
+}
+
+// Fields beyond what one record holds, and beyond what the in-memory
+// executor keeps packed.
+TEST(hash, Large) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        std::map<std::string, std::string> expected;
+        for (int i = 0; i < 200; ++i) {
+            std::string field = "field:" + std::to_string(i);
+            std::string value(i % 10 == 0 ? 4096 : 16, static_cast<char>('a' + i % 26));
+            expected[field] = value;
+            session.Submit({"HSET", "h", field, value});
+        }
+        session.Drain();
+        session.Read(0, 1);
+        CHECK_EQ(GetAll(&session, "h"), Join(expected));
+        for (int i = 0; i < 200; i += 3) {
+            std::string field = "field:" + std::to_string(i);
+            expected.erase(field);
+            session.Submit({"HDEL", "h", field});
+        }
+        session.Drain();
+        session.Read(0, 1);
+        CHECK_EQ(GetAll(&session, "h"), Join(expected));
+        CHECK_EQ(session.Run({"HGET", "h", "field:10"}), Bulk(std::string(4096, 'k')));
+    });
+}
+
+TEST(hash, Errors) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"HSET", "h", "a", "1", "b"}), "-ERR wrong number of arguments for 'hset' command\r\n");
+        CHECK_EQ(session.Run({"HGETALL", "h"}), "*0\r\n");
+
+        const std::string wrong_type = "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+        CHECK_EQ(session.Run({"SET", "s", "v"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"HSET", "s", "a", "1"}), wrong_type);
+        CHECK_EQ(session.Run({"HGET", "s", "a"}), wrong_type);
+        CHECK_EQ(session.Run({"HMGET", "s", "a"}), wrong_type);
+        CHECK_EQ(session.Run({"HGETALL", "s"}), wrong_type);
+        CHECK_EQ(session.Run({"HDEL", "s", "a"}), wrong_type);
+        CHECK_EQ(session.Run({"GET", "s"}), Bulk("v"));
+
+        CHECK_EQ(session.Run({"HSET", "h", "a", "1"}), ":1\r\n");
+        CHECK_EQ(session.Run({"GET", "h"}), wrong_type);
+    });
+}
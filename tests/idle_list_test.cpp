@@ -0,0 +1,89 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../src/idle_list.h"
+#include "test.h"
+
+using namespace cheapis;
+
+struct IdleClient : public IdleNode {
+    int id;
+    long last_mod_time = 0;
+
+    explicit IdleClient(int id) : id(id) {}
+};
+
+// Touches the client at curr_time, as reading from it does.
+static void Touch(IdleList * idle, IdleClient * c, long curr_time) {
+    c->last_mod_time = curr_time;
+    idle->Touch(c);
+}
+
+// Unlinks the clients idle for more than timeout, as the cron releases
+// them, and lists them in the order expired.
+static std::string Expire(IdleList * idle, long curr_time, long timeout) {
+    std::string expired;
+    for (IdleNode * node = idle->Front(); node != nullptr; node = idle->Front()) {
+        auto * c = static_cast<IdleClient *>(node);
+        if (curr_time - c->last_mod_time <= timeout) {
+            break;
+        }
+        c->Unlink();
+        expired += std::to_string(c->id) + " ";
+    }
+    return expired;
+}
+
+// Clients expire longest idle first, a touch moving a client behind the
+// others, and expiring stops at the first one still active.
+TEST(idle_list, ExpiryOrder) {
+    IdleList idle;
+    std::vector<std::unique_ptr<IdleClient>> clients;
+    for (int i = 0; i < 5; ++i) {
+        clients.emplace_back(new IdleClient(i));
+        Touch(&idle, clients[i].get(), i);
+    }
+    CHECK(idle.Front() == clients[0].get());
+    Touch(&idle, clients[0].get(), 10);
+    Touch(&idle, clients[2].get(), 11);
+    Touch(&idle, clients[2].get(), 12); /* Already at the back */
+    CHECK(idle.Front() == clients[1].get());
+
+    CHECK_EQ(Expire(&idle, 5, 10), "");
+    CHECK_EQ(Expire(&idle, 14, 10), "1 3 ");
+    CHECK_EQ(Expire(&idle, 20, 10), "4 ");
+    Touch(&idle, clients[1].get(), 20); /* Unlinked, linked again */
+    CHECK_EQ(Expire(&idle, 30, 10), "0 2 ");
+    CHECK_EQ(Expire(&idle, 40, 10), "1 ");
+    CHECK(idle.Front() == nullptr);
+}
+
+// A client freed without telling the list is unlinked, from the front, the
+// back or between others, and the list outliving or not its clients is fine.
+TEST(idle_list, UnlinkOnDestroy) {
+    IdleList idle;
+    std::vector<std::unique_ptr<IdleClient>> clients;
+    for (int i = 0; i < 5; ++i) {
+        clients.emplace_back(new IdleClient(i));
+        Touch(&idle, clients[i].get(), i);
+    }
+    clients[2].reset();
+    clients[0].reset();
+    clients[4].reset();
+    CHECK(idle.Front() == clients[1].get());
+    CHECK_EQ(Expire(&idle, 100, 10), "1 3 ");
+    CHECK(idle.Front() == nullptr);
+
+    IdleClient unlinked(5);
+    unlinked.Unlink(); /* Never linked */
+    {
+        IdleList other;
+        Touch(&other, clients[1].get(), 0);
+        Touch(&other, &unlinked, 0);
+    }
+    clients[1]->Unlink();
+    clients[1].reset();
+    Touch(&idle, &unlinked, 0);
+    CHECK(idle.Front() == &unlinked);
+}
@@ -0,0 +1,120 @@
+#include <climits>
+#include <string>
+
+#include "test.h"
+
+using namespace cheapis;
+
+TEST(incr, Counts) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"INCR", "n"}), ":1\r\n");
+        CHECK_EQ(session.Run({"INCR", "n"}), ":2\r\n");
+        CHECK_EQ(session.Run({"INCRBY", "n", "40"}), ":42\r\n");
+        CHECK_EQ(session.Run({"DECR", "n"}), ":41\r\n");
+        CHECK_EQ(session.Run({"DECRBY", "n", "50"}), ":-9\r\n");
+        CHECK_EQ(session.Run({"GET", "n"}), Bulk("-9"));
+        CHECK_EQ(session.Run({"DECR", "fresh"}), ":-1\r\n");
+
+        CHECK_EQ(session.Run({"SET", "n", "100"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"INCR", "n"}), ":101\r\n");
+        CHECK_EQ(session.Run({"DEL", "n"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"GET", "n"}), kNil);
+        CHECK_EQ(session.Run({"INCRBY", "n", "5"}), ":5\r\n");
+    });
+}
+
+// A counter reads the same through GET, RANGE and PREFIX as any string.
+TEST(incr, ReadBack) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        for (int i = 0; i < 10; ++i) {
+            session.Submit({"INCR", "c:a"});
+            session.Submit({"INCRBY", "c:b", "-3"});
+        }
+        session.Drain();
+        session.Read(0, 1);
+        CHECK_EQ(session.Run({"GET", "c:a"}), Bulk("10"));
+        CHECK_EQ(session.Run({"PREFIX", "c:"}), "*4\r\n" + Bulk("c:a") + Bulk("10") + Bulk("c:b") + Bulk("-30"));
+    });
+}
+
+// A counter made by INCR is a key in INFO keyspace before the cron writes
+// it out, one shard or several.
+TEST(incr, Keyspace) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"SET", "a", "1"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"INCR", "c"}), ":1\r\n");
+        CHECK_EQ(session.Run({"INCRBY", "d", "5"}), ":5\r\n");
+        CHECK(ParseReply(session.Run({"INFO", "keyspace"})).str.find("db0:keys=3\r\n") != std::string::npos);
+        CHECK_EQ(session.Run({"INCR", "c"}), ":2\r\n");
+        CHECK_EQ(session.Run({"DEL", "d"}), "+OK\r\n");
+        CHECK(ParseReply(session.Run({"INFO"})).str.find("db0:keys=2\r\n") != std::string::npos);
+        CHECK_EQ(session.Run({"GET", "c"}), Bulk("2"));
+    });
+}
+
+// More counters than the disk executor caches, so some are written back
+// and read again.
+TEST(incr, ManyCounters) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        constexpr int kCounters = 70000;
+        for (int round = 0; round < 2; ++round) {
+            for (int i = 0; i < kCounters; ++i) {
+                session.Submit({"INCRBY", "c" + std::to_string(i), std::to_string(i)});
+            }
+            session.Drain();
+            session.Read(0, 1);
+        }
+        std::string expected;
+        for (int i = 0; i < kCounters; i += 997) {
+            session.Submit({"GET", "c" + std::to_string(i)});
+            expected += Bulk(std::to_string(2 * i));
+        }
+        session.Drain();
+        CHECK_EQ(session.Read(0, expected.size()), expected);
+        CHECK_EQ(session.Run({"INCR", "c0"}), ":1\r\n");
+    });
+}
+
+TEST(incr, Float) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "f", "10.5"}), Bulk("10.5"));
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "f", "0.1"}), Bulk("10.6"));
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "f", "-5"}), Bulk("5.6"));
+        CHECK_EQ(session.Run({"GET", "f"}), Bulk("5.6"));
+        CHECK_EQ(session.Run({"SET", "g", "5.0e3"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "g", "2.0e2"}), Bulk("5200"));
+        CHECK_EQ(session.Run({"INCR", "i"}), ":1\r\n");
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "i", "0.5"}), Bulk("1.5"));
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "i", "-1.5"}), Bulk("0"));
+        CHECK_EQ(session.Run({"INCR", "f"}), "-ERR value is not an integer or out of range\r\n");
+    });
+}
+
+TEST(incr, Errors) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"SET", "s", "abc"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"INCR", "s"}), "-ERR value is not an integer or out of range\r\n");
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "s", "1"}), "-ERR value is not a valid float\r\n");
+        CHECK_EQ(session.Run({"GET", "s"}), Bulk("abc"));
+        CHECK_EQ(session.Run({"INCRBY", "n", "x"}), "-ERR value is not an integer or out of range\r\n");
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "n", "x"}), "-ERR value is not a valid float\r\n");
+        CHECK_EQ(session.Run({"GET", "n"}), kNil);
+
+        CHECK_EQ(session.Run({"SET", "max", std::to_string(LLONG_MAX)}), "+OK\r\n");
+        CHECK_EQ(session.Run({"INCR", "max"}), "-ERR increment or decrement would overflow\r\n");
+        CHECK_EQ(session.Run({"GET", "max"}), Bulk(std::to_string(LLONG_MAX)));
+        CHECK_EQ(session.Run({"DECRBY", "n", std::to_string(LLONG_MIN)}), "-ERR decrement would overflow\r\n");
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "n", "inf"}), "-ERR increment would produce NaN or Infinity\r\n");
+
+        CHECK_EQ(session.Run({"HSET", "h", "f", "1"}), ":1\r\n");
+        CHECK_EQ(session.Run({"INCR", "h"}), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+        CHECK_EQ(session.Run({"INCRBYFLOAT", "h", "1"}),
+                 "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+    });
+}
@@ -0,0 +1,126 @@
+#include <string>
+
+#include "../src/config.h"
+#include "../src/disk/kv_rep.h"
+#include "test.h"
+
+using namespace cheapis;
+
+// The value of a name:value line of INFO persistence, empty if none.
+static std::string GetPersistence(Executor * executor, const std::string & name) {
+    std::string info = "\n";
+    executor->GetInfo("persistence", &info);
+    size_t pos = info.find("\n" + name + ":");
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += name.size() + 2;
+    return info.substr(pos, info.find("\r\n", pos) - pos);
+}
+
+// Live and garbage bytes of data file 0.
+static void GetFileStats(Executor * executor, uint64_t * live, uint64_t * garbage) {
+    std::string stats = GetPersistence(executor, "data_file_0");
+    size_t comma = stats.find(',');
+    *live = std::stoull(stats.substr(5, comma - 5));
+    *garbage = std::stoull(stats.substr(comma + 9));
+}
+
+// An index that can't grow fails the writes that need more of it with an
+// error, and the node goes on: what is in the index reads back, the failed
+// records count as garbage, and the writes go through once it can grow.
+TEST(index, Full) {
+    const std::string kFull = "-ERR Index full, failed growing it\r\n";
+    Config * config = GetConfig();
+    uint64_t step = config->index_grow_step;
+    TestDisk disk;
+    Executor * executor = disk.Get();
+    TestSession session(executor);
+    config->index_grow_step = 0; /* Can't be configured, every growth fails */
+
+    int added = 0;
+    uint64_t expected_live = 0;
+    std::string reply;
+    for (; added < 1000000; ++added) {
+        std::string k = "k" + std::to_string(added);
+        reply = session.Run({"SET", k, "v"});
+        if (reply != "+OK\r\n") {
+            break;
+        }
+        expected_live += sizeof(Header) + k.size() + 1;
+    }
+    CHECK_EQ(reply, kFull);
+    uint64_t failed = sizeof(Header) + ("k" + std::to_string(added)).size() + 1;
+    CHECK_EQ(session.Run({"SET", "new", "v"}), kFull);
+    failed += sizeof(Header) + 3 + 1;
+    CHECK_EQ(session.Run({"INCRBYFLOAT", "float", "1.5"}), kFull);
+    failed += sizeof(Header) + 5 + 3;
+    CHECK_EQ(session.Run({"HSET", "h", "f", "v"}), kFull);
+
+    CHECK_EQ(session.Run({"PING"}), "+PONG\r\n");
+    CHECK_EQ(session.Run({"GET", "k0"}), Bulk("v"));
+    CHECK_EQ(session.Run({"GET", "k" + std::to_string(added - 1)}), Bulk("v"));
+    CHECK_EQ(session.Run({"GET", "k" + std::to_string(added)}), kNil);
+    CHECK_EQ(session.Run({"GET", "new"}), kNil);
+    CHECK_EQ(session.Run({"GET", "float"}), kNil);
+    CHECK_EQ(session.Run({"HGETALL", "h"}), "*0\r\n");
+    std::string info;
+    executor->GetInfo("keyspace", &info);
+    CHECK_EQ(info, "db0:keys=" + std::to_string(added) + "\r\n");
+
+    uint64_t live;
+    uint64_t garbage;
+    GetFileStats(executor, &live, &garbage);
+    CHECK(live == expected_live);
+    CHECK(garbage > failed); /* And the hash record */
+    CHECK(live + garbage == std::stoull(GetPersistence(executor, "data_file_offset")));
+
+    config->index_grow_step = step;
+    CHECK_EQ(session.Run({"SET", "new", "v"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"INCRBYFLOAT", "float", "1.5"}), Bulk("1.5"));
+    CHECK_EQ(session.Run({"HSET", "h", "f", "v"}), ":1\r\n");
+    CHECK_EQ(session.Run({"GET", "new"}), Bulk("v"));
+}
+
+// The hugepage, populate and mlock options are taken at startup only, and a
+// node opened with them reads back what it wrote while its index grows and
+// the pager faults in (and locks, where the limit allows) the new extents.
+TEST(index, MappingOptions) {
+    Config * config = GetConfig();
+    bool hugepage = config->index_hugepage;
+    bool populate = config->index_populate;
+    bool mlock = config->index_mlock;
+    std::string err;
+    for (const char * name:{"index-hugepage", "index-populate", "index-mlock"}) {
+        CHECK(LoadConfig(name, "yes", &err));
+        CHECK(!LoadConfig(name, "maybe", &err));
+    }
+    CHECK(config->index_hugepage && config->index_populate && config->index_mlock);
+
+    for (size_t shards:{1, 3}) {
+        GetTestContext() = shards == 1 ? "disk" : "disk with 3 shards";
+        TestDisk disk(shards);
+        TestSession session(disk.Get());
+        CHECK_EQ(session.Run({"CONFIG", "SET", "index-mlock", "no"}),
+                 "-ERR CONFIG SET failed, 'index-mlock' can only be set at startup\r\n");
+        CHECK_EQ(session.Run({"CONFIG", "GET", "index-populate"}), Array({"index-populate", "yes"}));
+        const int kKeys = 50000; /* Grows the index several times */
+        for (int i = 0; i < kKeys; ++i) {
+            session.Submit({"SET", "k" + std::to_string(i), std::to_string(i)});
+        }
+        session.Drain();
+        session.Read(0, 1);
+        for (int i = 0; i < kKeys; i += 997) {
+            CHECK_EQ(session.Run({"GET", "k" + std::to_string(i)}), Bulk(std::to_string(i)));
+        }
+        CHECK_EQ(session.Run({"GET", "missing"}), kNil);
+        CHECK_EQ(session.Run({"INCR", "k1"}), ":2\r\n");
+        std::string info;
+        disk.Get()->GetInfo("keyspace", &info);
+        CHECK_EQ(info, "db0:keys=" + std::to_string(kKeys) + "\r\n");
+    }
+    GetTestContext().clear();
+    config->index_hugepage = hugepage;
+    config->index_populate = populate;
+    config->index_mlock = mlock;
+}
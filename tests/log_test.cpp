@@ -0,0 +1,120 @@
+#include <cstdio>
+#include <string>
+#include <sys/time.h>
+
+#include "../src/config.h"
+#include "../src/log.h"
+#include "test.h"
+
+using namespace cheapis;
+
+// Sends stdout, where the log thread writes, to a file for the test's
+// lifetime, and puts the level back after it.
+class CaptureLog {
+public:
+    CaptureLog() : level_(GetLogLevel()), file_(tmpfile()) {
+        fflush(stdout);
+        stdout_ = dup(STDOUT_FILENO);
+        dup2(fileno(file_), STDOUT_FILENO);
+    }
+
+    ~CaptureLog() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        fflush(stdout);
+        dup2(stdout_, STDOUT_FILENO);
+        close(stdout_);
+        fclose(file_);
+        SetLogLevel(level_);
+    }
+
+    // What was logged since the last call, once the log thread wrote it.
+    std::string Read() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        fflush(stdout);
+        std::string logged;
+        char buf[4096];
+        ssize_t n;
+        while ((n = pread(fileno(file_), buf, sizeof(buf), read_)) > 0) { /* Shares its offset with stdout */
+            logged.append(buf, static_cast<size_t>(n));
+            read_ += n;
+        }
+        return logged;
+    }
+
+private:
+    LogLevel level_;
+    FILE * file_;
+    int stdout_;
+    off_t read_ = 0;
+};
+
+static size_t CountLines(const std::string & s, const std::string & text) {
+    size_t n = 0;
+    for (size_t pos = s.find(text); pos != std::string::npos; pos = s.find(text, pos + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+static void LogRepeated(int i) {
+    LIN_LOG_WARN("repeated %d", i);
+}
+
+// Waits for the start of the next second, so a burst stays within one.
+static void WaitNextSecond() {
+    struct timeval tv = {0};
+    gettimeofday(&tv, nullptr);
+    std::this_thread::sleep_for(std::chrono::microseconds(1000000 - tv.tv_usec + 1000));
+}
+
+// CONFIG SET loglevel takes the Redis names too and filters what is logged
+// from then on.
+TEST(log, Level) {
+    CaptureLog capture;
+    auto executor = OpenExecutorMem();
+    TestSession session(executor.get());
+    CHECK_EQ(session.Run({"CONFIG", "SET", "loglevel", "warning"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"CONFIG", "GET", "loglevel"}), Array({"loglevel", "WARN"}));
+    CHECK(session.Run({"CONFIG", "SET", "loglevel", "loud"}).compare(0, 4, "-ERR") == 0);
+    CHECK_EQ(session.Run({"CONFIG", "GET", "loglevel"}), Array({"loglevel", "WARN"}));
+    LIN_LOG_INFO("info-while-warn");
+    LIN_LOG_WARN("warn-while-warn");
+    LIN_LOG_ERROR("error-while-warn");
+
+    CHECK_EQ(session.Run({"CONFIG", "SET", "loglevel", "NOTICE"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"CONFIG", "GET", "loglevel"}), Array({"loglevel", "INFO"}));
+    LIN_LOG_INFO("info-while-info");
+    SetLogLevel(kLogError);
+    LIN_LOG_WARN("warn-while-error");
+
+    std::string logged = capture.Read();
+    CHECK(logged.find("info-while-warn") == std::string::npos);
+    CHECK(logged.find("WARN  ") != std::string::npos && logged.find("warn-while-warn") != std::string::npos);
+    CHECK(logged.find("ERROR ") != std::string::npos && logged.find("error-while-warn") != std::string::npos);
+    CHECK(logged.find("info-while-info") != std::string::npos);
+    CHECK(logged.find("warn-while-error") == std::string::npos);
+}
+
+// A call site logs a burst per second, the lines past it are counted on its
+// next line that gets through; other call sites aren't held back.
+TEST(log, RateLimit) {
+    CaptureLog capture;
+    SetLogLevel(kLogInfo);
+    WaitNextSecond();
+    for (int i = 0; i < 25; ++i) {
+        LogRepeated(i);
+    }
+    LIN_LOG_WARN("other site");
+    std::string logged = capture.Read();
+    CHECK(CountLines(logged, "repeated ") == 10);
+    CHECK(logged.find("repeated 9\n") != std::string::npos);
+    CHECK(CountLines(logged, "other site\n") == 1);
+
+    WaitNextSecond();
+    for (int i = 0; i < 25; ++i) {
+        LogRepeated(i);
+    }
+    logged = capture.Read();
+    CHECK(CountLines(logged, "repeated ") == 10);
+    CHECK(logged.find("repeated 0 (15 similar lines suppressed)\n") != std::string::npos);
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+using namespace cheapis;
+
+static void Populate(TestSession * session, std::initializer_list<std::string_view> keys) {
+    for (const auto & k:keys) {
+        session->Submit({"SET", k, "v:" + std::string(k)});
+    }
+    session->Drain();
+    session->Read(0, 1);
+}
+
+// The key-value pairs of keys, as RANGE and PREFIX reply.
+static std::string Pairs(std::initializer_list<std::string_view> keys) {
+    std::string s = "*" + std::to_string(keys.size() * 2) + "\r\n";
+    for (const auto & k:keys) {
+        s += Bulk(k) + Bulk("v:" + std::string(k));
+    }
+    return s;
+}
+
+TEST(range, Bounds) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        Populate(&session, {"a", "b", "bb", "c", "d", "e"});
+        CHECK_EQ(session.Run({"RANGE", "b", "d"}), Pairs({"b", "bb", "c"}));
+        CHECK_EQ(session.Run({"RANGE", "ba", "c"}), Pairs({"bb"}));
+        CHECK_EQ(session.Run({"RANGE", "c", ""}), Pairs({"c", "d", "e"}));
+        CHECK_EQ(session.Run({"RANGE", "", ""}), Pairs({"a", "b", "bb", "c", "d", "e"}));
+        CHECK_EQ(session.Run({"RANGE", "x", ""}), "*0\r\n");
+        CHECK_EQ(session.Run({"RANGE", "d", "b"}), "*0\r\n");
+    });
+}
+
+TEST(range, Limit) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        Populate(&session, {"a", "b", "bb", "c", "d", "e"});
+        CHECK_EQ(session.Run({"RANGE", "b", "", "LIMIT", "2"}), Pairs({"b", "bb"}));
+        CHECK_EQ(session.Run({"RANGE", "b", "", "LIMIT", "0"}), "*0\r\n");
+        CHECK_EQ(session.Run({"PREFIX", "b", "LIMIT", "1"}), Pairs({"b"}));
+    });
+}
+
+// Bytes compare unsigned, and a prefix ending in 0xff still bounds the keys.
+TEST(range, Prefix) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        Populate(&session, {"a", "b", "b\xff", "b\xff\x01", "bb", "c"});
+        CHECK_EQ(session.Run({"PREFIX", "b"}), Pairs({"b", "bb", "b\xff", "b\xff\x01"}));
+        CHECK_EQ(session.Run({"PREFIX", "b\xff"}), Pairs({"b\xff", "b\xff\x01"}));
+        CHECK_EQ(session.Run({"PREFIX", "z"}), "*0\r\n");
+        CHECK_EQ(session.Run({"PREFIX", ""}), Pairs({"a", "b", "bb", "b\xff", "b\xff\x01", "c"}));
+    });
+}
+
+TEST(range, SkipsHashes) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        Populate(&session, {"k1", "k3"});
+        CHECK_EQ(session.Run({"HSET", "k2", "f", "v"}), ":1\r\n");
+        CHECK_EQ(session.Run({"PREFIX", "k"}), Pairs({"k1", "k3"}));
+        CHECK_EQ(session.Run({"RANGE", "k2", "", "LIMIT", "1"}), Pairs({"k3"}));
+    });
+}
+
+// Sharded, the shards' pairs are merged back into key order.
+TEST(range, InOrder) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        std::vector<std::string> keys;
+        for (int i = 0; i < 300; ++i) {
+            keys.emplace_back("key:" + std::to_string(i * 7919 % 1000));
+            session.Submit({"SET", keys.back(), "v:" + keys.back()});
+        }
+        session.Drain();
+        session.Read(0, 1);
+        std::sort(keys.begin(), keys.end());
+
+        Reply reply = ParseReply(session.Run({"PREFIX", "key:"}));
+        std::vector<std::string> got = GetStrings(reply);
+        CHECK(got.size() == keys.size() * 2);
+        for (size_t i = 0; i < keys.size() && i * 2 + 1 < got.size(); ++i) {
+            CHECK_EQ(got[i * 2], keys[i]);
+            CHECK_EQ(got[i * 2 + 1], "v:" + keys[i]);
+        }
+
+        reply = ParseReply(session.Run({"RANGE", keys[100], keys[150], "LIMIT", "20"}));
+        got = GetStrings(reply);
+        CHECK(got.size() == 40);
+        for (size_t i = 0; i < 20 && i * 2 < got.size(); ++i) {
+            CHECK_EQ(got[i * 2], keys[100 + i]);
+        }
+    });
+}
+
+TEST(range, Errors) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"RANGE", "a", "b", "LIMIT"}), "-ERR syntax error\r\n");
+        CHECK_EQ(session.Run({"RANGE", "a", "b", "COUNT", "1"}), "-ERR syntax error\r\n");
+        CHECK_EQ(session.Run({"RANGE", "a", "b", "LIMIT", "-1"}),
+                 "-ERR value is out of range, must be positive\r\n");
+        CHECK_EQ(session.Run({"PREFIX", "a", "LIMIT", "x"}), "-ERR value is out of range, must be positive\r\n");
+    });
+}
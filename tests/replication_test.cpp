@@ -0,0 +1,183 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string>
+
+#include "test.h"
+
+using namespace cheapis;
+
+struct FullSync {
+    std::string replid;
+    std::string offset;
+    std::string snapshot;
+};
+
+// Reads a full sync off the replica's link: the FULLRESYNC reply, then the
+// snapshot between two EOF marks. False if it doesn't come whole in time.
+static bool ReadFullSync(TestSession * session, size_t replica, FullSync * sync) {
+    std::string got;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (std::chrono::steady_clock::now() < deadline) {
+        got += session->Read(replica, got.size() + 1, 100);
+        size_t eol = got.find("\r\n");
+        size_t mark_eol = eol != std::string::npos ? got.find("\r\n", eol + 2) : std::string::npos;
+        if (mark_eol == std::string::npos) {
+            continue;
+        }
+        std::string header = got.substr(0, eol);
+        std::string mark_line = got.substr(eol + 2, mark_eol - eol - 2);
+        if (header.compare(0, 12, "+FULLRESYNC ") != 0 || mark_line.compare(0, 5, "$EOF:") != 0) {
+            return false;
+        }
+        std::string mark = mark_line.substr(5);
+        size_t begin = mark_eol + 2;
+        if (got.size() < begin + mark.size() || got.compare(got.size() - mark.size(), mark.size(), mark) != 0) {
+            continue;
+        }
+        size_t space = header.find(' ', 12);
+        sync->replid = header.substr(12, space - 12);
+        sync->offset = header.substr(space + 1);
+        sync->snapshot = got.substr(begin, got.size() - mark.size() - begin);
+        return true;
+    }
+    return false;
+}
+
+// Runs the master's cron and loop until no replica waits on a full sync.
+static bool WaitOnline(TestSession * session) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (std::chrono::steady_clock::now() < deadline) {
+        session->Cron();
+        std::string info = ParseReply(session->Run({"INFO", "replication"})).str;
+        if (info.find("state=online") != std::string::npos && info.find("state=send_bulk") == std::string::npos &&
+            info.find("state=wait_bgsave") == std::string::npos) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+// A port on this host nothing listens on.
+static int GetClosedPort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+// A replica with nothing to continue from gets the snapshot as of the end
+// of the batch that asked for it, then the stream of the writes since.
+TEST(replication, FullSync) {
+    auto executor = OpenExecutorMem();
+    TestSession session(executor.get());
+    CHECK_EQ(session.Run({"SET", "before", "v"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"HSET", "h", "f", "v"}), ":1\r\n");
+
+    size_t replica = session.Connect();
+    session.Submit({"PSYNC", "?", "-1"}, replica);
+    session.Submit({"SET", "forked", "v"});
+    session.Drain();
+    CHECK_EQ(session.Read(), "+OK\r\n");
+    CHECK_EQ(session.Run({"SET", "during", "v"}), "+OK\r\n");
+    FullSync sync;
+    CHECK(ReadFullSync(&session, replica, &sync));
+    CHECK(sync.replid.size() == 40);
+    CHECK_EQ(sync.offset, std::to_string(Array({"SET", "forked", "v"}).size()));
+    CHECK(sync.snapshot.find("before") != std::string::npos);
+    CHECK(sync.snapshot.find("forked") != std::string::npos);
+    CHECK(sync.snapshot.find("during") == std::string::npos);
+
+    CHECK(WaitOnline(&session));
+    CHECK_EQ(session.Run({"SET", "after", "v"}), "+OK\r\n");
+    std::string stream = session.Read(replica);
+    size_t during = stream.find(Array({"SET", "during", "v"}));
+    size_t after = stream.find(Array({"SET", "after", "v"}));
+    CHECK(during != std::string::npos && after != std::string::npos && during < after);
+    CHECK(stream.find("before") == std::string::npos);
+    CHECK(stream.find("INFO") == std::string::npos);
+
+    session.Submit({"PSYNC", "?", "-1"}, replica);
+    session.Drain();
+    CHECK_EQ(session.Read(replica), "-ERR already a replica\r\n");
+}
+
+// A replica that has the stream up to an offset continues from there, one
+// that doesn't know the master's id is fully synced.
+TEST(replication, Continue) {
+    auto executor = OpenExecutorMem();
+    TestSession session(executor.get());
+    size_t first = session.Connect();
+    session.Submit({"PSYNC", "?", "-1"}, first);
+    session.Drain();
+    FullSync sync;
+    CHECK(ReadFullSync(&session, first, &sync));
+    CHECK(WaitOnline(&session));
+    CHECK_EQ(session.Run({"SET", "streamed", "v"}), "+OK\r\n");
+    std::string stream = session.Read(first);
+
+    size_t second = session.Connect();
+    session.Submit({"PSYNC", sync.replid, sync.offset}, second);
+    session.Drain();
+    std::string expected = "+CONTINUE " + sync.replid + "\r\n" + stream;
+    CHECK_EQ(session.Read(second, expected.size()), expected);
+
+    size_t third = session.Connect();
+    session.Submit({"PSYNC", "0123456789012345678901234567890123456789", "0"}, third);
+    session.Drain();
+    FullSync other;
+    CHECK(ReadFullSync(&session, third, &other));
+    CHECK_EQ(other.replid, sync.replid);
+    CHECK(other.snapshot.find("streamed") != std::string::npos);
+    CHECK(WaitOnline(&session));
+}
+
+// A replica serves reads but no writes until promoted.
+TEST(replication, Replicaof) {
+    std::string dir = MakeTestDir("replication");
+    {
+        auto executor = OpenExecutorMem(dir + "/dump.snapshot");
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"SET", "k", "v"}), "+OK\r\n");
+        std::string port = std::to_string(GetClosedPort());
+        CHECK_EQ(session.Run({"REPLICAOF", "127.0.0.1", port}), "+OK\r\n");
+        CHECK_EQ(session.Run({"REPLICAOF", "127.0.0.1", port}), "+OK Already connected to specified master\r\n");
+        CHECK_EQ(session.Run({"SET", "k", "w"}), "-READONLY You can't write against a read only replica.\r\n");
+        CHECK_EQ(session.Run({"INCR", "n"}), "-READONLY You can't write against a read only replica.\r\n");
+        CHECK_EQ(session.Run({"GET", "k"}), Bulk("v"));
+        CHECK_EQ(session.Run({"PSYNC", "?", "-1"}), "-ERR this node is a replica, sync from its master\r\n");
+        CHECK(ParseReply(session.Run({"INFO", "replication"})).str.find("role:slave") != std::string::npos);
+
+        CHECK_EQ(session.Run({"REPLICAOF", "NO", "ONE"}), "+OK\r\n");
+        CHECK(ParseReply(session.Run({"INFO", "replication"})).str.find("role:master") != std::string::npos);
+        CHECK_EQ(session.Run({"SET", "k", "w"}), "+OK\r\n");
+        CHECK_EQ(session.Run({"GET", "k"}), Bulk("w"));
+    }
+    RemoveTree(dir);
+}
+
+TEST(replication, Errors) {
+    {
+        auto executor = OpenExecutorMem();
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"REPLICAOF", "127.0.0.1", "0"}), "-ERR Invalid master port\r\n");
+        CHECK_EQ(session.Run({"REPLICAOF", "127.0.0.1", "x"}), "-ERR Invalid master port\r\n");
+        CHECK_EQ(session.Run({"REPLICAOF", "127.0.0.1", "6379"}), "-ERR no snapshot file to sync into\r\n");
+        CHECK_EQ(session.Run({"REPLICAOF", "no", "one"}), "+OK\r\n");
+    }
+    for (size_t shards:{1, 3}) {
+        GetTestContext() = shards == 1 ? "disk" : "disk with 3 shards";
+        TestDisk disk(shards);
+        TestSession session(disk.Get());
+        const std::string err = "-ERR replication is for the in-memory executor, disk nodes can't be replicated\r\n";
+        CHECK_EQ(session.Run({"REPLICAOF", "127.0.0.1", "6379"}), err);
+        CHECK_EQ(session.Run({"PSYNC", "?", "-1"}), err);
+        CHECK_EQ(session.Run({"REPLCONF", "ACK", "0"}), err);
+    }
+    GetTestContext().clear();
+}
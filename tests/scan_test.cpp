@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../src/crc32c.h"
+#include "test.h"
+
+using namespace cheapis;
+
+static std::vector<std::string> Sorted(std::vector<std::string> keys) {
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+static std::string Join(const std::vector<std::string> & keys) {
+    std::string joined;
+    for (const auto & k:keys) {
+        joined += k + " ";
+    }
+    return joined;
+}
+
+// Every key of a full SCAN, in the order returned.
+static std::vector<std::string> ScanAll(TestSession * session, const char * match, const char * count) {
+    std::vector<std::string> keys;
+    std::string cursor = "0";
+    for (int calls = 0; calls < 10000; ++calls) {
+        Reply reply = match != nullptr ? ParseReply(session->Run({"SCAN", cursor, "MATCH", match, "COUNT", count}))
+                                       : ParseReply(session->Run({"SCAN", cursor, "COUNT", count}));
+        if (reply.type != '*' || reply.elements.size() != 2) {
+            CheckFailed(__FILE__, __LINE__, "SCAN didn't reply with a cursor and keys");
+            break;
+        }
+        for (const auto & k:GetStrings(reply.elements[1])) {
+            keys.emplace_back(k);
+        }
+        cursor = reply.elements[0].str;
+        if (cursor == "0") {
+            break;
+        }
+    }
+    return keys;
+}
+
+// A shard that is empty may still take a call, with an empty page.
+TEST(scan, Empty) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK(ScanAll(&session, nullptr, "10").empty());
+        CHECK_EQ(session.Run({"KEYS", "*"}), "*0\r\n");
+    });
+}
+
+TEST(scan, EveryKeyOnce) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        std::vector<std::string> expected;
+        for (int i = 0; i < 200; ++i) {
+            std::string k = "key:" + std::to_string(i);
+            session.Submit({"SET", k, "v"});
+            expected.emplace_back(k);
+        }
+        session.Submit({"HSET", "hash", "f", "v"});
+        expected.emplace_back("hash");
+        session.Drain();
+        session.Read(0, 1);
+        std::sort(expected.begin(), expected.end());
+
+        for (const char * count:{"1", "7", "1000"}) {
+            CHECK_EQ(Join(Sorted(ScanAll(&session, nullptr, count))), Join(expected));
+        }
+        CHECK_EQ(Join(Sorted(GetStrings(ParseReply(session.Run({"KEYS", "*"}))))), Join(expected));
+    });
+}
+
+TEST(scan, Match) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        for (int i = 0; i < 50; ++i) {
+            session.Submit({"SET", "user:" + std::to_string(i), "v"});
+            session.Submit({"SET", "item:" + std::to_string(i), "v"});
+        }
+        session.Drain();
+        session.Read(0, 1);
+
+        std::vector<std::string> users = ScanAll(&session, "user:*", "10");
+        CHECK(users.size() == 50);
+        CHECK(std::set<std::string>(users.begin(), users.end()).size() == 50);
+        for (const auto & k:users) {
+            CHECK(k.compare(0, 5, "user:") == 0);
+        }
+        CHECK_EQ(Join(Sorted(GetStrings(ParseReply(session.Run({"KEYS", "user:?"}))))),
+                 "user:0 user:1 user:2 user:3 user:4 user:5 user:6 user:7 user:8 user:9 ");
+        CHECK_EQ(Join(Sorted(GetStrings(ParseReply(session.Run({"KEYS", "item:4[0-2]"}))))),
+                 "item:40 item:41 item:42 ");
+        CHECK_EQ(session.Run({"KEYS", "nothing*"}), "*0\r\n");
+    });
+}
+
+// Keys there from start to end of a SCAN are returned, deleted ones aren't
+// once gone.
+TEST(scan, ChangesDuringScan) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        for (int i = 0; i < 100; ++i) {
+            session.Submit({"SET", "k" + std::to_string(i), "v"});
+        }
+        session.Drain();
+        session.Read(0, 1);
+
+        std::set<std::string> seen;
+        std::string cursor = "0";
+        bool deleted = false;
+        do {
+            Reply reply = ParseReply(session.Run({"SCAN", cursor, "COUNT", "10"}));
+            if (reply.elements.size() != 2) {
+                CheckFailed(__FILE__, __LINE__, "SCAN didn't reply with a cursor and keys");
+                break;
+            }
+            for (const auto & k:GetStrings(reply.elements[1])) {
+                seen.insert(k);
+            }
+            cursor = reply.elements[0].str;
+            if (!deleted) {
+                for (int i = 0; i < 100; i += 2) {
+                    std::string k = "k" + std::to_string(i);
+                    if (seen.count(k) == 0) {
+                        session.Submit({"DEL", k});
+                    }
+                }
+                session.Drain();
+                session.Read(0, 1);
+                deleted = true;
+            }
+        } while (cursor != "0");
+        for (int i = 1; i < 100; i += 2) {
+            CHECK(seen.count("k" + std::to_string(i)) == 1);
+        }
+        CHECK(seen.size() < 100);
+    });
+}
+
+static uint32_t GetShard(const std::string & k) {
+    return Crc32c(0, k.data(), k.size()) % 3;
+}
+
+// Sharded, a SCAN walks the shards one after another: a cursor that ends a
+// shard resumes at the start of the next one, an empty shard included, and
+// keys added behind the cursor aren't returned.
+TEST(scan, AcrossShards) {
+    TestDisk disk(3);
+    TestSession session(disk.Get());
+    std::vector<std::string> expected;
+    for (int i = 0; expected.size() < 10; ++i) {
+        std::string k = "k" + std::to_string(i);
+        if (GetShard(k) != 1) {
+            expected.emplace_back(k);
+            session.Submit({"SET", k, "v"});
+        }
+    }
+    session.Drain();
+    session.Read(0, 1);
+    std::vector<std::string> keys = ScanAll(&session, nullptr, "3");
+    CHECK_EQ(Join(Sorted(keys)), Join(Sorted(expected)));
+    for (size_t i = 1; i < keys.size(); ++i) {
+        CHECK(GetShard(keys[i - 1]) <= GetShard(keys[i]));
+    }
+
+    /* Shard 0 done in one call, the cursor points at shard 1 */
+    Reply reply = ParseReply(session.Run({"SCAN", "0", "COUNT", "100"}));
+    CHECK(reply.elements.size() == 2);
+    if (reply.elements.size() != 2) {
+        return;
+    }
+    std::string cursor = reply.elements[0].str;
+    CHECK(cursor != "0");
+    std::set<std::string> seen;
+    for (const auto & k:GetStrings(reply.elements[1])) {
+        CHECK(GetShard(k) == 0);
+        seen.insert(k);
+    }
+    std::string behind;
+    std::string ahead;
+    for (int i = 0; behind.empty() || ahead.empty(); ++i) {
+        std::string k = "new" + std::to_string(i);
+        if (GetShard(k) == 0 && behind.empty()) {
+            behind = k;
+        } else if (GetShard(k) == 1 && ahead.empty()) {
+            ahead = k;
+        }
+    }
+    CHECK_EQ(session.Run({"SET", behind, "v"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"SET", ahead, "v"}), "+OK\r\n");
+    while (cursor != "0") {
+        reply = ParseReply(session.Run({"SCAN", cursor, "COUNT", "100"}));
+        if (reply.elements.size() != 2) {
+            CheckFailed(__FILE__, __LINE__, "SCAN didn't reply with a cursor and keys");
+            break;
+        }
+        for (const auto & k:GetStrings(reply.elements[1])) {
+            CHECK(seen.insert(k).second);
+        }
+        cursor = reply.elements[0].str;
+    }
+    CHECK(seen.count(ahead) == 1);
+    CHECK(seen.count(behind) == 0);
+    CHECK(seen.size() == expected.size() + 1);
+}
+
+// However many scans other clients start, a client's cursor resumes, also
+// from another connection; only the client's own later scans expire it.
+TEST(scan, SlowCursor) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        size_t busy = session.Connect();
+        for (int i = 0; i < 20; ++i) {
+            session.Submit({"SET", "key:" + std::to_string(i), "v"});
+        }
+        session.Drain();
+        session.Read(0, 1);
+        Reply first = ParseReply(session.Run({"SCAN", "0", "COUNT", "1"}));
+        std::string slow = first.elements[0].str;
+        CHECK(slow != "0");
+
+        for (int i = 0; i < 5000; ++i) {
+            session.Submit({"SCAN", "0", "COUNT", "1"}, busy);
+            if (i % 500 == 499) {
+                session.Drain();
+                session.Read(busy, 1);
+            }
+        }
+        session.Drain();
+        session.Read(busy, 1);
+        std::string oldest = ParseReply(session.Run({"SCAN", "0", "COUNT", "1"}, busy)).elements[0].str;
+        for (int i = 0; i < 16; ++i) {
+            session.Run({"SCAN", "0", "COUNT", "1"}, busy);
+        }
+        CHECK_EQ(session.Run({"SCAN", oldest}, busy), "-ERR invalid cursor\r\n");
+
+        CHECK(ParseReply(session.Run({"SCAN", slow})).type == '*');
+        size_t keys = GetStrings(first.elements[1]).size();
+        for (std::string cursor = slow; cursor != "0";) {
+            Reply reply = ParseReply(session.Run({"SCAN", cursor, "COUNT", "1000"}, busy));
+            if (reply.type != '*' || reply.elements.size() != 2) {
+                CheckFailed(__FILE__, __LINE__, "SCAN didn't reply with a cursor and keys");
+                break;
+            }
+            keys += GetStrings(reply.elements[1]).size();
+            cursor = reply.elements[0].str;
+        }
+        CHECK(keys == 20);
+    });
+}
+
+TEST(scan, Errors) {
+    ForEachExecutor([](Executor * executor) {
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"SCAN", "x"}), "-ERR invalid cursor\r\n");
+        CHECK_EQ(session.Run({"SCAN", "0", "COUNT", "0"}), "-ERR value is out of range, must be positive\r\n");
+        CHECK_EQ(session.Run({"SCAN", "0", "COUNT"}), "-ERR syntax error\r\n");
+        CHECK_EQ(session.Run({"SCAN", "0", "TYPE", "string"}), "-ERR syntax error\r\n");
+    });
+}
@@ -0,0 +1,86 @@
+#include <string>
+
+#include "test.h"
+
+using namespace cheapis;
+
+// Strings, counters and hashes of both encodings come back from a BGSAVE
+// snapshot, writes after the fork don't.
+TEST(snapshot, BgsaveAndLoad) {
+    std::string dir = MakeTestDir("snapshot");
+    std::string snapshot = dir + "/dump.snapshot";
+    {
+        auto executor = OpenExecutorMem(snapshot);
+        CHECK(executor != nullptr);
+        TestSession session(executor.get());
+        session.Submit({"SET", "s", "v"});
+        session.Submit({"SET", "empty", ""});
+        session.Submit({"INCRBY", "n", "42"});
+        session.Submit({"INCRBYFLOAT", "f", "1.5"});
+        session.Submit({"HSET", "small", "a", "1", "b", "2"});
+        for (int i = 0; i < 200; ++i) {
+            session.Submit({"HSET", "big", "f" + std::to_string(i), std::to_string(i)});
+        }
+        session.Drain();
+        session.Read(0, 1);
+
+        CHECK_EQ(session.Run({"BGSAVE"}), "+Background saving started\r\n");
+        CHECK_EQ(session.Run({"BGSAVE"}), "-ERR Background save already in progress\r\n");
+        CHECK_EQ(session.Run({"SET", "later", "v"}), "+OK\r\n");
+        CHECK(session.CronUntil("persistence", "rdb_bgsave_in_progress:0"));
+        CHECK(session.CronUntil("persistence", "rdb_last_bgsave_status:ok"));
+        CHECK(access(snapshot.c_str(), F_OK) == 0);
+        CHECK(access((snapshot + ".tmp").c_str(), F_OK) != 0);
+    }
+    {
+        auto executor = OpenExecutorMem(snapshot);
+        CHECK(executor != nullptr);
+        if (executor != nullptr) {
+            TestSession session(executor.get());
+            CHECK_EQ(session.Run({"GET", "s"}), Bulk("v"));
+            CHECK_EQ(session.Run({"GET", "empty"}), Bulk(""));
+            CHECK_EQ(session.Run({"INCR", "n"}), ":43\r\n");
+            CHECK_EQ(session.Run({"GET", "f"}), Bulk("1.5"));
+            CHECK_EQ(session.Run({"HMGET", "small", "a", "b"}), Array({"1", "2"}));
+            CHECK_EQ(session.Run({"HGET", "big", "f199"}), Bulk("199"));
+            CHECK(ParseReply(session.Run({"HGETALL", "big"})).elements.size() == 400);
+            CHECK_EQ(session.Run({"GET", "later"}), kNil);
+        }
+    }
+    RemoveTree(dir);
+}
+
+// A node started without a snapshot file loads nothing and saves a new one.
+TEST(snapshot, NoFileYet) {
+    std::string dir = MakeTestDir("snapshot");
+    std::string snapshot = dir + "/dump.snapshot";
+    auto executor = OpenExecutorMem(snapshot);
+    CHECK(executor != nullptr);
+    if (executor != nullptr) {
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"KEYS", "*"}), "*0\r\n");
+        CHECK_EQ(session.Run({"BGSAVE"}), "+Background saving started\r\n");
+        CHECK(session.CronUntil("persistence", "rdb_bgsave_in_progress:0"));
+        CHECK(access(snapshot.c_str(), F_OK) == 0);
+    }
+    executor.reset();
+    CHECK(OpenExecutorMem(snapshot) != nullptr);
+    RemoveTree(dir);
+}
+
+TEST(snapshot, Errors) {
+    {
+        auto executor = OpenExecutorMem();
+        TestSession session(executor.get());
+        CHECK_EQ(session.Run({"BGSAVE"}), "-ERR no snapshot file\r\n");
+        CHECK(ParseReply(session.Run({"LASTSAVE"})).type == ':');
+    }
+    {
+        TestDisk disk;
+        TestSession session(disk.Get());
+        const std::string err = "-ERR BGSAVE and BGREWRITEAOF are for the in-memory executor, "
+                                "every write here is in a data file already\r\n";
+        CHECK_EQ(session.Run({"BGSAVE"}), err);
+        CHECK_EQ(session.Run({"BGREWRITEAOF"}), err);
+    }
+}
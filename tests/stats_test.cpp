@@ -0,0 +1,98 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/env.h"
+#include "../src/histogram.h"
+#include "../src/stats.h"
+#include "test.h"
+
+using namespace cheapis;
+
+// Every value lands in a bucket whose upper bound is at most 1/kSubCount
+// above it, exact below kSubCount.
+TEST(stats, Buckets) {
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < 100000; ++i) {
+        uint64_t v = rng() >> (rng() % 64);
+        uint64_t upper = Histogram::GetBucketUpperBound(Histogram::GetBucket(v));
+        CHECK(upper >= v);
+        CHECK(upper - v <= v / Histogram::kSubCount);
+    }
+    for (uint64_t v = 0; v < Histogram::kSubCount; ++v) {
+        CHECK(Histogram::GetBucketUpperBound(Histogram::GetBucket(v)) == v);
+    }
+    CHECK(Histogram::GetBucket(UINT64_MAX) == Histogram::kBucketCount - 1);
+}
+
+TEST(stats, Percentiles) {
+    Histogram histogram;
+    uint64_t buckets[Histogram::kBucketCount] = {};
+    CHECK(Histogram::GetPercentile(buckets, 0, 50) == 0);
+    for (uint64_t v = 0; v < 100; ++v) {
+        histogram.Record(v);
+    }
+    histogram.AddTo(buckets);
+    CHECK(Histogram::GetPercentile(buckets, 100, 50) == 49);
+    CHECK(Histogram::GetPercentile(buckets, 100, 99) == 99); /* 98 shares the bucket of 96 to 99 */
+    CHECK(Histogram::GetPercentile(buckets, 100, 100) == 99);
+    CHECK(Histogram::GetPercentile(buckets, 100, 1) == 0);
+
+    /* One slow value among many fast ones moves p99.9 only */
+    for (int i = 0; i < 99900; ++i) {
+        histogram.Record(10);
+    }
+    histogram.Record(1000000);
+    uint64_t more[Histogram::kBucketCount] = {};
+    histogram.AddTo(more);
+    CHECK(Histogram::GetPercentile(more, 100001, 50) == 10);
+    CHECK(Histogram::GetPercentile(more, 100001, 99) == 10);
+    uint64_t p100 = Histogram::GetPercentile(more, 100001, 100);
+    CHECK(p100 >= 1000000 && p100 <= 1000000 + 1000000 / Histogram::kSubCount);
+}
+
+// Records a task that executed for us microseconds.
+static void RecordSlowTask(Command cmd, const rocksdb::autovector<std::string> & argv, uint64_t us) {
+    auto cycles = static_cast<uint64_t>(us * GetCyclesPerMicrosecond());
+    RecordTask(GetStats(), cmd, argv, 1, 0, 0, 0, cycles, cycles);
+}
+
+static std::string RunSlowlog(const rocksdb::autovector<std::string> & argv) {
+    std::string out;
+    ExecuteSlowlog(argv, 1, &out);
+    return out;
+}
+
+// Tasks slower than the threshold are logged newest first, up to a length,
+// and RESET empties the log; fast ones aren't logged.
+TEST(stats, Slowlog) {
+    CHECK_EQ(RunSlowlog({"SLOWLOG", "RESET"}), "+OK\r\n");
+    CHECK_EQ(RunSlowlog({"SLOWLOG", "LEN"}), ":0\r\n");
+    RecordSlowTask(kGet, {"GET", "fast"}, 10);
+    CHECK_EQ(RunSlowlog({"SLOWLOG", "LEN"}), ":0\r\n");
+    RecordSlowTask(kGet, {"GET", "first"}, 20000);
+    RecordSlowTask(kSet, {"SET", "second", std::string(200, 'v')}, 30000);
+    CHECK_EQ(RunSlowlog({"SLOWLOG", "LEN"}), ":2\r\n");
+
+    Reply entries = ParseReply(RunSlowlog({"SLOWLOG", "GET"}));
+    CHECK(entries.elements.size() == 2);
+    if (entries.elements.size() == 2) {
+        const Reply & newest = entries.elements[0];
+        CHECK(newest.elements.size() == 6 && newest.elements[2].integer >= 29999);
+        std::vector<std::string> args = GetStrings(newest.elements[3]);
+        CHECK(args.size() == 3 && args[2] == std::string(128, 'v') + "... (72 more bytes)");
+        CHECK(newest.elements[0].integer == entries.elements[1].elements[0].integer + 1);
+        CHECK(GetStrings(entries.elements[1].elements[3])[1] == "first");
+    }
+    CHECK(ParseReply(RunSlowlog({"SLOWLOG", "GET", "1"})).elements.size() == 1);
+
+    for (int i = 0; i < 200; ++i) {
+        RecordSlowTask(kGet, {"GET", std::to_string(i)}, 20000);
+    }
+    CHECK_EQ(RunSlowlog({"SLOWLOG", "LEN"}), ":128\r\n");
+    CHECK(ParseReply(RunSlowlog({"SLOWLOG", "GET", "-1"})).elements.size() == 128);
+    CHECK_EQ(RunSlowlog({"SLOWLOG", "RESET"}), "+OK\r\n");
+    CHECK_EQ(RunSlowlog({"SLOWLOG", "LEN"}), ":0\r\n");
+    CHECK_EQ(RunSlowlog({"SLOWLOG", "GET"}), "*0\r\n");
+    CHECK_EQ(RunSlowlog({"SLOWLOG", "GET", "-2"}), "-ERR count should be greater than or equal to -1\r\n");
+}
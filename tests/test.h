@@ -0,0 +1,359 @@
+#pragma once
+#ifndef CHEAPIS_TEST_H
+#define CHEAPIS_TEST_H
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <ftw.h>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/executor.h"
+
+namespace cheapis {
+    struct TestCase {
+        std::string name; /* group/name */
+        void (* run)();
+    };
+
+    inline std::vector<TestCase> & GetTestCases() {
+        static std::vector<TestCase> cases;
+        return cases;
+    }
+
+    struct TestRegistrar {
+        TestRegistrar(const char * name, void (* run)()) {
+            GetTestCases().push_back({name, run});
+        }
+    };
+
+    inline int & GetTestFailures() {
+        static int failures = 0;
+        return failures;
+    }
+
+    // Added to failures, e.g. the executor a shared test runs against.
+    inline std::string & GetTestContext() {
+        static std::string context;
+        return context;
+    }
+
+    // RESP as it would be typed, \r\n and other bytes outside ASCII escaped.
+    inline std::string Escape(const std::string_view & s) {
+        std::string escaped;
+        for (char ch:s) {
+            if (ch == '\r') {
+                escaped += "\\r";
+            } else if (ch == '\n') {
+                escaped += "\\n";
+            } else if (ch == '"' || ch == '\\') {
+                escaped += '\\';
+                escaped += ch;
+            } else if (ch < 0x20 || ch > 0x7e) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\x%02x", static_cast<unsigned char>(ch));
+                escaped += buf;
+            } else {
+                escaped += ch;
+            }
+        }
+        return escaped;
+    }
+
+    inline void CheckFailed(const char * file, int line, const std::string & what) {
+        const std::string & context = GetTestContext();
+        fprintf(stderr, "%s:%d: %s%s%s\n", file, line, context.c_str(), context.empty() ? "" : ": ", what.c_str());
+        ++GetTestFailures();
+    }
+
+    // Removes dir and everything under it.
+    inline void RemoveTree(const std::string & dir) {
+        nftw(dir.c_str(), [](const char * name, const struct stat *, int, struct FTW *) {
+            return remove(name);
+        }, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    // Returns an empty string on failure.
+    inline std::string MakeTestDir(const char * name) {
+        std::string dir = std::string("/tmp/cheapis-test-") + name + "-XXXXXX";
+        return mkdtemp(&dir[0]) != nullptr ? dir : std::string();
+    }
+
+    // Feeds an executor the way the event loop does. Each client is one end
+    // of a socketpair, the test reads the other, so replies are checked byte
+    // for byte as a client gets them.
+    class TestSession {
+    public:
+        explicit TestSession(Executor * executor)
+                : executor_(executor), el_(EventLoop<Client>::Open()) {
+            Connect();
+        }
+
+        ~TestSession() {
+            for (int peer:peers_) {
+                close(peer);
+            }
+        }
+
+        // Returns the number of the new client, the first one is 0.
+        size_t Connect() {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+                perror("socketpair");
+                abort();
+            }
+            fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+            fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+            el_.Acquire(fds[0], std::make_unique<Client>(fds[0], 0));
+            fds_.push_back(fds[0]);
+            peers_.push_back(fds[1]);
+            return fds_.size() - 1;
+        }
+
+        // Null once the executor released it.
+        Client * GetClient(size_t client) {
+            return el_.GetResource(fds_[client]).get();
+        }
+
+        void Submit(std::initializer_list<std::string_view> args, size_t client = 0) {
+            rocksdb::autovector<std::string_view> argv;
+            for (const auto & arg:args) {
+                argv.emplace_back(arg);
+            }
+            Client * c = GetClient(client);
+            executor_->Submit(argv, c, fds_[client]);
+            ++c->ref_count;
+        }
+
+        void Drain() {
+            while (executor_->GetTaskCount() != 0) {
+                executor_->Execute(executor_->GetTaskCount(), time(nullptr), &el_);
+            }
+        }
+
+        void Cron() {
+            executor_->Cron(time(nullptr));
+        }
+
+        // Runs the executor's cron, as the server does every second, until a
+        // line of its INFO section is line, e.g. once a background child is
+        // reaped. False if that takes over timeout_ms.
+        bool CronUntil(const char * section, const std::string & line, int timeout_ms = 10000) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            std::string info;
+            while (true) {
+                Cron();
+                info.assign("\n");
+                executor_->GetInfo(section, &info);
+                if (info.find("\n" + line + "\r\n") != std::string::npos) {
+                    return true;
+                }
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        // What the client got so far, waiting up to timeout_ms for at least
+        // min bytes. Output the executor left queued is written out first, as
+        // the event loop would once the socket is writable.
+        std::string Read(size_t client = 0, size_t min = 0, int timeout_ms = 5000) {
+            std::string got;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            while (true) {
+                Client * c = GetClient(client);
+                if (c != nullptr && !c->close && c->output.size() > c->held) {
+                    ssize_t nwrite = write(fds_[client], c->output.data(), c->output.size() - c->held);
+                    if (nwrite > 0) {
+                        c->output.erase(0, static_cast<size_t>(nwrite));
+                    }
+                }
+                char buf[65536];
+                ssize_t nread = read(peers_[client], buf, sizeof(buf));
+                if (nread > 0) {
+                    got.append(buf, static_cast<size_t>(nread));
+                    continue;
+                }
+                if (got.size() >= min || std::chrono::steady_clock::now() >= deadline) {
+                    return got;
+                }
+                struct pollfd pfd = {peers_[client], POLLIN, 0};
+                poll(&pfd, 1, 10);
+            }
+        }
+
+        // The reply to one command.
+        std::string Run(std::initializer_list<std::string_view> args, size_t client = 0) {
+            Submit(args, client);
+            Drain();
+            return Read(client);
+        }
+
+        EventLoop<Client> * GetEventLoop() { return &el_; }
+
+    private:
+        Executor * executor_;
+        EventLoop<Client> el_;
+        std::vector<int> fds_;
+        std::vector<int> peers_;
+    };
+
+    // A disk executor over fresh directories, one per shard, removed with it.
+    class TestDisk {
+    public:
+        explicit TestDisk(size_t shards = 1) {
+            for (size_t i = 0; i < shards; ++i) {
+                dirs_.emplace_back(MakeTestDir("disk"));
+            }
+            executor_ = OpenExecutorDisk(dirs_);
+        }
+
+        ~TestDisk() {
+            executor_.reset();
+            for (const auto & dir:dirs_) {
+                RemoveTree(dir);
+            }
+        }
+
+        Executor * Get() { return executor_.get(); }
+
+        const std::vector<std::string> & GetDirs() const { return dirs_; }
+
+    private:
+        std::vector<std::string> dirs_;
+        std::unique_ptr<Executor> executor_;
+    };
+
+    // Runs a test against a fresh executor of each kind: in memory, on disk,
+    // and on disk in three shards.
+    inline void ForEachExecutor(const std::function<void(Executor *)> & test) {
+        {
+            GetTestContext() = "mem";
+            auto executor = OpenExecutorMem();
+            test(executor.get());
+        }
+        for (size_t shards:{1, 3}) {
+            GetTestContext() = shards == 1 ? "disk" : "disk with 3 shards";
+            TestDisk disk(shards);
+            if (disk.Get() == nullptr) {
+                CheckFailed(__FILE__, __LINE__, "failed opening the disk executor");
+                continue;
+            }
+            test(disk.Get());
+        }
+        GetTestContext().clear();
+    }
+
+    // One RESP reply, parsed so tests can check replies whose order isn't
+    // fixed, such as the keys of KEYS.
+    struct Reply {
+        char type = 0; /* +, -, :, $ or *, 0 if the reply is cut short */
+        std::string str;
+        long long integer = 0;
+        bool nil = false;
+        std::vector<Reply> elements;
+    };
+
+    // Parses the reply at *pos and moves past it.
+    inline Reply ParseReply(const std::string & s, size_t * pos) {
+        Reply reply;
+        size_t end = s.find("\r\n", *pos);
+        if (end == std::string::npos || end == *pos) {
+            return reply;
+        }
+        char type = s[*pos];
+        std::string line = s.substr(*pos + 1, end - *pos - 1);
+        *pos = end + 2;
+        if (type == '+' || type == '-') {
+            reply.str = line;
+        } else if (type == ':') {
+            reply.integer = strtoll(line.c_str(), nullptr, 10);
+        } else if (type == '$' || type == '*') {
+            long long n = strtoll(line.c_str(), nullptr, 10);
+            reply.nil = n < 0;
+            for (long long i = 0; type == '*' && i < n; ++i) {
+                reply.elements.emplace_back(ParseReply(s, pos));
+                if (reply.elements.back().type == 0) {
+                    return Reply();
+                }
+            }
+            if (type == '$' && n >= 0) {
+                if (*pos + n + 2 > s.size()) {
+                    return Reply();
+                }
+                reply.str = s.substr(*pos, static_cast<size_t>(n));
+                *pos += n + 2;
+            }
+        } else {
+            return reply;
+        }
+        reply.type = type;
+        return reply;
+    }
+
+    inline Reply ParseReply(const std::string & s) {
+        size_t pos = 0;
+        return ParseReply(s, &pos);
+    }
+
+    // The bulk strings of an array reply.
+    inline std::vector<std::string> GetStrings(const Reply & reply) {
+        std::vector<std::string> strings;
+        for (const auto & element:reply.elements) {
+            strings.emplace_back(element.str);
+        }
+        return strings;
+    }
+
+    constexpr char kNil[] = "*-1\r\n"; /* A missing key, as the executors reply */
+
+    inline std::string Bulk(const std::string_view & s) {
+        return "$" + std::to_string(s.size()) + "\r\n" + std::string(s) + "\r\n";
+    }
+
+    inline std::string Array(std::initializer_list<std::string_view> items) {
+        std::string s = "*" + std::to_string(items.size()) + "\r\n";
+        for (const auto & item:items) {
+            s += Bulk(item);
+        }
+        return s;
+    }
+}
+
+#define TEST(group, name) \
+    static void Test_##group##_##name(); \
+    static const cheapis::TestRegistrar kRegistrar_##group##_##name(#group "/" #name, Test_##group##_##name); \
+    static void Test_##group##_##name()
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            cheapis::CheckFailed(__FILE__, __LINE__, "CHECK(" #cond ") failed"); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        std::string actual_ = (actual); \
+        std::string expected_ = (expected); \
+        if (actual_ != expected_) { \
+            cheapis::CheckFailed(__FILE__, __LINE__, #actual " is \"" + cheapis::Escape(actual_) + \
+                                                     "\", expected \"" + cheapis::Escape(expected_) + "\""); \
+        } \
+    } while (0)
+
+#endif //CHEAPIS_TEST_H
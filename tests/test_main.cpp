@@ -0,0 +1,25 @@
+#include <cstdio>
+
+#include "../src/log.h"
+#include "test.h"
+
+// Runs the tests whose name contains the filter, all of them without one.
+int main(int argc, char * argv[]) {
+    const char * filter = argc > 1 ? argv[1] : "";
+    cheapis::SetLogLevel(cheapis::kLogWarn);
+    int failed = 0;
+    int ran = 0;
+    for (const auto & test:cheapis::GetTestCases()) {
+        if (test.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        int failures = cheapis::GetTestFailures();
+        test.run();
+        bool ok = cheapis::GetTestFailures() == failures;
+        printf("%-40s %s\n", test.name.c_str(), ok ? "ok" : "FAILED");
+        failed += !ok;
+        ++ran;
+    }
+    printf("%d of %d tests failed\n", failed, ran);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+#include <fstream>
+#include <string>
+
+#include "../src/config.h"
+#include "../src/disk/filename.h"
+#include "test.h"
+
+using namespace cheapis;
+
+// Sets the write buffer for a test and puts the defaults back after it.
+class WriteBufferConfig {
+public:
+    WriteBufferConfig(uint64_t size, uint64_t usec, bool relaxed)
+            : size_(GetConfig()->write_buffer_size), usec_(GetConfig()->write_buffer_usec),
+              relaxed_(GetConfig()->write_relaxed) {
+        GetConfig()->write_buffer_size = size;
+        GetConfig()->write_buffer_usec = usec;
+        GetConfig()->write_relaxed = relaxed;
+    }
+
+    ~WriteBufferConfig() {
+        GetConfig()->write_buffer_size = size_;
+        GetConfig()->write_buffer_usec = usec_;
+        GetConfig()->write_relaxed = relaxed_;
+    }
+
+private:
+    uint64_t size_;
+    uint64_t usec_;
+    bool relaxed_;
+};
+
+// The value of a name:value line of INFO persistence, empty if none.
+static std::string GetPersistence(Executor * executor, const std::string & name) {
+    std::string info = "\n";
+    executor->GetInfo("persistence", &info);
+    size_t pos = info.find("\n" + name + ":");
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += name.size() + 2;
+    return info.substr(pos, info.find("\r\n", pos) - pos);
+}
+
+// The first n bytes of data file id, as on disk.
+static std::string ReadDataFile(const std::string & dir, const std::string & id, size_t n) {
+    std::string name;
+    DataFilename(dir, std::stoull(id), &name);
+    std::ifstream in(name, std::ios::binary);
+    std::string s(n, '\0');
+    in.read(&s[0], static_cast<std::streamsize>(n));
+    s.resize(static_cast<size_t>(in.gcount()));
+    return s;
+}
+
+// Runs the loop with nothing to do, as the server does on the executor's
+// timeout, until the write buffer is flushed. False if it isn't in time.
+static bool WaitForFlush(Executor * executor, TestSession * session, const std::string & prefix = "") {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (GetPersistence(executor, prefix + "write_buffer_bytes") != "0") {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        executor->Execute(0, time(nullptr), session->GetEventLoop());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// A record still in the buffer is read from it, not from the file, and the
+// reply to its SET waits for the flush while other clients' reads don't.
+TEST(write_buffer, Reads) {
+    WriteBufferConfig config(1 << 20, 1000000, false);
+    TestDisk disk;
+    Executor * executor = disk.Get();
+    TestSession session(executor);
+    size_t reader = session.Connect();
+    const std::string value = "buffered-value";
+    session.Submit({"SET", "k", value});
+    session.Submit({"GET", "k"}, reader);
+    session.Drain();
+    CHECK_EQ(session.Read(reader), Bulk(value));
+    CHECK_EQ(session.Read(), "");
+    CHECK(GetPersistence(executor, "write_buffer_bytes") != "0");
+    std::string id = GetPersistence(executor, "data_file_current");
+    size_t end = std::stoull(GetPersistence(executor, "data_file_offset"));
+    CHECK(ReadDataFile(disk.GetDirs()[0], id, end).find(value) == std::string::npos);
+    CHECK_EQ(session.Run({"GET", "k"}, reader), Bulk(value));
+
+    CHECK(WaitForFlush(executor, &session));
+    CHECK_EQ(session.Read(), "+OK\r\n");
+    CHECK(ReadDataFile(disk.GetDirs()[0], id, end).find(value) != std::string::npos);
+    CHECK_EQ(session.Run({"GET", "k"}, reader), Bulk(value));
+}
+
+// Once a client's reply is held behind a write, its later replies wait
+// behind it, in this batch and the next ones.
+TEST(write_buffer, HeldOrder) {
+    WriteBufferConfig config(1 << 20, 1000000, false);
+    for (size_t shards:{1, 3}) {
+        GetTestContext() = shards == 1 ? "disk" : "disk with 3 shards";
+        TestDisk disk(shards);
+        Executor * executor = disk.Get();
+        TestSession session(executor);
+        CHECK_EQ(session.Run({"SET", "a", "old"}), "");
+        CHECK(WaitForFlush(executor, &session, shards > 1 ? "shard0_" : ""));
+        CHECK(WaitForFlush(executor, &session, shards > 1 ? "shard1_" : ""));
+        CHECK(WaitForFlush(executor, &session, shards > 1 ? "shard2_" : ""));
+        CHECK_EQ(session.Read(), "+OK\r\n");
+
+        session.Submit({"SET", "a", "new"});
+        session.Submit({"GET", "a"});
+        session.Submit({"GET", "missing"});
+        session.Drain();
+        session.Submit({"GET", "a"});
+        session.Submit({"PING"});
+        session.Drain();
+        CHECK_EQ(session.Read(), "");
+        for (size_t s = 0; s < shards; ++s) {
+            CHECK(WaitForFlush(executor, &session, shards > 1 ? "shard" + std::to_string(s) + "_" : ""));
+        }
+        std::string expected = "+OK\r\n" + Bulk("new") + kNil + Bulk("new") + "+PONG\r\n";
+        CHECK_EQ(session.Read(0, expected.size()), expected);
+    }
+    GetTestContext().clear();
+}
+
+// Relaxed durability replies before the flush.
+TEST(write_buffer, Relaxed) {
+    WriteBufferConfig config(1 << 20, 1000000, true);
+    TestDisk disk;
+    Executor * executor = disk.Get();
+    TestSession session(executor);
+    CHECK_EQ(session.Run({"SET", "k", "v"}), "+OK\r\n");
+    CHECK_EQ(session.Run({"INCR", "n"}), ":1\r\n");
+    CHECK(GetPersistence(executor, "write_buffer_bytes") != "0");
+    CHECK_EQ(session.Run({"GET", "k"}), Bulk("v"));
+    CHECK(WaitForFlush(executor, &session));
+}
+
+// CHECKPOINT flushes the buffer first, its copy reads the file, whether it
+// starts or not, and the replies held behind it go out with its own.
+TEST(write_buffer, Checkpoint) {
+    WriteBufferConfig config(1 << 20, 1000000, false);
+    TestDisk disk;
+    Executor * executor = disk.Get();
+    TestSession session(executor);
+    std::string dir = MakeTestDir("write-buffer");
+    const std::string value = "checkpointed-value";
+    session.Submit({"SET", "k", value});
+    session.Submit({"CHECKPOINT", dir + "/checkpoint"});
+    session.Drain();
+    CHECK(GetPersistence(executor, "write_buffer_bytes") == "0");
+    std::string replies = session.Read();
+    CHECK(replies.compare(0, 5, "+OK\r\n") == 0);
+    CHECK(replies.size() > 5);
+    std::string id = GetPersistence(executor, "data_file_current");
+    size_t end = std::stoull(GetPersistence(executor, "data_file_offset"));
+    CHECK(ReadDataFile(disk.GetDirs()[0], id, end).find(value) != std::string::npos);
+    CHECK(session.CronUntil("persistence", "checkpoint_in_progress:0"));
+    RemoveTree(dir);
+}
+
+// Records buffered when the data file fills up are written to it before
+// the next one is started, and read back from it.
+TEST(write_buffer, Rollover) {
+    WriteBufferConfig config(0, 1000000, false);
+    TestDisk disk;
+    Executor * executor = disk.Get();
+    TestSession session(executor);
+    const uint64_t kFileSize = 1ULL << 31;
+    const std::string big(60000, 'b');
+    uint64_t offset = 0;
+    int n = 0;
+    while (offset + 64 * 65536 < kFileSize) { /* Written at once */
+        for (int i = 0; i < 64; ++i) {
+            session.Submit({"SET", "big" + std::to_string(n++ % 16), big});
+        }
+        session.Drain();
+        session.Read();
+        offset = std::stoull(GetPersistence(executor, "data_file_offset"));
+    }
+
+    GetConfig()->write_buffer_size = 1ULL << 30;
+    std::vector<std::string> tail;
+    while (offset < kFileSize) { /* Buffered, up to the end of the file */
+        tail.emplace_back("tail" + std::to_string(tail.size()));
+        session.Submit({"SET", tail.back(), tail.back() + big});
+        session.Drain();
+        offset = std::stoull(GetPersistence(executor, "data_file_offset"));
+    }
+    CHECK(GetPersistence(executor, "write_buffer_bytes") != "0");
+    CHECK_EQ(GetPersistence(executor, "data_file_current"), "0");
+
+    session.Submit({"SET", "next", "v"});
+    session.Drain();
+    CHECK_EQ(GetPersistence(executor, "data_file_current"), "1");
+    CHECK(WaitForFlush(executor, &session));
+    session.Read(0, tail.size() * 5 + 5);
+    std::string name;
+    DataFilename(disk.GetDirs()[0], 0, &name);
+    std::ifstream in(name, std::ios::binary);
+    std::string last(tail.back().size() * 2, '\0');
+    in.seekg(static_cast<std::streamoff>(offset - big.size() - tail.back().size()));
+    in.read(&last[0], static_cast<std::streamsize>(last.size()));
+    CHECK_EQ(last, tail.back() + std::string(tail.back().size(), 'b'));
+    for (const auto & k:tail) {
+        CHECK_EQ(session.Run({"GET", k}), Bulk(k + big));
+    }
+    CHECK_EQ(session.Run({"GET", "next"}), Bulk("v"));
+}
@@ -0,0 +1,519 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <getopt.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/anet.h"
+#include "../src/env.h"
+#include "../src/gujia.h"
+#include "../src/gujia_impl.h"
+#include "../src/histogram.h"
+#include "../src/resp_machine.h"
+#include "../src/util.h"
+#include "generator.h"
+
+namespace cheapis {
+    using namespace gujia;
+
+    enum Op {
+        kOpGet,
+        kOpSet,
+        kOpDel,
+        kOpCount,
+    };
+
+    constexpr const char * kOpNames[kOpCount] = {"GET", "SET", "DEL"};
+    constexpr size_t kReadLength = 16384;
+    constexpr size_t kProtocolError = SIZE_MAX;
+
+    struct Options {
+        std::string host = "127.0.0.1";
+        int port = 6379;
+        int threads = 1;
+        int clients = 50;
+        int pipeline = 1;
+        uint64_t requests = 100000;
+        double duration = 0; /* Seconds, overrides requests when set */
+        uint64_t keyspace = 100000;
+        bool zipfian = false;
+        double theta = 0.99;
+        size_t value_min = 16;
+        size_t value_max = 16;
+        unsigned int ratio[kOpCount] = {1, 1, 0};
+        bool json = false;
+    };
+
+    struct Result {
+        Histogram latency[kOpCount];
+        uint64_t latency_sum[kOpCount] = {};
+        uint64_t errors = 0;
+    };
+
+    struct Connection {
+        std::string output;
+        std::string input;
+        std::deque<std::pair<Op, uint64_t>> sent; /* Op and GetCycles() at send */
+    };
+
+    // Length of the first complete reply in [s, s + n), 0 if more bytes are
+    // needed, kProtocolError if it is not RESP.
+    static size_t ParseReply(const char * s, size_t n) {
+        const auto * cr = static_cast<const char *>(memchr(s, '\r', n));
+        if (cr == nullptr || cr + 1 == s + n) {
+            return 0;
+        }
+        auto line = static_cast<size_t>(cr - s) + 2;
+        long long len;
+        switch (s[0]) {
+            case '+':
+            case '-':
+            case ':':
+                return line;
+
+            case '$':
+                if (!string2ll(s + 1, line - 3, &len)) {
+                    return kProtocolError;
+                }
+                if (len < 0) {
+                    return line;
+                }
+                return line + len + 2 <= n ? line + len + 2 : 0;
+
+            case '*': {
+                if (!string2ll(s + 1, line - 3, &len)) {
+                    return kProtocolError;
+                }
+                size_t pos = line;
+                for (long long i = 0; i < len; ++i) {
+                    if (pos == n) {
+                        return 0;
+                    }
+                    size_t r = ParseReply(s + pos, n - pos);
+                    if (r == 0 || r == kProtocolError) {
+                        return r;
+                    }
+                    pos += r;
+                }
+                return pos;
+            }
+
+            default:
+                return kProtocolError;
+        }
+    }
+
+    class Worker {
+    public:
+        Worker(const Options & options, const KeyGenerator & keys, const std::string & values,
+               std::atomic<uint64_t> * issued, std::atomic<bool> * stop, uint64_t seed)
+                : options_(options), keys_(keys), values_(values),
+                  issued_(issued), stop_(stop), rng_(seed),
+                  ratio_sum_(options.ratio[kOpGet] + options.ratio[kOpSet] + options.ratio[kOpDel]),
+                  el_(EventLoop<Connection>::Open()) {}
+
+        bool Connect(int count) {
+            char err[ANET_ERR_LEN];
+            for (int i = 0; i < count; ++i) {
+                int fd = anetTcpConnect(err, const_cast<char *>(options_.host.c_str()), options_.port);
+                if (fd < 0) {
+                    fprintf(stderr, "Failed connecting to %s:%d. Error message: '%s'\n",
+                            options_.host.c_str(), options_.port, err);
+                    return false;
+                }
+                anetNonBlock(nullptr, fd);
+                anetEnableTcpNoDelay(nullptr, fd);
+                if (el_.Acquire(fd, std::make_unique<Connection>()) != 0 ||
+                    el_.AddEvent(fd, kReadable) != 0) {
+                    fprintf(stderr, "Failed adding the connection to the event loop\n");
+                    return false;
+                }
+                fds_.emplace_back(fd);
+            }
+            return true;
+        }
+
+        void Run() {
+            for (int fd:fds_) {
+                Connection * conn = el_.GetResource(fd).get();
+                for (int i = 0; i < options_.pipeline; ++i) {
+                    Issue(conn);
+                }
+                Flush(fd, conn);
+            }
+
+            struct timeval tv = {0, 100000};
+            while (in_flight_ != 0) {
+                int r = el_.Poll(&tv);
+                if (r < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    fprintf(stderr, "Failed polling. Error message: '%s'\n", strerror(errno));
+                    return;
+                }
+
+                const auto & events = el_.GetEvents();
+                for (int i = 0; i < r; ++i) {
+                    int fd = EventLoop<Connection>::GetEventFD(events[i]);
+                    Connection * conn = el_.GetResource(fd).get();
+                    if (EventLoop<Connection>::IsEventReadable(events[i]) && !Read(fd, conn)) {
+                        return;
+                    }
+                    if (EventLoop<Connection>::IsEventWritable(events[i])) {
+                        Flush(fd, conn);
+                    }
+                }
+            }
+        }
+
+        const Result & GetResult() const { return result_; }
+
+    private:
+        void Issue(Connection * conn) {
+            if (stop_->load(std::memory_order_relaxed)) {
+                return;
+            }
+            if (options_.duration == 0 &&
+                issued_->fetch_add(1, std::memory_order_relaxed) >= options_.requests) {
+                return;
+            }
+
+            auto pick = static_cast<unsigned int>(rng_() % ratio_sum_);
+            Op op = pick < options_.ratio[kOpGet] ? kOpGet
+                                                  : pick < options_.ratio[kOpGet] + options_.ratio[kOpSet]
+                                                    ? kOpSet : kOpDel;
+            key_ = "key:" + std::to_string(keys_.Next(&rng_));
+
+            std::string & out = conn->output;
+            RespMachine::AppendArrayLength(&out, op == kOpSet ? 3 : 2);
+            RespMachine::AppendBulkString(&out, kOpNames[op]);
+            RespMachine::AppendBulkString(&out, key_);
+            if (op == kOpSet) {
+                size_t len = options_.value_min;
+                if (options_.value_max > options_.value_min) {
+                    len += rng_() % (options_.value_max - options_.value_min + 1);
+                }
+                RespMachine::AppendBulkString(&out, values_.data(), len);
+            }
+            conn->sent.emplace_back(op, GetCycles());
+            ++in_flight_;
+        }
+
+        bool Read(int fd, Connection * conn) {
+            char buf[kReadLength];
+            while (true) {
+                ssize_t nread = read(fd, buf, sizeof(buf));
+                if (nread > 0) {
+                    conn->input.append(buf, static_cast<size_t>(nread));
+                    continue;
+                }
+                if (nread == 0 || errno != EAGAIN) {
+                    fprintf(stderr, "Connection lost. Error message: '%s'\n",
+                            nread == 0 ? "closed by server" : strerror(errno));
+                    return false;
+                }
+                break;
+            }
+
+            uint64_t now = GetCycles();
+            std::string & in = conn->input;
+            size_t start = 0;
+            while (start < in.size()) {
+                size_t len = ParseReply(in.data() + start, in.size() - start);
+                if (len == 0) {
+                    break;
+                }
+                if (len == kProtocolError || conn->sent.empty()) {
+                    fprintf(stderr, "Unexpected reply from server\n");
+                    return false;
+                }
+
+                if (in[start] == '-') {
+                    ++result_.errors;
+                }
+                auto[op, sent] = conn->sent.front();
+                conn->sent.pop_front();
+                result_.latency[op].Record(now - sent);
+                result_.latency_sum[op] += now - sent;
+                --in_flight_;
+                start += len;
+
+                Issue(conn);
+            }
+            in.erase(0, start);
+            Flush(fd, conn);
+            return true;
+        }
+
+        void Flush(int fd, Connection * conn) {
+            std::string & out = conn->output;
+            size_t written = 0;
+            while (written < out.size()) {
+                ssize_t nwrite = write(fd, out.data() + written, out.size() - written);
+                if (nwrite <= 0) {
+                    break;
+                }
+                written += nwrite;
+            }
+            out.erase(0, written);
+            if (out.empty()) {
+                el_.DelEvent(fd, kWritable);
+            } else {
+                el_.AddEvent(fd, kWritable);
+            }
+        }
+
+    private:
+        const Options & options_;
+        const KeyGenerator & keys_;
+        const std::string & values_;
+        std::atomic<uint64_t> * issued_;
+        std::atomic<bool> * stop_;
+        std::mt19937_64 rng_;
+        unsigned int ratio_sum_;
+        std::string key_;
+
+        EventLoop<Connection> el_;
+        std::vector<int> fds_;
+        uint64_t in_flight_ = 0;
+        Result result_;
+    };
+
+    struct Summary {
+        uint64_t count;
+        double avg, p50, p90, p99, p999, max; /* Microseconds */
+    };
+
+    static Summary Summarize(const uint64_t * buckets, uint64_t sum) {
+        Summary s = {};
+        for (int i = 0; i < Histogram::kBucketCount; ++i) {
+            s.count += buckets[i];
+            if (buckets[i] != 0) {
+                s.max = Histogram::GetBucketUpperBound(i);
+            }
+        }
+        if (s.count == 0) {
+            return s;
+        }
+        double cycles_per_us = GetCyclesPerMicrosecond();
+        s.avg = sum / cycles_per_us / s.count;
+        s.p50 = Histogram::GetPercentile(buckets, s.count, 50) / cycles_per_us;
+        s.p90 = Histogram::GetPercentile(buckets, s.count, 90) / cycles_per_us;
+        s.p99 = Histogram::GetPercentile(buckets, s.count, 99) / cycles_per_us;
+        s.p999 = Histogram::GetPercentile(buckets, s.count, 99.9) / cycles_per_us;
+        s.max /= cycles_per_us;
+        return s;
+    }
+
+    static void Report(const Options & options, const std::vector<std::unique_ptr<Worker>> & workers,
+                       double seconds) {
+        std::vector<uint64_t> buckets((kOpCount + 1) * Histogram::kBucketCount);
+        uint64_t sums[kOpCount + 1] = {};
+        uint64_t errors = 0;
+        for (const auto & worker:workers) {
+            const Result & result = worker->GetResult();
+            for (int op = 0; op < kOpCount; ++op) {
+                result.latency[op].AddTo(&buckets[op * Histogram::kBucketCount]);
+                result.latency[op].AddTo(&buckets[kOpCount * Histogram::kBucketCount]);
+                sums[op] += result.latency_sum[op];
+                sums[kOpCount] += result.latency_sum[op];
+            }
+            errors += result.errors;
+        }
+
+        Summary total = Summarize(&buckets[kOpCount * Histogram::kBucketCount], sums[kOpCount]);
+        double ops = total.count / seconds;
+        if (options.json) {
+            printf("{\"requests\":%lu,\"seconds\":%.3f,\"ops_per_sec\":%.1f,\"errors\":%lu,"
+                   "\"clients\":%d,\"threads\":%d,\"pipeline\":%d,\"latency_usec\":{",
+                   static_cast<unsigned long>(total.count), seconds, ops,
+                   static_cast<unsigned long>(errors),
+                   options.clients, options.threads, options.pipeline);
+        } else {
+            printf("%lu requests in %.3f seconds, %.1f requests per second, %lu errors\n"
+                   "%d clients, %d threads, pipeline %d, %s keys over %lu\n\n"
+                   "%-6s %10s %10s %10s %10s %10s %10s %10s (usec)\n",
+                   static_cast<unsigned long>(total.count), seconds, ops,
+                   static_cast<unsigned long>(errors),
+                   options.clients, options.threads, options.pipeline,
+                   options.zipfian ? "zipfian" : "uniform",
+                   static_cast<unsigned long>(options.keyspace),
+                   "", "count", "avg", "p50", "p90", "p99", "p99.9", "max");
+        }
+
+        bool first = true;
+        for (int op = 0; op <= kOpCount; ++op) {
+            Summary s = Summarize(&buckets[op * Histogram::kBucketCount], sums[op]);
+            if (s.count == 0 && op != kOpCount) {
+                continue;
+            }
+            const char * name = op == kOpCount ? "ALL" : kOpNames[op];
+            if (options.json) {
+                printf("%s\"%s\":{\"count\":%lu,\"avg\":%.2f,\"p50\":%.2f,\"p90\":%.2f,"
+                       "\"p99\":%.2f,\"p99.9\":%.2f,\"max\":%.2f}",
+                       first ? "" : ",", name, static_cast<unsigned long>(s.count),
+                       s.avg, s.p50, s.p90, s.p99, s.p999, s.max);
+            } else {
+                printf("%-6s %10lu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                       name, static_cast<unsigned long>(s.count),
+                       s.avg, s.p50, s.p90, s.p99, s.p999, s.max);
+            }
+            first = false;
+        }
+        if (options.json) {
+            printf("}}\n");
+        }
+    }
+
+    static void Usage(const char * name) {
+        fprintf(stderr,
+                "Usage: %s [options]\n"
+                " -h <host>              Server hostname (default 127.0.0.1)\n"
+                " -p <port>              Server port (default 6379)\n"
+                " -c <clients>           Number of connections (default 50)\n"
+                " -n <requests>          Total number of requests (default 100000)\n"
+                " -P <pipeline>          Requests in flight per connection (default 1)\n"
+                " -r <keyspace>          Number of distinct keys (default 100000)\n"
+                " -d <size>[-<max>]      Value size in bytes, fixed or uniform in a range (default 16)\n"
+                " --threads <n>          Client threads (default 1)\n"
+                " --duration <seconds>   Run for a time instead of -n requests\n"
+                " --distribution <name>  uniform or zipfian (default uniform)\n"
+                " --theta <theta>        Zipfian skew (default 0.99)\n"
+                " --ratio <g:s:d>        GET:SET:DEL mix (default 1:1:0)\n"
+                " --json                 Print the report as JSON\n"
+                "Keys are \"key:<n>\"; run a SET-only pass (--ratio 0:1:0) first so GETs hit.\n",
+                name);
+    }
+
+    static bool ParseOptions(int argc, char * argv[], Options * options) {
+        enum {
+            kOptThreads = 256, kOptDuration, kOptDistribution, kOptTheta, kOptRatio, kOptJson, kOptHelp,
+        };
+        static const struct option kLongOptions[] = {
+                {"threads",      required_argument, nullptr, kOptThreads},
+                {"duration",     required_argument, nullptr, kOptDuration},
+                {"distribution", required_argument, nullptr, kOptDistribution},
+                {"theta",        required_argument, nullptr, kOptTheta},
+                {"ratio",        required_argument, nullptr, kOptRatio},
+                {"json",         no_argument,       nullptr, kOptJson},
+                {"help",         no_argument,       nullptr, kOptHelp},
+                {nullptr, 0,                        nullptr, 0},
+        };
+
+        int opt;
+        while ((opt = getopt_long(argc, argv, "h:p:c:n:P:r:d:", kLongOptions, nullptr)) != -1) {
+            switch (opt) {
+                case 'h':
+                    options->host = optarg;
+                    break;
+                case 'p':
+                    options->port = atoi(optarg);
+                    break;
+                case 'c':
+                    options->clients = atoi(optarg);
+                    break;
+                case 'n':
+                    options->requests = strtoull(optarg, nullptr, 10);
+                    break;
+                case 'P':
+                    options->pipeline = atoi(optarg);
+                    break;
+                case 'r':
+                    options->keyspace = strtoull(optarg, nullptr, 10);
+                    break;
+                case 'd':
+                    if (sscanf(optarg, "%zu-%zu", &options->value_min, &options->value_max) != 2) {
+                        options->value_max = options->value_min = strtoull(optarg, nullptr, 10);
+                    }
+                    break;
+                case kOptThreads:
+                    options->threads = atoi(optarg);
+                    break;
+                case kOptDuration:
+                    options->duration = atof(optarg);
+                    break;
+                case kOptDistribution:
+                    if (strcmp(optarg, "zipfian") != 0 && strcmp(optarg, "uniform") != 0) {
+                        return false;
+                    }
+                    options->zipfian = strcmp(optarg, "zipfian") == 0;
+                    break;
+                case kOptTheta:
+                    options->theta = atof(optarg);
+                    break;
+                case kOptRatio:
+                    if (sscanf(optarg, "%u:%u:%u", &options->ratio[kOpGet],
+                               &options->ratio[kOpSet], &options->ratio[kOpDel]) != 3) {
+                        return false;
+                    }
+                    break;
+                case kOptJson:
+                    options->json = true;
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return options->threads > 0 && options->clients >= options->threads &&
+               options->pipeline > 0 && options->keyspace > 0 &&
+               options->value_max >= options->value_min &&
+               options->ratio[kOpGet] + options->ratio[kOpSet] + options->ratio[kOpDel] > 0 &&
+               (options->zipfian ? options->theta > 0 && options->theta < 1 : true);
+    }
+
+    int BenchmarkMain(int argc, char * argv[]) {
+        Options options;
+        if (!ParseOptions(argc, argv, &options)) {
+            Usage(argv[0]);
+            return 1;
+        }
+
+        KeyGenerator keys(options.keyspace, options.zipfian, options.theta);
+        std::string values(options.value_max, 'x');
+        std::mt19937_64 rng(42);
+        for (char & c:values) {
+            c = static_cast<char>('a' + rng() % 26);
+        }
+
+        std::atomic<uint64_t> issued(0);
+        std::atomic<bool> stop(false);
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (int i = 0; i < options.threads; ++i) {
+            workers.emplace_back(std::make_unique<Worker>(options, keys, values, &issued, &stop, rng()));
+            int count = options.clients / options.threads + (i < options.clients % options.threads);
+            if (!workers.back()->Connect(count)) {
+                return 1;
+            }
+        }
+        GetCyclesPerMicrosecond();
+
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (auto & worker:workers) {
+            threads.emplace_back([&worker]() { worker->Run(); });
+        }
+        if (options.duration > 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+            stop = true;
+        }
+        for (auto & thread:threads) {
+            thread.join();
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        Report(options, workers, std::chrono::duration<double>(end - begin).count());
+        return 0;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    return cheapis::BenchmarkMain(argc, argv);
+}
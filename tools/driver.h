@@ -0,0 +1,69 @@
+#pragma once
+#ifndef CHEAPIS_DRIVER_H
+#define CHEAPIS_DRIVER_H
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+#include "../src/disk/filename.h"
+#include "../src/executor.h"
+
+namespace cheapis {
+    // Feeds an executor the way the event loop does, without the network.
+    // Replies go to /dev/null, which takes every write whole, so they never
+    // queue up. Submit() executes once batch tasks are queued.
+    class ExecutorDriver {
+    public:
+        explicit ExecutorDriver(Executor * executor, size_t batch = 1024)
+                : executor_(executor), batch_(batch), el_(EventLoop<Client>::Open()) {
+            fd_ = open("/dev/null", O_WRONLY);
+            el_.Acquire(fd_, std::make_unique<Client>(fd_, 0));
+            c_ = el_.GetResource(fd_).get();
+        }
+
+        void Submit(const rocksdb::autovector<std::string_view> & argv) {
+            executor_->Submit(argv, c_, fd_);
+            ++c_->ref_count;
+            if (executor_->GetTaskCount() >= batch_) {
+                Drain();
+            }
+        }
+
+        void Drain() {
+            while (executor_->GetTaskCount() != 0) {
+                executor_->Execute(executor_->GetTaskCount(), 0, &el_);
+            }
+        }
+
+    private:
+        Executor * executor_;
+        size_t batch_;
+        EventLoop<Client> el_;
+        Client * c_;
+        int fd_;
+    };
+
+    // Returns an empty string on failure.
+    inline std::string MakeTempDir(const char * name) {
+        std::string dir = std::string("/tmp/") + name + "-XXXXXX";
+        return mkdtemp(&dir[0]) != nullptr ? dir : std::string();
+    }
+
+    // Removes a disk executor's files and the directory itself.
+    inline void RemoveDir(const std::string & dir) {
+        std::string name;
+        IndexFilename(dir, &name);
+        unlink(name.c_str());
+        for (uint64_t id = 0;; ++id) {
+            DataFilename(dir, id, &name);
+            if (unlink(name.c_str()) != 0) {
+                break;
+            }
+        }
+        rmdir(dir.c_str());
+    }
+}
+
+#endif //CHEAPIS_DRIVER_H
@@ -0,0 +1,71 @@
+#pragma once
+#ifndef CHEAPIS_GENERATOR_H
+#define CHEAPIS_GENERATOR_H
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+namespace cheapis {
+    // Key ranks in [0, n), uniform or Zipfian. The Zipfian one follows YCSB
+    // (Gray et al., "Quickly Generating Billion-Record Synthetic Databases"):
+    // zeta(n) is summed once at construction, O(n), then every draw is O(1).
+    // Rank 0 is the hottest, callers scramble ranks if locality matters.
+    class KeyGenerator {
+    public:
+        KeyGenerator(uint64_t n, bool zipfian, double theta = 0.99)
+                : n_(n), zipfian_(zipfian), theta_(theta) {
+            if (zipfian_) {
+                zeta_n_ = Zeta(n_, theta_);
+                alpha_ = 1.0 / (1.0 - theta_);
+                eta_ = (1.0 - std::pow(2.0 / n_, 1.0 - theta_)) / (1.0 - Zeta(2, theta_) / zeta_n_);
+            }
+        }
+
+        uint64_t Next(std::mt19937_64 * rng) const {
+            if (!zipfian_) {
+                return (*rng)() % n_;
+            }
+            double u = std::uniform_real_distribution<double>(0.0, 1.0)(*rng);
+            double uz = u * zeta_n_;
+            if (uz < 1.0) {
+                return 0;
+            }
+            if (uz < 1.0 + std::pow(0.5, theta_)) {
+                return 1;
+            }
+            auto rank = static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+            return rank < n_ ? rank : n_ - 1;
+        }
+
+        uint64_t GetCount() const { return n_; }
+
+        // Spreads ranks over [0, n) so hot keys are not neighbours (FNV-1a).
+        uint64_t Scramble(uint64_t rank) const {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (int i = 0; i < 8; ++i) {
+                h = (h ^ ((rank >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+            }
+            return h % n_;
+        }
+
+    private:
+        static double Zeta(uint64_t n, double theta) {
+            double sum = 0;
+            for (uint64_t i = 1; i <= n; ++i) {
+                sum += 1.0 / std::pow(static_cast<double>(i), theta);
+            }
+            return sum;
+        }
+
+    private:
+        uint64_t n_;
+        bool zipfian_;
+        double theta_;
+        double zeta_n_ = 0;
+        double alpha_ = 0;
+        double eta_ = 0;
+    };
+}
+
+#endif //CHEAPIS_GENERATOR_H
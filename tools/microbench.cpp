@@ -0,0 +1,346 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <getopt.h>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/disk/bloom_filter.h"
+#include "../src/disk/filename.h"
+#include "../src/disk/kv_rep.h"
+#include "../src/env.h"
+#include "../src/resp_machine.h"
+#include "driver.h"
+
+namespace cheapis {
+    constexpr size_t kParseCommands = 100000;
+    constexpr size_t kAppendCount = 10000000;
+
+    struct Options {
+        std::vector<uint64_t> keys = {1000000};
+        uint64_t cold_reads = 100000;
+        size_t value_size = 100;
+        std::string dir;
+        std::string filter;
+    };
+
+    // Times a fixture and prints its per-operation cost. Fixtures whose name
+    // does not contain the filter are skipped.
+    class Harness {
+    public:
+        explicit Harness(std::string filter) : filter_(std::move(filter)) {}
+
+        bool Wants(const std::string & name) const {
+            return name.find(filter_) != std::string::npos;
+        }
+
+        template<typename F>
+        void Run(const std::string & name, uint64_t ops, F && f) {
+            if (!Wants(name)) {
+                return;
+            }
+            uint64_t begin = GetCycles();
+            f();
+            double us = (GetCycles() - begin) / GetCyclesPerMicrosecond();
+            printf("%-36s %12lu ops %12.1f ns/op %10.3f Mops/s\n", name.c_str(),
+                   static_cast<unsigned long>(ops), us * 1000 / ops, ops / us);
+            fflush(stdout);
+        }
+
+    private:
+        std::string filter_;
+    };
+
+    static std::string MakeKey(uint64_t i) {
+        return "key:" + std::to_string(i);
+    }
+
+    static void BenchmarkResp(Harness * harness, const Options & options) {
+        std::string value(options.value_size, 'v');
+        std::string pipeline;
+        for (size_t i = 0; i < kParseCommands; ++i) {
+            RespMachine::AppendArrayLength(&pipeline, 3);
+            RespMachine::AppendBulkString(&pipeline, "SET");
+            RespMachine::AppendBulkString(&pipeline, MakeKey(i));
+            RespMachine::AppendBulkString(&pipeline, value);
+        }
+
+        /* Same loop as ReadFromClient, one 16 KB read at a time */
+        const size_t rounds = 10;
+        size_t parsed = 0;
+        harness->Run("resp/parse_set_pipeline", kParseCommands * rounds, [&]() {
+            for (size_t r = 0; r < rounds; ++r) {
+                RespMachine resp;
+                size_t consumed = 0;
+                size_t start = 0;
+                for (size_t end = 0; end < pipeline.size();) {
+                    end = std::min(end + 16384, pipeline.size());
+                    while (start + consumed < end) {
+                        consumed += resp.Input(pipeline.data() + start + consumed, end - start - consumed);
+                        if (resp.GetState() == RespMachine::kSuccess) {
+                            parsed += resp.GetArgv().size();
+                            resp.Reset();
+                            start += consumed;
+                            consumed = 0;
+                        } else if (resp.GetState() == RespMachine::kProcess) {
+                            break;
+                        } else {
+                            fprintf(stderr, "Failed parsing the pipeline\n");
+                            exit(1);
+                        }
+                    }
+                }
+            }
+        });
+        if (harness->Wants("resp/parse_set_pipeline") && parsed != kParseCommands * rounds * 3) {
+            fprintf(stderr, "Parsed %zu arguments, expected %zu\n", parsed, kParseCommands * rounds * 3);
+            exit(1);
+        }
+
+        std::string out;
+        auto append = [&](const char * name, auto && f) {
+            harness->Run(name, kAppendCount, [&]() {
+                for (size_t i = 0; i < kAppendCount; ++i) {
+                    if ((i & 4095) == 0) {
+                        out.clear();
+                    }
+                    f(i);
+                }
+            });
+        };
+        append("resp/append_simple_string", [&](size_t) {
+            RespMachine::AppendSimpleString(&out, "OK");
+        });
+        append("resp/append_integer", [&](size_t i) {
+            RespMachine::AppendInteger(&out, static_cast<long long>(i));
+        });
+        append("resp/append_bulk_string", [&](size_t) {
+            RespMachine::AppendBulkString(&out, value);
+        });
+    }
+
+    static void BenchmarkRep(Harness * harness) {
+        volatile uint64_t sink = 0;
+        harness->Run("disk/pack_unpack_rep", kAppendCount, [&]() {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < kAppendCount; ++i) {
+                uint64_t rep = PackIDLengthAndOffset(static_cast<uint16_t>(i >> 20),
+                                                     PackKVLength(i & 63, i & 4095),
+                                                     static_cast<uint32_t>(i));
+                auto[id, length, offset] = UnpackKVRep(rep);
+                auto[k_len, v_len] = UnpackLength(length);
+                sum += id + k_len + v_len + offset;
+            }
+            sink = sum;
+        });
+        (void) sink;
+    }
+
+    // Probes hit the keys added, misses measure the false positive rate.
+    static void BenchmarkBloom(Harness * harness, const Options & options) {
+        for (uint64_t n:options.keys) {
+            std::string prefix = "bloom/" + std::to_string(n) + "/";
+            BloomFilter filter(n, 10);
+            std::vector<uint64_t> hashes(n);
+            for (uint64_t i = 0; i < n; ++i) {
+                hashes[i] = BloomFilter::Hash(MakeKey(i));
+            }
+            harness->Run(prefix + "add", n, [&]() {
+                for (uint64_t h:hashes) {
+                    filter.Add(h);
+                }
+            });
+            for (uint64_t i = 0; i < n; ++i) {
+                hashes[i] = BloomFilter::Hash(MakeKey(i + n));
+            }
+            size_t positives = 0;
+            harness->Run(prefix + "probe_miss", n, [&]() {
+                for (uint64_t h:hashes) {
+                    positives += filter.MayContain(h);
+                }
+            });
+            if (harness->Wants(prefix + "probe_miss")) {
+                printf("%-36s %12.3f %% false positives\n", (prefix + "probe_miss").c_str(),
+                       100.0 * positives / n);
+            }
+        }
+    }
+
+    constexpr const char * kIndexFixtures[] = {"set", "get_hit", "get_miss", "get_cold"};
+
+    static bool WantsIndex(const Harness & harness, const std::string & prefix) {
+        for (const char * fixture:kIndexFixtures) {
+            if (harness.Wants(prefix + fixture)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // SET every key, then GET them in random order: hits, then misses.
+    static void BenchmarkIndex(Harness * harness, const Options & options, const char * kind,
+                               Executor * executor, uint64_t n) {
+        ExecutorDriver driver(executor);
+        std::string value(options.value_size, 'v');
+        std::string prefix = std::string(kind) + "/" + std::to_string(n) + "/";
+        std::mt19937_64 rng(n);
+        std::string key;
+
+        auto command = [&](const char * name, uint64_t i) {
+            key = MakeKey(i);
+            rocksdb::autovector<std::string_view> argv = {name, key};
+            if (name[0] == 'S') {
+                argv.emplace_back(value);
+            }
+            driver.Submit(argv);
+        };
+
+        auto populate = [&]() {
+            for (uint64_t i = 0; i < n; ++i) {
+                command("SET", i);
+            }
+            driver.Drain();
+        };
+        if (harness->Wants(prefix + "set")) {
+            harness->Run(prefix + "set", n, populate);
+        } else { // the other fixtures need the keys
+            populate();
+        }
+        harness->Run(prefix + "get_hit", n, [&]() {
+            for (uint64_t i = 0; i < n; ++i) {
+                command("GET", rng() % n);
+            }
+            driver.Drain();
+        });
+        harness->Run(prefix + "get_miss", n, [&]() {
+            for (uint64_t i = 0; i < n; ++i) {
+                command("GET", n + rng() % n);
+            }
+            driver.Drain();
+        });
+
+        if (options.dir.empty() || !harness->Wants(prefix + "get_cold")) {
+            return;
+        }
+        std::string name;
+        for (uint64_t id = 0;; ++id) {
+            DataFilename(options.dir, id, &name);
+            int fd = OpenFile(name, O_RDONLY);
+            if (fd < 0) {
+                break;
+            }
+            if (FileEvict(fd) != 0) {
+                fprintf(stderr, "Failed evicting %s. Error message: '%s'\n", name.c_str(), strerror(errno));
+            }
+            close(fd);
+        }
+        uint64_t reads = std::min(n, options.cold_reads);
+        harness->Run(prefix + "get_cold", reads, [&]() {
+            for (uint64_t i = 0; i < reads; ++i) {
+                command("GET", rng() % n);
+            }
+            driver.Drain();
+        });
+    }
+
+    static void Usage(const char * name) {
+        fprintf(stderr,
+                "Usage: %s [options] [filter]\n"
+                " --keys <n>[,<n>...]   Index sizes to run the executor fixtures at (default 1000000)\n"
+                " --cold-reads <n>      GETs after dropping the data files from the page cache (default 100000)\n"
+                " --value-size <n>      Value size in bytes (default 100)\n"
+                " --dir <dir>           Directory for the disk executor (default a temporary one)\n"
+                "Only fixtures whose name contains the filter run, e.g. \"resp/\" or \"disk/10000000/\".\n",
+                name);
+    }
+
+    int MicrobenchMain(int argc, char * argv[]) {
+        enum {
+            kOptKeys = 256, kOptColdReads, kOptValueSize, kOptDir, kOptHelp,
+        };
+        static const struct option kLongOptions[] = {
+                {"keys",       required_argument, nullptr, kOptKeys},
+                {"cold-reads", required_argument, nullptr, kOptColdReads},
+                {"value-size", required_argument, nullptr, kOptValueSize},
+                {"dir",        required_argument, nullptr, kOptDir},
+                {"help",       no_argument,       nullptr, kOptHelp},
+                {nullptr, 0,                      nullptr, 0},
+        };
+
+        Options options;
+        int opt;
+        while ((opt = getopt_long(argc, argv, "", kLongOptions, nullptr)) != -1) {
+            switch (opt) {
+                case kOptKeys: {
+                    options.keys.clear();
+                    for (char * p = optarg; *p != '\0';) {
+                        options.keys.emplace_back(strtoull(p, &p, 10));
+                        p += *p == ',';
+                    }
+                    break;
+                }
+                case kOptColdReads:
+                    options.cold_reads = strtoull(optarg, nullptr, 10);
+                    break;
+                case kOptValueSize:
+                    options.value_size = strtoull(optarg, nullptr, 10);
+                    break;
+                case kOptDir:
+                    options.dir = optarg;
+                    break;
+                default:
+                    Usage(argv[0]);
+                    return 1;
+            }
+        }
+        if (optind < argc) {
+            options.filter = argv[optind];
+        }
+
+        Harness harness(options.filter);
+        GetCyclesPerMicrosecond();
+        BenchmarkResp(&harness, options);
+        BenchmarkRep(&harness);
+        BenchmarkBloom(&harness, options);
+
+        for (uint64_t n:options.keys) {
+            if (WantsIndex(harness, "mem/" + std::to_string(n) + "/")) {
+                auto executor = OpenExecutorMem();
+                BenchmarkIndex(&harness, options, "mem", executor.get(), n);
+            }
+
+            if (WantsIndex(harness, "disk/" + std::to_string(n) + "/")) {
+                bool temporary = options.dir.empty();
+                Options disk_options = options;
+                if (temporary) {
+                    disk_options.dir = MakeTempDir("cheapis-microbench");
+                    if (disk_options.dir.empty()) {
+                        fprintf(stderr, "Failed creating a temporary directory. Error message: '%s'\n",
+                                strerror(errno));
+                        return 1;
+                    }
+                }
+
+                auto executor = OpenExecutorDisk(disk_options.dir);
+                if (executor == nullptr) {
+                    fprintf(stderr, "Failed opening the disk executor in %s\n", disk_options.dir.c_str());
+                    return 1;
+                }
+                BenchmarkIndex(&harness, disk_options, "disk", executor.get(), n);
+                executor.reset();
+                if (temporary) {
+                    RemoveDir(disk_options.dir);
+                }
+            }
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    return cheapis::MicrobenchMain(argc, argv);
+}
@@ -0,0 +1,410 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <getopt.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/env.h"
+#include "../src/histogram.h"
+#include "../src/stats.h"
+#include "driver.h"
+#include "generator.h"
+
+namespace cheapis {
+    enum Op {
+        kOpRead,
+        kOpUpdate,
+        kOpInsert,
+        kOpScan,
+        kOpReadModifyWrite,
+        kOpCount,
+    };
+
+    constexpr const char * kOpNames[kOpCount] = {"READ", "UPDATE", "INSERT", "SCAN", "RMW"};
+
+    enum Distribution {
+        kUniform,
+        kZipfian,
+        kLatest,
+    };
+
+    // The core workloads of YCSB, see workloads/workload[a-f] there.
+    struct Workload {
+        char name;
+        double proportion[kOpCount];
+        Distribution distribution;
+    };
+
+    constexpr Workload kWorkloads[] = {
+            {'a', {0.50, 0.50, 0,    0,    0},    kZipfian},
+            {'b', {0.95, 0.05, 0,    0,    0},    kZipfian},
+            {'c', {1.00, 0,    0,    0,    0},    kZipfian},
+            {'d', {0.95, 0,    0.05, 0,    0},    kLatest},
+            {'e', {0,    0,    0.05, 0.95, 0},    kZipfian},
+            {'f', {0.50, 0,    0,    0,    0.50}, kZipfian},
+    };
+
+    struct Options {
+        std::string workloads = "a";
+        uint64_t records = 100000;
+        uint64_t operations = 100000;
+        uint64_t interval = 0; /* Operations between progress lines, 0 for a tenth */
+        size_t value_size = 1000;
+        size_t scan_max = 100;
+        size_t batch = 1;
+        double theta = 0.99;
+        bool memory = false;
+        std::string dir;
+    };
+
+    // YCSB hashes the insert order into keys, so neighbours in id are spread
+    // over the key space.
+    static std::string KeyName(uint64_t id) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (int i = 0; i < 8; ++i) {
+            h = (h ^ ((id >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+        }
+        return "user" + std::to_string(h);
+    }
+
+    class Runner {
+    public:
+        Runner(const Options & options, const Workload & workload, Executor * executor)
+                : options_(options), workload_(workload), executor_(executor),
+                  keys_(options.records + static_cast<uint64_t>(options.operations *
+                                                                workload.proportion[kOpInsert]) + 1,
+                        workload.distribution != kUniform, options.theta),
+                  value_(options.value_size, 'v'),
+                  rng_(static_cast<uint64_t>(workload.name)) {}
+
+        void Load() {
+            ExecutorDriver driver(executor_);
+            Progress progress(this, "load");
+            for (uint64_t i = 0; i < options_.records; ++i) {
+                Insert(&driver);
+                if (i + 1 == options_.records) {
+                    driver.Drain();
+                }
+                progress.Step(i + 1, options_.records);
+            }
+        }
+
+        void Run() {
+            ExecutorDriver driver(executor_, SIZE_MAX);
+            Progress progress(this, "run");
+            std::vector<std::pair<Op, uint64_t>> pending;
+            for (uint64_t i = 0; i < options_.operations; ++i) {
+                Op op = ChooseOp();
+                pending.emplace_back(op, GetCycles());
+                switch (op) {
+                    case kOpRead:
+                        Read(&driver, ChooseId());
+                        break;
+                    case kOpUpdate:
+                        Update(&driver, ChooseId());
+                        break;
+                    case kOpInsert:
+                        Insert(&driver);
+                        break;
+                    case kOpScan:
+                        Scan(&driver, ChooseId(), 1 + rng_() % options_.scan_max);
+                        break;
+                    case kOpReadModifyWrite: {
+                        uint64_t id = ChooseId();
+                        Read(&driver, id);
+                        Update(&driver, id);
+                        break;
+                    }
+                    default:
+                        break;
+                }
+
+                if (pending.size() >= options_.batch || i + 1 == options_.operations) {
+                    driver.Drain();
+                    uint64_t now = GetCycles();
+                    for (const auto & p:pending) {
+                        latency_[p.first].Record(now - p.second);
+                        latency_sum_[p.first] += now - p.second;
+                    }
+                    pending.clear();
+                }
+                progress.Step(i + 1, options_.operations);
+            }
+            Report();
+        }
+
+    private:
+        // Prints throughput and amplification every interval operations.
+        class Progress {
+        public:
+            Progress(Runner * runner, const char * phase)
+                    : runner_(runner), phase_(phase), begin_(GetCycles()), last_(begin_) {}
+
+            void Step(uint64_t done, uint64_t total) {
+                uint64_t interval = runner_->options_.interval != 0 ? runner_->options_.interval
+                                                                    : std::max<uint64_t>(total / 10, 1);
+                if (done % interval != 0 && done != total) {
+                    return;
+                }
+                uint64_t now = GetCycles();
+                double us = (now - last_) / GetCyclesPerMicrosecond();
+                double elapsed = (now - begin_) / GetCyclesPerMicrosecond() / 1000000;
+                printf("[%c %-4s] %10lu ops %8.2f s %12.1f ops/s  write amp %6.3f  space amp %6.3f\n",
+                       runner_->workload_.name, phase_, static_cast<unsigned long>(done), elapsed,
+                       (done - last_done_) / us * 1000000,
+                       runner_->GetWriteAmplification(), runner_->GetSpaceAmplification());
+                fflush(stdout);
+                last_ = now;
+                last_done_ = done;
+            }
+
+        private:
+            Runner * runner_;
+            const char * phase_;
+            uint64_t begin_;
+            uint64_t last_;
+            uint64_t last_done_ = 0;
+        };
+
+        Op ChooseOp() {
+            double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng_);
+            for (int op = 0; op < kOpCount; ++op) {
+                if (u < workload_.proportion[op]) {
+                    return static_cast<Op>(op);
+                }
+                u -= workload_.proportion[op];
+            }
+            return kOpRead;
+        }
+
+        uint64_t ChooseId() {
+            switch (workload_.distribution) {
+                case kZipfian:
+                    return keys_.Scramble(keys_.Next(&rng_)) % count_;
+                case kLatest:
+                    return count_ - 1 - std::min(keys_.Next(&rng_), count_ - 1);
+                default:
+                    return keys_.Next(&rng_) % count_;
+            }
+        }
+
+        void Read(ExecutorDriver * driver, uint64_t id) {
+            key_ = KeyName(id);
+            driver->Submit({"GET", key_});
+        }
+
+        // len records in key order from the id's key on, as YCSB's scan.
+        void Scan(ExecutorDriver * driver, uint64_t id, uint64_t len) {
+            key_ = KeyName(id);
+            limit_ = std::to_string(len);
+            driver->Submit({"RANGE", key_, "", "LIMIT", limit_});
+        }
+
+        void Update(ExecutorDriver * driver, uint64_t id) {
+            key_ = KeyName(id);
+            driver->Submit({"SET", key_, value_});
+            user_bytes_ += key_.size() + value_.size();
+        }
+
+        void Insert(ExecutorDriver * driver) {
+            Update(driver, count_++);
+            logical_bytes_ += key_.size() + value_.size();
+        }
+
+        // Data file bytes written per byte the workload wrote.
+        double GetWriteAmplification() const {
+            auto written = static_cast<uint64_t>(GetStats()->data_bytes_written.Get()) - written_base_;
+            return user_bytes_ != 0 ? static_cast<double>(written) / user_bytes_ : 0;
+        }
+
+        // Data files plus the index per byte of live keys and values.
+        double GetSpaceAmplification() const {
+            std::string info;
+            executor_->GetInfo("memory", &info);
+            const char * field = strstr(info.c_str(), "index_file_size:");
+            uint64_t index = field != nullptr ? strtoull(field + strlen("index_file_size:"), nullptr, 10) : 0;
+            auto written = static_cast<uint64_t>(GetStats()->data_bytes_written.Get()) - written_base_;
+            return logical_bytes_ != 0 ? static_cast<double>(written + index) / logical_bytes_ : 0;
+        }
+
+        void Report() const {
+            double cycles_per_us = GetCyclesPerMicrosecond();
+            printf("[%c] %-6s %10s %10s %10s %10s %10s %10s %10s (usec)\n", workload_.name,
+                   "", "count", "avg", "p50", "p95", "p99", "p99.9", "max");
+            for (int op = 0; op < kOpCount; ++op) {
+                uint64_t buckets[Histogram::kBucketCount] = {};
+                latency_[op].AddTo(buckets);
+                uint64_t count = 0;
+                uint64_t max = 0;
+                for (int i = 0; i < Histogram::kBucketCount; ++i) {
+                    count += buckets[i];
+                    if (buckets[i] != 0) {
+                        max = Histogram::GetBucketUpperBound(i);
+                    }
+                }
+                if (count == 0) {
+                    continue;
+                }
+                printf("[%c] %-6s %10lu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", workload_.name,
+                       kOpNames[op], static_cast<unsigned long>(count),
+                       latency_sum_[op] / cycles_per_us / count,
+                       Histogram::GetPercentile(buckets, count, 50) / cycles_per_us,
+                       Histogram::GetPercentile(buckets, count, 95) / cycles_per_us,
+                       Histogram::GetPercentile(buckets, count, 99) / cycles_per_us,
+                       Histogram::GetPercentile(buckets, count, 99.9) / cycles_per_us,
+                       max / cycles_per_us);
+            }
+            fflush(stdout);
+        }
+
+    private:
+        const Options & options_;
+        const Workload & workload_;
+        Executor * executor_;
+        KeyGenerator keys_;
+        std::string value_;
+        std::string key_;
+        std::string limit_;
+        std::mt19937_64 rng_;
+
+        uint64_t count_ = 0; /* Records inserted, ids are [0, count_) */
+        uint64_t user_bytes_ = 0;
+        uint64_t logical_bytes_ = 0;
+        uint64_t written_base_ = static_cast<uint64_t>(GetStats()->data_bytes_written.Get());
+
+        Histogram latency_[kOpCount];
+        uint64_t latency_sum_[kOpCount] = {};
+    };
+
+    static void Usage(const char * name) {
+        fprintf(stderr,
+                "Usage: %s [options]\n"
+                " --workloads <abcdef>   YCSB core workloads to run, each on a fresh store (default a)\n"
+                " --records <n>          Records loaded before each workload (default 100000)\n"
+                " --operations <n>       Operations per workload (default 100000)\n"
+                " --value-size <n>       Value size in bytes (default 1000)\n"
+                " --scan-max <n>         Longest scan (default 100)\n"
+                " --batch <n>            Operations per Execute, as if n clients (default 1)\n"
+                " --theta <theta>        Zipfian skew (default 0.99)\n"
+                " --interval <n>         Operations between progress lines (default a tenth)\n"
+                " --memory               Drive the memory executor instead of the disk one\n"
+                " --dir <dir>            Directory for the disk executor (default a temporary one)\n",
+                name);
+    }
+
+    int YcsbMain(int argc, char * argv[]) {
+        enum {
+            kOptWorkloads = 256, kOptRecords, kOptOperations, kOptValueSize, kOptScanMax,
+            kOptBatch, kOptTheta, kOptInterval, kOptMemory, kOptDir, kOptHelp,
+        };
+        static const struct option kLongOptions[] = {
+                {"workloads",  required_argument, nullptr, kOptWorkloads},
+                {"records",    required_argument, nullptr, kOptRecords},
+                {"operations", required_argument, nullptr, kOptOperations},
+                {"value-size", required_argument, nullptr, kOptValueSize},
+                {"scan-max",   required_argument, nullptr, kOptScanMax},
+                {"batch",      required_argument, nullptr, kOptBatch},
+                {"theta",      required_argument, nullptr, kOptTheta},
+                {"interval",   required_argument, nullptr, kOptInterval},
+                {"memory",     no_argument,       nullptr, kOptMemory},
+                {"dir",        required_argument, nullptr, kOptDir},
+                {"help",       no_argument,       nullptr, kOptHelp},
+                {nullptr, 0,                      nullptr, 0},
+        };
+
+        Options options;
+        int opt;
+        while ((opt = getopt_long(argc, argv, "", kLongOptions, nullptr)) != -1) {
+            switch (opt) {
+                case kOptWorkloads:
+                    options.workloads = optarg;
+                    break;
+                case kOptRecords:
+                    options.records = strtoull(optarg, nullptr, 10);
+                    break;
+                case kOptOperations:
+                    options.operations = strtoull(optarg, nullptr, 10);
+                    break;
+                case kOptValueSize:
+                    options.value_size = strtoull(optarg, nullptr, 10);
+                    break;
+                case kOptScanMax:
+                    options.scan_max = strtoull(optarg, nullptr, 10);
+                    break;
+                case kOptBatch:
+                    options.batch = strtoull(optarg, nullptr, 10);
+                    break;
+                case kOptTheta:
+                    options.theta = atof(optarg);
+                    break;
+                case kOptInterval:
+                    options.interval = strtoull(optarg, nullptr, 10);
+                    break;
+                case kOptMemory:
+                    options.memory = true;
+                    break;
+                case kOptDir:
+                    options.dir = optarg;
+                    break;
+                default:
+                    Usage(argv[0]);
+                    return 1;
+            }
+        }
+        if (options.records == 0 || options.scan_max == 0 || options.batch == 0 ||
+            options.theta <= 0 || options.theta >= 1) {
+            Usage(argv[0]);
+            return 1;
+        }
+
+        GetCyclesPerMicrosecond();
+        for (char name:options.workloads) {
+            const Workload * workload = nullptr;
+            for (const auto & w:kWorkloads) {
+                if (w.name == name) {
+                    workload = &w;
+                }
+            }
+            if (workload == nullptr) {
+                fprintf(stderr, "Unknown workload '%c'\n", name);
+                return 1;
+            }
+
+            std::string dir = options.dir;
+            std::unique_ptr<Executor> executor;
+            if (options.memory) {
+                executor = OpenExecutorMem();
+            } else {
+                if (options.dir.empty()) {
+                    dir = MakeTempDir("cheapis-ycsb");
+                    if (dir.empty()) {
+                        fprintf(stderr, "Failed creating a temporary directory. Error message: '%s'\n",
+                                strerror(errno));
+                        return 1;
+                    }
+                }
+                executor = OpenExecutorDisk(dir);
+                if (executor == nullptr) {
+                    fprintf(stderr, "Failed opening the disk executor in %s\n", dir.c_str());
+                    return 1;
+                }
+            }
+
+            Runner runner(options, *workload, executor.get());
+            runner.Load();
+            runner.Run();
+
+            executor.reset();
+            if (!options.memory && options.dir.empty()) {
+                RemoveDir(dir);
+            }
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    return cheapis::YcsbMain(argc, argv);
+}